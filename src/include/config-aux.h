@@ -20,6 +20,31 @@
 #define HAVE_IPC 1
 #endif
 
+#undef HAVE_THREADS
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+#define HAVE_THREADS 1
+#endif
+
+#undef HAVE_LINE_TEE
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE) && defined(HAVE_THREADS)
+#define HAVE_LINE_TEE 1
+#endif
+
+#undef HAVE_PARALLEL_ENGINE
+#if defined(HAVE_THREADS)
+#define HAVE_PARALLEL_ENGINE 1
+#endif
+
+#undef HAVE_DIGEST
+#if defined(HAVE_STDINT_H) && defined(HAVE_THREADS)
+#define HAVE_DIGEST 1
+#endif
+
+#undef HAVE_MMAP_ENGINE
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#define HAVE_MMAP_ENGINE 1
+#endif
+
 #undef CURSOR_ANSWERBACK_BYTE_BY_BYTE
 #ifndef _AIX
 #define CURSOR_ANSWERBACK_BYTE_BY_BYTE 1
@@ -42,9 +42,42 @@ struct opts_s {           /* structure describing run-time options */
 	unsigned long long size;       /* total size of data */
 	bool no_splice;                /* flag set if never to use splice */
 	unsigned int skip_errors;      /* skip read errors counter */
+	unsigned long long error_skip_block; /* bytes to skip on read error */
+	char *error_map;               /* file to list unread regions in */
+	bool error_map_retry;          /* retry the regions in error_map */
+	unsigned long long skip_input; /* bytes to skip at start of input */
+	unsigned long long seek_output; /* bytes to seek past in output */
+	unsigned long long input_length; /* most bytes to read from input */
+	unsigned long long input_block_size; /* fixed size of each read */
+	unsigned long long output_block_size; /* fixed size of each write */
+	bool output_block_pad;         /* pad the last output block */
+	bool preallocate;              /* preallocate output space */
+	unsigned int parallel;         /* threads for parallel copying */
+	char **output_files;           /* extra outputs for --tee */
+	unsigned int output_file_count; /* number of --tee outputs */
+	bool tee_drop;                 /* drop --tee outputs which lag */
+	bool split;                    /* spread lines between --tee outputs */
+	bool merge;                    /* read all inputs at the same time */
+	char *hash;                    /* hash algorithms for --hash */
+	bool hash_per_file;            /* also hash each input file */
+	bool verify;                   /* read the output back to check it */
+	char *generate;                /* type of data to generate */
+	char *validate;                /* type of data to check input against */
+	bool discard;                  /* read the input but write nothing */
+	char *exec_command;            /* command to pass the data through */
+	bool multi;                    /* arguments are input/output pairs */
+	char *multi_file;              /* file listing more of those pairs */
+	bool per_file;                 /* show the current input file too */
+	char *manifest;                /* file to write per-file figures to */
+	bool manifest_json;            /* write the manifest as JSON */
+	char *checkpoint;              /* checkpoint journal file */
+	bool resume;                   /* resume from checkpoint journal */
 	bool stop_at_size;             /* set if we stop at "size" bytes */
 	bool sync_after_write;         /* set if we sync after every write */
 	bool direct_io;                /* set if O_DIRECT is to be used */
+	unsigned int pipe_size;        /* size to set pipes to (0=leave) */
+	bool calibrate;                /* benchmark settings, don't transfer */
+	double max_latency;            /* target max seconds to hold data */
 	double interval;               /* interval between updates */
 	double delay_start;            /* delay before first display */
 	unsigned int watch_pid;	       /* process to watch fds of */
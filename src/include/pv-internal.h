@@ -29,19 +29,187 @@ extern "C" {
 #define PV_DISPLAY_BUFPERCENT	128
 #define PV_DISPLAY_OUTPUTBUF	256
 #define PV_DISPLAY_FINETA	512
+#define PV_DISPLAY_ENGINE	1024
+#define PV_DISPLAY_LATENCY	2048
 
 #define RATE_GRANULARITY	100000	 /* usec between -L rate chunks */
 #define RATE_BURST_WINDOW	5	 /* rate burst window (multiples of rate) */
 #define REMOTE_INTERVAL		100000	 /* usec between checks for -R */
 #define BUFFER_SIZE		409600	 /* default transfer buffer size */
 #define BUFFER_SIZE_MAX		524288	 /* max auto transfer buffer size */
+#define BLOCK_SIZE_MAX		67108864 /* max --input/--output-block-size */
 #define MAX_READ_AT_ONCE	524288	 /* max to read() in one go */
 #define MAX_WRITE_AT_ONCE	524288	 /* max to write() in one go */
 #define TRANSFER_READ_TIMEOUT	90000	 /* usec to time reads out at */
 #define TRANSFER_WRITE_TIMEOUT	900000	 /* usec to time writes out at */
+#define MMAP_WINDOW_SIZE	8388608	 /* bytes of input to map at once */
+#define ENGINE_TRIAL_TIME	250000	 /* usec to try each I/O engine for */
+#define ENGINE_RETRIAL_INTERVAL	30	 /* sec between I/O engine trials */
+#define ENGINE_RATE_MARGIN	0.95	 /* rate within which CPU use decides */
+#define CALIBRATE_SAMPLE_TIME	250000	 /* usec per --calibrate rate sample */
+#define CALIBRATE_SETTLE_SAMPLES 3	 /* samples which must agree to settle */
+#define CALIBRATE_SETTLE_MARGIN	0.05	 /* spread of samples counted as settled */
+#define CALIBRATE_MAX_TIME	5	 /* max sec to measure one setting for */
+#define LATENCY_MARKS		256	 /* buffer arrival times kept */
+#define LATENCY_BUCKETS		128	 /* hold time histogram buckets */
+#define LATENCY_PERCENTILE	0.99	 /* hold time percentile for %L */
+#define LATENCY_GRANULARITY_MIN	1000	 /* min usec between latency-driven waits */
+#define RECOVER_MIN_BLOCK	512	 /* smallest region -Z recovery tries */
+#define RECOVER_MAX_BUFFER	16777216 /* most -Z recovery reads at once */
+#define RECOVER_RETRY_BLOCK	65536	 /* default --error-map retry block */
+#define CHECKPOINT_INTERVAL	10	 /* sec between --checkpoint saves */
+#define CHECKPOINT_WINDOW	65536	 /* bytes of input checksummed */
+#define PARALLEL_MAX_THREADS	64	 /* most --parallel worker threads */
+#define FANOUT_RING_BUFFERS	8	 /* --tee ring size, in transfer buffers */
+#define VERIFY_BLOCK_SIZE	1048576	 /* bytes per --verify block hash */
+#define VERIFY_READ_SIZE	1048576	 /* bytes per --verify read */
+#define VERIFY_ALIGN		4096	 /* alignment of --verify reads */
+#define SPLIT_CHUNK_SIZE	65536	 /* most given to one --split output at once */
+#define GENERATE_LANES		4	 /* --generate random xorshift128+ lanes */
+#define GENERATE_TEXT_PERIOD	65536	 /* bytes before --generate text repeats */
+#define GENERATE_TEXT_WIDTH	72	 /* longest --generate text line */
+#define VALIDATE_CHUNK_SIZE	65536	 /* bytes --validate generates at once */
+#define PERFILE_STALL_MIN	0.5	 /* sec without data to count as a stall */
+#define PERFILE_BAR_WIDTH	20	 /* width of the --per-file progress bar */
+#define EXEC_RELAY_SIZE		262144	 /* max --exec output relayed at once */
 
 #define MAXIMISE_BUFFER_FILL	1
 
+/*
+ * I/O engines which pv_transfer() can use to move data (see engine.c).
+ */
+#define PV_ENGINE_READWRITE	0	 /* read() into the buffer, write() out */
+#define PV_ENGINE_SPLICE	1	 /* splice(), with tee() in line mode */
+#define PV_ENGINE_MMAP		2	 /* write straight from an mmap() */
+#define PV_ENGINE_PARALLEL	3	 /* pread() / pwrite() in threads */
+#define PV_ENGINE_COUNT		4
+
+
+struct pvlinetee_s;
+struct pvmmap_s;
+struct pvlatency_s;
+struct pvparallel_s;
+struct pvdigest_s;
+struct pvexec_s;
+struct pvstep_s;
+struct pvperfile_s;
+
+/*
+ * A region of an input file which was skipped because of read errors, and
+ * filled with zeroes in the output at "output_offset" (-1 if the output
+ * can't be written to at an offset).
+ */
+struct pvskipregion_s {
+	off_t input_offset;
+	off_t output_offset;
+	off_t length;
+};
+
+/*
+ * The byte count and rate of one of the extra inputs or outputs shown on
+ * its own line below the main progress display.
+ */
+struct pvcounter_s {
+	const char *name;		 /* file name or "|command" */
+	unsigned long long position;	 /* bytes transferred so far */
+	unsigned long long prev_position; /* position at the last display */
+	long double prev_elapsed;	 /* elapsed time at the last display */
+	long double rate;		 /* rate at the last display */
+};
+
+/*
+ * What happened while one input file was being read, for --per-file and
+ * --manifest.  In line mode, "transferred" and "size" are in lines.
+ */
+struct pvfilestat_s {
+	unsigned long long transferred;	 /* bytes transferred from the file */
+	unsigned long long size;	 /* bytes expected from it (0=unknown) */
+	double elapsed;			 /* seconds spent on the file */
+	double peak_rate;		 /* highest rate over a display interval */
+	double stalled;			 /* seconds spent with nothing arriving */
+	bool started;			 /* set once the file has been opened */
+};
+
+/*
+ * An extra output being written to with --tee, and how far through the
+ * data it has got.  With --split, each one has its own buffer holding the
+ * whole lines last handed to it.
+ */
+struct pvsink_s {
+	struct pvcounter_s counter;	 /* name and bytes of the data written */
+	int fd;				 /* file descriptor, -1 once closed */
+	pid_t pid;			 /* process ID of command, or 0 */
+	int status;			 /* PV_SINK_* */
+	unsigned char *buffer;		 /* --split buffer */
+	size_t buffer_size;		 /* size of --split buffer */
+	size_t buffer_fill;		 /* bytes in --split buffer */
+	size_t buffer_done;		 /* bytes of those written so far */
+};
+
+/*
+ * An input being read from at the same time as the others with --merge,
+ * holding whatever has arrived from it since the end of its last complete
+ * line.
+ */
+struct pvmergeinput_s {
+	struct pvcounter_s counter;	 /* name and bytes of the data read */
+	int fd;				 /* file descriptor */
+	bool eof;			 /* true once it has reached the end */
+	unsigned char *buffer;		 /* data not yet passed on */
+	size_t buffer_size;		 /* size of the buffer */
+	size_t buffer_fill;		 /* bytes in the buffer */
+};
+
+/*
+ * One of the transfers run side by side with --multi, from "input" to
+ * "output", with a state of its own.  See multi.c.
+ */
+struct pvstream_s {
+	struct pvcounter_s counter;	 /* name and bytes transferred */
+	const char *input;		 /* input file name, or "-" */
+	const char *output;		 /* output file name, or "-" */
+	char *spec_line;		 /* --multi-file line the names are in */
+	pvstate_t pv;			 /* state of this transfer */
+	int output_fd;			 /* output file descriptor, or -1 */
+	bool done;			 /* set once finished and closed */
+	unsigned long long size;	 /* bytes to transfer, or 0 if unknown */
+};
+
+/*
+ * A source of synthetic data for --generate.  The repeating types are
+ * produced from one "period" of the data; the pseudo-random type comes
+ * from GENERATE_LANES interleaved xorshift128+ generators.
+ *
+ * When writing, the data is taken from "source": for the repeating types,
+ * that is the transfer buffer filled once with whole periods, or the
+ * period itself if that doesn't fit; for random data, it is the transfer
+ * buffer, refilled each time it has all been written.
+ */
+struct pvgenerate_s {
+	int type;			 /* PV_GENERATE_* */
+	unsigned char *period;		 /* one period of a repeating type */
+	size_t period_length;		 /* its length in bytes */
+	size_t phase;			 /* where the next byte is in the period */
+	unsigned long long lane_a[GENERATE_LANES]; /* xorshift128+ states */
+	unsigned long long lane_b[GENERATE_LANES];
+	unsigned char spare[GENERATE_LANES * 8]; /* last round of random data */
+	size_t spare_length;		 /* bytes at the end of it not yet used */
+	bool avx2;			 /* use AVX2 to generate random data */
+	unsigned char *source;		 /* data to write from */
+	size_t source_fill;		 /* bytes of data at "source" */
+	size_t source_offset;		 /* next byte to write from it */
+	bool vmsplice;			 /* use vmsplice() to write */
+};
+
+#define PV_GENERATE_ZERO	0	 /* zero bytes */
+#define PV_GENERATE_PATTERN	1	 /* a repeating string */
+#define PV_GENERATE_RANDOM	2	 /* seeded pseudo-random data */
+#define PV_GENERATE_TEXT	3	 /* compressible text */
+
+#define PV_SINK_OPEN		0	 /* still being written to */
+#define PV_SINK_CLOSED		1	 /* reader has gone away */
+#define PV_SINK_DROPPED		2	 /* fell too far behind, with --tee-drop */
+#define PV_SINK_FAILED		3	 /* write error */
 
 typedef struct pvhistory {
 	long long   total_bytes;
@@ -61,6 +229,8 @@ typedef struct pvhistory {
 #define PV_SIZEOF_STR_LASTOUTPUT	512
 #define PV_SIZEOF_STR_ETA		128
 #define PV_SIZEOF_STR_FINETA		128
+#define PV_SIZEOF_STR_ENGINE		32
+#define PV_SIZEOF_STR_LATENCY		32
 #define PV_FORMAT_ARRAY_MAX		100
 #define PV_SIZEOF_CRS_LOCK_FILE		1024
 
@@ -68,6 +238,11 @@ typedef struct pvhistory {
 #define PV_SIZEOF_FILE_FD		4096
 #define PV_SIZEOF_FILE_FDPATH		4096
 #define PV_SIZEOF_DISPLAY_NAME		512
+#define PV_SIZEOF_ERROR_MAP_NAME	4096
+
+#define PV_ERROR_MAP_HEADER	"# pv error map"
+#define PV_SIZEOF_CHECKPOINT_NAME	4096
+#define PV_CHECKPOINT_HEADER	"# pv checkpoint"
 
 
 /*
@@ -91,12 +266,37 @@ struct pvstate_s {
 	bool bits;			 /* report bits instead of bytes */
 	bool null;                       /* lines are null-terminated */
 	bool no_op;                      /* do nothing other than pipe data */
+	bool silent;			 /* don't report errors (--calibrate tries) */
 	unsigned int skip_errors;        /* skip read errors counter */
+	unsigned long long error_skip_block;	/* bytes to skip on error (0=auto) */
+	const char *error_map;		 /* file to save unread regions in */
+	unsigned long long skip_input;	 /* bytes to skip at start of each input */
+	unsigned long long seek_output;	 /* bytes to seek past at start of output */
+	unsigned long long input_length; /* most bytes to read per input (0=all) */
+	unsigned long input_block_size;	 /* exact size of each read (0=any) */
+	unsigned long output_block_size; /* exact size of each write (0=any) */
+	bool output_block_pad;		 /* pad the last output block with zeros */
+	const char *digest_names;	 /* --hash algorithms, comma separated */
+	bool digest_per_file;		 /* also hash each input file */
+	bool verify;			 /* read the output back afterwards */
+	const char *generate;		 /* --generate data type, or NULL */
+	const char *validate;		 /* --validate data type, or NULL */
+	bool discard;			 /* don't write to standard output */
+	const char *exec_command;	 /* --exec command, or NULL */
+	bool per_file;			 /* show the current input file too */
+	const char *manifest;		 /* --manifest file, or NULL */
+	bool manifest_json;		 /* write the manifest as JSON */
+	bool preallocate;		 /* preallocate the output's space */
+	unsigned int parallel_threads;	 /* --parallel threads (0=not used) */
+	const char *checkpoint;		 /* checkpoint journal file */
+	bool resume;			 /* resume from the checkpoint */
 	bool stop_at_size;               /* set if we stop at "size" bytes */
 	bool sync_after_write;           /* set if we sync after every write */
 	bool direct_io;                  /* set if O_DIRECT is to be used */
 	bool direct_io_changed;          /* set when direct_io is changed */
 	bool no_splice;                  /* never use splice() */
+	unsigned int pipe_size;          /* size to set pipes to (0=leave) */
+	double max_latency;              /* max sec to hold data (0=no max) */
 	unsigned long long rate_limit;   /* rate limit, in bytes per second */
 	unsigned long long target_buffer_size;  /* buffer size (0=default) */
 	unsigned long long size;         /* total size of data */
@@ -116,25 +316,26 @@ struct pvstate_s {
 	const char *program_name;	 /* program name for error reporting */
 	char cwd[PV_SIZEOF_CWD];	 /* current working directory for relative path */
 	const char *current_file;	 /* current file being read */
+	int current_file_num;		 /* its number in the list of inputs */
+	unsigned long long current_file_size; /* bytes to read from it (0=unknown) */
+	int output_fd;			 /* where the data goes; normally stdout */
+	int input_fd;			 /* caller's input, or -1 to use files */
+	bool no_wait;			 /* pv_transfer() must not wait */
 	int exit_status; 		 /* exit status to give (0=OK) */
 
 	/*******************
 	 * Signal handling *
 	 *******************/
-	int pv_sig_old_stderr;		 /* see pv_sig_ttou() */
-	struct timeval pv_sig_tstp_time; /* see pv_sig_tstp() / __cont() */
 	struct timeval pv_sig_toffset;		 /* total time spent stopped */
-	volatile sig_atomic_t pv_sig_newsize;	 /* whether we need to get term size again */
-	volatile sig_atomic_t pv_sig_abort;	 /* whether we need to abort right now */
+	bool pv_sig_newsize;			 /* whether we need to get term size again */
+	bool pv_sig_abort;			 /* whether we need to abort right now */
+	sig_atomic_t pv_sig_seen_abort;		 /* signal counts seen by pv_sig_check() */
+	sig_atomic_t pv_sig_seen_winch;
+	sig_atomic_t pv_sig_seen_cont;
+	struct timeval pv_sig_seen_stopped;	 /* time stopped, as last seen */
+	time_t pv_sig_next_checkbg;		 /* see pv_sig_checkbg() */
 	volatile sig_atomic_t reparse_display;	 /* whether to re-check format string */
-	struct sigaction pv_sig_old_sigpipe;
-	struct sigaction pv_sig_old_sigttou;
-	struct sigaction pv_sig_old_sigtstp;
-	struct sigaction pv_sig_old_sigcont;
-	struct sigaction pv_sig_old_sigwinch;
-	struct sigaction pv_sig_old_sigint;
-	struct sigaction pv_sig_old_sighup;
-	struct sigaction pv_sig_old_sigterm;
+	bool pv_sig_installed;			 /* set between pv_sig_init() and _fini() */
 
 	/*****************
 	 * Display state *
@@ -169,6 +370,8 @@ struct pvstate_s {
 	char str_lastoutput[PV_SIZEOF_STR_LASTOUTPUT];
 	char str_eta[PV_SIZEOF_STR_ETA];
 	char str_fineta[PV_SIZEOF_STR_FINETA];
+	char str_engine[PV_SIZEOF_STR_ENGINE];
+	char str_latency[PV_SIZEOF_STR_LATENCY];
 	unsigned long components_used;	 /* bitmask of components used */
 	struct {
 		const char *string;
@@ -232,6 +435,43 @@ struct pvstate_s {
 	int last_read_skip_fd;
 	unsigned long read_errors_in_a_row;
 	int read_error_warning_shown;
+
+	/*
+	 * Every region skipped because of read errors in the current input
+	 * file is remembered in "skipped", merging neighbours; with -Z, once
+	 * the file has been read through, the first "skipped_tried" have
+	 * been bisected to recover what they can (see recover.c), leaving
+	 * only what still could not be read.
+	 */
+	struct pvskipregion_s *skipped;	 /* array of skipped regions */
+	unsigned int skipped_count;	 /* number of regions in the array */
+	unsigned int skipped_alloc;	 /* number of regions allocated */
+	unsigned int skipped_tried;	 /* number already tried to recover */
+	off_t error_map_output;		 /* output size the error map was for */
+
+	long long input_remaining;	 /* bytes left of --input-length (-1=no limit) */
+
+	/*
+	 * Output space allocated by --preallocate, up to "prealloc_end",
+	 * which pv_preallocate_trim() gives back if it isn't all used.
+	 */
+	bool prealloc_active;		 /* set if output was preallocated */
+	bool prealloc_keep_size;	 /* set if allocated past end of file */
+	off_t prealloc_end;		 /* end of preallocated region */
+	off_t prealloc_orig_size;	 /* output size before preallocating */
+
+	/*
+	 * Where --resume picks up from, read from the checkpoint journal;
+	 * "resume_pending" is cleared once the input has been seeked.
+	 */
+	bool resume_pending;		 /* input not yet seeked to checkpoint */
+	int resume_file;		 /* input file number to resume in */
+	off_t resume_input_offset;	 /* offset to resume from in input */
+	off_t resume_output_offset;	 /* offset to resume from in output */
+	off_t resume_input_size;	 /* size of input at checkpoint (-1=?) */
+	off_t resume_window;		 /* bytes covered by resume_sum */
+	unsigned long resume_sum;	 /* Adler-32 of window before offset */
+	long long resume_done;		 /* amount transferred at checkpoint */
 #ifdef HAVE_SPLICE
 	/*
 	 * These variables are used to keep track of whether splice() was
@@ -242,9 +482,173 @@ struct pvstate_s {
 	 */
 	int splice_failed_fd;
 	int splice_used;
+	/*
+	 * With --discard, splice() moves the data to /dev/null, through a
+	 * private pipe if the input is not a pipe itself.
+	 */
+	int discard_null_fd;
+	int discard_pipe[2];
+#endif
+#ifdef HAVE_LINE_TEE
+	/*
+	 * In line mode, when both the input and the output are pipes, the
+	 * input is duplicated with tee() into a private side pipe before
+	 * being spliced to the output, and a helper thread counts the line
+	 * separators it reads from the side pipe.  This keeps the main data
+	 * path zero-copy at the cost of the line count lagging slightly
+	 * behind the bytes written.  See pv__linetee_*() in transfer.c.
+	 */
+	struct pvlinetee_s *linetee;
+#endif
+#ifdef HAVE_MMAP_ENGINE
+	/*
+	 * When the input is a regular file and splice() is not being used,
+	 * it is mapped into memory a window at a time and written straight
+	 * from the mapping, instead of being copied through the transfer
+	 * buffer.  The engine state is kept in mmap_engine (see pv__mmap_*()
+	 * in transfer.c); mmap_failed_fd is the file descriptor it last gave
+	 * up on, so that it is not retried on that fd.
+	 */
+	struct pvmmap_s *mmap_engine;
+	int mmap_failed_fd;
 #endif
+	/*
+	 * Online I/O engine selection, see engine.c.  For each input file,
+	 * engine_candidates is a bitmask of the PV_ENGINE_* engines that
+	 * could be used on it; each candidate is tried in turn for
+	 * ENGINE_TRIAL_TIME, measuring its throughput and CPU time per
+	 * byte, and then the best one is kept until the next round of
+	 * trials, ENGINE_RETRIAL_INTERVAL seconds later.
+	 *
+	 * The engine_wanted is the engine the selector wants to use, and
+	 * engine is the one pv_transfer() is actually using - they differ
+	 * until pv_transfer() reaches a point where it is safe to switch.
+	 * An engine_trial of -1 means that no trial is under way.
+	 */
+	int engine_fd;			 /* input fd the selector is set up for */
+	unsigned int engine_candidates;	 /* bitmask of 1 << PV_ENGINE_* */
+	int engine;			 /* engine in use */
+	int engine_wanted;		 /* engine to switch to */
+	int engine_trial;		 /* engine being tried, or -1 */
+	struct timeval engine_trial_start;	/* when this trial started */
+	long double engine_trial_cpu;	 /* CPU seconds used at trial start */
+	unsigned long long engine_trial_bytes;	/* bytes moved in this trial */
+	long double engine_rate[PV_ENGINE_COUNT];	/* bytes/sec per engine */
+	long double engine_cpu[PV_ENGINE_COUNT];	/* CPU sec/byte per engine */
+	struct timeval engine_next_trial;	/* when to start the next round */
+	/*
+	 * With a --max-latency target, the time each chunk of data arrived
+	 * in the transfer buffer is kept, so that reading stops in time for
+	 * the oldest data to be written out before its deadline, and so that
+	 * a histogram of how long each byte was held can be built up for
+	 * %L.  See pv__latency_*() in transfer.c.
+	 */
+	struct pvlatency_s *latency;
+	/*
+	 * With --parallel, when the input and output are both seekable,
+	 * worker threads copy chunks of the input with pread() and pwrite()
+	 * at their own offsets, and the main loop only counts what they've
+	 * finished.  See parallel.c.
+	 */
+	struct pvparallel_s *parallel;
+	/*
+	 * With --tee, everything written to standard output is also copied
+	 * into a ring buffer, from which each of the extra outputs is
+	 * written to as fast as it will take it; "fanout_head" is the total
+	 * number of bytes ever put into the ring.  Unless --tee-drop was
+	 * given, standard output waits for the slowest of them when the
+	 * ring is full.  With --split, instead of standard output, whole
+	 * lines are handed out to whichever output is idle, and
+	 * "fanout_head" counts what has been handed out.  See fanout.c.
+	 */
+	const char **output_files;	 /* --tee output files */
+	unsigned int output_file_count;	 /* number of --tee output files */
+	bool tee_drop;			 /* drop outputs which fall behind */
+	bool split;			 /* spread lines between the outputs */
+	unsigned int split_next;	 /* next output to try with --split */
+	struct pvsink_s *sinks;		 /* array of open --tee outputs */
+	unsigned int sink_count;	 /* number of entries in "sinks" */
+	unsigned char *fanout_ring;	 /* ring buffer for the outputs */
+	size_t fanout_ring_size;	 /* size of the ring buffer */
+	unsigned long long fanout_head;	 /* bytes put into the ring so far */
+	/*
+	 * With --merge, all of the input files are read at once instead of
+	 * one after another, and whole lines from each are moved into the
+	 * transfer buffer as they arrive, taking turns.  See merge.c.
+	 */
+	bool merge;			 /* read all inputs at the same time */
+	struct pvmergeinput_s *merge_inputs; /* array of --merge inputs */
+	unsigned int merge_input_count;	 /* number of entries in "merge_inputs" */
+	unsigned int merge_next;	 /* next input to take lines from */
+	/*
+	 * With --hash, everything written to standard output is passed
+	 * through a private pipe to a helper thread which hashes it, so
+	 * that the main loop never waits for the hashing unless it falls a
+	 * whole pipe behind.  When splice() is used, the data is duplicated
+	 * into the pipe with tee() instead of being copied.  See digest.c.
+	 */
+	struct pvdigest_s *digest;
+	/*
+	 * With --verify, the hash thread also keeps a hash of each
+	 * VERIFY_BLOCK_SIZE block of the output, starting at the output's
+	 * file offset "verify_offset", and once the transfer is done the
+	 * output is read back and checked against them.  See verify.c.
+	 */
+	off_t verify_offset;		 /* output offset the transfer began at */
+	/*
+	 * With --generate, there is no input file: the data comes from the
+	 * generator, and is written straight to standard output by
+	 * pv_transfer().  See generate.c.
+	 */
+	struct pvgenerate_s *generator;
+	/*
+	 * With --validate, nothing is written to standard output: the data
+	 * is compared with what the generator produces instead, counting
+	 * the bytes that differ.  See validate.c.
+	 */
+	struct pvgenerate_s *validator;
+	unsigned char *validate_expected; /* expected data being compared */
+	unsigned long long validate_offset; /* bytes compared so far */
+	unsigned long long validate_mismatches; /* bytes that differed */
+	long long validate_first_bad;	 /* offset of the first, or -1 */
+	/*
+	 * With --exec, standard output is swapped for a pipe to the
+	 * command's standard input, and a helper thread passes what the
+	 * command writes on to the real standard output, counting it for
+	 * the display.  See exec.c.
+	 */
+	struct pvexec_s *exec;
+	/*
+	 * With --multi, the input files are taken in pairs as an input and
+	 * an output, along with any listed in "multi_file", and each pair
+	 * is transferred at the same time as the rest by pv_multi_loop(),
+	 * with the display showing the totals and a line for each.  See
+	 * multi.c.
+	 */
+	bool multi;			 /* run many transfers at once */
+	const char *multi_file;		 /* file listing more of them, or NULL */
+	struct pvstream_s *streams;	 /* array of --multi transfers */
+	unsigned int stream_count;	 /* number of entries in "streams" */
+	unsigned int stream_next;	 /* stream to go first next time */
+	/*
+	 * Programs embedding PV can drive a transfer themselves a step at a
+	 * time, and have each update passed to a function of their own as a
+	 * snapshot instead of being drawn on the terminal.  See step.c.
+	 */
+	struct pvstep_s *step;		 /* pv_step() transfer, or NULL */
+	pv_stats_callback_t stats_callback; /* function to give updates to */
+	void *stats_callback_data;	 /* pointer to pass to it */
+	struct pvstats_s stats;		 /* snapshot as of the last update */
+	/*
+	 * With --per-file or --manifest, each input file's share of the
+	 * transfer is timed as it goes, for the current file's line on the
+	 * display and the manifest written at the end.  See perfile.c.
+	 */
+	struct pvperfile_s *perfile;
+	unsigned int display_sublines;	 /* extra display lines drawn */
 	long to_write;			 /* max to write this time around */
 	long written;			 /* bytes sent to stdout this time */
+	unsigned long output_block_done; /* bytes of current output block sent */
 };
 
 
@@ -270,9 +674,85 @@ void pv_error(pvstate_t, char *, ...);
 
 int pv_main_loop(pvstate_t);
 void pv_display(pvstate_t, long double, long long, long long);
+void pv_display_restart(pvstate_t, unsigned long long);
 long pv_transfer(pvstate_t, int, int *, int *, unsigned long long, long *);
+void pv_transfer_fini(pvstate_t);
+off_t pv_transfer_input_offset(pvstate_t, int);
+off_t pv_transfer_output_offset(pvstate_t);
+long double pv_transfer_hold_time(pvstate_t, long double);
+void pv_engine_start(pvstate_t, int);
+bool pv_engine_allowed(pvstate_t, int);
+void pv_engine_begin(pvstate_t, int);
+void pv_engine_update(pvstate_t, long);
+const char *pv_engine_name(int);
 void pv_set_buffer_size(unsigned long long, int);
 int pv_next_file(pvstate_t, int, int);
+void pv_set_pipe_size(pvstate_t, int);
+void pv_preallocate_output(pvstate_t);
+bool pv_parallel_usable(pvstate_t, int);
+int pv_parallel_transfer(pvstate_t, int, int *, int *, unsigned long long);
+bool pv_parallel_offsets(pvstate_t, int, off_t *, off_t *);
+void pv_parallel_fini(pvstate_t);
+bool pv_fanout_open(pvstate_t);
+size_t pv_fanout_room(pvstate_t, size_t);
+void pv_fanout_append(pvstate_t, const unsigned char *, size_t);
+ssize_t pv_fanout_split(pvstate_t, const unsigned char *, size_t);
+unsigned long long pv_fanout_queued(pvstate_t, struct pvsink_s *);
+int pv_fanout_fdset(pvstate_t, fd_set *, int);
+void pv_fanout_flush(pvstate_t, fd_set *);
+bool pv_fanout_pending(pvstate_t);
+void pv_fanout_wait(pvstate_t);
+void pv_fanout_fini(pvstate_t);
+bool pv_merge_open(pvstate_t, int);
+int pv_merge_fdset(pvstate_t, fd_set *, int);
+size_t pv_merge_read(pvstate_t, fd_set *, unsigned char *, size_t, bool *);
+void pv_merge_fini(pvstate_t);
+bool pv_digest_start(pvstate_t);
+void pv_digest_data(pvstate_t, const unsigned char *, size_t);
+ssize_t pv_digest_splice(pvstate_t, int, size_t);
+bool pv_digest_pending(pvstate_t);
+void pv_digest_file_end(pvstate_t, int);
+void pv_digest_finish(pvstate_t, bool);
+long long pv_digest_verify_begin(pvstate_t);
+unsigned long long pv_digest_verify_end(pvstate_t, long long *);
+bool pv_verify_start(pvstate_t);
+void pv_verify_run(pvstate_t);
+struct pvgenerate_s *pv_generate_new(pvstate_t, const char *, const char *);
+void pv_generate_data(struct pvgenerate_s *, unsigned char *, size_t);
+void pv_generate_free(struct pvgenerate_s *);
+int pv_generate_open(pvstate_t);
+bool pv_validate_start(pvstate_t);
+size_t pv_validate_data(pvstate_t, const unsigned char *, size_t);
+void pv_validate_finish(pvstate_t, bool);
+bool pv_exec_start(pvstate_t);
+bool pv_exec_pending(pvstate_t);
+bool pv_exec_failed(pvstate_t);
+void pv_exec_wait(pvstate_t);
+struct pvcounter_s *pv_exec_counter(pvstate_t);
+void pv_exec_fini(pvstate_t);
+bool pv_multi_open(pvstate_t);
+int pv_multi_fdset(pvstate_t, fd_set *, fd_set *, int);
+unsigned int pv_multi_active(pvstate_t);
+long long pv_multi_transfer(pvstate_t, bool, unsigned long long);
+void pv_multi_status(struct pvstream_s *, char *, size_t);
+void pv_multi_fini(pvstate_t);
+bool pv_perfile_start(pvstate_t, long long);
+void pv_perfile_update(pvstate_t, int, long long);
+struct pvcounter_s *pv_perfile_counter(pvstate_t, long double);
+void pv_perfile_status(pvstate_t, char *, size_t);
+void pv_perfile_finish(pvstate_t, long long);
+void pv_perfile_fini(pvstate_t);
+void pv_stats_update(pvstate_t, long double, long long, bool);
+int pv_step_fdset(pvstate_t, fd_set *, fd_set *, int);
+void pv_preallocate_trim(pvstate_t);
+void pv_skipped_add(pvstate_t, off_t, off_t, unsigned long);
+void pv_skipped_reset(pvstate_t);
+void pv_recover_skipped(pvstate_t, int);
+void pv_error_map_save(pvstate_t, int, bool);
+void pv_checkpoint_save(pvstate_t, int, int, long long);
+bool pv_checkpoint_load(pvstate_t);
+bool pv_checkpoint_resume_input(pvstate_t, int, int);
+bool pv_checkpoint_resume_output(pvstate_t);
 
 void pv_write_retry(int, const char *, size_t);
 
@@ -283,14 +763,14 @@ void pv_crs_update(pvstate_t, const char *);
 void pv_crs_needreinit(pvstate_t);
 #endif
 
-void pv_sig_allowpause(void);
-void pv_sig_checkbg(void);
-void pv_sig_nopause(void);
+void pv_sig_sync(pvstate_t);
+void pv_sig_check(pvstate_t);
+bool pv_sig_aborted(pvstate_t);
+void pv_sig_checkbg(pvstate_t);
 
 void pv_remote_init(pvstate_t);
 void pv_remote_check(pvstate_t);
 void pv_remote_fini(pvstate_t);
-int pv_remote_set(pvstate_t);
 
 int pv_watchfd_info(pvstate_t, pvwatchfd_t, int);
 int pv_watchfd_changed(pvwatchfd_t);
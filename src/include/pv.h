@@ -21,6 +21,29 @@ extern "C" {
 struct pvstate_s;
 typedef struct pvstate_s *pvstate_t;
 
+/*
+ * A snapshot of how a transfer is going, for programs using these functions
+ * to do their own transfers instead of running pv_main_loop().  In line
+ * mode, "transferred", "size", and the rates are in lines, not bytes.
+ */
+struct pvstats_s {
+	unsigned long long transferred;	 /* bytes transferred so far */
+	unsigned long long size;	 /* total expected, or 0 if unknown */
+	long double elapsed;		 /* seconds since the transfer started */
+	long double rate;		 /* bytes per second since the last one */
+	long double average_rate;	 /* bytes per second since the start */
+	double percentage;		 /* percentage done, or -1 if unknown */
+	long eta;			 /* seconds left, or -1 if unknown */
+	int file_num;			 /* which input file is being read */
+	bool finished;			 /* set once the transfer has ended */
+};
+
+/*
+ * Function to call with a snapshot at each update of a transfer, given
+ * the state, the snapshot, and the pointer given when it was set.
+ */
+typedef void (*pv_stats_callback_t)(pvstate_t, const struct pvstats_s *, void *);
+
 /*
  * Valid number types for pv_getnum_check().
  */
@@ -105,12 +128,41 @@ extern void pv_state_bits_set(pvstate_t, bool);
 extern void pv_state_null_set(pvstate_t, bool);
 extern void pv_state_no_op_set(pvstate_t, bool);
 extern void pv_state_skip_errors_set(pvstate_t, unsigned int);
+extern void pv_state_error_skip_block_set(pvstate_t, unsigned long long);
+extern void pv_state_error_map_set(pvstate_t, const char *);
+extern void pv_state_skip_input_set(pvstate_t, unsigned long long);
+extern void pv_state_seek_output_set(pvstate_t, unsigned long long);
+extern void pv_state_input_length_set(pvstate_t, unsigned long long);
+extern void pv_state_input_block_size_set(pvstate_t, unsigned long long);
+extern void pv_state_output_block_size_set(pvstate_t, unsigned long long);
+extern void pv_state_output_block_pad_set(pvstate_t, bool);
+extern void pv_state_preallocate_set(pvstate_t, bool);
+extern void pv_state_parallel_set(pvstate_t, unsigned int);
+extern void pv_state_tee_drop_set(pvstate_t, bool);
+extern void pv_state_split_set(pvstate_t, bool);
+extern void pv_state_merge_set(pvstate_t, bool);
+extern void pv_state_hash_set(pvstate_t, const char *);
+extern void pv_state_hash_per_file_set(pvstate_t, bool);
+extern void pv_state_verify_set(pvstate_t, bool);
+extern void pv_state_generate_set(pvstate_t, const char *);
+extern void pv_state_validate_set(pvstate_t, const char *);
+extern void pv_state_discard_set(pvstate_t, bool);
+extern void pv_state_exec_set(pvstate_t, const char *);
+extern void pv_state_multi_set(pvstate_t, bool);
+extern void pv_state_multi_file_set(pvstate_t, const char *);
+extern void pv_state_per_file_set(pvstate_t, bool);
+extern void pv_state_manifest_set(pvstate_t, const char *);
+extern void pv_state_manifest_json_set(pvstate_t, bool);
+extern void pv_state_checkpoint_set(pvstate_t, const char *);
+extern void pv_state_resume_set(pvstate_t, bool);
 extern void pv_state_stop_at_size_set(pvstate_t, bool);
 extern void pv_state_sync_after_write_set(pvstate_t, bool);
 extern void pv_state_direct_io_set(pvstate_t, bool);
 extern void pv_state_rate_limit_set(pvstate_t, unsigned long long);
 extern void pv_state_target_buffer_size_set(pvstate_t, unsigned long long);
 extern void pv_state_no_splice_set(pvstate_t, bool);
+extern void pv_state_pipe_size_set(pvstate_t, unsigned int);
+extern void pv_state_max_latency_set(pvstate_t, double);
 extern void pv_state_size_set(pvstate_t, unsigned long long);
 extern void pv_state_interval_set(pvstate_t, double);
 extern void pv_state_width_set(pvstate_t, unsigned int);
@@ -122,6 +174,20 @@ extern void pv_state_watch_fd_set(pvstate_t, int);
 extern void pv_state_average_rate_window_set(pvstate_t, int);
 
 extern void pv_state_inputfiles(pvstate_t, int, const char **);
+extern void pv_state_outputfiles(pvstate_t, unsigned int, const char **);
+
+/*
+ * Read from the given file descriptor instead of the input files, and
+ * write to the given one instead of standard output.  Neither is closed.
+ */
+extern void pv_state_input_fd_set(pvstate_t, int);
+extern void pv_state_output_fd_set(pvstate_t, int);
+
+/*
+ * Call the given function with a snapshot of the transfer at each update,
+ * instead of showing anything on standard error.
+ */
+extern void pv_state_stats_callback_set(pvstate_t, pv_stats_callback_t, void *);
 
 /*
  * Work out whether we are in the foreground.
@@ -148,6 +214,41 @@ extern void pv_sig_init(pvstate_t);
  */
 extern int pv_main_loop(pvstate_t);
 
+/*
+ * Open the input ready for pv_step(), returning false on error; calling
+ * pv_step() does this if it hasn't been done already.
+ */
+extern bool pv_step_start(pvstate_t);
+
+/*
+ * Move up to the given number of bytes (lines in line mode, 0 for no
+ * limit other than the rate limit) from the input to the output without
+ * waiting, returning the number moved, or -1 once the transfer has ended.
+ */
+extern long long pv_step(pvstate_t, unsigned long long);
+
+/*
+ * Finish a transfer made with pv_step(), returning the exit status.
+ */
+extern int pv_step_finish(pvstate_t);
+
+/*
+ * Fill in a snapshot of how the transfer is going, as of the last update.
+ */
+extern void pv_stats(pvstate_t, struct pvstats_s *);
+
+/*
+ * Benchmark different transfer settings between the first input file and
+ * the output, and report the best ones.
+ */
+extern int pv_calibrate(pvstate_t);
+
+/*
+ * Try again to read the regions of the input listed in the error map, and
+ * patch them into the output.
+ */
+extern int pv_error_map_retry(pvstate_t);
+
 /*
  * Watch the selected file descriptor of the selected process.
  */
@@ -187,6 +288,11 @@ extern void pv_state_free(pvstate_t);
  */
 void debugging_output_destination(const char *);
 
+/*
+ * Close the debugging destination file, if debugging is enabled.
+ */
+void debugging_output_close(void);
+
 /*
  * Output debugging information, if debugging is enabled.
  */
@@ -15,17 +15,62 @@
 #include <time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif				/* HAVE_THREADS */
 
 
 #ifdef ENABLE_DEBUGGING
-/*@null@*/ static const char *debug_filename = NULL;
+/*
+ * The debugging output file is shared by everything in the process, so it
+ * is opened and closed explicitly, rather than on first use, and written
+ * under a lock so that lines from different threads don't get mixed up.
+ */
+/*@null@*/ static FILE *debugfptr = NULL;
+#ifdef HAVE_THREADS
+static pthread_mutex_t debug_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif				/* HAVE_THREADS */
 
 /*
- * Set the destination for debugging information.
+ * Set the destination for debugging information, opening the file for
+ * appending; any previous destination is closed.
  */
 void debugging_output_destination(const char *filename)
 {
-	debug_filename = filename;
+	FILE *fptr;
+
+	fptr = fopen(filename, "a");	    /* flawfinder: ignore */
+	/*
+	 * flawfinder note: caller directly controls filename, the safest
+	 * we can manage is to use append mode.
+	 */
+
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&debug_mutex);
+#endif				/* HAVE_THREADS */
+	if (NULL != debugfptr)
+		(void) fclose(debugfptr);
+	debugfptr = fptr;
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&debug_mutex);
+#endif				/* HAVE_THREADS */
+}
+
+
+/*
+ * Close the debugging output file, if there is one.
+ */
+void debugging_output_close(void)
+{
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&debug_mutex);
+#endif				/* HAVE_THREADS */
+	if (NULL != debugfptr)
+		(void) fclose(debugfptr);
+	debugfptr = NULL;
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&debug_mutex);
+#endif				/* HAVE_THREADS */
 }
 
 
@@ -35,11 +80,9 @@ void debugging_output_destination(const char *filename)
  */
 void debugging_output(const char *function, const char *file, int line, const char *format, ...)
 {
-	static bool tried_open = false;
-	static FILE *debugfptr = NULL;
 	va_list ap;
 	time_t t;
-	struct tm *tm;
+	struct tm tm;
 	char tbuf[128];			 /* flawfinder: ignore */
 
 	/*
@@ -47,30 +90,28 @@ void debugging_output(const char *function, const char *file, int line, const ch
 	 * takes its size, and we enforce string termination.
 	 */
 
-	if (false == tried_open) {
-		if (NULL != debug_filename) {
-			debugfptr = fopen(debug_filename, "a");	/* flawfinder: ignore */
-			/*
-			 * flawfinder note: caller directly controls
-			 * filename, the safest we can manage is to use
-			 * append mode.
-			 */
-		}
-		tried_open = true;
-	}
-
 	if (NULL == debugfptr) {
 		return;
 	}
 
 	(void) time(&t);
-	tm = localtime(&t);
+	(void) localtime_r(&t, &tm);
 	tbuf[0] = '\0';
-	if (0 == strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", tm)) {
+	if (0 == strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm)) {
 		tbuf[0] = '\0';
 	}
 	tbuf[sizeof(tbuf) - 1] = '\0';	    /* enforce termination */
 
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&debug_mutex);
+#endif				/* HAVE_THREADS */
+	if (NULL == debugfptr) {
+#ifdef HAVE_THREADS
+		pthread_mutex_unlock(&debug_mutex);
+#endif				/* HAVE_THREADS */
+		return;
+	}
+
 	(void) fprintf(debugfptr, "[%s] (%d) %s (%s:%d): ", tbuf, getpid(), function, file, line);
 
 	va_start(ap, format);
@@ -84,6 +125,9 @@ void debugging_output(const char *function, const char *file, int line, const ch
 
 	(void) fprintf(debugfptr, "\n");
 	(void) fflush(debugfptr);
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&debug_mutex);
+#endif				/* HAVE_THREADS */
 }
 
 #else				/* ! ENABLE_DEBUGGING */
@@ -96,6 +140,13 @@ void debugging_output_destination( __attribute__((unused))
 {
 }
 
+/*
+ * Stub debugging close function.
+ */
+void debugging_output_close(void)
+{
+}
+
 /*
  * Stub debugging output function.
  */
@@ -368,6 +368,95 @@ void display_help(void)
 		{ "-E", "--skip-errors", NULL,
 		 N_("skip read errors in input"),
 		 { 0, 0, 0, 0} },
+		{ "-Z", "--error-skip-block", N_("BYTES"),
+		 N_("with -E, skip BYTES at a time and recover later"),
+		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--error-map", N_("FILE"),
+		 N_("list unread regions in FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--error-map-retry", NULL,
+		 N_("retry the regions listed in the --error-map FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--skip-input", N_("BYTES"),
+		 N_("skip BYTES at the start of each input"),
+		 { 0, 0, 0, 0} },
+		{ "", "--seek-output", N_("BYTES"),
+		 N_("skip BYTES at the start of the output"),
+		 { 0, 0, 0, 0} },
+		{ "", "--input-length", N_("BYTES"),
+		 N_("read at most BYTES from each input"),
+		 { 0, 0, 0, 0} },
+		{ "", "--input-block-size", N_("BYTES"),
+		 N_("read exactly BYTES at a time"),
+		 { 0, 0, 0, 0} },
+		{ "", "--output-block-size", N_("BYTES"),
+		 N_("write exactly BYTES at a time, like dd obs="),
+		 { 0, 0, 0, 0} },
+		{ "", "--output-block-pad", NULL,
+		 N_("pad the last output block out with zeros"),
+		 { 0, 0, 0, 0} },
+		{ "", "--preallocate", NULL,
+		 N_("allocate the output file's space in advance"),
+		 { 0, 0, 0, 0} },
+		{ "", "--parallel", N_("NUM"),
+		 N_("copy with NUM threads if input and output are seekable"),
+		 { 0, 0, 0, 0} },
+		{ "", "--tee", N_("FILE"),
+		 N_("also write everything to FILE (may be repeated)"),
+		 { 0, 0, 0, 0} },
+		{ "", "--tee-drop", NULL,
+		 N_("give up on a --tee FILE that falls behind"),
+		 { 0, 0, 0, 0} },
+		{ "", "--split", NULL,
+		 N_("spread whole lines between the --tee FILEs"),
+		 { 0, 0, 0, 0} },
+		{ "", "--merge", NULL,
+		 N_("read all FILEs at once, interleaving whole lines"),
+		 { 0, 0, 0, 0} },
+		{ "", "--hash", N_("LIST"),
+		 N_("hash the output with crc32c, xxh3, and/or sha256"),
+		 { 0, 0, 0, 0} },
+		{ "", "--hash-per-file", NULL,
+		 N_("with --hash, also hash each input FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--verify", NULL,
+		 N_("read the output back afterwards to check it"),
+		 { 0, 0, 0, 0} },
+		{ "", "--generate", N_("TYPE"),
+		 N_("write zero, pattern, random, or text data"),
+		 { 0, 0, 0, 0} },
+		{ "", "--validate", N_("TYPE"),
+		 N_("check input is --generate TYPE data; no output"),
+		 { 0, 0, 0, 0} },
+		{ "", "--discard", NULL,
+		 N_("read the input but write nothing to the output"),
+		 { 0, 0, 0, 0} },
+		{ "", "--exec", N_("CMD"),
+		 N_("pass the data through CMD, showing both sides"),
+		 { 0, 0, 0, 0} },
+		{ "", "--multi", NULL,
+		 N_("copy each input FILE to the output FILE after it"),
+		 { 0, 0, 0, 0} },
+		{ "", "--multi-file", N_("FILE"),
+		 N_("with --multi, also copy the pairs listed in FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--per-file", NULL,
+		 N_("add a display line for the current input file"),
+		 { 0, 0, 0, 0} },
+		{ "", "--manifest", N_("FILE"),
+		 N_("write each input file's times and rates to FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--manifest-format", N_("FORMAT"),
+		 N_("write the --manifest as tsv (default) or json"),
+		 { 0, 0, 0, 0} },
+		{ "", "--checkpoint", N_("FILE"),
+		 N_("record how far the transfer has got in FILE"),
+		 { 0, 0, 0, 0} },
+		{ "", "--resume", NULL,
+		 N_("with --checkpoint, carry on from where FILE says"),
+		 { 0, 0, 0, 0} },
+#endif				/* HAVE_GETOPT_LONG */
 		{ "-S", "--stop-at-size", NULL,
 		 N_("stop after --size bytes have been transferred"),
 		 { 0, 0, 0, 0} },
@@ -377,6 +466,17 @@ void display_help(void)
 		{ "-K", "--direct-io", NULL,
 		 N_("use direct I/O to bypass cache"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--pipe-size", N_("BYTES"),
+		 N_("set input and output pipes to hold BYTES"),
+		 { 0, 0, 0, 0} },
+		{ "", "--calibrate", NULL,
+		 N_("benchmark transfer settings on the input and output"),
+		 { 0, 0, 0, 0} },
+		{ "", "--max-latency", N_("SEC"),
+		 N_("pass data on within SEC seconds of reading it"),
+		 { 0, 0, 0, 0} },
+#endif				/* HAVE_GETOPT_LONG */
 #ifdef HAVE_IPC
 		{ "-R", "--remote", N_("PID"),
 		 N_("update settings of process PID"),
@@ -497,6 +597,8 @@ void display_help(void)
 		option_width += 2 + definition->width.opt_short;	/* "  short" */
 #ifdef HAVE_GETOPT_LONG
 		option_width += 2 + definition->width.opt_long;	/* ", <long>" */
+		if ((0 == definition->width.opt_short) && (definition->width.opt_long > 0))
+			option_width += 2;	/* "    <long>" for long-only options */
 #endif
 		option_width += 1 + definition->width.opt_argument;	/* " ARG" */
 		option_width += 2;	    /* final 2 spaces */
@@ -537,8 +639,17 @@ void display_help(void)
 		}
 #ifdef HAVE_GETOPT_LONG
 		if (definition->width.opt_long > 0 && NULL != definition->opt_long) {
-			printf(", %s", definition->opt_long);
-			option_width += 2 + definition->width.opt_long;
+			/*
+			 * Line long-only options up with the long options
+			 * that follow a two character short option.
+			 */
+			if (0 == option_width) {
+				printf("      %s", definition->opt_long);
+				option_width += 6 + definition->width.opt_long;
+			} else {
+				printf(", %s", definition->opt_long);
+				option_width += 2 + definition->width.opt_long;
+			}
 		}
 #endif
 		if (definition->width.opt_argument > 0 && NULL != definition->opt_argument) {
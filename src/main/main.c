@@ -24,8 +24,8 @@
 
 
 int pv_remote_set(opts_t);
-void pv_remote_init(void);
-void pv_remote_fini(void);
+void pv_remote_init(pvstate_t);
+void pv_remote_fini(pvstate_t);
 
 
 /*
@@ -97,9 +97,11 @@ int main(int argc, char **argv)
 	}
 
 	/*
-	 * If no files were given, pretend "-" was given (stdin).
+	 * If no files were given, pretend "-" was given (stdin) - unless
+	 * generating data instead, or with --multi, where the arguments
+	 * are pairs of inputs and outputs.
 	 */
-	if (0 == opts->argc) {
+	if ((0 == opts->argc) && (NULL == opts->generate) && (!opts->multi)) {
 		debug("%s", "no files given - adding fake argument `-'");
 		opts->argv[opts->argc++] = "-";
 	}
@@ -109,20 +111,34 @@ int main(int argc, char **argv)
 	 */
 	pv_state_inputfiles(state, opts->argc, (const char **) (opts->argv));
 
+	/*
+	 * The input and output windows affect the calculated size.
+	 */
+	pv_state_skip_input_set(state, opts->skip_input);
+	pv_state_seek_output_set(state, opts->seek_output);
+	pv_state_input_length_set(state, opts->input_length);
+
 	if (0 == opts->watch_pid) {
 		/*
 		 * If no size was given, and we're not in line mode, try to
 		 * calculate the total size.
 		 */
-		if ((0 == opts->size) && (false == opts->linemode)) {
+		if ((0 == opts->size) && (false == opts->linemode) && (NULL == opts->generate) && (!opts->multi)) {
 			opts->size = pv_calc_total_size(state);
 			debug("%s: %llu", "no size given - calculated", opts->size);
 		}
 
 		/*
-		 * If the size is unknown, we cannot have an ETA.
+		 * When generating data, the size says how much to generate.
+		 */
+		if ((opts->size > 0) && (NULL != opts->generate))
+			opts->stop_at_size = true;
+
+		/*
+		 * If the size is unknown, we cannot have an ETA.  With
+		 * --multi, it is worked out once the streams are open.
 		 */
-		if (opts->size < 1) {
+		if ((opts->size < 1) && (!opts->multi)) {
 			opts->eta = false;
 			debug("%s", "size unknown - ETA disabled");
 		}
@@ -193,9 +209,36 @@ int main(int argc, char **argv)
 	pv_state_bits_set(state, opts->bits);
 	pv_state_null_set(state, opts->null);
 	pv_state_skip_errors_set(state, opts->skip_errors);
+	pv_state_error_skip_block_set(state, opts->error_skip_block);
+	pv_state_error_map_set(state, opts->error_map);
+	pv_state_input_block_size_set(state, opts->input_block_size);
+	pv_state_output_block_size_set(state, opts->output_block_size);
+	pv_state_output_block_pad_set(state, opts->output_block_pad);
+	pv_state_preallocate_set(state, opts->preallocate);
+	pv_state_parallel_set(state, opts->parallel);
+	pv_state_outputfiles(state, opts->output_file_count, (const char **) (opts->output_files));
+	pv_state_tee_drop_set(state, opts->tee_drop);
+	pv_state_split_set(state, opts->split);
+	pv_state_merge_set(state, opts->merge);
+	pv_state_hash_set(state, opts->hash);
+	pv_state_hash_per_file_set(state, opts->hash_per_file);
+	pv_state_verify_set(state, opts->verify);
+	pv_state_generate_set(state, opts->generate);
+	pv_state_validate_set(state, opts->validate);
+	pv_state_discard_set(state, opts->discard);
+	pv_state_exec_set(state, opts->exec_command);
+	pv_state_multi_set(state, opts->multi);
+	pv_state_multi_file_set(state, opts->multi_file);
+	pv_state_per_file_set(state, opts->per_file);
+	pv_state_manifest_set(state, opts->manifest);
+	pv_state_manifest_json_set(state, opts->manifest_json);
+	pv_state_checkpoint_set(state, opts->checkpoint);
+	pv_state_resume_set(state, opts->resume);
 	pv_state_stop_at_size_set(state, opts->stop_at_size);
 	pv_state_sync_after_write_set(state, opts->sync_after_write);
 	pv_state_direct_io_set(state, opts->direct_io);
+	pv_state_pipe_size_set(state, opts->pipe_size);
+	pv_state_max_latency_set(state, opts->max_latency);
 	pv_state_rate_limit_set(state, opts->rate_limit);
 	pv_state_target_buffer_size_set(state, opts->buffer_size);
 	pv_state_no_splice_set(state, opts->no_splice);
@@ -281,9 +324,15 @@ int main(int argc, char **argv)
 		}
 	} else {
 		pv_sig_init(state);
-		pv_remote_init();
-		retcode = pv_main_loop(state);
-		pv_remote_fini();
+		pv_remote_init(state);
+		if (opts->calibrate) {
+			retcode = pv_calibrate(state);
+		} else if (opts->error_map_retry) {
+			retcode = pv_error_map_retry(state);
+		} else {
+			retcode = pv_main_loop(state);
+		}
+		pv_remote_fini(state);
 		if (t_needs_reset && pv_in_foreground()) {
 			(void) tcsetattr(STDERR_FILENO, TCSANOW, &t_save);
 		}
@@ -300,6 +349,7 @@ int main(int argc, char **argv)
 	opts_free(opts);
 
 	debug("%s: %d", "exiting with status", retcode);
+	debugging_output_close();
 
 	return retcode;
 }
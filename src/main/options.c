@@ -23,6 +23,41 @@
 void display_help(void);
 void display_version(void);
 
+/*
+ * Values returned by getopt_long() for options with no short equivalent.
+ */
+#define OPTION_CALIBRATE	256
+#define OPTION_PIPE_SIZE	257
+#define OPTION_MAX_LATENCY	258
+#define OPTION_ERROR_MAP	259
+#define OPTION_CHECKPOINT	260
+#define OPTION_RESUME		261
+#define OPTION_SKIP_INPUT	262
+#define OPTION_SEEK_OUTPUT	263
+#define OPTION_INPUT_LENGTH	264
+#define OPTION_PREALLOCATE	265
+#define OPTION_PARALLEL		266
+#define OPTION_TEE		267
+#define OPTION_TEE_DROP		268
+#define OPTION_SPLIT		269
+#define OPTION_MERGE		270
+#define OPTION_INPUT_BLOCK_SIZE	271
+#define OPTION_OUTPUT_BLOCK_SIZE	272
+#define OPTION_OUTPUT_BLOCK_PAD	273
+#define OPTION_HASH		274
+#define OPTION_HASH_PER_FILE	275
+#define OPTION_VERIFY		276
+#define OPTION_GENERATE		277
+#define OPTION_VALIDATE		278
+#define OPTION_DISCARD		279
+#define OPTION_EXEC		280
+#define OPTION_MULTI		281
+#define OPTION_MULTI_FILE	282
+#define OPTION_PER_FILE		283
+#define OPTION_MANIFEST		284
+#define OPTION_MANIFEST_FORMAT	285
+#define OPTION_ERROR_MAP_RETRY	286
+
 
 /*
  * Free an opts_t object.
@@ -33,6 +68,8 @@ void opts_free(opts_t opts)
 		return;
 	if (NULL != opts->argv)
 		free(opts->argv);
+	if (NULL != opts->output_files)
+		free(opts->output_files);
 	free(opts);
 }
 
@@ -81,6 +118,35 @@ opts_t opts_parse(int argc, char **argv)
 		{ "buffer-size", 1, NULL, (int) 'B' },
 		{ "no-splice", 0, NULL, (int) 'C' },
 		{ "skip-errors", 0, NULL, (int) 'E' },
+		{ "error-skip-block", 1, NULL, (int) 'Z' },
+		{ "error-map", 1, NULL, OPTION_ERROR_MAP },
+		{ "error-map-retry", 0, NULL, OPTION_ERROR_MAP_RETRY },
+		{ "skip-input", 1, NULL, OPTION_SKIP_INPUT },
+		{ "seek-output", 1, NULL, OPTION_SEEK_OUTPUT },
+		{ "input-length", 1, NULL, OPTION_INPUT_LENGTH },
+		{ "input-block-size", 1, NULL, OPTION_INPUT_BLOCK_SIZE },
+		{ "output-block-size", 1, NULL, OPTION_OUTPUT_BLOCK_SIZE },
+		{ "output-block-pad", 0, NULL, OPTION_OUTPUT_BLOCK_PAD },
+		{ "preallocate", 0, NULL, OPTION_PREALLOCATE },
+		{ "parallel", 1, NULL, OPTION_PARALLEL },
+		{ "tee", 1, NULL, OPTION_TEE },
+		{ "tee-drop", 0, NULL, OPTION_TEE_DROP },
+		{ "split", 0, NULL, OPTION_SPLIT },
+		{ "merge", 0, NULL, OPTION_MERGE },
+		{ "hash", 1, NULL, OPTION_HASH },
+		{ "hash-per-file", 0, NULL, OPTION_HASH_PER_FILE },
+		{ "verify", 0, NULL, OPTION_VERIFY },
+		{ "generate", 1, NULL, OPTION_GENERATE },
+		{ "validate", 1, NULL, OPTION_VALIDATE },
+		{ "discard", 0, NULL, OPTION_DISCARD },
+		{ "exec", 1, NULL, OPTION_EXEC },
+		{ "multi", 0, NULL, OPTION_MULTI },
+		{ "multi-file", 1, NULL, OPTION_MULTI_FILE },
+		{ "per-file", 0, NULL, OPTION_PER_FILE },
+		{ "manifest", 1, NULL, OPTION_MANIFEST },
+		{ "manifest-format", 1, NULL, OPTION_MANIFEST_FORMAT },
+		{ "checkpoint", 1, NULL, OPTION_CHECKPOINT },
+		{ "resume", 0, NULL, OPTION_RESUME },
 		{ "stop-at-size", 0, NULL, (int) 'S' },
 		{ "sync", 0, NULL, (int) 'Y' },
 		{ "direct-io", 0, NULL, (int) 'K' },
@@ -88,6 +154,9 @@ opts_t opts_parse(int argc, char **argv)
 		{ "pidfile", 1, NULL, (int) 'P' },
 		{ "watchfd", 1, NULL, (int) 'd' },
 		{ "average-rate-window", 1, NULL, (int) 'm' },
+		{ "pipe-size", 1, NULL, OPTION_PIPE_SIZE },
+		{ "calibrate", 0, NULL, OPTION_CALIBRATE },
+		{ "max-latency", 1, NULL, OPTION_MAX_LATENCY },
 #ifdef ENABLE_DEBUGGING
 		{ "debug", 1, NULL, (int) '!' },
 #endif				/* ENABLE_DEBUGGING */
@@ -95,7 +164,7 @@ opts_t opts_parse(int argc, char **argv)
 	};
 	int option_index = 0;
 #endif				/* HAVE_GETOPT_LONG */
-	char *short_options = "hVpteIrab8TA:fnqcWD:s:l0i:w:H:N:F:L:B:CESYKR:P:d:m:"
+	char *short_options = "hVpteIrab8TA:fnqcWD:s:l0i:w:H:N:F:L:B:CEZ:SYKR:P:d:m:"
 #ifdef ENABLE_DEBUGGING
 	    "!:"
 #endif
@@ -157,6 +226,7 @@ opts_t opts_parse(int argc, char **argv)
 		case 'H':
 		case 'L':
 		case 'B':
+		case 'Z':
 		case 'R':
 		case 'm':
 			if (pv_getnum_check(optarg, PV_NUMTYPE_INTEGER) != 0) {
@@ -165,6 +235,60 @@ opts_t opts_parse(int argc, char **argv)
 				return NULL;
 			}
 			break;
+		case OPTION_PIPE_SIZE:
+			if (pv_getnum_check(optarg, PV_NUMTYPE_INTEGER) != 0) {
+				fprintf(stderr, "%s: --%s: %s\n", opts->program_name, "pipe-size",
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case OPTION_PARALLEL:
+			if (pv_getnum_check(optarg, PV_NUMTYPE_INTEGER) != 0) {
+				fprintf(stderr, "%s: --%s: %s\n", opts->program_name, "parallel",
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case OPTION_MANIFEST_FORMAT:
+			if ((0 != strcmp(optarg, "tsv")) && (0 != strcmp(optarg, "json"))) {
+				fprintf(stderr, "%s: --%s: %s\n", opts->program_name, "manifest-format",
+					_("format must be tsv or json"));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case OPTION_SKIP_INPUT:
+		case OPTION_SEEK_OUTPUT:
+		case OPTION_INPUT_LENGTH:
+			if (pv_getnum_check(optarg, PV_NUMTYPE_INTEGER) != 0) {
+				fprintf(stderr, "%s: --%s: %s\n", opts->program_name,
+					(OPTION_SKIP_INPUT == c) ? "skip-input"
+					: ((OPTION_SEEK_OUTPUT == c) ? "seek-output" : "input-length"),
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case OPTION_INPUT_BLOCK_SIZE:
+		case OPTION_OUTPUT_BLOCK_SIZE:
+			if (pv_getnum_check(optarg, PV_NUMTYPE_INTEGER) != 0) {
+				fprintf(stderr, "%s: --%s: %s\n", opts->program_name,
+					OPTION_INPUT_BLOCK_SIZE == c ? "input-block-size" : "output-block-size",
+					_("integer argument expected"));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case OPTION_MAX_LATENCY:
+			if (pv_getnum_check(optarg, PV_NUMTYPE_DOUBLE) != 0) {
+				fprintf(stderr, "%s: --%s: %s\n", opts->program_name, "max-latency",
+					_("numeric argument expected"));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
 		case 'i':
 		case 'D':
 			if (pv_getnum_check(optarg, PV_NUMTYPE_DOUBLE) != 0) {
@@ -321,6 +445,103 @@ opts_t opts_parse(int argc, char **argv)
 		case 'E':
 			opts->skip_errors++;
 			break;
+		case 'Z':
+			opts->error_skip_block = pv_getnum_ull(optarg);
+			break;
+		case OPTION_ERROR_MAP:
+			opts->error_map = optarg;
+			break;
+		case OPTION_ERROR_MAP_RETRY:
+			opts->error_map_retry = true;
+			break;
+		case OPTION_SKIP_INPUT:
+			opts->skip_input = pv_getnum_ull(optarg);
+			break;
+		case OPTION_SEEK_OUTPUT:
+			opts->seek_output = pv_getnum_ull(optarg);
+			break;
+		case OPTION_INPUT_LENGTH:
+			opts->input_length = pv_getnum_ull(optarg);
+			break;
+		case OPTION_INPUT_BLOCK_SIZE:
+			opts->input_block_size = pv_getnum_ull(optarg);
+			break;
+		case OPTION_OUTPUT_BLOCK_SIZE:
+			opts->output_block_size = pv_getnum_ull(optarg);
+			break;
+		case OPTION_OUTPUT_BLOCK_PAD:
+			opts->output_block_pad = true;
+			break;
+		case OPTION_PREALLOCATE:
+			opts->preallocate = true;
+			break;
+		case OPTION_PARALLEL:
+			opts->parallel = pv_getnum_ui(optarg);
+			break;
+		case OPTION_TEE:
+			if (NULL == opts->output_files) {
+				opts->output_files = calloc((size_t) (argc + 1), sizeof(char *));
+				if (NULL == opts->output_files) {
+					fprintf(stderr, "%s: %s: %s\n", opts->program_name,
+						_("option structure argv allocation failed"), strerror(errno));
+					opts_free(opts);
+					return NULL;
+				}
+			}
+			opts->output_files[opts->output_file_count++] = optarg;
+			break;
+		case OPTION_TEE_DROP:
+			opts->tee_drop = true;
+			break;
+		case OPTION_SPLIT:
+			opts->split = true;
+			break;
+		case OPTION_MERGE:
+			opts->merge = true;
+			break;
+		case OPTION_HASH:
+			opts->hash = optarg;
+			break;
+		case OPTION_HASH_PER_FILE:
+			opts->hash_per_file = true;
+			break;
+		case OPTION_VERIFY:
+			opts->verify = true;
+			break;
+		case OPTION_GENERATE:
+			opts->generate = optarg;
+			break;
+		case OPTION_VALIDATE:
+			opts->validate = optarg;
+			break;
+		case OPTION_DISCARD:
+			opts->discard = true;
+			break;
+		case OPTION_EXEC:
+			opts->exec_command = optarg;
+			break;
+		case OPTION_MULTI:
+			opts->multi = true;
+			break;
+		case OPTION_MULTI_FILE:
+			opts->multi = true;
+			opts->multi_file = optarg;
+			break;
+		case OPTION_PER_FILE:
+			opts->per_file = true;
+			break;
+		case OPTION_MANIFEST:
+			opts->manifest = optarg;
+			break;
+		case OPTION_MANIFEST_FORMAT:
+			opts->manifest_json = (0 == strcmp(optarg, "json")) ? true : false;
+			break;
+		case OPTION_CHECKPOINT:
+			opts->checkpoint = optarg;
+			break;
+		case OPTION_RESUME:
+			opts->resume = true;
+			break;
 		case 'S':
 			opts->stop_at_size = true;
 			break;
@@ -348,6 +569,15 @@ opts_t opts_parse(int argc, char **argv)
 		case 'm':
 			opts->average_rate_window = pv_getnum_ui(optarg);
 			break;
+		case OPTION_PIPE_SIZE:
+			opts->pipe_size = pv_getnum_ui(optarg);
+			break;
+		case OPTION_CALIBRATE:
+			opts->calibrate = true;
+			break;
+		case OPTION_MAX_LATENCY:
+			opts->max_latency = pv_getnum_d(optarg);
+			break;
 #ifdef ENABLE_DEBUGGING
 		case '!':
 			debugging_output_destination(optarg);
@@ -376,6 +606,13 @@ opts_t opts_parse(int argc, char **argv)
 			return NULL;
 		}
 
+		if (opts->calibrate) {
+			fprintf(stderr, "%s: %s\n", opts->program_name,
+				_("cannot calibrate when watching file descriptors"));
+			opts_free(opts);
+			return NULL;
+		}
+
 		if (opts->cursor) {
 			fprintf(stderr, "%s: %s\n", opts->program_name,
 				_("cannot use cursor positioning when watching file descriptors"));
@@ -424,6 +661,182 @@ opts_t opts_parse(int argc, char **argv)
 		opts->argv[opts->argc++] = argv[optind++];
 	}
 
+	/*
+	 * Retrying needs a map of what to retry.
+	 */
+	if ((opts->error_map_retry) && (NULL == opts->error_map)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--error-map-retry requires --error-map"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * An error map only describes one input file.
+	 */
+	if ((NULL != opts->error_map) && (opts->argc > 1)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("cannot use an error map with more than one input file"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Splitting needs outputs to split between.
+	 */
+	if ((opts->split) && (0 == opts->output_file_count)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--split needs --tee outputs to split between"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Merging reads the inputs all at once, so there is no one place in
+	 * one input file to record or to start from.
+	 */
+	if ((opts->merge)
+	    && ((NULL != opts->checkpoint) || (NULL != opts->error_map) || (opts->skip_input > 0)
+		|| (opts->input_length > 0))) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("--merge cannot be used with --checkpoint, --error-map, --skip-input, or --input-length"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Fixed size output blocks are written to standard output, not
+	 * handed out to the --split outputs, and padding needs a block size.
+	 */
+	if ((opts->output_block_size > 0) && (opts->split)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--output-block-size cannot be used with --split"));
+		opts_free(opts);
+		return NULL;
+	}
+	if ((opts->output_block_pad) && (0 == opts->output_block_size)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--output-block-pad needs --output-block-size"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Per-file hashes need the input files to be read one at a time.
+	 */
+	if ((opts->hash_per_file) && (NULL == opts->hash)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--hash-per-file needs --hash"));
+		opts_free(opts);
+		return NULL;
+	}
+	if ((opts->hash_per_file) && (opts->merge)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--hash-per-file cannot be used with --merge"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Verification reads back standard output, which with --split only
+	 * receives some of the data.
+	 */
+	if ((opts->verify) && (opts->split)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--verify cannot be used with --split"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Generated data takes the place of the input files, and is written
+	 * straight to standard output without passing through the transfer
+	 * buffer.
+	 */
+	if ((NULL != opts->generate)
+	    && ((opts->argc > 0) || (NULL != opts->checkpoint) || (NULL != opts->error_map) || (opts->skip_input > 0)
+		|| (opts->input_length > 0) || (opts->input_block_size > 0))) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("--generate cannot be used with input files or the options that read them"));
+		opts_free(opts);
+		return NULL;
+	}
+	if ((NULL != opts->generate) && ((opts->linemode) || (opts->output_file_count > 0)
+					 || (opts->output_block_size > 0))) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("--generate cannot be used with --line-mode, --tee, or --output-block-size"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Validation checks the data instead of writing it to standard
+	 * output, so there is nothing there to split, verify, or generate.
+	 */
+	if ((NULL != opts->validate) && ((NULL != opts->generate) || (opts->split) || (opts->verify))) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("--validate cannot be used with --generate, --split, or --verify"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Discarding the data leaves nothing to copy to other outputs,
+	 * verify, or validate instead, and nothing to generate it for.
+	 */
+	if ((opts->discard)
+	    && ((NULL != opts->generate) || (NULL != opts->validate) || (opts->output_file_count > 0)
+		|| (opts->verify))) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("--discard cannot be used with --generate, --validate, --tee, or --verify"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * With --exec, standard output is a pipe to the command, so it can't
+	 * be read back, checkpointed, or done without.
+	 */
+	if ((NULL != opts->exec_command)
+	    && ((opts->discard) || (NULL != opts->validate) || (opts->verify) || (NULL != opts->checkpoint))) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("--exec cannot be used with --discard, --validate, --verify, or --checkpoint"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * With --multi, each stream is a plain copy from its input to its
+	 * output, with nothing else to send the data to or check it with.
+	 */
+	if ((opts->multi)
+	    && ((opts->output_file_count > 0) || (opts->merge) || (NULL != opts->hash) || (opts->verify)
+		|| (NULL != opts->exec_command) || (NULL != opts->generate) || (NULL != opts->validate)
+		|| (opts->discard) || (NULL != opts->checkpoint) || (NULL != opts->error_map)
+		|| (opts->skip_input > 0) || (opts->seek_output > 0) || (opts->input_length > 0)
+		|| (opts->input_block_size > 0) || (opts->output_block_size > 0))) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("--multi cannot be used with --tee, --merge, --hash, --verify, --exec, --generate, "
+			  "--validate, --discard, --checkpoint, --error-map, "
+			  "or the input and output windows or block sizes"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Per-file figures need the input files to be read one at a time,
+	 * and there have to be input files to have figures for.
+	 */
+	if (((opts->per_file) || (NULL != opts->manifest))
+	    && ((opts->merge) || (opts->multi) || (NULL != opts->generate))) {
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("--per-file and --manifest cannot be used with --merge, --multi, or --generate"));
+		opts_free(opts);
+		return NULL;
+	}
+
+	/*
+	 * Resuming needs a checkpoint journal to resume from.
+	 */
+	if ((opts->resume) && (NULL == opts->checkpoint)) {
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("--resume needs --checkpoint"));
+		opts_free(opts);
+		return NULL;
+	}
+
 	return opts;
 }
 
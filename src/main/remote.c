@@ -11,6 +11,7 @@
 #include "pv.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
@@ -21,6 +22,9 @@
 #ifdef HAVE_IPC
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif				/* HAVE_THREADS */
 #endif				/* HAVE_IPC */
 
 
@@ -46,8 +50,48 @@ struct remote_msg {
 	char format[256];
 };
 
+/*
+ * The message queue is shared by every state in the process, since -R
+ * messages are addressed by process ID.  It is opened by the first state
+ * to call pv_remote_init() and removed by the last to call
+ * pv_remote_fini().  The last message received is kept, numbered, so that
+ * each state can apply it once - see remote__fetch().
+ *
+ * Each state between pv_remote_init() and pv_remote_fini() has an entry
+ * in the "remote__users" list, recording the number of the last message it
+ * applied.
+ */
+struct remote_user {
+	pvstate_t state;
+	unsigned long seen;		 /* last message applied */
+	struct remote_user *next;
+};
 
 static int remote__msgid = -1;
+static struct remote_user *remote__users = NULL;
+static struct remote_msg remote__latest;
+static unsigned long remote__sequence = 0;
+#ifdef HAVE_THREADS
+static pthread_mutex_t remote__lock = PTHREAD_MUTEX_INITIALIZER;
+#endif				/* HAVE_THREADS */
+
+
+/*
+ * Return the entry in the "remote__users" list for "state", or NULL if
+ * remote message reception isn't active for it.  The caller must hold
+ * "remote__lock".
+ */
+static struct remote_user *remote__find(pvstate_t state)
+{
+	struct remote_user *user;
+
+	for (user = remote__users; NULL != user; user = user->next) {
+		if (user->state == state)
+			return user;
+	}
+
+	return NULL;
+}
 
 
 /*
@@ -218,32 +262,72 @@ int pv_remote_set(opts_t opts)
 
 
 /*
- * Check for an IPC remote handling message and, if there is one, replace
- * the current process's options with those being passed in.
+ * Fetch any message for this process from the queue into the shared copy,
+ * and then, if "state" hasn't applied the latest message yet, copy it
+ * into "msgbuf" and return true.
  *
- * NB relies on pv_state_set_format() causing the output format to be
- * reparsed.
+ * Messages are addressed to a process, not to any one state, so every
+ * state in the process applies each one.  Whichever state gets here first
+ * takes the message off the queue, and the rest pick it up from the
+ * shared copy on their next check.
+ *
+ * Returns false without looking at the queue if remote message reception
+ * isn't active for "state".
  */
-void pv_remote_check(pvstate_t state)
+static bool remote__fetch(pvstate_t state, struct remote_msg *msgbuf)
 {
-	struct remote_msg msgbuf;
+	struct remote_user *user;
+	bool have_message;
 	ssize_t got;
 
-	if (remote__msgid < 0)
-		return;
+	have_message = false;
 
-	memset(&msgbuf, 0, sizeof(msgbuf));
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&remote__lock);
+#endif				/* HAVE_THREADS */
 
-	got = msgrcv(remote__msgid, &msgbuf, sizeof(msgbuf) - sizeof(long), getpid(), IPC_NOWAIT);
-	if (got < 0) {
-		/*
-		 * If our queue had been deleted, re-create it.
-		 */
-		if (errno != EAGAIN && errno != ENOMSG) {
+	user = remote__find(state);
+
+	if ((NULL != user) && (remote__msgid >= 0)) {
+		memset(msgbuf, 0, sizeof(*msgbuf));
+		got = msgrcv(remote__msgid, msgbuf, sizeof(*msgbuf) - sizeof(long), getpid(), IPC_NOWAIT);
+		if ((got < 0) && (errno != EAGAIN) && (errno != ENOMSG)) {
+			/*
+			 * If our queue had been deleted, re-create it.
+			 */
 			remote__msgid = remote__msgget();
+		} else if (got > 0) {
+			memcpy(&remote__latest, msgbuf, sizeof(remote__latest));
+			remote__sequence++;
 		}
 	}
-	if (got < 1)
+
+	if ((NULL != user) && (user->seen != remote__sequence)) {
+		memcpy(msgbuf, &remote__latest, sizeof(*msgbuf));
+		user->seen = remote__sequence;
+		have_message = true;
+	}
+
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&remote__lock);
+#endif				/* HAVE_THREADS */
+
+	return have_message;
+}
+
+
+/*
+ * Check for an IPC remote handling message and, if there is one, replace
+ * the current process's options with those being passed in.
+ *
+ * NB relies on pv_state_set_format() causing the output format to be
+ * reparsed.
+ */
+void pv_remote_check(pvstate_t state)
+{
+	struct remote_msg msgbuf;
+
+	if (!remote__fetch(state, &msgbuf))
 		return;
 
 	debug("%s", "received remote message");
@@ -276,24 +360,66 @@ void pv_remote_check(pvstate_t state)
 
 
 /*
- * Initialise remote message reception handling.
+ * Initialise remote message reception handling for "state".  The queue is
+ * opened by the first state in the process, and only messages which
+ * arrive from now on are applied to this one.
  */
-void pv_remote_init(void)
+void pv_remote_init(pvstate_t state)
 {
-	remote__msgid = remote__msgget();
+	struct remote_user *user;
+
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&remote__lock);
+#endif				/* HAVE_THREADS */
+
+	if (NULL == remote__find(state)) {
+		user = malloc(sizeof(*user));
+		if (NULL != user) {
+			if (NULL == remote__users)
+				remote__msgid = remote__msgget();
+			user->state = state;
+			user->seen = remote__sequence;
+			user->next = remote__users;
+			remote__users = user;
+		}
+	}
+
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&remote__lock);
+#endif				/* HAVE_THREADS */
 }
 
 
 /*
- * Clean up after remote message reception handling.
+ * Clean up after remote message reception handling for "state", removing
+ * the queue once the last state in the process has finished with it.
  */
-void pv_remote_fini(void)
+void pv_remote_fini(pvstate_t state)
 {
-	if (remote__msgid >= 0) {
-		struct msqid_ds qbuf;
-		memset(&qbuf, 0, sizeof(qbuf));
-		(void) msgctl(remote__msgid, IPC_RMID, &qbuf);
+	struct remote_user **link;
+
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&remote__lock);
+#endif				/* HAVE_THREADS */
+
+	for (link = &remote__users; NULL != *link; link = &((*link)->next)) {
+		struct remote_user *user = *link;
+		if (user->state != state)
+			continue;
+		*link = user->next;
+		free(user);
+		if ((NULL == remote__users) && (remote__msgid >= 0)) {
+			struct msqid_ds qbuf;
+			memset(&qbuf, 0, sizeof(qbuf));
+			(void) msgctl(remote__msgid, IPC_RMID, &qbuf);
+			remote__msgid = -1;
+		}
+		break;
 	}
+
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&remote__lock);
+#endif				/* HAVE_THREADS */
 }
 
 #else				/* !HAVE_IPC */
@@ -301,19 +427,19 @@ void pv_remote_fini(void)
 /*
  * Dummy stubs for remote control when we don't have IPC.
  */
-void pv_remote_init(void)
+void pv_remote_init( __attribute__((unused)) pvstate_t state)
 {
 }
 
-void pv_remote_check(pvstate_t state)
+void pv_remote_check( __attribute__((unused)) pvstate_t state)
 {
 }
 
-void pv_remote_fini(void)
+void pv_remote_fini( __attribute__((unused)) pvstate_t state)
 {
 }
 
-int pv_remote_set(pvstate_t state)
+int pv_remote_set( __attribute__((unused)) opts_t opts)
 {
 	fprintf(stderr, "%s\n", _("IPC not supported on this system"));
 	return 1;
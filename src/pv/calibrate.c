@@ -0,0 +1,641 @@
+/*
+ * Functions for benchmarking transfer settings against the real input and
+ * output, for --calibrate.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+/*
+ * One combination of transfer settings to try, and how it did.
+ */
+struct pvcalsetting_s {
+	unsigned long long buffer_size;	 /* -B value, 0 if splicing */
+	bool splice;			 /* splice() allowed, i.e. no -C */
+	bool direct_io;			 /* -K */
+	bool sync_after_write;		 /* -Y */
+	unsigned int pipe_size;		 /* --pipe-size, 0 to leave alone */
+	bool measured;			 /* set once it has been tried */
+	bool settled;			 /* set if its rate settled */
+	bool failed;			 /* set if the transfer failed */
+	long double rate;		 /* bytes per second achieved */
+};
+
+/*
+ * What we know about the input and output.
+ */
+struct pvcalendpoints_s {
+	bool input_pipe;		 /* input is a pipe */
+	bool output_pipe;		 /* output is a pipe */
+	bool rewind;			 /* both can be rewound between tries */
+	bool can_sync;			 /* syncing the output means something */
+	bool can_direct;		 /* O_DIRECT can be set on either end */
+	int input_pipe_size;		 /* original input pipe size */
+	int output_pipe_size;		 /* original output pipe size */
+	int output_fd;			 /* the output itself */
+};
+
+/*
+ * The values tried for each setting - each list ends with 0.
+ */
+static const unsigned long long pv__calibrate_buffer_sizes[] = { 65536, 262144, 1048576, 4194304, 0 };
+
+static const unsigned int pv__calibrate_pipe_sizes[] = { 262144, 1048576, 0 };
+
+#define PV_CALIBRATE_MAX_SETTINGS	128
+
+
+/*
+ * Return true if the regular file or block device "fd" accepts O_DIRECT,
+ * leaving it switched off again.
+ */
+static bool pv__calibrate_direct_ok(int fd)
+{
+#ifdef O_DIRECT
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return false;
+	if (fcntl(fd, F_SETFL, flags | O_DIRECT) < 0)
+		return false;
+	(void) fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+	return true;
+#else				/* !O_DIRECT */
+	return false;
+#endif				/* O_DIRECT */
+}
+
+
+/*
+ * Work out what can be varied between the input "fd" and the output
+ * "output_fd".
+ */
+static void pv__calibrate_endpoints(int fd, int output_fd, struct pvcalendpoints_s *ends)
+{
+	struct stat isb, osb;
+	bool input_seekable, output_seekable;
+	int flags;
+
+	memset(ends, 0, sizeof(*ends));
+	ends->input_pipe_size = -1;
+	ends->output_pipe_size = -1;
+	ends->output_fd = output_fd;
+
+	if ((0 != fstat(fd, &isb)) || (0 != fstat(output_fd, &osb)))
+		return;
+
+	ends->input_pipe = S_ISFIFO(isb.st_mode) ? true : false;
+	ends->output_pipe = S_ISFIFO(osb.st_mode) ? true : false;
+
+	input_seekable = (S_ISREG(isb.st_mode) || S_ISBLK(isb.st_mode)) ? true : false;
+	output_seekable = (S_ISREG(osb.st_mode) || S_ISBLK(osb.st_mode)) ? true : false;
+
+	/*
+	 * Output opened for appending can't be rewound.
+	 */
+	flags = fcntl(output_fd, F_GETFL);
+	if ((flags >= 0) && (0 != (flags & O_APPEND)))
+		output_seekable = false;
+
+	ends->rewind = (input_seekable && output_seekable) ? true : false;
+	ends->can_sync = output_seekable;
+
+	/*
+	 * Only try O_DIRECT when both ends can be rewound, so that reads
+	 * and writes always start on an aligned offset - and never on a
+	 * pipe, where it means something else entirely.
+	 */
+	if (ends->rewind)
+		ends->can_direct = (pv__calibrate_direct_ok(fd) || pv__calibrate_direct_ok(output_fd)) ? true : false;
+
+#ifdef F_GETPIPE_SZ
+	if (ends->input_pipe)
+		ends->input_pipe_size = fcntl(fd, F_GETPIPE_SZ);
+	if (ends->output_pipe)
+		ends->output_pipe_size = fcntl(output_fd, F_GETPIPE_SZ);
+#endif				/* F_GETPIPE_SZ */
+}
+
+
+/*
+ * Fill in the array "settings" with every combination of settings worth
+ * trying between the given endpoints, returning the number of entries.
+ */
+static int pv__calibrate_matrix(struct pvcalendpoints_s *ends, struct pvcalsetting_s *settings)
+{
+	int count, splice_idx, buffer_idx, direct_idx, pipe_idx, sync_idx;
+	bool can_splice, can_resize_pipes;
+
+	can_splice = false;
+#ifdef HAVE_SPLICE
+	if (ends->input_pipe || ends->output_pipe)
+		can_splice = true;
+#endif				/* HAVE_SPLICE */
+
+	can_resize_pipes = false;
+#ifdef F_SETPIPE_SZ
+	if ((ends->input_pipe_size > 0) || (ends->output_pipe_size > 0))
+		can_resize_pipes = true;
+#endif				/* F_SETPIPE_SZ */
+
+	count = 0;
+
+	/*
+	 * Pipe sizes only ever grow from one setting to the next, since a
+	 * pipe can't be shrunk below what it currently holds.
+	 */
+	for (pipe_idx = -1; pipe_idx < 0 || pv__calibrate_pipe_sizes[pipe_idx] > 0; pipe_idx++) {
+		if ((pipe_idx >= 0) && (!can_resize_pipes))
+			break;
+		for (splice_idx = (can_splice ? 0 : 1); splice_idx < 2; splice_idx++) {
+			for (buffer_idx = 0; pv__calibrate_buffer_sizes[buffer_idx] > 0; buffer_idx++) {
+				/* The buffer size is irrelevant when splicing. */
+				if ((0 == splice_idx) && (buffer_idx > 0))
+					break;
+				for (direct_idx = 0; direct_idx < (ends->can_direct ? 2 : 1); direct_idx++) {
+					for (sync_idx = 0; sync_idx < (ends->can_sync ? 2 : 1); sync_idx++) {
+						struct pvcalsetting_s *setting;
+
+						if (count >= PV_CALIBRATE_MAX_SETTINGS)
+							return count;
+
+						setting = &(settings[count++]);
+						memset(setting, 0, sizeof(*setting));
+						setting->splice = (0 == splice_idx) ? true : false;
+						setting->buffer_size =
+						    setting->splice ? 0 : pv__calibrate_buffer_sizes[buffer_idx];
+						setting->direct_io = (1 == direct_idx) ? true : false;
+						setting->pipe_size = (pipe_idx < 0) ? 0 : pv__calibrate_pipe_sizes[pipe_idx];
+						setting->sync_after_write = (1 == sync_idx) ? true : false;
+					}
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+
+/*
+ * Set the input and output pipes to the given size, or back to their
+ * original sizes if "pipe_size" is 0.  Returns false on failure.
+ */
+static bool pv__calibrate_pipes(int fd, struct pvcalendpoints_s *ends, unsigned int pipe_size)
+{
+#ifdef F_SETPIPE_SZ
+	if (ends->input_pipe_size > 0) {
+		if (fcntl(fd, F_SETPIPE_SZ, pipe_size > 0 ? (int) pipe_size : ends->input_pipe_size) < 0)
+			return false;
+	}
+	if (ends->output_pipe_size > 0) {
+		if (fcntl(ends->output_fd, F_SETPIPE_SZ, pipe_size > 0 ? (int) pipe_size : ends->output_pipe_size) < 0)
+			return false;
+	}
+#endif				/* F_SETPIPE_SZ */
+	return true;
+}
+
+
+/*
+ * Return the number of seconds between "start" and "end".
+ */
+static long double pv__calibrate_elapsed(struct timeval *start, struct timeval *end)
+{
+	return (long double) (end->tv_sec - start->tv_sec)
+	    + (long double) (end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+
+/*
+ * Transfer data from "fd" to standard output using the given settings,
+ * until the rate settles, CALIBRATE_MAX_TIME seconds pass, or the input
+ * runs out, filling in the results in "setting".  Returns the number of
+ * bytes transferred, or -1 if the calibration as a whole should stop.
+ *
+ * Everything read is written before returning, so that the output is
+ * always an exact copy of the start of the input.
+ */
+static long long pv__calibrate_run(pvstate_t state, int fd, struct pvcalsetting_s *setting, bool *input_done)
+{
+	struct timeval start_time, sample_start, now;
+	long double samples[CALIBRATE_SETTLE_SAMPLES];
+	unsigned long long sample_bytes;
+	long long total_bytes;
+	int sample_count;
+	int eof_in, eof_out;
+	pvstate_t trial;
+	long written;
+
+	trial = pv_state_alloc(state->program_name);
+	if (NULL == trial) {
+		pv_error(state, "%s: %s", _("state allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return -1;
+	}
+
+	trial->current_file = state->current_file;
+	trial->silent = true;
+	pv_state_target_buffer_size_set(trial, setting->splice ? BUFFER_SIZE : setting->buffer_size);
+	pv_state_no_splice_set(trial, setting->splice ? false : true);
+	pv_state_direct_io_set(trial, setting->direct_io);
+	pv_state_sync_after_write_set(trial, setting->sync_after_write);
+
+	setting->measured = true;
+
+	eof_in = 0;
+	eof_out = 0;
+	total_bytes = 0;
+	sample_bytes = 0;
+	sample_count = -1;		    /* the first sample is a warm-up */
+
+	gettimeofday(&start_time, NULL);
+	sample_start = start_time;
+
+	while (!(eof_in && eof_out)) {
+		long double sample_elapsed;
+
+		if (pv_sig_aborted(state))
+			break;
+
+		written = pv_transfer(trial, fd, &eof_in, &eof_out, 0, NULL);
+		if (written < 0) {
+			setting->failed = true;
+			break;
+		}
+
+		total_bytes += written;
+		sample_bytes += written;
+
+		gettimeofday(&now, NULL);
+
+		if (pv__calibrate_elapsed(&start_time, &now) >= CALIBRATE_MAX_TIME)
+			break;
+
+		sample_elapsed = pv__calibrate_elapsed(&sample_start, &now);
+		if (sample_elapsed < (long double) CALIBRATE_SAMPLE_TIME / 1000000.0)
+			continue;
+
+		if (sample_count >= 0) {
+			long double lowest, highest;
+			int idx;
+
+			samples[sample_count % CALIBRATE_SETTLE_SAMPLES] = (long double) sample_bytes / sample_elapsed;
+
+			/*
+			 * The rate has settled once the last few samples
+			 * are all close together.
+			 */
+			lowest = samples[0];
+			highest = samples[0];
+			for (idx = 1; (idx < CALIBRATE_SETTLE_SAMPLES) && (idx <= sample_count); idx++) {
+				if (samples[idx] < lowest)
+					lowest = samples[idx];
+				if (samples[idx] > highest)
+					highest = samples[idx];
+			}
+			if ((sample_count + 1 >= CALIBRATE_SETTLE_SAMPLES) && (highest > 0)
+			    && (highest - lowest <= highest * CALIBRATE_SETTLE_MARGIN)) {
+				setting->settled = true;
+				break;
+			}
+		}
+
+		sample_count++;
+		sample_bytes = 0;
+		sample_start = now;
+	}
+
+	if (eof_in && eof_out)
+		*input_done = true;
+
+	/*
+	 * Write out anything still in the buffer, by pretending the input
+	 * has ended.
+	 */
+	if ((!setting->failed) && (!eof_out)) {
+		eof_in = 1;
+		while ((!eof_out) && (trial->read_position > trial->write_position)) {
+			written = pv_transfer(trial, fd, &eof_in, &eof_out, 0, NULL);
+			if (written < 0) {
+				setting->failed = true;
+				break;
+			}
+			total_bytes += written;
+		}
+	}
+
+	/*
+	 * Include the time taken to get the data to disk, so that settings
+	 * which leave it all in the cache don't look better than they are.
+	 */
+	if (!setting->failed)
+		(void) fdatasync(state->output_fd);
+
+	gettimeofday(&now, NULL);
+
+	if (pv__calibrate_elapsed(&start_time, &now) > 0)
+		setting->rate = (long double) total_bytes / pv__calibrate_elapsed(&start_time, &now);
+
+	debug("%s: %llu/%d/%d/%d/%u: %lld %s, %Lf %s%s", "calibration", setting->buffer_size,
+	      setting->splice ? 1 : 0, setting->direct_io ? 1 : 0, setting->sync_after_write ? 1 : 0,
+	      setting->pipe_size, total_bytes, "bytes", setting->rate, "bytes/sec",
+	      setting->settled ? " (settled)" : "");
+
+	pv_state_free(trial);
+
+#ifdef O_DIRECT
+	if (setting->direct_io) {
+		(void) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+		(void) fcntl(state->output_fd, F_SETFL, fcntl(state->output_fd, F_GETFL) & ~O_DIRECT);
+	}
+#endif				/* O_DIRECT */
+
+	if (pv_sig_aborted(state))
+		return -1;
+
+	return total_bytes;
+}
+
+
+/*
+ * Put a human readable version of "amount" into "buffer", with the given
+ * suffix, e.g. "12.3 MiB/s".
+ */
+static void pv__calibrate_describe(char *buffer, size_t bufsize, long double amount, const char *suffix)
+{
+	const char *prefixes[] = { "", "Ki", "Mi", "Gi", "Ti", "Pi", NULL };
+	int idx;
+
+	for (idx = 0; (amount >= 1024.0) && (NULL != prefixes[idx + 1]); idx++)
+		amount /= 1024.0;
+
+	(void) pv_snprintf(buffer, bufsize, "%.1Lf %s%s", amount, prefixes[idx], suffix);
+}
+
+
+/*
+ * Put "size" into "buffer" in the form the command line options take,
+ * using a K or M suffix where possible.
+ */
+static void pv__calibrate_optsize(char *buffer, size_t bufsize, unsigned long long size)
+{
+	if ((size >= 1048576) && (0 == size % 1048576)) {
+		(void) pv_snprintf(buffer, bufsize, "%lluM", size / 1048576);
+	} else if ((size >= 1024) && (0 == size % 1024)) {
+		(void) pv_snprintf(buffer, bufsize, "%lluK", size / 1024);
+	} else {
+		(void) pv_snprintf(buffer, bufsize, "%llu", size);
+	}
+}
+
+
+/*
+ * Comparison function for sorting settings fastest first, with any that
+ * failed or were never tried at the end.
+ */
+static int pv__calibrate_compare(const void *a, const void *b)
+{
+	const struct pvcalsetting_s *first = a;
+	const struct pvcalsetting_s *second = b;
+	bool first_ok, second_ok;
+
+	first_ok = (first->measured && !first->failed) ? true : false;
+	second_ok = (second->measured && !second->failed) ? true : false;
+
+	if (first_ok != second_ok)
+		return first_ok ? -1 : 1;
+	if (first->rate > second->rate)
+		return -1;
+	if (first->rate < second->rate)
+		return 1;
+	return 0;
+}
+
+
+/*
+ * Output the ranked table of results to standard error, followed by the
+ * options which would give the best one.
+ */
+static void pv__calibrate_report(pvstate_t state, struct pvcalsetting_s *settings, int count)
+{
+	char options[256];		 /* flawfinder: ignore */
+	char amount[64];		 /* flawfinder: ignore */
+	bool any_unsettled, any_settled;
+	int idx, rank;
+
+	/*
+	 * flawfinder: the buffers are only written with pv_snprintf() and
+	 * pv_strlcat(), which are bounded and always terminate.
+	 */
+
+	qsort(settings, count, sizeof(settings[0]), pv__calibrate_compare);
+
+	fprintf(stderr, "%s: %s\n", state->program_name, _("calibration results, fastest first:"));
+	fprintf(stderr, "%4s  %14s  %8s  %6s  %6s  %9s  %4s\n", "#", _("rate"), _("buffer"), _("splice"),
+		_("direct"), _("pipe size"), _("sync"));
+
+	any_unsettled = false;
+	any_settled = false;
+	rank = 0;
+
+	for (idx = 0; idx < count; idx++) {
+		struct pvcalsetting_s *setting = &(settings[idx]);
+		char rate_string[64];	 /* flawfinder: ignore */
+		char buffer_string[32];	 /* flawfinder: ignore */
+		char pipe_string[32];	 /* flawfinder: ignore */
+
+		if (!setting->measured)
+			continue;
+
+		if (setting->failed) {
+			(void) pv_snprintf(rate_string, sizeof(rate_string), "%s", _("failed"));
+		} else {
+			pv__calibrate_describe(rate_string, sizeof(rate_string), setting->rate, "B/s");
+			if (!setting->settled) {
+				pv_strlcat(rate_string, "*", sizeof(rate_string));
+				any_unsettled = true;
+			} else {
+				any_settled = true;
+			}
+		}
+
+		if (setting->splice) {
+			(void) pv_snprintf(buffer_string, sizeof(buffer_string), "%s", "-");
+		} else {
+			pv__calibrate_optsize(buffer_string, sizeof(buffer_string), setting->buffer_size);
+		}
+
+		if (0 == setting->pipe_size) {
+			(void) pv_snprintf(pipe_string, sizeof(pipe_string), "%s", "-");
+		} else {
+			pv__calibrate_optsize(pipe_string, sizeof(pipe_string), setting->pipe_size);
+		}
+
+		rank++;
+		fprintf(stderr, "%4d  %14s  %8s  %6s  %6s  %9s  %4s\n", rank, rate_string, buffer_string,
+			setting->splice ? _("yes") : _("no"), setting->direct_io ? _("yes") : _("no"),
+			pipe_string, setting->sync_after_write ? _("yes") : _("no"));
+	}
+
+	if (any_unsettled) {
+		fprintf(stderr, "%s\n",
+			_("* the rate had not settled when the time limit or the end of the input was reached"));
+	}
+
+	if ((count < 1) || (!settings[0].measured) || (settings[0].failed)) {
+		pv_error(state, "%s", _("no settings could be calibrated"));
+		state->exit_status |= 16;
+		return;
+	}
+
+	/*
+	 * Build the command line options for the best settings.  A buffer
+	 * size implies -C, so only one or the other is needed.
+	 */
+	(void) pv_snprintf(options, sizeof(options), "%s", PROGRAM_NAME);
+	if (!settings[0].splice) {
+		pv__calibrate_optsize(amount, sizeof(amount), settings[0].buffer_size);
+		pv_strlcat(options, " -B ", sizeof(options));
+		pv_strlcat(options, amount, sizeof(options));
+	}
+	if (settings[0].direct_io)
+		pv_strlcat(options, " -K", sizeof(options));
+	if (settings[0].sync_after_write)
+		pv_strlcat(options, " -Y", sizeof(options));
+	if (settings[0].pipe_size > 0) {
+		pv__calibrate_optsize(amount, sizeof(amount), settings[0].pipe_size);
+		pv_strlcat(options, " --pipe-size ", sizeof(options));
+		pv_strlcat(options, amount, sizeof(options));
+	}
+
+	/*
+	 * If no rate settled, the ranking is down to the noise of a short
+	 * run, so say so rather than let the options look definitive.
+	 */
+	if (!any_settled) {
+		fprintf(stderr, "%s\n",
+			_("the input was too short for any rate to settle, so these options are only a guess"));
+	}
+
+	fprintf(stderr, "%s: %s\n", _("best options"), options);
+}
+
+
+/*
+ * Try every worthwhile combination of buffer size, splice(), direct I/O,
+ * pipe size, and syncing on the first input file and the output, and
+ * report them ranked by speed along with the options for the fastest.
+ *
+ * If both the input and the output can be rewound, each combination
+ * starts again from where the input and output started (after any
+ * --seek-output), so the output ends up holding a copy of as much of the
+ * start of the input as any one try got through, and the input is dropped
+ * from the cache between tries.  Otherwise each try
+ * carries on from where the last one stopped, until the input runs out.
+ *
+ * Returns nonzero on error.
+ */
+int pv_calibrate(pvstate_t state)
+{
+	struct pvcalsetting_s settings[PV_CALIBRATE_MAX_SETTINGS];
+	struct pvcalendpoints_s ends;
+	long long total_bytes;
+	off_t input_start, output_start;
+	bool input_done, show_progress;
+	int fd, count, idx;
+
+	if (NULL == state)
+		return 1;
+
+	fd = pv_next_file(state, 0, -1);
+	if (fd < 0)
+		return state->exit_status;
+
+	pv__calibrate_endpoints(fd, state->output_fd, &ends);
+	count = pv__calibrate_matrix(&ends, settings);
+
+	debug("%s: %d %s, %s", "calibration", count, "settings", ends.rewind ? "rewinding" : "sequential");
+
+	input_start = lseek(fd, 0, SEEK_CUR);
+	output_start = lseek(state->output_fd, 0, SEEK_CUR);
+	if (output_start >= 0)
+		output_start += (off_t) (state->seek_output);
+	total_bytes = 0;
+	input_done = false;
+	show_progress = (isatty(STDERR_FILENO) && !state->no_op) ? true : false;
+
+	for (idx = 0; idx < count && !input_done; idx++) {
+		long long transferred;
+
+		if (show_progress)
+			fprintf(stderr, "\r%s %d/%d ", _("calibrating"), idx + 1, count);
+
+		if (!pv__calibrate_pipes(fd, &ends, settings[idx].pipe_size)) {
+			debug("%s: %u: %s", "pipe size", settings[idx].pipe_size, strerror(errno));
+			settings[idx].measured = true;
+			settings[idx].failed = true;
+			continue;
+		}
+
+		if (ends.rewind) {
+			(void) lseek(fd, input_start, SEEK_SET);
+			(void) lseek(state->output_fd, output_start, SEEK_SET);
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+			(void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+		}
+
+		transferred = pv__calibrate_run(state, fd, &(settings[idx]), &input_done);
+		if (transferred < 0)
+			break;
+
+		total_bytes += transferred;
+
+		/*
+		 * The mmap() engine doesn't move the file offset, so put it
+		 * where the next try should start.
+		 */
+		if ((!ends.rewind) && (input_start >= 0))
+			(void) lseek(fd, input_start + total_bytes, SEEK_SET);
+
+		if (ends.rewind)
+			input_done = false;
+	}
+
+	if (show_progress)
+		fprintf(stderr, "\r%*s\r", 30, "");
+
+	if ((!ends.rewind) && (idx < count)) {
+		fprintf(stderr, "%s: %s\n", state->program_name,
+			_("input ended before all settings could be tried"));
+	}
+
+	(void) pv__calibrate_pipes(fd, &ends, 0);
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	if (!pv_sig_aborted(state))
+		pv__calibrate_report(state, settings, count);
+
+	return state->exit_status;
+}
+
+/* EOF */
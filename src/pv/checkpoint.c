@@ -0,0 +1,363 @@
+/*
+ * Functions for keeping a checkpoint journal of how far a transfer has
+ * safely got, and for resuming an interrupted transfer from it.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+/*
+ * Calculate the Adler-32 rolling checksum of the "window" bytes of "fd"
+ * ending at offset "end", putting it in "sum".  Returns false if they
+ * could not all be read, such as when "fd" has O_DIRECT set or was opened
+ * for writing only.
+ */
+static bool pv__checkpoint_sum(int fd, off_t end, off_t window, unsigned long *sum)
+{
+	unsigned char buffer[4096];	 /* flawfinder: ignore */
+	unsigned long a, b;
+	off_t offset;
+
+	/*
+	 * flawfinder: buffer is only filled by pread(), bounded by its
+	 * size.
+	 */
+
+	a = 1;
+	b = 0;
+	offset = end - window;
+
+	while (offset < end) {
+		ssize_t nread;
+		size_t want;
+		ssize_t idx;
+
+		want = sizeof(buffer);
+		if ((off_t) want > end - offset)
+			want = (size_t) (end - offset);
+
+		nread = pread(fd, buffer, want, offset);
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread <= 0)
+			return false;
+
+		for (idx = 0; idx < nread; idx++) {
+			a = (a + buffer[idx]) % 65521;
+			b = (b + a) % 65521;
+		}
+
+		offset += nread;
+	}
+
+	*sum = (b << 16) | a;
+	return true;
+}
+
+
+/*
+ * Record in the --checkpoint journal that everything before "done" bytes
+ * (or lines) of the transfer, reading input file number "filenum" on "fd",
+ * has reached the disk, after first making sure that it has.
+ *
+ * The input offset is that of the first byte not yet written out, and the
+ * output offset is that of the output's file position; both sides must be
+ * seekable, otherwise the journal is given up on with an error.  The
+ * checksum of the last CHECKPOINT_WINDOW bytes of input before the
+ * offset is recorded too, so that a resumed transfer can tell if it is
+ * being given different data.
+ */
+void pv_checkpoint_save(pvstate_t state, int fd, int filenum, long long done)
+{
+	char tmpname[PV_SIZEOF_CHECKPOINT_NAME];	 /* flawfinder: ignore */
+	off_t input_offset, output_offset, input_size, window;
+	unsigned long sum;
+	struct stat sb;
+	FILE *fptr;
+
+	/*
+	 * flawfinder: tmpname is only written with pv_snprintf(), which is
+	 * bounded and always terminates.
+	 */
+
+	if ((NULL == state) || (NULL == state->checkpoint) || (fd < 0))
+		return;
+
+	input_offset = pv_transfer_input_offset(state, fd);
+	output_offset = pv_transfer_output_offset(state);
+	input_size = -1;
+	if ((0 == fstat(fd, &sb)) && (S_ISREG(sb.st_mode)))
+		input_size = sb.st_size;
+
+	if ((input_offset < 0) || (output_offset < 0)) {
+		pv_error(state, "%s: %s", state->checkpoint, _("checkpoints need a seekable input and output"));
+		state->exit_status |= 2;
+		state->checkpoint = NULL;
+		return;
+	}
+
+	/*
+	 * Only record what the output device says it has stored.
+	 */
+#ifdef HAVE_FDATASYNC
+	if ((fdatasync(state->output_fd) < 0) && (EIO == errno)) {
+		pv_error(state, "%s: %s", _("failed to sync output"), strerror(errno));
+		state->exit_status |= 16;
+		return;
+	}
+#else				/* !HAVE_FDATASYNC */
+	if ((fsync(state->output_fd) < 0) && (EIO == errno)) {
+		pv_error(state, "%s: %s", _("failed to sync output"), strerror(errno));
+		state->exit_status |= 16;
+		return;
+	}
+#endif				/* HAVE_FDATASYNC */
+
+	window = input_offset < CHECKPOINT_WINDOW ? input_offset : CHECKPOINT_WINDOW;
+	sum = 1;
+	if (!pv__checkpoint_sum(fd, input_offset, window, &sum)) {
+		window = 0;
+		sum = 1;
+	}
+
+	(void) pv_snprintf(tmpname, sizeof(tmpname), "%s.tmp", state->checkpoint);
+
+	fptr = fopen(tmpname, "w");	/* flawfinder: ignore */
+	if (NULL == fptr) {
+		pv_error(state, "%s: %s", tmpname, strerror(errno));
+		state->exit_status |= 2;
+		return;
+	}
+
+	fprintf(fptr, "%s\n", PV_CHECKPOINT_HEADER);
+	fprintf(fptr, "# input: %s\n", state->input_files[filenum]);
+	fprintf(fptr, "# size: %lld\n", (long long) input_size);
+	fprintf(fptr, "# file input_offset output_offset done window adler32\n");
+	fprintf(fptr, "%d %lld %lld %lld %lld %08lx\n", filenum, (long long) input_offset, (long long) output_offset,
+		done, (long long) window, sum);
+
+	if ((0 != fflush(fptr)) || (0 != fsync(fileno(fptr))) || (0 != ferror(fptr)) || (0 != fclose(fptr))) {
+		pv_error(state, "%s: %s", tmpname, strerror(errno));
+		state->exit_status |= 2;
+		(void) unlink(tmpname);
+		return;
+	}
+
+	if (0 != rename(tmpname, state->checkpoint)) {
+		pv_error(state, "%s: %s", state->checkpoint, strerror(errno));
+		state->exit_status |= 2;
+		(void) unlink(tmpname);
+		return;
+	}
+
+	debug("%s: %d %lld %lld %lld", "checkpoint", filenum, (long long) input_offset, (long long) output_offset,
+	      done);
+}
+
+
+/*
+ * Read the --checkpoint journal to find out where to resume from, checking
+ * that it names one of the current input files.  Returns false on error.
+ */
+bool pv_checkpoint_load(pvstate_t state)
+{
+	char line[PV_SIZEOF_CHECKPOINT_NAME + 32];	 /* flawfinder: ignore */
+	char *input_name;
+	bool header_seen, entry_seen;
+	long long input_size;
+	FILE *fptr;
+
+	/*
+	 * flawfinder: fgets() is bounded by sizeof(line) and always
+	 * terminates.
+	 */
+
+	fptr = fopen(state->checkpoint, "r");	/* flawfinder: ignore */
+	if (NULL == fptr) {
+		pv_error(state, "%s: %s", state->checkpoint, strerror(errno));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	input_name = NULL;
+	input_size = -1;
+	header_seen = false;
+	entry_seen = false;
+
+	while (NULL != fgets(line, sizeof(line), fptr)) {
+		long long input_offset, output_offset, done, window;
+		unsigned long sum;
+		int filenum;
+
+		if (!header_seen) {
+			if (0 != strncmp(line, PV_CHECKPOINT_HEADER, strlen(PV_CHECKPOINT_HEADER)))
+				break;
+			header_seen = true;
+			continue;
+		}
+
+		if (0 == strncmp(line, "# input: ", 9)) {
+			line[strcspn(line, "\n")] = '\0';
+			if (NULL != input_name)
+				free(input_name);
+			input_name = strdup(line + 9);
+			continue;
+		}
+
+		if (1 == sscanf(line, "# size: %lld", &input_size))
+			continue;
+
+		if ('#' == line[0])
+			continue;
+
+		if (6 != sscanf(line, "%d %lld %lld %lld %lld %lx", &filenum, &input_offset, &output_offset, &done,
+				&window, &sum))
+			continue;
+
+		if ((filenum < 0) || (input_offset < 0) || (output_offset < 0) || (done < 0) || (window < 0)
+		    || (window > input_offset))
+			continue;
+
+		state->resume_file = filenum;
+		state->resume_input_offset = (off_t) input_offset;
+		state->resume_output_offset = (off_t) output_offset;
+		state->resume_done = done;
+		state->resume_input_size = (off_t) input_size;
+		state->resume_window = (off_t) window;
+		state->resume_sum = sum;
+		entry_seen = true;
+	}
+
+	fclose(fptr);
+
+	if ((!header_seen) || (!entry_seen)) {
+		pv_error(state, "%s: %s", state->checkpoint, _("not a checkpoint journal"));
+		state->exit_status |= 2;
+		if (NULL != input_name)
+			free(input_name);
+		return false;
+	}
+
+	if ((state->resume_file >= state->input_file_count)
+	    || ((NULL != input_name) && (0 != strcmp(input_name, state->input_files[state->resume_file])))) {
+		pv_error(state, "%s: %s", state->checkpoint, _("checkpoint is for a different input file"));
+		state->exit_status |= 2;
+		if (NULL != input_name)
+			free(input_name);
+		return false;
+	}
+
+	if (NULL != input_name)
+		free(input_name);
+
+	state->resume_pending = true;
+
+	debug("%s: %d %lld %lld %lld", "resuming from checkpoint", state->resume_file,
+	      (long long) (state->resume_input_offset), (long long) (state->resume_output_offset), state->resume_done);
+
+	return true;
+}
+
+
+/*
+ * If the transfer is being resumed and "fd" is the input file number
+ * "filenum" that the checkpoint was taken in, check that it still looks
+ * the same, and seek it to where the checkpoint left off.  Returns false
+ * on error.
+ */
+bool pv_checkpoint_resume_input(pvstate_t state, int fd, int filenum)
+{
+	unsigned long sum;
+	struct stat sb;
+
+	if ((!state->resume_pending) || (filenum != state->resume_file))
+		return true;
+
+	state->resume_pending = false;
+
+	if ((state->resume_input_size >= 0) && (0 == fstat(fd, &sb)) && (S_ISREG(sb.st_mode))
+	    && (sb.st_size != state->resume_input_size)) {
+		pv_error(state, "%s: %s", state->current_file, _("input has changed size since the checkpoint"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	if ((state->resume_window > 0)
+	    && pv__checkpoint_sum(fd, state->resume_input_offset, state->resume_window, &sum)
+	    && (sum != state->resume_sum)) {
+		pv_error(state, "%s: %s", state->current_file, _("input does not match the checkpoint"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	if (lseek(fd, state->resume_input_offset, SEEK_SET) != state->resume_input_offset) {
+		pv_error(state, "%s: %s: %s", state->current_file, _("failed to seek to checkpoint"), strerror(errno));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * When resuming, seek the output to where the checkpoint left off,
+ * checking that it already holds everything before that point and, if it
+ * can be read back, that its last few bytes match what was read from the
+ * input.  The output must not be truncated or appended to, so it should
+ * be opened with "1<>FILE" in the shell.  Returns false on error.
+ */
+bool pv_checkpoint_resume_output(pvstate_t state)
+{
+	unsigned long sum;
+	struct stat sb;
+	int flags;
+
+	if (!state->resume)
+		return true;
+
+	flags = fcntl(state->output_fd, F_GETFL);
+	if ((flags >= 0) && (0 != (flags & O_APPEND))) {
+		pv_error(state, "%s: %s", "(stdout)", _("cannot resume output opened for appending"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	if ((0 == fstat(state->output_fd, &sb)) && (S_ISREG(sb.st_mode)) && (sb.st_size < state->resume_output_offset)) {
+		pv_error(state, "%s: %s", "(stdout)", _("output is shorter than the checkpoint"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	if ((state->resume_window > 0) && (state->resume_output_offset >= state->resume_window)
+	    && pv__checkpoint_sum(state->output_fd, state->resume_output_offset, state->resume_window, &sum)
+	    && (sum != state->resume_sum)) {
+		pv_error(state, "%s: %s", "(stdout)", _("output does not match the checkpoint"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	if (lseek(state->output_fd, state->resume_output_offset, SEEK_SET) != state->resume_output_offset) {
+		pv_error(state, "%s: %s: %s", "(stdout)", _("failed to seek to checkpoint"), strerror(errno));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	return true;
+}
+
+/* EOF */
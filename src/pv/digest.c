@@ -0,0 +1,1451 @@
+/*
+ * Functions for hashing the data as it passes through with --hash, on a
+ * helper thread fed through a private pipe, so that the main loop only has
+ * to copy the data into the pipe, or with splice(), duplicate it there with
+ * tee().  The same thread keeps the block hashes for --verify.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#ifdef HAVE_DIGEST
+#include <stdint.h>
+#include <pthread.h>
+#endif				/* HAVE_DIGEST */
+
+#ifdef HAVE_DIGEST
+
+#if defined(HAVE_CPUID_H) && defined(__GNUC__) && defined(__x86_64__)
+#define PV_DIGEST_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif				/* HAVE_CPUID_H && __GNUC__ && __x86_64__ */
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif				/* __ARM_FEATURE_CRC32 */
+
+#define PV_DIGEST_CRC32C	0
+#define PV_DIGEST_XXH3		1
+#define PV_DIGEST_SHA256	2
+#define PV_DIGEST_COUNT		3
+
+#define DIGEST_READ_SIZE	131072	 /* most the helper reads at once */
+#define DIGEST_PIPE_SIZE	1048576	 /* size to make the pipe, if we can */
+
+/*
+ * Names accepted by --hash, and the tags shown with the results, which
+ * are those used by "sha256sum --tag" and "xxhsum --tag".
+ */
+static const char *pv__digest_names[PV_DIGEST_COUNT] = { "crc32c", "xxh3", "sha256" };
+static const char *pv__digest_tags[PV_DIGEST_COUNT] = { "CRC32C", "XXH3", "SHA256" };
+
+/*
+ * Running state of XXH3 (64 bit, seed 0).  Nothing is hashed until there
+ * are more than 256 bytes, since short inputs are hashed differently; after
+ * that, whole 64 byte stripes are consumed as long as there is more data
+ * after them, and "last_stripe" keeps a copy of the last one consumed, in
+ * case it is needed for the final stripe.
+ */
+struct pvxxh3_s {
+	uint64_t acc[8];		 /* accumulators */
+	unsigned char buffer[256];	 /* data not yet consumed */
+	unsigned char last_stripe[64];	 /* last stripe consumed */
+	size_t buffer_fill;		 /* bytes in "buffer" */
+	size_t stripes;			 /* stripes consumed in this block */
+	unsigned long long total;	 /* bytes seen so far */
+};
+
+/*
+ * Running state of SHA-256.
+ */
+struct pvsha256_s {
+	uint32_t h[8];			 /* intermediate hash value */
+	unsigned char block[64];	 /* partial block */
+	size_t block_fill;		 /* bytes in "block" */
+	unsigned long long total;	 /* bytes seen so far */
+};
+
+/*
+ * One set of running hashes, for the whole output or for one input file.
+ */
+struct pvdigestctx_s {
+	uint32_t crc32c;
+	struct pvxxh3_s xxh3;
+	struct pvsha256_s sha256;
+};
+
+/*
+ * State of the hashing helper thread.  The main thread writes, or tee()s,
+ * everything into "pipe_fds", counting it in "fed"; the helper reads it
+ * back out, hashes it, and counts it in "hashed" under "mutex", signalling
+ * "cond" so that the main thread can wait for it to catch up.
+ *
+ * "untaken" is the number of bytes which have been duplicated into the
+ * pipe with tee() but not yet spliced to the output, as in the line
+ * counting side channel in transfer.c.
+ *
+ * With --verify, the helper also hashes each "block_size" block of the
+ * output into "block_hashes"; then, once it is switched to "verifying",
+ * it hashes what is read back in the same way and compares each block
+ * with the one recorded for it.
+ */
+struct pvdigest_s {
+	bool enabled[PV_DIGEST_COUNT];	 /* which hashes to calculate */
+	bool per_file;			 /* also hash each input file */
+	bool hw_crc32c;			 /* use the CPU's CRC32C instruction */
+	bool hw_sha256;			 /* use the CPU's SHA-256 instructions */
+	uint32_t crc_table[8][256];	 /* tables for software CRC32C */
+	int pipe_fds[2];		 /* pipe from main thread to helper */
+	bool running;			 /* set while the helper thread exists */
+	pthread_t thread;		 /* the helper thread */
+	pthread_mutex_t mutex;		 /* lock protecting "hashed" */
+	pthread_cond_t cond;		 /* signalled when "hashed" changes */
+	unsigned long long fed;		 /* bytes passed to the helper */
+	unsigned long long hashed;	 /* bytes the helper has hashed */
+	size_t untaken;			 /* bytes teed but not yet spliced */
+	struct pvdigestctx_s whole;	 /* hashes of everything */
+	struct pvdigestctx_s file;	 /* hashes of the current input file */
+	size_t block_size;		 /* --verify block size (0=none) */
+	bool verifying;			 /* checking blocks, not recording them */
+	bool block_alloc_failed;	 /* set if "block_hashes" couldn't grow */
+	struct pvxxh3_s block;		 /* hash of the current block */
+	size_t block_fill;		 /* bytes in the current block so far */
+	unsigned long long recorded;	 /* bytes recorded in block hashes */
+	uint64_t *block_hashes;		 /* hash of each block written */
+	size_t block_count;		 /* number of blocks recorded */
+	size_t block_alloc;		 /* blocks allocated in "block_hashes" */
+	size_t block_checked;		 /* blocks checked when verifying */
+	unsigned long long bad_blocks;	 /* blocks which did not match */
+	long long first_bad;		 /* index of the first bad block, or -1 */
+	char *report;			 /* result lines to show at the end */
+	size_t report_length;		 /* length of "report" */
+};
+
+
+/*
+ * Read a little-endian 32 or 64 bit value from "ptr", which need not be
+ * aligned.
+ */
+static uint32_t pv__digest_le32(const unsigned char *ptr)
+{
+	return (uint32_t) ptr[0] | ((uint32_t) ptr[1] << 8) | ((uint32_t) ptr[2] << 16) | ((uint32_t) ptr[3] << 24);
+}
+
+static uint64_t pv__digest_le64(const unsigned char *ptr)
+{
+	return (uint64_t) pv__digest_le32(ptr) | ((uint64_t) pv__digest_le32(ptr + 4) << 32);
+}
+
+
+/*
+ * ------------------------------------------------------------------------
+ * CRC32C (Castagnoli), as used by iSCSI, ext4, and many storage systems.
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * Fill in the tables for slicing-by-8 software CRC32C.
+ */
+static void pv__crc32c_init(uint32_t table[8][256])
+{
+	uint32_t crc;
+	int idx, bit, slice;
+
+	for (idx = 0; idx < 256; idx++) {
+		crc = (uint32_t) idx;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+		table[0][idx] = crc;
+	}
+
+	for (idx = 0; idx < 256; idx++) {
+		crc = table[0][idx];
+		for (slice = 1; slice < 8; slice++) {
+			crc = table[0][crc & 0xff] ^ (crc >> 8);
+			table[slice][idx] = crc;
+		}
+	}
+}
+
+
+/*
+ * Update the (pre-inverted) CRC32C "crc" with "count" bytes from "buf" in
+ * software, eight bytes at a time.
+ */
+static uint32_t pv__crc32c_sw(uint32_t table[8][256], uint32_t crc, const unsigned char *buf, size_t count)
+{
+	while (count >= 8) {
+		uint32_t low, high;
+		low = pv__digest_le32(buf) ^ crc;
+		high = pv__digest_le32(buf + 4);
+		crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff]
+		    ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+		    ^ table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff]
+		    ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+		buf += 8;
+		count -= 8;
+	}
+	while (count-- > 0)
+		crc = table[0][(crc ^ *(buf++)) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+
+#ifdef PV_DIGEST_X86
+/*
+ * Update the CRC32C "crc" using the SSE 4.2 CRC32 instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t pv__crc32c_x86(uint32_t crc, const unsigned char *buf, size_t count)
+{
+	uint64_t crc64 = crc;
+
+	while (count >= 8) {
+		uint64_t value;
+		memcpy(&value, buf, 8);
+		crc64 = _mm_crc32_u64(crc64, value);
+		buf += 8;
+		count -= 8;
+	}
+	crc = (uint32_t) crc64;
+	while (count-- > 0)
+		crc = _mm_crc32_u8(crc, *(buf++));
+	return crc;
+}
+#endif				/* PV_DIGEST_X86 */
+
+
+#if defined(__ARM_FEATURE_CRC32)
+/*
+ * Update the CRC32C "crc" using the ARMv8 CRC32C instructions.
+ */
+static uint32_t pv__crc32c_arm(uint32_t crc, const unsigned char *buf, size_t count)
+{
+	while (count >= 8) {
+		uint64_t value;
+		memcpy(&value, buf, 8);
+		crc = __crc32cd(crc, value);
+		buf += 8;
+		count -= 8;
+	}
+	while (count-- > 0)
+		crc = __crc32cb(crc, *(buf++));
+	return crc;
+}
+#endif				/* __ARM_FEATURE_CRC32 */
+
+
+/*
+ * ------------------------------------------------------------------------
+ * XXH3, 64 bit variant with the default secret and a seed of 0, giving
+ * the same results as "xxhsum -H3".
+ * ------------------------------------------------------------------------
+ */
+
+#define XXH_PRIME32_1	0x9E3779B1U
+#define XXH_PRIME32_2	0x85EBCA77U
+#define XXH_PRIME32_3	0xC2B2AE3DU
+#define XXH_PRIME64_1	0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3	0x165667B19E3779F9ULL
+#define XXH_PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5	0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1	0x165667919E3779F9ULL
+#define XXH_PRIME_MX2	0x9FB21C651E98DF25ULL
+
+static const unsigned char pv__xxh3_secret[192] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+#define XXH3_STRIPES_PER_BLOCK	16	 /* (sizeof(secret) - 64) / 8 */
+
+
+/*
+ * Rotate "value" left by "bits" bits.
+ */
+static uint64_t pv__xxh3_rotl64(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+
+/*
+ * Reverse the byte order of "value".
+ */
+static uint64_t pv__xxh3_swap64(uint64_t value)
+{
+	return ((value << 56) & 0xff00000000000000ULL) | ((value << 40) & 0x00ff000000000000ULL)
+	    | ((value << 24) & 0x0000ff0000000000ULL) | ((value << 8) & 0x000000ff00000000ULL)
+	    | ((value >> 8) & 0x00000000ff000000ULL) | ((value >> 24) & 0x0000000000ff0000ULL)
+	    | ((value >> 40) & 0x000000000000ff00ULL) | ((value >> 56) & 0x00000000000000ffULL);
+}
+
+
+/*
+ * Multiply two 64 bit values into 128 bits, and fold the halves together.
+ */
+static uint64_t pv__xxh3_mul128_fold64(uint64_t lhs, uint64_t rhs)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 product = (unsigned __int128) lhs * rhs;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+#else				/* !__SIZEOF_INT128__ */
+	uint64_t lo_lo, hi_lo, lo_hi, hi_hi, cross, upper, lower;
+
+	lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+	hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+	lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+	hi_hi = (lhs >> 32) * (rhs >> 32);
+	cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+	return lower ^ upper;
+#endif				/* __SIZEOF_INT128__ */
+}
+
+
+/*
+ * Final mixing step of XXH64, used by XXH3 for inputs of up to 3 bytes.
+ */
+static uint64_t pv__xxh64_avalanche(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+
+/*
+ * Final mixing step of XXH3.
+ */
+static uint64_t pv__xxh3_avalanche(uint64_t hash)
+{
+	hash ^= hash >> 37;
+	hash *= XXH_PRIME_MX1;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+
+/*
+ * Stronger final mixing step of XXH3, used for inputs of 4 to 8 bytes.
+ */
+static uint64_t pv__xxh3_rrmxmx(uint64_t hash, uint64_t length)
+{
+	hash ^= pv__xxh3_rotl64(hash, 49) ^ pv__xxh3_rotl64(hash, 24);
+	hash *= XXH_PRIME_MX2;
+	hash ^= (hash >> 35) + length;
+	hash *= XXH_PRIME_MX2;
+	hash ^= hash >> 28;
+	return hash;
+}
+
+
+/*
+ * Mix 16 bytes of "input" with 16 bytes of "secret".
+ */
+static uint64_t pv__xxh3_mix16(const unsigned char *input, const unsigned char *secret)
+{
+	return pv__xxh3_mul128_fold64(pv__digest_le64(input) ^ pv__digest_le64(secret),
+				      pv__digest_le64(input + 8) ^ pv__digest_le64(secret + 8));
+}
+
+
+/*
+ * Hash "length" bytes at "input", where there are no more than 240, which
+ * XXH3 treats differently from longer inputs.
+ */
+static uint64_t pv__xxh3_short(const unsigned char *input, size_t length)
+{
+	const unsigned char *secret = pv__xxh3_secret;
+	uint64_t acc, acc_end;
+	size_t idx;
+
+	if (0 == length)
+		return pv__xxh64_avalanche(pv__digest_le64(secret + 56) ^ pv__digest_le64(secret + 64));
+
+	if (length <= 3) {
+		uint32_t combined;
+		combined = ((uint32_t) input[0] << 16) | ((uint32_t) input[length >> 1] << 24)
+		    | (uint32_t) input[length - 1] | ((uint32_t) length << 8);
+		return pv__xxh64_avalanche((uint64_t) combined
+					   ^ (uint64_t) (pv__digest_le32(secret) ^ pv__digest_le32(secret + 4)));
+	}
+
+	if (length <= 8) {
+		uint64_t input64, keyed;
+		input64 = pv__digest_le32(input + length - 4) + ((uint64_t) pv__digest_le32(input) << 32);
+		keyed = input64 ^ (pv__digest_le64(secret + 8) ^ pv__digest_le64(secret + 16));
+		return pv__xxh3_rrmxmx(keyed, length);
+	}
+
+	if (length <= 16) {
+		uint64_t input_lo, input_hi;
+		input_lo = pv__digest_le64(input) ^ (pv__digest_le64(secret + 24) ^ pv__digest_le64(secret + 32));
+		input_hi = pv__digest_le64(input + length - 8)
+		    ^ (pv__digest_le64(secret + 40) ^ pv__digest_le64(secret + 48));
+		acc = length + pv__xxh3_swap64(input_lo) + input_hi + pv__xxh3_mul128_fold64(input_lo, input_hi);
+		return pv__xxh3_avalanche(acc);
+	}
+
+	acc = length * XXH_PRIME64_1;
+
+	if (length <= 128) {
+		if (length > 32) {
+			if (length > 64) {
+				if (length > 96) {
+					acc += pv__xxh3_mix16(input + 48, secret + 96);
+					acc += pv__xxh3_mix16(input + length - 64, secret + 112);
+				}
+				acc += pv__xxh3_mix16(input + 32, secret + 64);
+				acc += pv__xxh3_mix16(input + length - 48, secret + 80);
+			}
+			acc += pv__xxh3_mix16(input + 16, secret + 32);
+			acc += pv__xxh3_mix16(input + length - 32, secret + 48);
+		}
+		acc += pv__xxh3_mix16(input, secret);
+		acc += pv__xxh3_mix16(input + length - 16, secret + 16);
+		return pv__xxh3_avalanche(acc);
+	}
+
+	for (idx = 0; idx < 8; idx++)
+		acc += pv__xxh3_mix16(input + 16 * idx, secret + 16 * idx);
+	acc = pv__xxh3_avalanche(acc);
+	acc_end = pv__xxh3_mix16(input + length - 16, secret + 136 - 17);
+	for (idx = 8; idx < length / 16; idx++)
+		acc_end += pv__xxh3_mix16(input + 16 * idx, secret + 16 * (idx - 8) + 3);
+	return pv__xxh3_avalanche(acc + acc_end);
+}
+
+
+/*
+ * Accumulate one 64 byte stripe of "input" using "secret".
+ */
+static void pv__xxh3_accumulate(uint64_t acc[8], const unsigned char *input, const unsigned char *secret)
+{
+	size_t lane;
+
+	for (lane = 0; lane < 8; lane++) {
+		uint64_t data_val, data_key;
+		data_val = pv__digest_le64(input + lane * 8);
+		data_key = data_val ^ pv__digest_le64(secret + lane * 8);
+		acc[lane ^ 1] += data_val;
+		acc[lane] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+	}
+}
+
+
+/*
+ * Scramble the accumulators at the end of a block.
+ */
+static void pv__xxh3_scramble(uint64_t acc[8])
+{
+	const unsigned char *secret = pv__xxh3_secret + sizeof(pv__xxh3_secret) - 64;
+	size_t lane;
+
+	for (lane = 0; lane < 8; lane++) {
+		uint64_t value = acc[lane];
+		value ^= value >> 47;
+		value ^= pv__digest_le64(secret + lane * 8);
+		value *= XXH_PRIME32_1;
+		acc[lane] = value;
+	}
+}
+
+
+/*
+ * Consume "count" whole stripes from "input", which the caller has made
+ * sure are followed by more data, scrambling at the end of each block.
+ */
+static void pv__xxh3_stripes(struct pvxxh3_s *xxh3, const unsigned char *input, size_t count)
+{
+	while (count-- > 0) {
+		pv__xxh3_accumulate(xxh3->acc, input, pv__xxh3_secret + 8 * xxh3->stripes);
+		xxh3->stripes++;
+		if (xxh3->stripes >= XXH3_STRIPES_PER_BLOCK) {
+			pv__xxh3_scramble(xxh3->acc);
+			xxh3->stripes = 0;
+		}
+		memcpy(xxh3->last_stripe, input, 64);
+		input += 64;
+	}
+}
+
+
+/*
+ * Reset the running XXH3 state "xxh3".
+ */
+static void pv__xxh3_init(struct pvxxh3_s *xxh3)
+{
+	static const uint64_t init_acc[8] = {
+		XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+		XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+	};
+	memset(xxh3, 0, sizeof(*xxh3));
+	memcpy(xxh3->acc, init_acc, sizeof(init_acc));
+}
+
+
+/*
+ * Add "count" bytes from "input" to the running XXH3 state "xxh3".
+ */
+static void pv__xxh3_update(struct pvxxh3_s *xxh3, const unsigned char *input, size_t count)
+{
+	size_t space;
+
+	xxh3->total += count;
+
+	space = sizeof(xxh3->buffer) - xxh3->buffer_fill;
+	if (count <= space) {
+		memcpy(xxh3->buffer + xxh3->buffer_fill, input, count);
+		xxh3->buffer_fill += count;
+		return;
+	}
+
+	/*
+	 * There's more than the buffer holds, so fill it up and consume it
+	 * all, since we know more follows.
+	 */
+	if (xxh3->buffer_fill > 0) {
+		memcpy(xxh3->buffer + xxh3->buffer_fill, input, space);
+		input += space;
+		count -= space;
+		pv__xxh3_stripes(xxh3, xxh3->buffer, sizeof(xxh3->buffer) / 64);
+		xxh3->buffer_fill = 0;
+	}
+
+	/*
+	 * Consume stripes straight from the input, always leaving at least
+	 * one byte behind in the buffer.
+	 */
+	if (count > sizeof(xxh3->buffer)) {
+		size_t stripes = (count - 1) / 64;
+		pv__xxh3_stripes(xxh3, input, stripes);
+		input += 64 * stripes;
+		count -= 64 * stripes;
+	}
+
+	memcpy(xxh3->buffer, input, count);
+	xxh3->buffer_fill = count;
+}
+
+
+/*
+ * Return the XXH3 hash of everything passed to "xxh3" so far.
+ */
+static uint64_t pv__xxh3_final(struct pvxxh3_s *xxh3)
+{
+	const unsigned char *secret;
+	unsigned char last_stripe[64];
+	struct pvxxh3_s copy;
+	uint64_t result;
+	size_t fill, idx;
+
+	if (xxh3->total <= 240)
+		return pv__xxh3_short(xxh3->buffer, (size_t) (xxh3->total));
+
+	/*
+	 * Work on a copy so that the state could still be updated.
+	 */
+	memcpy(&copy, xxh3, sizeof(copy));
+	fill = copy.buffer_fill;
+
+	if (fill >= 64) {
+		pv__xxh3_stripes(&copy, copy.buffer, (fill - 1) / 64);
+		memcpy(last_stripe, copy.buffer + fill - 64, 64);
+	} else {
+		memcpy(last_stripe, copy.last_stripe + fill, 64 - fill);
+		memcpy(last_stripe + 64 - fill, copy.buffer, fill);
+	}
+
+	pv__xxh3_accumulate(copy.acc, last_stripe, pv__xxh3_secret + sizeof(pv__xxh3_secret) - 64 - 7);
+
+	/*
+	 * Merge the accumulators together.
+	 */
+	result = copy.total * XXH_PRIME64_1;
+	secret = pv__xxh3_secret + 11;
+	for (idx = 0; idx < 4; idx++) {
+		result += pv__xxh3_mul128_fold64(copy.acc[2 * idx] ^ pv__digest_le64(secret + 16 * idx),
+						 copy.acc[2 * idx + 1] ^ pv__digest_le64(secret + 16 * idx + 8));
+	}
+
+	return pv__xxh3_avalanche(result);
+}
+
+
+/*
+ * ------------------------------------------------------------------------
+ * SHA-256 (FIPS 180-4).
+ * ------------------------------------------------------------------------
+ */
+
+static const uint32_t pv__sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA256_ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * Process "blocks" 64 byte blocks from "data" in software.
+ */
+static void pv__sha256_blocks_sw(uint32_t h[8], const unsigned char *data, size_t blocks)
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, hh;
+	int idx;
+
+	while (blocks-- > 0) {
+		for (idx = 0; idx < 16; idx++) {
+			w[idx] = ((uint32_t) data[4 * idx] << 24) | ((uint32_t) data[4 * idx + 1] << 16)
+			    | ((uint32_t) data[4 * idx + 2] << 8) | (uint32_t) data[4 * idx + 3];
+		}
+		for (idx = 16; idx < 64; idx++) {
+			uint32_t s0, s1;
+			s0 = SHA256_ROTR(w[idx - 15], 7) ^ SHA256_ROTR(w[idx - 15], 18) ^ (w[idx - 15] >> 3);
+			s1 = SHA256_ROTR(w[idx - 2], 17) ^ SHA256_ROTR(w[idx - 2], 19) ^ (w[idx - 2] >> 10);
+			w[idx] = w[idx - 16] + s0 + w[idx - 7] + s1;
+		}
+
+		a = h[0];
+		b = h[1];
+		c = h[2];
+		d = h[3];
+		e = h[4];
+		f = h[5];
+		g = h[6];
+		hh = h[7];
+
+		for (idx = 0; idx < 64; idx++) {
+			uint32_t t1, t2;
+			t1 = hh + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25))
+			    + ((e & f) ^ ((~e) & g)) + pv__sha256_k[idx] + w[idx];
+			t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22))
+			    + ((a & b) ^ (a & c) ^ (b & c));
+			hh = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+		h[5] += f;
+		h[6] += g;
+		h[7] += hh;
+
+		data += 64;
+	}
+}
+
+
+#ifdef PV_DIGEST_X86
+/*
+ * Process "blocks" 64 byte blocks from "data" using the x86 SHA
+ * extensions, four rounds at a time.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void pv__sha256_blocks_x86(uint32_t h[8], const unsigned char *data, size_t blocks)
+{
+	const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef_save, cdgh_save, msg, tmp;
+	__m128i msgs[4];
+	int idx;
+
+	/*
+	 * Rearrange the hash value into the ABEF / CDGH form the
+	 * instructions work on.
+	 */
+	tmp = _mm_loadu_si128((const __m128i *) &(h[0]));
+	state1 = _mm_loadu_si128((const __m128i *) &(h[4]));
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);
+	state1 = _mm_shuffle_epi32(state1, 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	while (blocks-- > 0) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		for (idx = 0; idx < 4; idx++) {
+			msgs[idx] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * idx)), byteswap);
+		}
+
+		for (idx = 0; idx < 16; idx++) {
+			if (idx >= 4) {
+				/* W[t] from W[t-16], W[t-15], W[t-7], and W[t-2]. */
+				tmp = _mm_sha256msg1_epu32(msgs[idx & 3], msgs[(idx + 1) & 3]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(msgs[(idx + 3) & 3], msgs[(idx + 2) & 3], 4));
+				msgs[idx & 3] = _mm_sha256msg2_epu32(tmp, msgs[(idx + 3) & 3]);
+			}
+			msg = _mm_add_epi32(msgs[idx & 3], _mm_loadu_si128((const __m128i *) &(pv__sha256_k[4 * idx])));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+
+		data += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128((__m128i *) &(h[0]), state0);
+	_mm_storeu_si128((__m128i *) &(h[4]), state1);
+}
+#endif				/* PV_DIGEST_X86 */
+
+
+/*
+ * Reset the running SHA-256 state "sha256".
+ */
+static void pv__sha256_init(struct pvsha256_s *sha256)
+{
+	static const uint32_t init_h[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memset(sha256, 0, sizeof(*sha256));
+	memcpy(sha256->h, init_h, sizeof(init_h));
+}
+
+
+/*
+ * Process "blocks" 64 byte blocks from "data", with the CPU's SHA
+ * instructions if "hardware" is true.
+ */
+static void pv__sha256_blocks(bool hardware, uint32_t h[8], const unsigned char *data, size_t blocks)
+{
+#ifdef PV_DIGEST_X86
+	if (hardware) {
+		pv__sha256_blocks_x86(h, data, blocks);
+		return;
+	}
+#endif				/* PV_DIGEST_X86 */
+	(void) hardware;
+	pv__sha256_blocks_sw(h, data, blocks);
+}
+
+
+/*
+ * Add "count" bytes from "data" to the running SHA-256 state "sha256".
+ */
+static void pv__sha256_update(bool hardware, struct pvsha256_s *sha256, const unsigned char *data, size_t count)
+{
+	sha256->total += count;
+
+	if (sha256->block_fill > 0) {
+		size_t space = sizeof(sha256->block) - sha256->block_fill;
+		if (space > count)
+			space = count;
+		memcpy(sha256->block + sha256->block_fill, data, space);
+		sha256->block_fill += space;
+		data += space;
+		count -= space;
+		if (sha256->block_fill < sizeof(sha256->block))
+			return;
+		pv__sha256_blocks(hardware, sha256->h, sha256->block, 1);
+		sha256->block_fill = 0;
+	}
+
+	if (count >= 64) {
+		pv__sha256_blocks(hardware, sha256->h, data, count / 64);
+		data += 64 * (count / 64);
+		count = count % 64;
+	}
+
+	if (count > 0) {
+		memcpy(sha256->block, data, count);
+		sha256->block_fill = count;
+	}
+}
+
+
+/*
+ * Write the final SHA-256 of "sha256" as 64 hex digits, plus a terminating
+ * null, into "hex".
+ */
+static void pv__sha256_final(bool hardware, struct pvsha256_s *sha256, char *hex)
+{
+	unsigned char padding[128];	 /* flawfinder: ignore */
+	unsigned long long bits;
+	uint32_t h[8];
+	size_t length, idx;
+
+	/*
+	 * flawfinder: padding is only filled up to the 128 bytes worked out
+	 * below, and hex is sized by the caller for 65 bytes.
+	 */
+
+	memcpy(h, sha256->h, sizeof(h));
+
+	length = (sha256->block_fill < 56) ? 64 : 128;
+	memset(padding, 0, sizeof(padding));
+	memcpy(padding, sha256->block, sha256->block_fill);
+	padding[sha256->block_fill] = 0x80;
+
+	bits = sha256->total * 8;
+	for (idx = 0; idx < 8; idx++)
+		padding[length - 1 - idx] = (unsigned char) (bits >> (8 * idx));
+
+	pv__sha256_blocks(hardware, h, padding, length / 64);
+
+	for (idx = 0; idx < 8; idx++)
+		(void) sprintf(hex + 8 * idx, "%08x", (unsigned int) (h[idx]));
+}
+
+
+/*
+ * ------------------------------------------------------------------------
+ * Running the hashes.
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * Reset the set of running hashes "ctx".
+ */
+static void pv__digest_reset(struct pvdigestctx_s *ctx)
+{
+	ctx->crc32c = 0xFFFFFFFF;
+	pv__xxh3_init(&(ctx->xxh3));
+	pv__sha256_init(&(ctx->sha256));
+}
+
+
+/*
+ * Pass "count" bytes from "buf" through each of the running hashes in
+ * "ctx" that are enabled.
+ */
+static void pv__digest_update(struct pvdigest_s *digest, struct pvdigestctx_s *ctx, const unsigned char *buf,
+			      size_t count)
+{
+	if (digest->enabled[PV_DIGEST_CRC32C]) {
+#if defined(__ARM_FEATURE_CRC32)
+		ctx->crc32c = pv__crc32c_arm(ctx->crc32c, buf, count);
+#else				/* !__ARM_FEATURE_CRC32 */
+#ifdef PV_DIGEST_X86
+		if (digest->hw_crc32c)
+			ctx->crc32c = pv__crc32c_x86(ctx->crc32c, buf, count);
+		else
+#endif				/* PV_DIGEST_X86 */
+			ctx->crc32c = pv__crc32c_sw(digest->crc_table, ctx->crc32c, buf, count);
+#endif				/* __ARM_FEATURE_CRC32 */
+	}
+	if (digest->enabled[PV_DIGEST_XXH3])
+		pv__xxh3_update(&(ctx->xxh3), buf, count);
+	if (digest->enabled[PV_DIGEST_SHA256])
+		pv__sha256_update(digest->hw_sha256, &(ctx->sha256), buf, count);
+}
+
+
+/*
+ * Append the results of the running hashes in "ctx" to the report,
+ * labelled with "name", in the same form as "sha256sum --tag".
+ */
+static void pv__digest_report(pvstate_t state, struct pvdigestctx_s *ctx, const char *name)
+{
+	struct pvdigest_s *digest = state->digest;
+	char value[72];			 /* flawfinder: ignore */
+	int algorithm;
+
+	/*
+	 * flawfinder: value is only written with pv_snprintf() and by
+	 * pv__sha256_final(), which writes 65 bytes.
+	 */
+
+	for (algorithm = 0; algorithm < PV_DIGEST_COUNT; algorithm++) {
+		size_t length;
+		char *report;
+
+		if (!digest->enabled[algorithm])
+			continue;
+
+		switch (algorithm) {
+		case PV_DIGEST_CRC32C:
+			(void) pv_snprintf(value, sizeof(value), "%08lx",
+					   (unsigned long) (ctx->crc32c ^ 0xFFFFFFFF));
+			break;
+		case PV_DIGEST_XXH3:
+			(void) pv_snprintf(value, sizeof(value), "%016llx",
+					   (unsigned long long) pv__xxh3_final(&(ctx->xxh3)));
+			break;
+		default:
+			pv__sha256_final(digest->hw_sha256, &(ctx->sha256), value);
+			break;
+		}
+
+		length = strlen(pv__digest_tags[algorithm]) + strlen(name) + strlen(value) + 8;
+		report = realloc(digest->report, digest->report_length + length);
+		if (NULL == report)
+			return;
+		digest->report = report;
+		(void) pv_snprintf(report + digest->report_length, length, "%s (%s) = %s\n",
+				   pv__digest_tags[algorithm], name, value);
+		digest->report_length += strlen(report + digest->report_length);
+	}
+}
+
+
+/*
+ * Finish the hash of the current --verify block, and either record it or,
+ * if verifying, compare it with the one recorded for the same block.
+ */
+static void pv__digest_block_done(struct pvdigest_s *digest)
+{
+	uint64_t hash;
+
+	hash = pv__xxh3_final(&(digest->block));
+	pv__xxh3_init(&(digest->block));
+	digest->block_fill = 0;
+
+	if (digest->verifying) {
+		if ((digest->block_checked >= digest->block_count)
+		    || (digest->block_hashes[digest->block_checked] != hash)) {
+			if (digest->first_bad < 0)
+				digest->first_bad = (long long) (digest->block_checked);
+			digest->bad_blocks++;
+		}
+		digest->block_checked++;
+		return;
+	}
+
+	if (digest->block_count >= digest->block_alloc) {
+		uint64_t *newptr;
+		size_t newalloc;
+		newalloc = digest->block_alloc > 0 ? digest->block_alloc * 2 : 1024;
+		newptr = realloc(digest->block_hashes, newalloc * sizeof(*newptr));
+		if (NULL == newptr) {
+			digest->block_alloc_failed = true;
+			return;
+		}
+		digest->block_hashes = newptr;
+		digest->block_alloc = newalloc;
+	}
+
+	digest->block_hashes[digest->block_count++] = hash;
+}
+
+
+/*
+ * Pass "count" bytes from "buf" through the --verify block hashes.
+ */
+static void pv__digest_blocks(struct pvdigest_s *digest, const unsigned char *buf, size_t count)
+{
+	while (count > 0) {
+		size_t amount;
+
+		amount = digest->block_size - digest->block_fill;
+		if (amount > count)
+			amount = count;
+
+		pv__xxh3_update(&(digest->block), buf, amount);
+		digest->block_fill += amount;
+		if (!digest->verifying)
+			digest->recorded += amount;
+		buf += amount;
+		count -= amount;
+
+		if (digest->block_fill >= digest->block_size)
+			pv__digest_block_done(digest);
+	}
+}
+
+
+/*
+ * Helper thread: read everything from the pipe and hash it, until the
+ * write end is closed.
+ */
+static void *pv__digest_thread(void *arg)
+{
+	struct pvdigest_s *digest;
+	unsigned char *buf;
+
+	digest = (struct pvdigest_s *) arg;
+
+	buf = malloc(DIGEST_READ_SIZE);
+	if (NULL == buf)
+		return NULL;
+
+	while (1) {
+		ssize_t nread;
+
+		nread = read(digest->pipe_fds[0], buf, DIGEST_READ_SIZE);
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread <= 0)
+			break;
+
+		pthread_mutex_lock(&(digest->mutex));
+		if (!digest->verifying) {
+			pv__digest_update(digest, &(digest->whole), buf, (size_t) nread);
+			if (digest->per_file)
+				pv__digest_update(digest, &(digest->file), buf, (size_t) nread);
+		}
+		if (digest->block_size > 0)
+			pv__digest_blocks(digest, buf, (size_t) nread);
+		digest->hashed += nread;
+		pthread_cond_broadcast(&(digest->cond));
+		pthread_mutex_unlock(&(digest->mutex));
+	}
+
+	free(buf);
+
+	return NULL;
+}
+
+
+/*
+ * Wait for the helper thread to hash everything it has been given,
+ * returning with the mutex locked.
+ */
+static void pv__digest_catch_up(struct pvdigest_s *digest)
+{
+	pthread_mutex_lock(&(digest->mutex));
+	while (digest->running && (digest->hashed < digest->fed))
+		pthread_cond_wait(&(digest->cond), &(digest->mutex));
+}
+
+
+/*
+ * Return the name to show in the report for input file number "filenum".
+ */
+static const char *pv__digest_file_name(pvstate_t state, int filenum)
+{
+	if ((filenum < 0) || (filenum >= state->input_file_count))
+		return "(stdin)";
+	return state->input_files[filenum];
+}
+
+
+/*
+ * Find out which hash acceleration the CPU offers.
+ */
+static void pv__digest_detect_cpu(struct pvdigest_s *digest)
+{
+#ifdef PV_DIGEST_X86
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		digest->hw_crc32c = (0 != (ecx & (1U << 20))) ? true : false;
+		/* SSE4.1 (bit 19) and SSSE3 (bit 9) are needed for SHA too. */
+		if ((0 != (ecx & (1U << 19))) && (0 != (ecx & (1U << 9)))
+		    && (__get_cpuid_max(0, NULL) >= 7)) {
+			__cpuid_count(7, 0, eax, ebx, ecx, edx);
+			digest->hw_sha256 = (0 != (ebx & (1U << 29))) ? true : false;
+		}
+	}
+#endif				/* PV_DIGEST_X86 */
+	debug("%s: crc32c=%s, sha256=%s", "hash acceleration", digest->hw_crc32c ? "yes" : "no",
+	      digest->hw_sha256 ? "yes" : "no");
+}
+
+#endif				/* HAVE_DIGEST */
+
+
+/*
+ * If --hash or --verify was given, check the list of hash algorithms, and
+ * start the helper thread that will calculate them.  Returns false on
+ * error, in which case the transfer should not go ahead.
+ */
+bool pv_digest_start(pvstate_t state)
+{
+#ifdef HAVE_DIGEST
+	struct pvdigest_s *digest;
+	sigset_t all_signals, old_signals;
+	const char *name;
+	int rc;
+
+	if ((NULL == state->digest_names) && (!state->verify))
+		return true;
+
+	digest = calloc(1, sizeof(*digest));
+	if (NULL == digest) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return false;
+	}
+
+	name = (NULL == state->digest_names) ? "" : state->digest_names;
+	while ('\0' != *name) {
+		size_t length;
+		int algorithm;
+
+		length = strcspn(name, ",");
+		for (algorithm = 0; algorithm < PV_DIGEST_COUNT; algorithm++) {
+			if ((strlen(pv__digest_names[algorithm]) == length)
+			    && (0 == strncmp(name, pv__digest_names[algorithm], length)))
+				break;
+		}
+		if (algorithm >= PV_DIGEST_COUNT) {
+			pv_error(state, "%s: %.*s", _("unknown hash algorithm"), (int) length, name);
+			state->exit_status |= 2;
+			free(digest);
+			return false;
+		}
+		digest->enabled[algorithm] = true;
+
+		name += length;
+		if (',' == *name)
+			name++;
+	}
+
+	digest->per_file = state->digest_per_file;
+	digest->block_size = state->verify ? VERIFY_BLOCK_SIZE : 0;
+	digest->first_bad = -1;
+	pv__xxh3_init(&(digest->block));
+	pv__crc32c_init(digest->crc_table);
+	pv__digest_detect_cpu(digest);
+	pv__digest_reset(&(digest->whole));
+	pv__digest_reset(&(digest->file));
+
+	if (0 != pipe(digest->pipe_fds)) {
+		pv_error(state, "%s: %s", _("failed to create hash pipe"), strerror(errno));
+		state->exit_status |= 2;
+		free(digest);
+		return false;
+	}
+#ifdef F_SETPIPE_SZ
+	(void) fcntl(digest->pipe_fds[1], F_SETPIPE_SZ, DIGEST_PIPE_SIZE);
+#endif
+
+	pthread_mutex_init(&(digest->mutex), NULL);
+	pthread_cond_init(&(digest->cond), NULL);
+
+	/*
+	 * Block all signals while creating the thread, so that it inherits
+	 * a mask leaving signal handling to the main thread.
+	 */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(digest->thread), NULL, pv__digest_thread, digest);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		pv_error(state, "%s: %s", _("failed to start hash thread"), strerror(rc));
+		state->exit_status |= 2;
+		close(digest->pipe_fds[0]);
+		close(digest->pipe_fds[1]);
+		pthread_mutex_destroy(&(digest->mutex));
+		pthread_cond_destroy(&(digest->cond));
+		free(digest);
+		return false;
+	}
+
+	digest->running = true;
+	state->digest = digest;
+
+	debug("%s: %s", "started hash thread", NULL == state->digest_names ? "-" : state->digest_names);
+
+	return true;
+#else				/* !HAVE_DIGEST */
+	if ((NULL == state->digest_names) && (!state->verify))
+		return true;
+	pv_error(state, "%s", _("--hash and --verify are not supported on this platform"));
+	state->exit_status |= 2;
+	return false;
+#endif				/* HAVE_DIGEST */
+}
+
+
+/*
+ * Pass "count" bytes from "buf", which have just been written to the
+ * output, to the hash thread.
+ */
+void pv_digest_data(pvstate_t state, const unsigned char *buf, size_t count)
+{
+#ifdef HAVE_DIGEST
+	struct pvdigest_s *digest = state->digest;
+
+	if ((NULL == digest) || (!digest->running))
+		return;
+
+	while (count > 0) {
+		ssize_t nwritten;
+
+		nwritten = write(digest->pipe_fds[1], buf, count);
+		if ((nwritten < 0) && ((EINTR == errno) || (EAGAIN == errno)))
+			continue;
+		if (nwritten <= 0) {
+			pv_error(state, "%s: %s", _("failed to pass data to hash thread"), strerror(errno));
+			state->exit_status |= 16;
+			return;
+		}
+
+		buf += nwritten;
+		count -= nwritten;
+		digest->fed += nwritten;
+	}
+#else				/* !HAVE_DIGEST */
+	(void) state;
+	(void) buf;
+	(void) count;
+#endif				/* HAVE_DIGEST */
+}
+
+
+/*
+ * Move up to "count" bytes from the pipe "fd" to standard output with
+ * splice(), having first duplicated them into the hash thread's pipe with
+ * tee().  Returns the number of bytes written to standard output, 0 at the
+ * end of the input, or -1 on error, like splice().
+ *
+ * Anything teed but not spliced last time is spliced first, without
+ * duplicating it again.
+ */
+ssize_t pv_digest_splice(pvstate_t state, int fd, size_t count)
+{
+#if defined(HAVE_DIGEST) && defined(HAVE_SPLICE) && defined(HAVE_TEE)
+	struct pvdigest_s *digest = state->digest;
+	ssize_t nteed, nspliced;
+
+	if (0 == digest->untaken) {
+		/*
+		 * This blocks if the hash thread is behind, which is what
+		 * we want, since it should hold back the transfer.
+		 */
+		nteed = tee(fd, digest->pipe_fds[1], count, 0);
+		if (nteed <= 0)
+			return nteed;
+		digest->untaken = (size_t) nteed;
+		digest->fed += nteed;
+	}
+
+	nspliced = splice(fd, NULL, state->output_fd, NULL, digest->untaken, SPLICE_F_MORE);
+	if (nspliced > 0)
+		digest->untaken -= nspliced;
+
+	/*
+	 * We already know there is data, so a zero return means the output
+	 * went away; report it as a broken pipe rather than an input EOF.
+	 */
+	if (0 == nspliced) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	return nspliced;
+#else				/* !HAVE_DIGEST || !HAVE_SPLICE || !HAVE_TEE */
+	(void) state;
+	(void) fd;
+	(void) count;
+	errno = EINVAL;
+	return -1;
+#endif				/* HAVE_DIGEST && HAVE_SPLICE && HAVE_TEE */
+}
+
+
+/*
+ * Return true if data has been duplicated for the hash thread with
+ * pv_digest_splice() but not yet spliced to the output, in which case the
+ * transfer must carry on with splice() until it has.
+ */
+bool pv_digest_pending(pvstate_t state)
+{
+#ifdef HAVE_DIGEST
+	if (NULL == state->digest)
+		return false;
+	return (state->digest->untaken > 0) ? true : false;
+#else				/* !HAVE_DIGEST */
+	(void) state;
+	return false;
+#endif				/* HAVE_DIGEST */
+}
+
+
+/*
+ * Record the end of input file number "filenum": with --hash-per-file,
+ * wait for the hash thread to catch up, and add the file's hashes to the
+ * report.
+ */
+void pv_digest_file_end(pvstate_t state, int filenum)
+{
+#ifdef HAVE_DIGEST
+	struct pvdigest_s *digest = state->digest;
+
+	if ((NULL == digest) || (!digest->per_file) || (!digest->running))
+		return;
+
+	pv__digest_catch_up(digest);
+	pv__digest_report(state, &(digest->file), pv__digest_file_name(state, filenum));
+	pv__digest_reset(&(digest->file));
+	pthread_mutex_unlock(&(digest->mutex));
+#else				/* !HAVE_DIGEST */
+	(void) state;
+	(void) filenum;
+#endif				/* HAVE_DIGEST */
+}
+
+
+/*
+ * With --verify, once everything has been written, wait for the hash
+ * thread to catch up, and switch it from recording the hash of each block
+ * of the output to checking what it is given next against them.  Returns
+ * the number of bytes that were recorded, or -1 on error.
+ */
+long long pv_digest_verify_begin(pvstate_t state)
+{
+#ifdef HAVE_DIGEST
+	struct pvdigest_s *digest = state->digest;
+	long long recorded;
+
+	if ((NULL == digest) || (0 == digest->block_size) || (!digest->running))
+		return -1;
+
+	pv__digest_catch_up(digest);
+
+	if (digest->block_fill > 0)
+		pv__digest_block_done(digest);
+
+	if (digest->block_alloc_failed) {
+		pthread_mutex_unlock(&(digest->mutex));
+		pv_error(state, "%s: %s", _("buffer allocation failed"), _("--verify block hashes"));
+		state->exit_status |= 64;
+		return -1;
+	}
+
+	recorded = (long long) (digest->recorded);
+	digest->verifying = true;
+	digest->block_checked = 0;
+	digest->bad_blocks = 0;
+	digest->first_bad = -1;
+
+	pthread_mutex_unlock(&(digest->mutex));
+
+	return recorded;
+#else				/* !HAVE_DIGEST */
+	(void) state;
+	return -1;
+#endif				/* HAVE_DIGEST */
+}
+
+
+/*
+ * With --verify, once everything has been read back, wait for the hash
+ * thread to catch up, and return the number of blocks which did not match
+ * or were not read back at all, putting the index of the first of them in
+ * "first_bad".
+ */
+unsigned long long pv_digest_verify_end(pvstate_t state, long long *first_bad)
+{
+#ifdef HAVE_DIGEST
+	struct pvdigest_s *digest = state->digest;
+	unsigned long long bad_blocks;
+
+	*first_bad = -1;
+	if ((NULL == digest) || (!digest->verifying))
+		return 0;
+
+	pv__digest_catch_up(digest);
+
+	if (digest->block_fill > 0)
+		pv__digest_block_done(digest);
+
+	if (digest->block_checked < digest->block_count) {
+		if (digest->first_bad < 0)
+			digest->first_bad = (long long) (digest->block_checked);
+		digest->bad_blocks += digest->block_count - digest->block_checked;
+		digest->block_checked = digest->block_count;
+	}
+
+	bad_blocks = digest->bad_blocks;
+	*first_bad = digest->first_bad;
+
+	pthread_mutex_unlock(&(digest->mutex));
+
+	return bad_blocks;
+#else				/* !HAVE_DIGEST */
+	(void) state;
+	*first_bad = -1;
+	return 0;
+#endif				/* HAVE_DIGEST */
+}
+
+
+/*
+ * Stop the hash thread and free its resources.  If "report" is true, the
+ * transfer is complete, so write the hashes of the last input file (with
+ * --hash-per-file) and of the whole output to standard error.
+ */
+void pv_digest_finish(pvstate_t state, bool report)
+{
+#ifdef HAVE_DIGEST
+	struct pvdigest_s *digest = state->digest;
+
+	if (NULL == digest)
+		return;
+
+	if (digest->running) {
+		close(digest->pipe_fds[1]);
+		pthread_join(digest->thread, NULL);
+		close(digest->pipe_fds[0]);
+		digest->running = false;
+	}
+
+	if (report) {
+		if (digest->per_file)
+			pv__digest_report(state, &(digest->file), pv__digest_file_name(state, state->current_file_num));
+		pv__digest_report(state, &(digest->whole), "stdout");
+		if (NULL != digest->report)
+			pv_write_retry(STDERR_FILENO, digest->report, digest->report_length);
+	}
+
+	pthread_mutex_destroy(&(digest->mutex));
+	pthread_cond_destroy(&(digest->cond));
+	if (NULL != digest->report)
+		free(digest->report);
+	if (NULL != digest->block_hashes)
+		free(digest->block_hashes);
+	free(digest);
+	state->digest = NULL;
+#else				/* !HAVE_DIGEST */
+	(void) state;
+	(void) report;
+#endif				/* HAVE_DIGEST */
+}
+
+/* EOF */
@@ -38,12 +38,29 @@
  * Output an error message.  If we've displayed anything to the terminal
  * already, then put a newline before our error so we don't write over what
  * we've written.
+ *
+ * Nothing is output for a state which has been told to stay silent, such
+ * as one of the --calibrate tries, whose failures go in the results table.
  */
 void pv_error(pvstate_t state, char *format, ...)
 {
 	va_list ap;
-	if (state->display_visible)
+	unsigned int line;
+
+	if (state->silent) {
+		debug("%s: %s", "error not reported", format);
+		return;
+	}
+	if (state->display_visible) {
 		fprintf(stderr, "\n");
+		/*
+		 * Move below any extra lines drawn under the main display
+		 * too.
+		 */
+		for (line = 0; line < state->display_sublines; line++)
+			fprintf(stderr, "\n");
+	}
+	state->display_sublines = 0;
 	fprintf(stderr, "%s: ", state->program_name);
 	va_start(ap, format);
 	(void) vfprintf(stderr, format, ap);
@@ -152,33 +169,19 @@ static long pv__calc_eta(const long long so_far, const long long total, const lo
  */
 static void pv__si_prefix(long double *value, char *prefix, const long double ratio, int is_bytes)
 {
-	static char *pfx_000 = NULL;	 /* kilo, mega, etc */
-	static char *pfx_024 = NULL;	 /* kibi, mibi, etc */
-	static char const *pfx_middle_000 = NULL;
-	static char const *pfx_middle_024 = NULL;
-	char *pfx;
-	char const *pfx_middle;
+	char const *pfx;
 	char const *i;
 	long double cutoff;
 
-	if (NULL == pfx_000) {
-		pfx_000 = _("yzafpnum kMGTPEZY");
-		pfx_middle_000 = strchr(pfx_000, ' ');
-	}
-
-	if (NULL == pfx_024) {
-		pfx_024 = _("yzafpnum KMGTPEZY");
-		pfx_middle_024 = strchr(pfx_024, ' ');
-	}
-
-	pfx = pfx_000;
-	pfx_middle = pfx_middle_000;
-	if (is_bytes) {
-		pfx = pfx_024;
-		pfx_middle = pfx_middle_024;
-	}
+	/*
+	 * The prefixes are looked up every time rather than kept in
+	 * statics, so that this is safe to call from several threads.
+	 */
+	pfx = is_bytes ? _("yzafpnum KMGTPEZY") : _("yzafpnum kMGTPEZY");
 
-	i = pfx_middle;
+	i = strchr(pfx, ' ');
+	if (NULL == i)
+		i = pfx;
 
 	prefix[0] = ' ';		    /* Make the prefix start blank. */
 	prefix[1] = 0;
@@ -391,6 +394,16 @@ static void pv__format_init(pvstate_t state)
 				state->format[segment].length = 0;
 				state->components_used |= PV_DISPLAY_BUFPERCENT;
 				break;
+			case 'E':
+				state->format[segment].string = state->str_engine;
+				state->format[segment].length = 0;
+				state->components_used |= PV_DISPLAY_ENGINE;
+				break;
+			case 'L':
+				state->format[segment].string = state->str_latency;
+				state->format[segment].length = 0;
+				state->components_used |= PV_DISPLAY_LATENCY;
+				break;
 			case 'N':
 				state->format[segment].string = state->str_name;
 				state->format[segment].length = strlen(state->str_name);
@@ -744,6 +757,30 @@ static const char *pv__format(pvstate_t state,
 		state->str_lastoutput[idx] = 0;
 	}
 
+	/* I/O engine - set up the display string. */
+	if ((state->components_used & PV_DISPLAY_ENGINE) != 0) {
+		(void) pv_snprintf(state->str_engine, PV_SIZEOF_STR_ENGINE, "%s%s", pv_engine_name(state->engine),
+				   ((state->engine_candidates != 0) && (state->engine_trial >= 0)) ? "?" : "");
+	}
+
+	/* Buffer hold time percentile - set up the display string. */
+	if ((state->components_used & PV_DISPLAY_LATENCY) != 0) {
+		long double hold_time;
+
+		hold_time = pv_transfer_hold_time(state, LATENCY_PERCENTILE);
+		if (hold_time < 0) {
+			(void) pv_snprintf(state->str_latency, PV_SIZEOF_STR_LATENCY, "%s", "p99 -");
+		} else if (hold_time < 0.001) {
+			(void) pv_snprintf(state->str_latency, PV_SIZEOF_STR_LATENCY, "p99 %.0Lfus",
+					   hold_time * 1000000.0);
+		} else if (hold_time < 1) {
+			(void) pv_snprintf(state->str_latency, PV_SIZEOF_STR_LATENCY, "p99 %.1Lfms",
+					   hold_time * 1000.0);
+		} else {
+			(void) pv_snprintf(state->str_latency, PV_SIZEOF_STR_LATENCY, "p99 %.2Lfs", hold_time);
+		}
+	}
+
 	/* ETA (only if size is known) - set up the display string. */
 	if (((state->components_used & PV_DISPLAY_ETA) != 0)
 	    && (state->size > 0)) {
@@ -794,6 +831,7 @@ static const char *pv__format(pvstate_t state,
 		int show_eta = 1;
 		time_t now = time(NULL);
 		time_t then;
+		struct tm then_tm;
 		struct tm *time_ptr;
 		char *time_format = NULL;
 
@@ -818,20 +856,15 @@ static const char *pv__format(pvstate_t state,
 		}
 
 		then = now + eta;
-		time_ptr = localtime(&then);
+		time_ptr = localtime_r(&then, &then_tm);
 
 		if (NULL == time_ptr) {
 			show_eta = 0;
 		} else {
-			/* Localtime keeps data stored in a
-			 * static buffer that gets overwritten
-			 * by time functions. */
-			struct tm time = *time_ptr;
-
 			(void) pv_snprintf(state->str_fineta, PV_SIZEOF_STR_FINETA, "%.16s ", _("ETA"));
 			strftime(state->str_fineta +
 				 strlen(state->str_fineta),
-				 PV_SIZEOF_STR_FINETA - 1 - strlen(state->str_fineta), time_format, &time);
+				 PV_SIZEOF_STR_FINETA - 1 - strlen(state->str_fineta), time_format, &then_tm);
 		}
 
 		if (!show_eta) {
@@ -989,6 +1022,175 @@ static const char *pv__format(pvstate_t state,
 }
 
 
+/*
+ * Draw one line under the main display for "counter", showing how much has
+ * gone through it and how fast, followed by "status", cut off at "width"
+ * columns.  If "final" is true, the rate is the average over the whole
+ * "elapsed_sec".
+ */
+static void pv__display_counter(struct pvcounter_s *counter, const char *arrow, const char *status,
+				long double elapsed_sec, bool final, size_t width)
+{
+	char line[1024];		 /* flawfinder: ignore */
+	char str_bytes[128];		 /* flawfinder: ignore */
+	char str_rate[128];		 /* flawfinder: ignore */
+	long double time_since_last;
+	size_t length;
+
+	/*
+	 * flawfinder: all of these are only written with pv_snprintf() or
+	 * pv__sizestr(), which are bounded and always terminate.
+	 */
+
+	if (width > sizeof(line) - 1)
+		width = sizeof(line) - 1;
+
+	time_since_last = elapsed_sec - counter->prev_elapsed;
+	if (final) {
+		counter->rate = (elapsed_sec > 0.000001) ? (long double) (counter->position) / elapsed_sec : 0;
+	} else if (time_since_last > 0.01) {
+		counter->rate = (long double) (counter->position - counter->prev_position) / time_since_last;
+		counter->prev_position = counter->position;
+		counter->prev_elapsed = elapsed_sec;
+	}
+
+	pv__sizestr(str_bytes, sizeof(str_bytes), "%s", (long double) (counter->position), "", _("B"), 1);
+	pv__sizestr(str_rate, sizeof(str_rate), "[%s]", counter->rate, _("/s"), _("B/s"), 1);
+
+	(void) pv_snprintf(line, sizeof(line), " %s %.500s: %s %s %s", arrow, counter->name, str_bytes, str_rate,
+			   status);
+
+	/*
+	 * Pad the line out to overwrite whatever was there before, and cut
+	 * it off before it can wrap.
+	 */
+	length = strlen(line);
+	while (length < width)
+		line[length++] = ' ';
+	line[width] = '\0';
+
+	pv_write_retry(STDERR_FILENO, "\n", 1);
+	pv_write_retry(STDERR_FILENO, line, strlen(line));
+}
+
+
+/*
+ * Draw a line under the main display for each --merge input and each --tee
+ * output, showing how much has gone through it, how fast, and how much is
+ * waiting, then move the cursor back up to the main display.  If "final"
+ * is true, the rates are the averages over the whole "elapsed_sec".
+ *
+ * With --exec, the main display is what went into the command, and a line
+ * is added for what came out of it, with the ratio of the two, using
+ * "total_bytes" as the amount that went in.
+ *
+ * With --multi, there is a line for each stream instead, as many as will
+ * fit on the terminal under the main display.
+ *
+ * With --per-file, the first line is the input file being read, with its
+ * own rate and progress bar.
+ */
+static void pv__display_sublines(pvstate_t state, long double elapsed_sec, long long total_bytes, bool final)
+{
+	struct pvcounter_s *exec_counter;
+	struct pvcounter_s *file_counter;
+	char str_status[160];		 /* flawfinder: ignore */
+	char move_up[32];		 /* flawfinder: ignore */
+	unsigned int idx, lines, stream_lines;
+	size_t width;
+
+	/*
+	 * flawfinder: both are only written with pv_snprintf() or
+	 * pv__sizestr(), which are bounded and always terminate.
+	 */
+
+	exec_counter = pv_exec_counter(state);
+	file_counter = pv_perfile_counter(state, elapsed_sec);
+
+	stream_lines = state->stream_count;
+	if ((state->height > 2) && (stream_lines > state->height - 2))
+		stream_lines = state->height - 2;
+
+	lines = state->merge_input_count + state->sink_count + stream_lines;
+	if (NULL != exec_counter)
+		lines++;
+	if (NULL != file_counter)
+		lines++;
+	if (0 == lines)
+		return;
+
+	width = 1023;
+	if ((state->width > 1) && (state->width - 1 < width))
+		width = state->width - 1;
+
+	/*
+	 * The file's own rate is shown even on the final update, since the
+	 * average over the whole transfer would be nothing to do with it.
+	 */
+	if (NULL != file_counter) {
+		pv_perfile_status(state, str_status, sizeof(str_status));
+		pv__display_counter(file_counter, "<-", str_status, elapsed_sec, false, width);
+	}
+
+	for (idx = 0; idx < state->merge_input_count; idx++) {
+		struct pvmergeinput_s *input = &(state->merge_inputs[idx]);
+
+		str_status[0] = '\0';
+		if (input->buffer_fill > 0) {
+			pv__sizestr(str_status, sizeof(str_status), _("%s partial"), (long double) (input->buffer_fill),
+				    "", _("B"), 1);
+		} else if (input->eof) {
+			(void) pv_snprintf(str_status, sizeof(str_status), "%s", _("finished"));
+		}
+
+		pv__display_counter(&(input->counter), "<-", str_status, elapsed_sec, final, width);
+	}
+
+	for (idx = 0; idx < state->sink_count; idx++) {
+		struct pvsink_s *sink = &(state->sinks[idx]);
+
+		switch (sink->status) {
+		case PV_SINK_CLOSED:
+			(void) pv_snprintf(str_status, sizeof(str_status), "%s", _("closed"));
+			break;
+		case PV_SINK_DROPPED:
+			(void) pv_snprintf(str_status, sizeof(str_status), "%s", _("dropped"));
+			break;
+		case PV_SINK_FAILED:
+			(void) pv_snprintf(str_status, sizeof(str_status), "%s", _("failed"));
+			break;
+		default:
+			str_status[0] = '\0';
+			if (pv_fanout_queued(state, sink) > 0)
+				pv__sizestr(str_status, sizeof(str_status),
+					    state->split ? _("%s queued") : _("%s behind"),
+					    (long double) pv_fanout_queued(state, sink), "", _("B"), 1);
+			break;
+		}
+
+		pv__display_counter(&(sink->counter), "->", str_status, elapsed_sec, final, width);
+	}
+
+	if (NULL != exec_counter) {
+		str_status[0] = '\0';
+		if ((!state->linemode) && (total_bytes > 0))
+			(void) pv_snprintf(str_status, sizeof(str_status), "%s %.3Lf", _("ratio"),
+					   (long double) (exec_counter->position) / (long double) total_bytes);
+		pv__display_counter(exec_counter, "<-", str_status, elapsed_sec, final, width);
+	}
+
+	for (idx = 0; idx < stream_lines; idx++) {
+		pv_multi_status(&(state->streams[idx]), str_status, sizeof(str_status));
+		pv__display_counter(&(state->streams[idx].counter), "->", str_status, elapsed_sec, final, width);
+	}
+
+	(void) pv_snprintf(move_up, sizeof(move_up), "\033[%uA", lines);
+	pv_write_retry(STDERR_FILENO, move_up, strlen(move_up));
+
+	state->display_sublines = lines;
+}
+
+
 /*
  * Output status information on standard error, where "esec" is the seconds
  * elapsed since the transfer started, "sl" is the number of bytes transferred
@@ -1007,6 +1209,14 @@ void pv_display(pvstate_t state, long double esec, long long sl, long long tot)
 	if (NULL == state)
 		return;
 
+	/*
+	 * Keep the snapshot up to date, and if it is being given to a
+	 * function instead, don't draw anything.
+	 */
+	pv_stats_update(state, esec, tot, sl < 0 ? true : false);
+	if (NULL != state->stats_callback)
+		return;
+
 	/*
 	 * If the display options need reparsing, do so to generate new
 	 * formatting parameters.
@@ -1016,7 +1226,7 @@ void pv_display(pvstate_t state, long double esec, long long sl, long long tot)
 		state->reparse_display = 0;
 	}
 
-	pv_sig_checkbg();
+	pv_sig_checkbg(state);
 
 	display = pv__format(state, esec, sl, tot);
 	if (NULL == display)
@@ -1032,6 +1242,7 @@ void pv_display(pvstate_t state, long double esec, long long sl, long long tot)
 	} else {
 		if (state->force || pv_in_foreground()) {
 			pv_write_retry(STDERR_FILENO, display, strlen(display));
+			pv__display_sublines(state, esec, tot, sl < 0 ? true : false);
 			pv_write_retry(STDERR_FILENO, "\r", 1);
 			state->display_visible = true;
 		}
@@ -1040,4 +1251,28 @@ void pv_display(pvstate_t state, long double esec, long long sl, long long tot)
 	debug("%s: [%s]", "display", display);
 }
 
+
+/*
+ * Reset the rate and ETA calculations so that the display can be used
+ * again, on a new line, for another pass over "size" bytes, such as the
+ * read-back check of --verify.
+ */
+void pv_display_restart(pvstate_t state, unsigned long long size)
+{
+	state->size = size;
+	state->initial_offset = 0;
+	state->percentage = 0;
+	state->prev_elapsed_sec = 0;
+	state->prev_rate = 0;
+	state->prev_trans = 0;
+	state->current_avg_rate = 0;
+	state->prev_length = 0;
+
+	if (NULL != state->history) {
+		state->history_first = state->history_last = 0;
+		state->history[0].elapsed_sec = 0.0;
+		state->history[0].total_bytes = 0;
+	}
+}
+
 /* EOF */
@@ -0,0 +1,391 @@
+/*
+ * Functions for choosing which I/O engine pv_transfer() should use, by
+ * trying each of the possible ones and measuring how they do.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+#include <sys/resource.h>
+#endif
+
+
+/*
+ * Return the name of the given I/O engine, for display.
+ */
+const char *pv_engine_name(int engine)
+{
+	switch (engine) {
+	case PV_ENGINE_SPLICE:
+		return "splice";
+	case PV_ENGINE_MMAP:
+		return "mmap";
+	case PV_ENGINE_PARALLEL:
+		return "parallel";
+	default:
+		break;
+	}
+	return "read/write";
+}
+
+
+/*
+ * Return the number of seconds of CPU time used by this process so far,
+ * including any helper threads, or 0 if it cannot be determined.
+ */
+static long double pv__engine_cpu(void)
+{
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+	struct rusage usage;
+
+	if (0 != getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	return (long double) (usage.ru_utime.tv_sec) + (long double) (usage.ru_utime.tv_usec) / 1000000.0
+	    + (long double) (usage.ru_stime.tv_sec) + (long double) (usage.ru_stime.tv_usec) / 1000000.0;
+#else				/* ! defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE) */
+	return 0;
+#endif				/* defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE) */
+}
+
+
+/*
+ * Return the engine that would have been used before the selector existed,
+ * out of the current candidates: splice() if possible, then mmap(), then
+ * read() and write() - unless the parallel engine was asked for.
+ */
+static int pv__engine_default(pvstate_t state)
+{
+	if (0 != (state->engine_candidates & (1 << PV_ENGINE_PARALLEL)))
+		return PV_ENGINE_PARALLEL;
+	if (0 != (state->engine_candidates & (1 << PV_ENGINE_SPLICE)))
+		return PV_ENGINE_SPLICE;
+	if (0 != (state->engine_candidates & (1 << PV_ENGINE_MMAP)))
+		return PV_ENGINE_MMAP;
+	return PV_ENGINE_READWRITE;
+}
+
+
+/*
+ * Start measuring the engine currently being tried from now.
+ */
+static void pv__engine_trial_reset(pvstate_t state)
+{
+	gettimeofday(&(state->engine_trial_start), NULL);
+	state->engine_trial_cpu = pv__engine_cpu();
+	state->engine_trial_bytes = 0;
+}
+
+
+/*
+ * Pick the best engine from the measurements taken in the last round of
+ * trials: the fastest, unless another engine came within
+ * ENGINE_RATE_MARGIN of it while using less CPU time per byte, as happens
+ * when something else in the pipeline is the bottleneck.
+ */
+static int pv__engine_best(pvstate_t state)
+{
+	long double best_rate;
+	int engine, best;
+
+	best_rate = 0;
+	for (engine = 0; engine < PV_ENGINE_COUNT; engine++) {
+		if (0 == (state->engine_candidates & (1 << engine)))
+			continue;
+		if (state->engine_rate[engine] > best_rate)
+			best_rate = state->engine_rate[engine];
+	}
+
+	if (best_rate <= 0)
+		return pv__engine_default(state);
+
+	best = -1;
+	for (engine = 0; engine < PV_ENGINE_COUNT; engine++) {
+		if (0 == (state->engine_candidates & (1 << engine)))
+			continue;
+		if (state->engine_rate[engine] < best_rate * ENGINE_RATE_MARGIN)
+			continue;
+		if ((best < 0) || (state->engine_cpu[engine] < state->engine_cpu[best]))
+			best = engine;
+	}
+
+	return best < 0 ? pv__engine_default(state) : best;
+}
+
+
+/*
+ * Move on to trying the next candidate engine after the one currently
+ * being tried, or, if they have all been tried, settle on the best one
+ * until the next round of trials is due.
+ */
+static void pv__engine_next_trial(pvstate_t state)
+{
+	int engine;
+
+	for (engine = state->engine_trial + 1; engine < PV_ENGINE_COUNT; engine++) {
+		if (0 != (state->engine_candidates & (1 << engine)))
+			break;
+	}
+
+	if (engine < PV_ENGINE_COUNT) {
+		debug("%s: %s", "trying I/O engine", pv_engine_name(engine));
+		state->engine_trial = engine;
+		state->engine_wanted = engine;
+		/*
+		 * If it's already in use, there will be no switch, so
+		 * start measuring it straight away.
+		 */
+		if (engine == state->engine)
+			pv__engine_trial_reset(state);
+		return;
+	}
+
+	state->engine_trial = -1;
+	state->engine_wanted = pv__engine_best(state);
+
+	gettimeofday(&(state->engine_next_trial), NULL);
+	state->engine_next_trial.tv_sec += ENGINE_RETRIAL_INTERVAL;
+
+	debug("%s: %s", "chose I/O engine", pv_engine_name(state->engine_wanted));
+}
+
+
+/*
+ * Drop any candidate engines that have failed on the current input, so
+ * that they are not tried again.
+ */
+static void pv__engine_drop_failed(pvstate_t state)
+{
+#ifdef HAVE_SPLICE
+	if ((state->splice_failed_fd == state->engine_fd)
+	    && (0 != (state->engine_candidates & (1 << PV_ENGINE_SPLICE)))) {
+		debug("%s: %s", "dropping failed I/O engine", pv_engine_name(PV_ENGINE_SPLICE));
+		state->engine_candidates &= ~(1 << PV_ENGINE_SPLICE);
+	}
+#endif				/* HAVE_SPLICE */
+#ifdef HAVE_MMAP_ENGINE
+	if ((state->mmap_failed_fd == state->engine_fd)
+	    && (0 != (state->engine_candidates & (1 << PV_ENGINE_MMAP)))) {
+		debug("%s: %s", "dropping failed I/O engine", pv_engine_name(PV_ENGINE_MMAP));
+		state->engine_candidates &= ~(1 << PV_ENGINE_MMAP);
+	}
+#endif				/* HAVE_MMAP_ENGINE */
+
+	if ((state->engine_trial >= 0)
+	    && (0 == (state->engine_candidates & (1 << state->engine_trial)))) {
+		pv__engine_next_trial(state);
+	} else if ((state->engine_trial < 0)
+		   && (0 == (state->engine_candidates & (1 << state->engine_wanted)))) {
+		state->engine_wanted = pv__engine_default(state);
+	}
+}
+
+
+/*
+ * Set up the engine selector for a new input file "fd", working out which
+ * engines could be used on it, and starting a round of trials if there is
+ * more than one.
+ */
+void pv_engine_start(pvstate_t state, int fd)
+{
+	struct stat isb, osb;
+	int engine, count;
+	bool hashing;
+
+	state->engine_fd = fd;
+	state->engine_candidates = 1 << PV_ENGINE_READWRITE;
+	state->engine_trial = -1;
+
+	for (engine = 0; engine < PV_ENGINE_COUNT; engine++) {
+		state->engine_rate[engine] = 0;
+		state->engine_cpu[engine] = 0;
+	}
+
+	/*
+	 * The --tee outputs are fed from what is written out of the
+	 * transfer buffer, so nothing can bypass it.  With --merge, lines
+	 * from all of the inputs are gathered in the buffer too, and with
+	 * --validate, the data is checked there instead of being written.
+	 */
+	if ((state->output_file_count > 0) || (state->merge) || (NULL != state->validate)) {
+		state->engine_wanted = PV_ENGINE_READWRITE;
+		debug("%s %d: %s", "fd", fd, "only read/write can be used with --tee, --merge, or --validate");
+		return;
+	}
+
+	/*
+	 * Fixed size blocks have to be gathered in the transfer buffer.
+	 */
+	if ((state->input_block_size > 0) || (state->output_block_size > 0)) {
+		state->engine_wanted = PV_ENGINE_READWRITE;
+		debug("%s %d: %s", "fd", fd, "only read/write can be used with fixed block sizes");
+		return;
+	}
+
+	/*
+	 * If --parallel was given and can be used, use nothing else - unless
+	 * hashing with --hash or --verify, which needs the data to pass
+	 * through in order.
+	 */
+	hashing = ((NULL != state->digest_names) || (state->verify)) ? true : false;
+	if ((!hashing) && (!state->discard) && pv_parallel_usable(state, fd)) {
+		state->engine_candidates = 1 << PV_ENGINE_PARALLEL;
+		state->engine_wanted = PV_ENGINE_PARALLEL;
+		debug("%s %d: %s", "fd", fd, "using parallel I/O engine");
+		return;
+	}
+
+	if ((0 == fstat(fd, &isb)) && (0 == fstat(state->output_fd, &osb))) {
+#ifdef HAVE_SPLICE
+		if ((!state->no_splice) && (state->linemode)) {
+#ifdef HAVE_LINE_TEE
+			if ((S_ISFIFO(isb.st_mode)) && (S_ISFIFO(osb.st_mode)) && (!hashing) && (!state->discard))
+				state->engine_candidates |= 1 << PV_ENGINE_SPLICE;
+#endif				/* HAVE_LINE_TEE */
+		} else if ((!state->no_splice) && state->discard) {
+			/*
+			 * With --discard, splice() can move anything to
+			 * /dev/null, but the hash thread needs the data.
+			 */
+			if (!hashing)
+				state->engine_candidates |= 1 << PV_ENGINE_SPLICE;
+		} else if ((!state->no_splice) && hashing) {
+#ifdef HAVE_TEE
+			/* When hashing, tee() needs the input to be a pipe. */
+			if (S_ISFIFO(isb.st_mode))
+				state->engine_candidates |= 1 << PV_ENGINE_SPLICE;
+#endif				/* HAVE_TEE */
+		} else if (!state->no_splice) {
+			if ((S_ISFIFO(isb.st_mode)) || (S_ISFIFO(osb.st_mode)))
+				state->engine_candidates |= 1 << PV_ENGINE_SPLICE;
+		}
+#endif				/* HAVE_SPLICE */
+#ifdef HAVE_MMAP_ENGINE
+		if ((S_ISREG(isb.st_mode)) && (!state->direct_io) && (0 == state->skip_errors) && (!state->discard))
+			state->engine_candidates |= 1 << PV_ENGINE_MMAP;
+#endif				/* HAVE_MMAP_ENGINE */
+	}
+
+	count = 0;
+	for (engine = 0; engine < PV_ENGINE_COUNT; engine++) {
+		if (0 != (state->engine_candidates & (1 << engine)))
+			count++;
+	}
+
+	debug("%s %d: %s: %d", "fd", fd, "candidate I/O engines", count);
+
+	if (count < 2) {
+		state->engine_wanted = pv__engine_default(state);
+		return;
+	}
+
+	pv__engine_next_trial(state);
+}
+
+
+/*
+ * Return true if pv_transfer() may use the given engine at the moment.  If
+ * the selector has not been set up, any engine may be used, as before.
+ */
+bool pv_engine_allowed(pvstate_t state, int engine)
+{
+	if (0 == state->engine_candidates)
+		return true;
+	return (engine == state->engine) ? true : false;
+}
+
+
+/*
+ * Called by pv_transfer() when it has switched to using "engine", so that
+ * if it is being tried, its measurements can start from now.
+ */
+void pv_engine_begin(pvstate_t state, int engine)
+{
+	debug("%s: %s -> %s", "switching I/O engine", pv_engine_name(state->engine), pv_engine_name(engine));
+
+	state->engine = engine;
+
+	if (engine == state->engine_trial)
+		pv__engine_trial_reset(state);
+}
+
+
+/*
+ * Update the selector after pv_transfer() has written "written" bytes,
+ * finishing the current trial if it has run for long enough, or starting
+ * a new round of trials if one is due.
+ */
+void pv_engine_update(pvstate_t state, long written)
+{
+	struct timeval now;
+	long double elapsed;
+	int engine;
+
+	if (0 == state->engine_candidates)
+		return;
+
+	pv__engine_drop_failed(state);
+
+	gettimeofday(&now, NULL);
+
+	if (state->engine_trial < 0) {
+		unsigned int others;
+
+		/*
+		 * Start a new round of trials if one is due and there is
+		 * still more than one candidate.
+		 */
+		others = state->engine_candidates & ~(1 << state->engine);
+		if ((0 == others)
+		    || (now.tv_sec < state->engine_next_trial.tv_sec)
+		    || ((now.tv_sec == state->engine_next_trial.tv_sec)
+			&& (now.tv_usec < state->engine_next_trial.tv_usec)))
+			return;
+		pv__engine_next_trial(state);
+		return;
+	}
+
+	engine = state->engine_trial;
+
+	/*
+	 * Nothing to measure until pv_transfer() has switched over.
+	 */
+	if (state->engine != engine)
+		return;
+
+	if (written > 0)
+		state->engine_trial_bytes += written;
+
+	elapsed = (long double) (now.tv_sec - state->engine_trial_start.tv_sec)
+	    + (long double) (now.tv_usec - state->engine_trial_start.tv_usec) / 1000000.0;
+
+	if (elapsed < (long double) ENGINE_TRIAL_TIME / 1000000.0)
+		return;
+
+	state->engine_rate[engine] = (long double) (state->engine_trial_bytes) / elapsed;
+	if (state->engine_trial_bytes > 0) {
+		state->engine_cpu[engine] =
+		    (pv__engine_cpu() - state->engine_trial_cpu) / (long double) (state->engine_trial_bytes);
+	} else {
+		state->engine_cpu[engine] = 1;
+	}
+
+	debug("%s: %s: %Lf %s, %Lf %s", "I/O engine trial", pv_engine_name(engine),
+	      state->engine_rate[engine], "bytes/sec", state->engine_cpu[engine] * 1000000000.0, "ns CPU/byte");
+
+	pv__engine_next_trial(state);
+}
+
+/* EOF */
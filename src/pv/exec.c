@@ -0,0 +1,527 @@
+/*
+ * Functions for --exec, which runs a command with its standard input fed
+ * by the transfer, and relays its standard output to our own, so that the
+ * rates going into and coming out of the command can be shown together.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif				/* HAVE_THREADS */
+
+#ifdef HAVE_THREADS
+
+/*
+ * State of the --exec command.  While it runs, our standard output is the
+ * write end of a pipe to the command's standard input, so that the rest of
+ * the transfer needs no changes; the real standard output is kept open as
+ * "output_fd" until the command's input is closed, when it is put back.
+ *
+ * A helper thread moves whatever the command writes to "from_command" on
+ * to "output_fd", with splice() where it can, and adds it to "relayed".
+ * Everything from "relayed" on is protected by "mutex".
+ */
+struct pvexec_s {
+	pid_t pid;			 /* process ID of the command */
+	int output_fd;			 /* real standard output, or -1 */
+	int from_command;		 /* read end of command's output */
+	bool input_closed;		 /* set once the command's input is closed */
+	pthread_t thread;		 /* relay thread */
+	bool thread_failed;		 /* set if the thread wasn't started */
+	struct pvcounter_s counter;	 /* command output, for the display */
+	pthread_mutex_t mutex;		 /* lock for everything below */
+	pthread_cond_t cond;		 /* signalled when the relay ends */
+	unsigned long long relayed;	 /* bytes passed on so far */
+	bool stopping;			 /* set to tell the thread to stop */
+	bool finished;			 /* set when the thread is done */
+	int error;			 /* errno of a relay failure, or 0 */
+};
+
+
+/*
+ * Move up to "count" bytes from "from" to "to", with splice() if "use_splice"
+ * points to true, setting it to false and falling back to read() and
+ * write() if splice() can't be used.  Returns the number of bytes moved, 0
+ * at the end of the data, or -1 on error.
+ */
+static ssize_t pv__exec_move(int from, int to, unsigned char *buffer, size_t count, bool *use_splice)
+{
+	ssize_t nread, nwritten, done;
+
+#ifdef HAVE_SPLICE
+	if (*use_splice) {
+		nread = splice(from, NULL, to, NULL, count, SPLICE_F_MORE);
+		if ((nread >= 0) || ((EINVAL != errno) && (ENOSYS != errno)))
+			return nread;
+		*use_splice = false;
+	}
+#else				/* !HAVE_SPLICE */
+	*use_splice = false;
+#endif				/* HAVE_SPLICE */
+
+	nread = read(from, buffer, count);	/* flawfinder: ignore */
+	/*
+	 * flawfinder: "buffer" is always at least "count" bytes long.
+	 */
+	if (nread <= 0)
+		return nread;
+
+	for (done = 0; done < nread;) {
+		nwritten = write(to, buffer + done, (size_t) (nread - done));
+		if ((nwritten < 0) && (EINTR == errno))
+			continue;
+		if (nwritten < 0)
+			return -1;
+		done += nwritten;
+	}
+
+	return nread;
+}
+
+
+/*
+ * Relay thread: pass everything the command writes on to the real standard
+ * output, until the command closes its end or we are told to stop.
+ *
+ * If the relay fails, such as when our standard output has gone away, our
+ * end of the command's output is closed, so that the command is stopped by
+ * SIGPIPE the next time it writes instead of blocking for ever.
+ */
+static void *pv__exec_thread(void *arg)
+{
+	struct pvexec_s *exec = (struct pvexec_s *) arg;
+	unsigned char *buffer;
+	bool use_splice;
+	int error;
+
+	buffer = malloc(EXEC_RELAY_SIZE);
+	use_splice = true;
+	error = 0;
+
+	while (true) {
+		struct timeval tv;
+		fd_set readfds;
+		ssize_t moved;
+		bool stopping;
+
+		pthread_mutex_lock(&(exec->mutex));
+		stopping = exec->stopping;
+		pthread_mutex_unlock(&(exec->mutex));
+		if (stopping)
+			break;
+
+		/*
+		 * Wait for the command's output in short steps, so that a
+		 * request to stop is noticed even if it is writing nothing.
+		 */
+		FD_ZERO(&readfds);
+		FD_SET(exec->from_command, &readfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000;
+		if (select(exec->from_command + 1, &readfds, NULL, NULL, &tv) < 1)
+			continue;
+
+		if ((NULL == buffer) && (!use_splice)) {
+			error = ENOMEM;
+			break;
+		}
+
+		moved = pv__exec_move(exec->from_command, exec->output_fd, buffer, EXEC_RELAY_SIZE, &use_splice);
+		if ((moved < 0) && ((EINTR == errno) || (EAGAIN == errno)))
+			continue;
+		if (moved < 0) {
+			error = errno;
+			break;
+		}
+		if (0 == moved)
+			break;
+
+		pthread_mutex_lock(&(exec->mutex));
+		exec->relayed += moved;
+		pthread_mutex_unlock(&(exec->mutex));
+	}
+
+	if (NULL != buffer)
+		free(buffer);
+
+	if (0 != error) {
+		(void) close(exec->from_command);
+		exec->from_command = -1;
+	}
+
+	pthread_mutex_lock(&(exec->mutex));
+	exec->error = error;
+	exec->finished = true;
+	pthread_cond_broadcast(&(exec->cond));
+	pthread_mutex_unlock(&(exec->mutex));
+
+	return NULL;
+}
+
+
+/*
+ * Start the shell command "command" with its standard input reading from
+ * "input" and its standard output writing to "output", returning its
+ * process ID, or -1 on error.
+ */
+static pid_t pv__exec_spawn(const char *command, int input[2], int output[2])
+{
+	pid_t pid;
+
+	pid = fork();
+	if (0 != pid)
+		return pid;
+
+	/* Child process - read one pipe and write to the other. */
+	(void) close(input[1]);
+	(void) close(output[0]);
+	if (input[0] != STDIN_FILENO) {
+		(void) dup2(input[0], STDIN_FILENO);
+		(void) close(input[0]);
+	}
+	if (output[1] != STDOUT_FILENO) {
+		(void) dup2(output[1], STDOUT_FILENO);
+		(void) close(output[1]);
+	}
+
+	/*
+	 * We ignore SIGPIPE, and that would be inherited, so that the
+	 * command would not stop when its own output is closed.
+	 */
+	(void) signal(SIGPIPE, SIG_DFL);
+
+	(void) execl("/bin/sh", "sh", "-c", command, (char *) NULL);	/* flawfinder: ignore */
+	/*
+	 * flawfinder: the command is given by the user, to run as
+	 * themselves.
+	 */
+	_exit(127);
+}
+
+#endif				/* HAVE_THREADS */
+
+
+/*
+ * With --exec, start the command and the thread relaying its output, and
+ * swap our standard output for the command's standard input.  Returns
+ * false on error.
+ */
+bool pv_exec_start(pvstate_t state)
+{
+#ifdef HAVE_THREADS
+	struct pvexec_s *exec;
+	int to_command[2], from_command[2];
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	if ((NULL == state->exec_command) || (NULL != state->exec))
+		return true;
+
+	exec = calloc(1, sizeof(*exec));
+	if (NULL == exec) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return false;
+	}
+
+	if (0 != pipe(to_command)) {
+		pv_error(state, "%s: %s: %s", state->exec_command, _("failed to run command"), strerror(errno));
+		state->exit_status |= 2;
+		free(exec);
+		return false;
+	}
+	if (0 != pipe(from_command)) {
+		pv_error(state, "%s: %s: %s", state->exec_command, _("failed to run command"), strerror(errno));
+		state->exit_status |= 2;
+		(void) close(to_command[0]);
+		(void) close(to_command[1]);
+		free(exec);
+		return false;
+	}
+
+	exec->output_fd = dup(state->output_fd);
+	if (exec->output_fd >= 0)
+		(void) fcntl(exec->output_fd, F_SETFD, FD_CLOEXEC);
+
+	exec->pid = (exec->output_fd < 0) ? -1 : pv__exec_spawn(state->exec_command, to_command, from_command);
+	if (exec->pid < 0) {
+		pv_error(state, "%s: %s: %s", state->exec_command, _("failed to run command"), strerror(errno));
+		state->exit_status |= 2;
+		if (exec->output_fd >= 0)
+			(void) close(exec->output_fd);
+		(void) close(to_command[0]);
+		(void) close(to_command[1]);
+		(void) close(from_command[0]);
+		(void) close(from_command[1]);
+		free(exec);
+		return false;
+	}
+
+	(void) close(to_command[0]);
+	(void) close(from_command[1]);
+	(void) fcntl(from_command[0], F_SETFD, FD_CLOEXEC);
+	exec->from_command = from_command[0];
+	pv_set_pipe_size(state, exec->from_command);
+
+	/*
+	 * From now on, everything written to standard output goes to the
+	 * command.
+	 */
+	(void) dup2(to_command[1], state->output_fd);
+	(void) close(to_command[1]);
+
+	exec->counter.name = state->exec_command;
+
+	pthread_mutex_init(&(exec->mutex), NULL);
+	pthread_cond_init(&(exec->cond), NULL);
+
+	/*
+	 * Block all signals while creating the thread, as in
+	 * pv_digest_start().
+	 */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(exec->thread), NULL, pv__exec_thread, exec);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	state->exec = exec;
+
+	if (0 != rc) {
+		pv_error(state, "%s: %s", _("failed to start relay thread"), strerror(rc));
+		state->exit_status |= 2;
+		exec->finished = true;
+		exec->thread_failed = true;
+		pv_exec_fini(state);
+		return false;
+	}
+
+	debug("%s: %s: %d", "started command", state->exec_command, (int) (exec->pid));
+
+	return true;
+#else				/* !HAVE_THREADS */
+	if (NULL == state->exec_command)
+		return true;
+	pv_error(state, "%s", _("--exec is not supported on this platform"));
+	state->exit_status |= 2;
+	return false;
+#endif				/* HAVE_THREADS */
+}
+
+
+#ifdef HAVE_THREADS
+/*
+ * Close the command's standard input, by putting our real standard output
+ * back, so that it sees the end of the data.
+ */
+static void pv__exec_close_input(pvstate_t state, struct pvexec_s *exec)
+{
+	if (exec->input_closed)
+		return;
+	exec->input_closed = true;
+
+	if (exec->output_fd >= 0) {
+		(void) dup2(exec->output_fd, state->output_fd);
+	} else {
+		(void) close(state->output_fd);
+	}
+
+	debug("%s: %s", state->exec_command, "closed command input");
+}
+#endif				/* HAVE_THREADS */
+
+
+/*
+ * Return true if the command is still producing output that has not yet
+ * been relayed.
+ */
+bool pv_exec_pending(pvstate_t state)
+{
+#ifdef HAVE_THREADS
+	bool finished;
+
+	if (NULL == state->exec)
+		return false;
+
+	pthread_mutex_lock(&(state->exec->mutex));
+	finished = state->exec->finished;
+	pthread_mutex_unlock(&(state->exec->mutex));
+
+	return finished ? false : true;
+#else				/* !HAVE_THREADS */
+	return false;
+#endif				/* HAVE_THREADS */
+}
+
+
+/*
+ * Return true if the command's output could not be relayed, in which case
+ * the transfer should stop as if our own standard output had gone away.
+ */
+bool pv_exec_failed(pvstate_t state)
+{
+#ifdef HAVE_THREADS
+	bool failed;
+
+	if (NULL == state->exec)
+		return false;
+
+	pthread_mutex_lock(&(state->exec->mutex));
+	failed = (state->exec->finished && (0 != state->exec->error)) ? true : false;
+	pthread_mutex_unlock(&(state->exec->mutex));
+
+	return failed;
+#else				/* !HAVE_THREADS */
+	return false;
+#endif				/* HAVE_THREADS */
+}
+
+
+/*
+ * Once all of the input has been passed to the command, close its input,
+ * and wait briefly for it to finish writing its output; used so that the
+ * display keeps being updated while the command catches up.
+ */
+void pv_exec_wait(pvstate_t state)
+{
+#ifdef HAVE_THREADS
+	struct pvexec_s *exec;
+	struct timeval now;
+	struct timespec until;
+
+	exec = state->exec;
+	if (NULL == exec)
+		return;
+
+	pv__exec_close_input(state, exec);
+
+	gettimeofday(&now, NULL);
+	until.tv_sec = now.tv_sec;
+	until.tv_nsec = (now.tv_usec + 90000) * 1000L;
+	if (until.tv_nsec >= 1000000000L) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&(exec->mutex));
+	if (!exec->finished)
+		(void) pthread_cond_timedwait(&(exec->cond), &(exec->mutex), &until);
+	pthread_mutex_unlock(&(exec->mutex));
+#endif				/* HAVE_THREADS */
+}
+
+
+/*
+ * Return the counter of the command's output, brought up to date, for the
+ * display, or NULL if there is no command.
+ */
+struct pvcounter_s *pv_exec_counter(pvstate_t state)
+{
+#ifdef HAVE_THREADS
+	if (NULL == state->exec)
+		return NULL;
+
+	pthread_mutex_lock(&(state->exec->mutex));
+	state->exec->counter.position = state->exec->relayed;
+	pthread_mutex_unlock(&(state->exec->mutex));
+
+	return &(state->exec->counter);
+#else				/* !HAVE_THREADS */
+	return NULL;
+#endif				/* HAVE_THREADS */
+}
+
+
+/*
+ * Close the command's input, stop the relay thread once the command has
+ * closed its output (or straight away if we are aborting), and wait for
+ * the command to exit, reporting it if it failed.
+ */
+void pv_exec_fini(pvstate_t state)
+{
+#ifdef HAVE_THREADS
+	struct pvexec_s *exec;
+	int wstatus;
+
+	exec = state->exec;
+	if (NULL == exec)
+		return;
+
+	pv__exec_close_input(state, exec);
+
+	if (!exec->thread_failed) {
+		pthread_mutex_lock(&(exec->mutex));
+		if (pv_sig_aborted(state))
+			exec->stopping = true;
+		pthread_mutex_unlock(&(exec->mutex));
+		pthread_join(exec->thread, NULL);
+	}
+
+	if ((0 != exec->error) && (EPIPE != exec->error)) {
+		pv_error(state, "%s: %s: %s", state->exec_command, _("failed to relay command output"),
+			 strerror(exec->error));
+		state->exit_status |= 16;
+	}
+
+	if (exec->from_command >= 0)
+		(void) close(exec->from_command);
+	if (exec->output_fd >= 0)
+		(void) close(exec->output_fd);
+
+	/*
+	 * If we were interrupted, don't wait for the command to finish by
+	 * itself.
+	 */
+	if (pv_sig_aborted(state))
+		(void) kill(exec->pid, SIGTERM);
+
+	wstatus = 0;
+	while ((waitpid(exec->pid, &wstatus, 0) < 0) && (EINTR == errno)) {
+		/* try again */
+	}
+
+	/*
+	 * A command stopped by SIGPIPE because our own output went away is
+	 * not an error, just as it wouldn't be in a shell pipeline; the
+	 * shell running it may report that as an exit status of 128 plus
+	 * the signal number.
+	 */
+	if ((EPIPE == exec->error)
+	    && (((WIFSIGNALED(wstatus)) && (SIGPIPE == WTERMSIG(wstatus)))
+		|| ((WIFEXITED(wstatus)) && (128 + SIGPIPE == WEXITSTATUS(wstatus))))) {
+		debug("%s: %s", state->exec_command, "command stopped by SIGPIPE");
+	} else if ((WIFEXITED(wstatus)) && (0 != WEXITSTATUS(wstatus))) {
+		pv_error(state, "%s: %s: %d", state->exec_command, _("command exited with status"),
+			 WEXITSTATUS(wstatus));
+		state->exit_status |= 16;
+	} else if ((WIFSIGNALED(wstatus)) && (!pv_sig_aborted(state))) {
+		pv_error(state, "%s: %s: %d", state->exec_command, _("command killed by signal"), WTERMSIG(wstatus));
+		state->exit_status |= 16;
+	}
+
+	debug("%s: %s: %llu %s", "command finished", state->exec_command, exec->relayed, "bytes relayed");
+
+	pthread_mutex_destroy(&(exec->mutex));
+	pthread_cond_destroy(&(exec->cond));
+	free(exec);
+	state->exec = NULL;
+#endif				/* HAVE_THREADS */
+}
+
+/* EOF */
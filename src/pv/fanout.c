@@ -0,0 +1,542 @@
+/*
+ * Functions for the extra outputs given with --tee, which are either each
+ * sent a copy of everything, written at their own pace from a shared ring
+ * buffer, or with --split, each sent whole lines at a time, to spread the
+ * data between them.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+
+/*
+ * Close the output "sink", marking it with "status", and if it is a
+ * command, wait for it to exit, reporting it if it failed.
+ */
+static void pv__fanout_close(pvstate_t state, struct pvsink_s *sink, int status)
+{
+	int wstatus;
+
+	if (sink->fd >= 0)
+		(void) close(sink->fd);
+	sink->fd = -1;
+	sink->status = status;
+
+	if (sink->pid <= 0)
+		return;
+
+	/*
+	 * If waitpid() fails, there is nothing to report.
+	 */
+	wstatus = 0;
+	while ((waitpid(sink->pid, &wstatus, 0) < 0) && (EINTR == errno)) {
+		/* try again */
+	}
+	sink->pid = 0;
+
+	if ((WIFEXITED(wstatus)) && (0 == WEXITSTATUS(wstatus)))
+		return;
+
+	if (WIFEXITED(wstatus)) {
+		pv_error(state, "%s: %s: %d", sink->counter.name, _("command exited with status"),
+			 WEXITSTATUS(wstatus));
+	} else if (WIFSIGNALED(wstatus)) {
+		pv_error(state, "%s: %s: %d", sink->counter.name, _("command killed by signal"), WTERMSIG(wstatus));
+	}
+	state->exit_status |= 16;
+}
+
+
+/*
+ * Start the shell command "command" with its standard input coming from a
+ * pipe, filling in the sink's file descriptor and process ID.  Returns
+ * false on error.
+ */
+static bool pv__fanout_command(struct pvsink_s *sink, const char *command)
+{
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		return false;
+
+	sink->pid = fork();
+	if (sink->pid < 0) {
+		(void) close(fds[0]);
+		(void) close(fds[1]);
+		sink->pid = 0;
+		return false;
+	}
+
+	if (0 == sink->pid) {
+		/* Child process - read the pipe as standard input. */
+		(void) close(fds[1]);
+		if (fds[0] != STDIN_FILENO) {
+			(void) dup2(fds[0], STDIN_FILENO);
+			(void) close(fds[0]);
+		}
+
+		/*
+		 * We ignore SIGPIPE, and that would be inherited, so that the
+		 * command would not stop when its own output is closed.
+		 */
+		(void) signal(SIGPIPE, SIG_DFL);
+
+		(void) execl("/bin/sh", "sh", "-c", command, (char *) NULL);	/* flawfinder: ignore */
+		/*
+		 * flawfinder: the command is given by the user, to run as
+		 * themselves.
+		 */
+		_exit(127);
+	}
+
+	(void) close(fds[0]);
+	(void) fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	sink->fd = fds[1];
+
+	return true;
+}
+
+
+/*
+ * Fill in "iov" with the data waiting to be written to "sink", returning
+ * the number of iovec entries used, or 0 if there is nothing waiting.  No
+ * more than MAX_WRITE_AT_ONCE bytes are given.
+ */
+static int pv__fanout_queued(pvstate_t state, struct pvsink_s *sink, struct iovec *iov)
+{
+	size_t offset, pending;
+
+	if (PV_SINK_OPEN != sink->status)
+		return 0;
+
+	if (state->split) {
+		if (sink->buffer_done >= sink->buffer_fill)
+			return 0;
+		iov[0].iov_base = sink->buffer + sink->buffer_done;
+		iov[0].iov_len = sink->buffer_fill - sink->buffer_done;
+		return 1;
+	}
+
+	if (sink->counter.position >= state->fanout_head)
+		return 0;
+
+	pending = (size_t) (state->fanout_head - sink->counter.position);
+	if (pending > MAX_WRITE_AT_ONCE)
+		pending = MAX_WRITE_AT_ONCE;
+	offset = (size_t) (sink->counter.position % state->fanout_ring_size);
+
+	iov[0].iov_base = state->fanout_ring + offset;
+	iov[0].iov_len = pending;
+	if (offset + pending <= state->fanout_ring_size)
+		return 1;
+
+	/*
+	 * The data wraps around the end of the ring buffer.
+	 */
+	iov[0].iov_len = state->fanout_ring_size - offset;
+	iov[1].iov_base = state->fanout_ring;
+	iov[1].iov_len = pending - iov[0].iov_len;
+
+	return 2;
+}
+
+
+/*
+ * Write as much of the data waiting for "sink" as it will take without
+ * blocking.  An output whose reader has gone away is closed, quietly
+ * unless --split data meant for it is lost; any other write error is
+ * reported.
+ */
+static void pv__fanout_write(pvstate_t state, struct pvsink_s *sink)
+{
+	struct iovec iov[2];
+	ssize_t nwritten;
+	int iovcnt;
+
+	iovcnt = pv__fanout_queued(state, sink, iov);
+	if (0 == iovcnt)
+		return;
+
+	nwritten = writev(sink->fd, iov, iovcnt);
+
+	if (nwritten > 0) {
+		sink->counter.position += nwritten;
+		if (state->split) {
+			sink->buffer_done += nwritten;
+			if (sink->buffer_done >= sink->buffer_fill) {
+				sink->buffer_done = 0;
+				sink->buffer_fill = 0;
+			}
+		}
+	} else if ((nwritten < 0) && ((EINTR == errno) || (EAGAIN == errno))) {
+		return;
+	} else if ((nwritten < 0) && (EPIPE == errno) && (!state->split)) {
+		debug("%s: %s", sink->counter.name, "--tee output closed by reader");
+		pv__fanout_close(state, sink, PV_SINK_CLOSED);
+	} else {
+		pv_error(state, "%s: %s: %s", sink->counter.name, _("write failed"),
+			 nwritten < 0 ? strerror(errno) : _("end of file"));
+		state->exit_status |= 16;
+		pv__fanout_close(state, sink, PV_SINK_FAILED);
+	}
+}
+
+
+/*
+ * Open each of the --tee outputs, truncating files and starting commands
+ * given as "|COMMAND", and allocate the buffers they will be written from:
+ * a shared ring buffer of FANOUT_RING_BUFFERS transfer buffers, or with
+ * --split, a buffer of up to SPLIT_CHUNK_SIZE for each output.  The
+ * outputs are made non-blocking, so that a slow one never holds up the
+ * others.
+ *
+ * Returns false on error.
+ */
+bool pv_fanout_open(pvstate_t state)
+{
+	unsigned int idx;
+
+	if (0 == state->output_file_count)
+		return true;
+
+	state->sinks = calloc(state->output_file_count, sizeof(*(state->sinks)));
+	if (NULL == state->sinks) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return false;
+	}
+
+	if (!state->split) {
+		state->fanout_ring_size = FANOUT_RING_BUFFERS * state->target_buffer_size;
+		state->fanout_ring = malloc(state->fanout_ring_size);
+		if (NULL == state->fanout_ring) {
+			pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->exit_status |= 64;
+			return false;
+		}
+	}
+	state->fanout_head = 0;
+
+	for (idx = 0; idx < state->output_file_count; idx++) {
+		struct pvsink_s *sink;
+		int flags;
+
+		sink = &(state->sinks[idx]);
+		sink->counter.name = state->output_files[idx];
+		sink->fd = -1;
+		state->sink_count++;
+
+		if (state->split) {
+			sink->buffer_size = SPLIT_CHUNK_SIZE;
+			if (sink->buffer_size > state->target_buffer_size)
+				sink->buffer_size = state->target_buffer_size;
+			sink->buffer = malloc(sink->buffer_size);
+			if (NULL == sink->buffer) {
+				pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+				state->exit_status |= 64;
+				return false;
+			}
+		}
+
+		if ('|' == sink->counter.name[0]) {
+			if (!pv__fanout_command(sink, sink->counter.name + 1)) {
+				pv_error(state, "%s: %s: %s", sink->counter.name, _("failed to start command"),
+					 strerror(errno));
+				state->exit_status |= 2;
+				return false;
+			}
+		} else {
+			sink->fd = open(sink->counter.name, O_WRONLY | O_CREAT | O_TRUNC, 0666);	/* flawfinder: ignore */
+			/*
+			 * flawfinder: the file is named by the user, who
+			 * could equally redirect the output there.
+			 */
+			if (sink->fd < 0) {
+				pv_error(state, "%s: %s: %s", sink->counter.name, _("failed to open file"),
+					 strerror(errno));
+				state->exit_status |= 2;
+				return false;
+			}
+		}
+
+		flags = fcntl(sink->fd, F_GETFL);
+		if (flags >= 0)
+			(void) fcntl(sink->fd, F_SETFL, flags | O_NONBLOCK);
+
+		debug("%s: %s: %d", "opened --tee output", sink->counter.name, sink->fd);
+	}
+
+	return true;
+}
+
+
+/*
+ * Return "count", reduced if necessary so that writing that many more
+ * bytes to standard output doesn't put more into the ring buffer than the
+ * slowest --tee output has room for - or, with --tee-drop, more than the
+ * ring buffer holds.
+ *
+ * With --split, return how much the largest idle output's buffer can take,
+ * up to "count", or 0 if all of them are busy.
+ */
+size_t pv_fanout_room(pvstate_t state, size_t count)
+{
+	unsigned long long lowest;
+	unsigned int idx;
+	size_t room;
+
+	if (state->split) {
+		bool any_open = false;
+		room = 0;
+		for (idx = 0; idx < state->sink_count; idx++) {
+			struct pvsink_s *sink = &(state->sinks[idx]);
+			if (PV_SINK_OPEN != sink->status)
+				continue;
+			any_open = true;
+			if ((0 == sink->buffer_fill) && (sink->buffer_size > room))
+				room = sink->buffer_size;
+		}
+		/*
+		 * With nobody left to send to, let pv_fanout_split() say
+		 * so.
+		 */
+		if (!any_open)
+			return count;
+		return count > room ? room : count;
+	}
+
+	if (NULL == state->fanout_ring)
+		return count;
+
+	lowest = state->fanout_head;
+	if (!state->tee_drop) {
+		for (idx = 0; idx < state->sink_count; idx++) {
+			if ((PV_SINK_OPEN == state->sinks[idx].status) && (state->sinks[idx].counter.position < lowest))
+				lowest = state->sinks[idx].counter.position;
+		}
+	}
+
+	room = state->fanout_ring_size - (size_t) (state->fanout_head - lowest);
+
+	return count > room ? room : count;
+}
+
+
+/*
+ * Add "count" bytes from "buf", which have just been written to standard
+ * output, to the ring buffer for the --tee outputs.  With --tee-drop, any
+ * output still needing the data this would overwrite is given up on.
+ */
+void pv_fanout_append(pvstate_t state, const unsigned char *buf, size_t count)
+{
+	unsigned int idx;
+	size_t offset, first;
+
+	if ((NULL == state->fanout_ring) || (0 == count))
+		return;
+
+	for (idx = 0; idx < state->sink_count; idx++) {
+		struct pvsink_s *sink = &(state->sinks[idx]);
+		if ((PV_SINK_OPEN != sink->status)
+		    || (state->fanout_head + count - sink->counter.position <= state->fanout_ring_size))
+			continue;
+		pv_error(state, "%s: %s", sink->counter.name, _("output fell too far behind - dropped"));
+		state->exit_status |= 16;
+		pv__fanout_close(state, sink, PV_SINK_DROPPED);
+	}
+
+	offset = (size_t) (state->fanout_head % state->fanout_ring_size);
+	first = state->fanout_ring_size - offset;
+	if (first > count)
+		first = count;
+
+	memcpy(state->fanout_ring + offset, buf, first);
+	if (first < count)
+		memcpy(state->fanout_ring, buf + first, count - first);
+
+	state->fanout_head += count;
+}
+
+
+/*
+ * With --split, hand the "count" bytes at "buf", which pv_transfer() has
+ * already cut at a line boundary, to the next idle output in turn, and
+ * try writing them to it straight away.  Returns the number of bytes
+ * taken, which is 0 if all of the outputs are busy, or -1 with errno set
+ * to EPIPE if none are left.
+ */
+ssize_t pv_fanout_split(pvstate_t state, const unsigned char *buf, size_t count)
+{
+	unsigned int tried;
+	bool any_open;
+
+	any_open = false;
+
+	for (tried = 0; tried < state->sink_count; tried++) {
+		struct pvsink_s *sink;
+
+		sink = &(state->sinks[state->split_next]);
+		state->split_next = (state->split_next + 1) % state->sink_count;
+
+		if (PV_SINK_OPEN != sink->status)
+			continue;
+		any_open = true;
+		if (0 != sink->buffer_fill)
+			continue;
+
+		if (count > sink->buffer_size)
+			count = sink->buffer_size;
+
+		memcpy(sink->buffer, buf, count);
+		sink->buffer_fill = count;
+		sink->buffer_done = 0;
+		state->fanout_head += count;
+
+		pv__fanout_write(state, sink);
+
+		return (ssize_t) count;
+	}
+
+	if (!any_open) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Add each --tee output with data waiting for it to "writefds", returning
+ * the new highest file descriptor given the current highest "max_fd".
+ */
+int pv_fanout_fdset(pvstate_t state, fd_set *writefds, int max_fd)
+{
+	struct iovec iov[2];
+	unsigned int idx;
+
+	for (idx = 0; idx < state->sink_count; idx++) {
+		struct pvsink_s *sink = &(state->sinks[idx]);
+		if (0 == pv__fanout_queued(state, sink, iov))
+			continue;
+		FD_SET(sink->fd, writefds);
+		if (sink->fd > max_fd)
+			max_fd = sink->fd;
+	}
+
+	return max_fd;
+}
+
+
+/*
+ * Write to each --tee output which "writefds" says is ready, as much of the
+ * data waiting for it as it will take.
+ */
+void pv_fanout_flush(pvstate_t state, fd_set *writefds)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < state->sink_count; idx++) {
+		struct pvsink_s *sink = &(state->sinks[idx]);
+		if ((PV_SINK_OPEN != sink->status) || (!FD_ISSET(sink->fd, writefds)))
+			continue;
+		pv__fanout_write(state, sink);
+	}
+}
+
+
+/*
+ * Return the number of bytes waiting to be written to "sink".
+ */
+unsigned long long pv_fanout_queued(pvstate_t state, struct pvsink_s *sink)
+{
+	if (PV_SINK_OPEN != sink->status)
+		return 0;
+	if (state->split)
+		return sink->buffer_fill - sink->buffer_done;
+	return state->fanout_head - sink->counter.position;
+}
+
+
+/*
+ * Return true if any --tee output still has data waiting for it.
+ */
+bool pv_fanout_pending(pvstate_t state)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < state->sink_count; idx++) {
+		if (pv_fanout_queued(state, &(state->sinks[idx])) > 0)
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Wait briefly for any --tee outputs with data waiting for them to become
+ * writable, and write to them; used once standard output has had
+ * everything, while the slower outputs catch up.
+ */
+void pv_fanout_wait(pvstate_t state)
+{
+	struct timeval tv;
+	fd_set writefds;
+	int max_fd;
+
+	FD_ZERO(&writefds);
+	max_fd = pv_fanout_fdset(state, &writefds, -1);
+	if (max_fd < 0)
+		return;
+
+	tv.tv_sec = 0;
+	tv.tv_usec = 90000;
+
+	if (select(max_fd + 1, NULL, &writefds, NULL, &tv) > 0)
+		pv_fanout_flush(state, &writefds);
+}
+
+
+/*
+ * Close all of the --tee outputs, waiting for any commands to finish, and
+ * free their buffers.
+ */
+void pv_fanout_fini(pvstate_t state)
+{
+	unsigned int idx;
+
+	if (NULL != state->sinks) {
+		for (idx = 0; idx < state->sink_count; idx++) {
+			pv__fanout_close(state, &(state->sinks[idx]), state->sinks[idx].status);
+			if (NULL != state->sinks[idx].buffer)
+				free(state->sinks[idx].buffer);
+		}
+		free(state->sinks);
+	}
+	state->sinks = NULL;
+	state->sink_count = 0;
+
+	if (NULL != state->fanout_ring)
+		free(state->fanout_ring);
+	state->fanout_ring = NULL;
+	state->fanout_ring_size = 0;
+}
+
+/* EOF */
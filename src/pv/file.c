@@ -20,10 +20,27 @@
 #include <limits.h>
 
 
+/*
+ * Return how much of an input file of "size" bytes lies inside the window
+ * selected by --skip-input and --input-length.
+ */
+static unsigned long long pv__file_window(pvstate_t state, unsigned long long size)
+{
+	size = (size > state->skip_input) ? size - state->skip_input : 0;
+	if ((state->input_length > 0) && (size > state->input_length))
+		size = state->input_length;
+	return size;
+}
+
+
 /*
  * Try to work out the total size of all data by adding up the sizes of all
  * input files. If any of the input files are of indeterminate size (i.e.
- * they are a pipe), the total size is set to zero.
+ * they are a pipe), the total size is set to zero, unless --input-length
+ * says how much will be read from each one.
+ *
+ * Only the part of each file inside the --skip-input / --input-length
+ * window is counted.
  *
  * Any files that cannot be stat()ed or that access() says we can't read
  * will cause a warning to be output and will be removed from the list.
@@ -36,7 +53,7 @@
  */
 unsigned long long pv_calc_total_size(pvstate_t state)
 {
-	unsigned long long total;
+	unsigned long long total, scanned;
 	struct stat sb;
 	int rc, i, j, fd;
 
@@ -48,8 +65,11 @@ unsigned long long pv_calc_total_size(pvstate_t state)
 	 * No files specified - check stdin.
 	 */
 	if (state->input_file_count < 1) {
-		if (0 == fstat(STDIN_FILENO, &sb))
-			total = sb.st_size;
+		if ((0 == fstat(STDIN_FILENO, &sb)) && (S_ISREG(sb.st_mode))) {
+			total = pv__file_window(state, sb.st_size);
+		} else if (state->input_length > 0) {
+			total = state->input_length;
+		}
 		return total;
 	}
 
@@ -88,14 +108,16 @@ unsigned long long pv_calc_total_size(pvstate_t state)
 				fd = open(state->input_files[i], O_RDONLY);
 			}
 			if (fd >= 0) {
-				total += lseek(fd, 0, SEEK_END);
+				total += pv__file_window(state, lseek(fd, 0, SEEK_END));
 				close(fd);
 			} else {
 				pv_error(state, "%s: %s", state->input_files[i], strerror(errno));
 				state->exit_status |= 2;
 			}
 		} else if (S_ISREG(sb.st_mode)) {
-			total += sb.st_size;
+			total += pv__file_window(state, sb.st_size);
+		} else if (state->input_length > 0) {
+			total += state->input_length;
 		} else {
 			total = 0;
 		}
@@ -110,15 +132,19 @@ unsigned long long pv_calc_total_size(pvstate_t state)
 	 * and that we can seek back to the start after getting the size.
 	 */
 	if (total <= 0) {
-		rc = fstat(STDOUT_FILENO, &sb);
+		rc = fstat(state->output_fd, &sb);
 		if ((0 == rc) && S_ISBLK(sb.st_mode)
-		    && (0 == (fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND))) {
-			total = lseek(STDOUT_FILENO, 0, SEEK_END);
-			if (lseek(STDOUT_FILENO, 0, SEEK_SET) != 0) {
+		    && (0 == (fcntl(state->output_fd, F_GETFL) & O_APPEND))) {
+			total = lseek(state->output_fd, 0, SEEK_END);
+			if (lseek(state->output_fd, 0, SEEK_SET) != 0) {
 				pv_error(state, "%s: %s: %s", "(stdout)",
 					 _("failed to seek to start of output"), strerror(errno));
 				state->exit_status |= 2;
 			}
+			/*
+			 * Only the part after --seek-output will be written.
+			 */
+			total = (total > state->seek_output) ? total - state->seek_output : 0;
 			/*
 			 * If we worked out a size, then set the
 			 * stop-at-size flag to prevent a "no space left on
@@ -165,11 +191,20 @@ unsigned long long pv_calc_total_size(pvstate_t state)
 			return total;
 		}
 
-		while (1) {
+		if (state->skip_input > 0)
+			lseek(fd, (off_t) (state->skip_input), SEEK_CUR);
+		scanned = 0;
+
+		while ((0 == state->input_length) || (scanned < state->input_length)) {
 			unsigned char scanbuf[1024];
+			size_t scansize;
 			int numread, j;
 
-			numread = read(fd, scanbuf, sizeof(scanbuf));
+			scansize = sizeof(scanbuf);
+			if ((state->input_length > 0) && (state->input_length - scanned < scansize))
+				scansize = state->input_length - scanned;
+
+			numread = read(fd, scanbuf, scansize);
 			if (numread < 0) {
 				pv_error(state, "%s: %s", state->input_files[i], strerror(errno));
 				state->exit_status |= 2;
@@ -181,6 +216,7 @@ unsigned long long pv_calc_total_size(pvstate_t state)
 				if ('\n' == scanbuf[j])
 					total++;
 			}
+			scanned += numread;
 		}
 
 		lseek(fd, 0, SEEK_SET);
@@ -191,6 +227,203 @@ unsigned long long pv_calc_total_size(pvstate_t state)
 }
 
 
+/*
+ * If a pipe size was given, and "fd" is a pipe, try to set its capacity to
+ * that size, reporting (but otherwise ignoring) failure.
+ */
+void pv_set_pipe_size(pvstate_t state, int fd)
+{
+#ifdef F_SETPIPE_SZ
+	struct stat sb;
+
+	if (0 == state->pipe_size)
+		return;
+	if ((0 != fstat(fd, &sb)) || (!S_ISFIFO(sb.st_mode)))
+		return;
+
+	if (fcntl(fd, F_SETPIPE_SZ, (int) (state->pipe_size)) < 0) {
+		pv_error(state, "%s: %s", _("failed to set pipe size"), strerror(errno));
+	} else {
+		debug("%s %d: %s: %d", "fd", fd, "pipe size", fcntl(fd, F_GETPIPE_SZ));
+	}
+#endif				/* F_SETPIPE_SZ */
+}
+
+
+/*
+ * With --preallocate, if the amount to be written is known and the output
+ * is a regular file, ask the filesystem to allocate space for it all now,
+ * rather than a bit at a time as it is written.  The file size is set to
+ * what it will be at the end, unless appending, in which case the space
+ * is allocated past the end of the file without changing its size.
+ *
+ * If it can't be done, say so, since the output will then be allocated
+ * on demand as usual.
+ */
+void pv_preallocate_output(pvstate_t state)
+{
+#ifdef HAVE_FALLOCATE
+	unsigned long long remaining;
+	struct stat sb;
+	off_t start;
+	int mode, flags;
+
+	state->prealloc_active = false;
+
+	if ((!state->preallocate) || (state->linemode) || (state->size <= state->initial_offset))
+		return;
+	if ((0 != fstat(state->output_fd, &sb)) || (!S_ISREG(sb.st_mode)))
+		return;
+
+	remaining = state->size - state->initial_offset;
+
+	mode = 0;
+	flags = fcntl(state->output_fd, F_GETFL);
+	if ((flags >= 0) && (0 != (flags & O_APPEND))) {
+#ifdef FALLOC_FL_KEEP_SIZE
+		mode = FALLOC_FL_KEEP_SIZE;
+		start = sb.st_size;
+#else				/* !FALLOC_FL_KEEP_SIZE */
+		return;
+#endif				/* FALLOC_FL_KEEP_SIZE */
+	} else {
+		start = lseek(state->output_fd, 0, SEEK_CUR);
+		if (start < 0)
+			return;
+	}
+
+	if (0 != fallocate(state->output_fd, mode, start, (off_t) remaining)) {
+		pv_error(state, "%s: %s: %s", "(stdout)", _("preallocation failed, allocating on demand"),
+			 strerror(errno));
+		return;
+	}
+
+	debug("%s: %lld + %llu%s", "preallocated output", (long long) start, remaining,
+	      0 == mode ? "" : " (keeping size)");
+
+	state->prealloc_active = true;
+	state->prealloc_keep_size = (0 == mode) ? false : true;
+	state->prealloc_end = start + (off_t) remaining;
+	state->prealloc_orig_size = sb.st_size;
+#endif				/* HAVE_FALLOCATE */
+}
+
+
+/*
+ * If the output was preallocated and the transfer has ended early, trim
+ * off the part that was never written, without cutting off anything that
+ * was already in the file before we started.
+ */
+void pv_preallocate_trim(pvstate_t state)
+{
+	struct stat sb;
+	off_t end;
+
+	if (!state->prealloc_active)
+		return;
+
+	state->prealloc_active = false;
+
+	if (0 != fstat(state->output_fd, &sb))
+		return;
+
+	if (state->prealloc_keep_size) {
+		/*
+		 * Release any space allocated past the end of the file.
+		 */
+		end = sb.st_size;
+	} else {
+		end = lseek(state->output_fd, 0, SEEK_CUR);
+		if ((end < 0) || (end >= state->prealloc_end))
+			return;
+		if (end < state->prealloc_orig_size)
+			end = state->prealloc_orig_size;
+		if (end >= sb.st_size)
+			return;
+	}
+
+	debug("%s: %lld", "trimming preallocated output", (long long) end);
+
+	if (0 != ftruncate(state->output_fd, end)) {
+		pv_error(state, "%s: %s: %s", "(stdout)", _("failed to trim preallocated output"), strerror(errno));
+		state->exit_status |= 16;
+	}
+}
+
+
+/*
+ * Move past the first --skip-input bytes of the input file "fd", with
+ * lseek() if it's seekable, or otherwise by throwing them away - with
+ * splice() to /dev/null if possible, so they don't have to be copied.
+ * Reaching the end of the input first is not an error.  Returns false on
+ * error.
+ */
+static bool pv__file_skip(pvstate_t state, int fd)
+{
+	unsigned char discard[16384];	 /* flawfinder: ignore */
+	unsigned long long remaining;
+	ssize_t nread;
+
+	/*
+	 * flawfinder: discard is only filled by read(), bounded by its
+	 * size.
+	 */
+
+	if (0 == state->skip_input)
+		return true;
+
+	if (lseek(fd, (off_t) (state->skip_input), SEEK_CUR) >= 0)
+		return true;
+
+	if (ESPIPE != errno) {
+		pv_error(state, "%s: %s: %s", state->current_file, _("failed to skip input"), strerror(errno));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	remaining = state->skip_input;
+
+#ifdef HAVE_SPLICE
+	{
+		int nullfd;
+
+		nullfd = open("/dev/null", O_WRONLY);
+		while ((nullfd >= 0) && (remaining > 0) && (!pv_sig_aborted(state))) {
+			size_t count;
+
+			count = remaining > MAX_READ_AT_ONCE ? MAX_READ_AT_ONCE : (size_t) remaining;
+			nread = splice(fd, NULL, nullfd, NULL, count, SPLICE_F_MORE);
+			if (nread > 0) {
+				remaining -= nread;
+			} else if (0 == nread) {
+				remaining = 0;
+			} else if (EINTR != errno) {
+				debug("%s %d: %s: %s", "fd", fd, "splice to /dev/null failed", strerror(errno));
+				break;
+			}
+		}
+		if (nullfd >= 0)
+			close(nullfd);
+	}
+#endif				/* HAVE_SPLICE */
+
+	while ((remaining > 0) && (!pv_sig_aborted(state))) {
+		nread = read(fd, discard, remaining > sizeof(discard) ? sizeof(discard) : (size_t) remaining);
+		if (nread > 0) {
+			remaining -= nread;
+		} else if (0 == nread) {
+			remaining = 0;
+		} else if ((EINTR != errno) && (EAGAIN != errno)) {
+			pv_error(state, "%s: %s: %s", state->current_file, _("failed to skip input"), strerror(errno));
+			state->exit_status |= 16;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
 /*
  * Close the given file descriptor and open the next one, whose number in
  * the list is "filenum", returning the new file descriptor (or negative on
@@ -204,6 +437,7 @@ int pv_next_file(pvstate_t state, int filenum, int oldfd)
 	struct stat isb;
 	struct stat osb;
 	int fd, input_file_is_stdout;
+	bool resuming;
 
 	if (oldfd > 0) {
 		if (close(oldfd)) {
@@ -242,7 +476,7 @@ int pv_next_file(pvstate_t state, int filenum, int oldfd)
 		return -1;
 	}
 
-	if (fstat(STDOUT_FILENO, &osb)) {
+	if (fstat(state->output_fd, &osb)) {
 		pv_error(state, "%s: %s", _("failed to stat output file"), strerror(errno));
 		close(fd);
 		state->exit_status |= 2;
@@ -252,7 +486,8 @@ int pv_next_file(pvstate_t state, int filenum, int oldfd)
 	/*
 	 * Check that this new input file is not the same as stdout's
 	 * destination. This restriction is ignored for anything other
-	 * than a regular file or block device.
+	 * than a regular file or block device, and with --discard, when
+	 * nothing is written there.
 	 */
 	input_file_is_stdout = 1;
 	if (isb.st_dev != osb.st_dev)
@@ -263,6 +498,8 @@ int pv_next_file(pvstate_t state, int filenum, int oldfd)
 		input_file_is_stdout = 0;
 	if ((!S_ISREG(isb.st_mode)) && (!S_ISBLK(isb.st_mode)))
 		input_file_is_stdout = 0;
+	if (state->discard)
+		input_file_is_stdout = 0;
 
 	if (input_file_is_stdout) {
 		pv_error(state, "%s: %s", _("input file is output file"), state->input_files[filenum]);
@@ -272,20 +509,66 @@ int pv_next_file(pvstate_t state, int filenum, int oldfd)
 	}
 
 	state->current_file = state->input_files[filenum];
+	state->current_file_num = filenum;
 	if (0 == strcmp(state->input_files[filenum], "-")) {
 		state->current_file = "(stdin)";
 	}
+
+	/*
+	 * Note how much should come from this file, for --per-file.
+	 */
+	state->current_file_size = 0;
+	if (S_ISREG(isb.st_mode)) {
+		state->current_file_size = pv__file_window(state, isb.st_size);
+	} else if (state->input_length > 0) {
+		state->current_file_size = state->input_length;
+	}
+
+	/*
+	 * If resuming from a checkpoint in this file, seek to it before
+	 * O_DIRECT might get in the way of checking it; otherwise, move to
+	 * the start of the --skip-input window.
+	 */
+	resuming = (state->resume_pending && (filenum == state->resume_file)) ? true : false;
+	if ((!pv_checkpoint_resume_input(state, fd, filenum))
+	    || ((!resuming) && (!pv__file_skip(state, fd)))) {
+		if (fd != STDIN_FILENO)
+			close(fd);
+		return -1;
+	}
+
+	/*
+	 * Read no more than --input-length bytes, less any already read
+	 * from this file before the checkpoint being resumed from.
+	 */
+	state->input_remaining = -1;
+	if (state->input_length > 0) {
+		state->input_remaining = (long long) (state->input_length);
+		if (resuming)
+			state->input_remaining -=
+			    (long long) (state->resume_input_offset) - (long long) (state->skip_input);
+		if (state->input_remaining < 0)
+			state->input_remaining = 0;
+	}
 #ifdef O_DIRECT
 	/*
 	 * Set or clear O_DIRECT on the file descriptor.
 	 */
-	fcntl(fd, F_SETFL, (state->direct_io ? O_DIRECT : 0) | fcntl(fd, F_GETFL));
+	fcntl(fd, F_SETFL, (state->direct_io ? O_DIRECT : 0) | (fcntl(fd, F_GETFL) & ~O_DIRECT));
 	/*
 	 * We don't clear direct_io_changed here, to avoid race conditions
 	 * that could cause the input and output settings to differ.
 	 */
 #endif				/* O_DIRECT */
 
+	pv_set_pipe_size(state, fd);
+
+	/*
+	 * Work out which I/O engines to try on this input.
+	 */
+	pv_skipped_reset(state);
+	pv_engine_start(state, fd);
+
 	return fd;
 }
 
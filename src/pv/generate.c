@@ -0,0 +1,373 @@
+/*
+ * Functions for producing synthetic data with --generate instead of
+ * reading any input: zero bytes, a repeating pattern, seeded pseudo-random
+ * data, or compressible text.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PV_GENERATE_X86 1
+#endif				/* __GNUC__ && __x86_64__ */
+
+/*
+ * Words that --generate text builds its lines from.
+ */
+static const char *pv__generate_words[] = {
+	"the", "of", "and", "to", "in", "is", "was", "that", "for", "on",
+	"with", "as", "by", "at", "from", "this", "be", "or", "an", "which",
+	"data", "pipe", "buffer", "transfer", "progress", "rate", "time",
+	"file", "output", "input", "block", "stream", "value", "record",
+	"system", "monitor", "process", "network", "storage", "compress"
+};
+
+
+/*
+ * Return the next value of the SplitMix64 generator with state "x", which
+ * is used to seed the others from a single number.
+ */
+static unsigned long long pv__generate_splitmix(unsigned long long *x)
+{
+	unsigned long long z;
+
+	*x += 0x9E3779B97F4A7C15ULL;
+	z = *x;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+
+/*
+ * Write "rounds" rounds of GENERATE_LANES * 8 bytes of pseudo-random data
+ * to "out", each round being one 64-bit little-endian word from each of
+ * the xorshift128+ lanes in turn.  The lanes are independent so that the
+ * compiler can step them all at once with vector instructions.
+ */
+#ifdef __GNUC__
+__attribute__((always_inline))
+#endif
+static inline void pv__generate_rounds_inline(struct pvgenerate_s *gen, unsigned char *out, size_t rounds)
+{
+	unsigned long long lane_a[GENERATE_LANES], lane_b[GENERATE_LANES];
+	int lane;
+
+	memcpy(lane_a, gen->lane_a, sizeof(lane_a));
+	memcpy(lane_b, gen->lane_b, sizeof(lane_b));
+
+	for (; rounds > 0; rounds--) {
+		for (lane = 0; lane < GENERATE_LANES; lane++) {
+			unsigned long long s0, s1, word;
+
+			s1 = lane_a[lane];
+			s0 = lane_b[lane];
+			word = s0 + s1;
+			lane_a[lane] = s0;
+			s1 ^= s1 << 23;
+			lane_b[lane] = s1 ^ s0 ^ (s1 >> 18) ^ (s0 >> 5);
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+			memcpy(out + lane * 8, &word, 8);
+#else				/* !__ORDER_LITTLE_ENDIAN__ */
+			{
+				int byte;
+				for (byte = 0; byte < 8; byte++)
+					out[lane * 8 + byte] = (unsigned char) (word >> (8 * byte));
+			}
+#endif				/* __ORDER_LITTLE_ENDIAN__ */
+		}
+		out += GENERATE_LANES * 8;
+	}
+
+	memcpy(gen->lane_a, lane_a, sizeof(lane_a));
+	memcpy(gen->lane_b, lane_b, sizeof(lane_b));
+}
+
+
+#ifdef PV_GENERATE_X86
+/*
+ * Generate pseudo-random data with the AVX2 instructions, which step all
+ * four lanes at once.
+ */
+__attribute__((target("avx2")))
+static void pv__generate_rounds_avx2(struct pvgenerate_s *gen, unsigned char *out, size_t rounds)
+{
+	pv__generate_rounds_inline(gen, out, rounds);
+}
+#endif				/* PV_GENERATE_X86 */
+
+
+/*
+ * Generate pseudo-random data as above, with the widest vector instructions
+ * the CPU offers.
+ */
+static void pv__generate_rounds(struct pvgenerate_s *gen, unsigned char *out, size_t rounds)
+{
+#ifdef PV_GENERATE_X86
+	if (gen->avx2) {
+		pv__generate_rounds_avx2(gen, out, rounds);
+		return;
+	}
+#endif				/* PV_GENERATE_X86 */
+	pv__generate_rounds_inline(gen, out, rounds);
+}
+
+
+/*
+ * Fill one period of --generate text: lines of words picked with the
+ * SplitMix64 generator seeded with "seed", the last line padded with
+ * spaces so that it ends exactly at the end of the period.
+ */
+static void pv__generate_text(unsigned char *period, size_t length, unsigned long long seed)
+{
+	size_t pos, line_length, word_count;
+
+	word_count = sizeof(pv__generate_words) / sizeof(pv__generate_words[0]);
+	pos = 0;
+	line_length = 0;
+
+	while (pos < length - 1) {
+		const char *word;
+		size_t word_length;
+
+		word = pv__generate_words[pv__generate_splitmix(&seed) % word_count];
+		word_length = strlen(word);
+
+		if (pos + word_length + 2 > length)
+			break;
+
+		if ((line_length > 0) && (line_length + word_length + 1 > GENERATE_TEXT_WIDTH)) {
+			period[pos++] = '\n';
+			line_length = 0;
+		} else if (line_length > 0) {
+			period[pos++] = ' ';
+			line_length++;
+		}
+
+		memcpy(period + pos, word, word_length);
+		pos += word_length;
+		line_length += word_length;
+	}
+
+	while (pos < length - 1)
+		period[pos++] = ' ';
+	period[pos] = '\n';
+}
+
+
+/*
+ * Return a new generator for the data described by "spec", which is one
+ * of "zero", "pattern[:STRING]", "random[:SEED]", or "text[:SEED]", or
+ * NULL on error, reporting the error as being with "option".
+ */
+struct pvgenerate_s *pv_generate_new(pvstate_t state, const char *spec, const char *option)
+{
+	struct pvgenerate_s *gen;
+	const char *arg;
+	size_t name_length;
+	unsigned long long seed;
+	int lane;
+
+	gen = calloc(1, sizeof(*gen));
+	if (NULL == gen) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return NULL;
+	}
+
+	arg = strchr(spec, ':');
+	name_length = (NULL == arg) ? strlen(spec) : (size_t) (arg - spec);
+	if (NULL != arg)
+		arg++;
+
+	if ((4 == name_length) && (0 == strncmp(spec, "zero", 4)) && (NULL == arg)) {
+		gen->type = PV_GENERATE_ZERO;
+		gen->period_length = 1;
+	} else if ((7 == name_length) && (0 == strncmp(spec, "pattern", 7))) {
+		gen->type = PV_GENERATE_PATTERN;
+		gen->period_length = ((NULL == arg) || ('\0' == *arg)) ? 256 : strlen(arg);
+	} else if ((6 == name_length) && (0 == strncmp(spec, "random", 6))) {
+		gen->type = PV_GENERATE_RANDOM;
+	} else if ((4 == name_length) && (0 == strncmp(spec, "text", 4))) {
+		gen->type = PV_GENERATE_TEXT;
+		gen->period_length = GENERATE_TEXT_PERIOD;
+	} else {
+		pv_error(state, "%s: %s: %s", option, spec, _("unknown type of data"));
+		state->exit_status |= 2;
+		free(gen);
+		return NULL;
+	}
+
+	seed = 0;
+	if ((NULL != arg) && (PV_GENERATE_PATTERN != gen->type)) {
+		char *end = NULL;
+		seed = strtoull(arg, &end, 10);
+		if ((NULL == end) || ('\0' != *end) || ('\0' == *arg)) {
+			pv_error(state, "%s: %s: %s", option, spec, _("invalid seed"));
+			state->exit_status |= 2;
+			free(gen);
+			return NULL;
+		}
+	}
+
+	if (gen->period_length > 0) {
+		gen->period = malloc(gen->period_length);
+		if (NULL == gen->period) {
+			pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->exit_status |= 64;
+			free(gen);
+			return NULL;
+		}
+	}
+
+	switch (gen->type) {
+	case PV_GENERATE_ZERO:
+		gen->period[0] = 0;
+		break;
+	case PV_GENERATE_PATTERN:
+		if ((NULL == arg) || ('\0' == *arg)) {
+			size_t idx;
+			for (idx = 0; idx < 256; idx++)
+				gen->period[idx] = (unsigned char) idx;
+		} else {
+			memcpy(gen->period, arg, gen->period_length);
+		}
+		break;
+	case PV_GENERATE_TEXT:
+		pv__generate_text(gen->period, gen->period_length, seed);
+		break;
+	default:
+		for (lane = 0; lane < GENERATE_LANES; lane++) {
+			gen->lane_a[lane] = pv__generate_splitmix(&seed);
+			gen->lane_b[lane] = pv__generate_splitmix(&seed);
+		}
+#ifdef PV_GENERATE_X86
+		gen->avx2 = __builtin_cpu_supports("avx2") ? true : false;
+#endif				/* PV_GENERATE_X86 */
+		break;
+	}
+
+	debug("%s: %s: %d, %s %ld", option, spec, gen->type, "period", (long) (gen->period_length));
+
+	return gen;
+}
+
+
+/*
+ * Write the next "count" bytes of the generated data to "buf".
+ */
+void pv_generate_data(struct pvgenerate_s *gen, unsigned char *buf, size_t count)
+{
+	size_t amount;
+
+	if (gen->period_length > 0) {
+		/*
+		 * A repeating type: copy from the period, starting where
+		 * the last call left off in it.
+		 */
+		while (count > 0) {
+			amount = gen->period_length - gen->phase;
+			if (amount > count)
+				amount = count;
+			memcpy(buf, gen->period + gen->phase, amount);
+			buf += amount;
+			count -= amount;
+			gen->phase += amount;
+			if (gen->phase >= gen->period_length)
+				gen->phase = 0;
+		}
+		return;
+	}
+
+	/*
+	 * Pseudo-random data: use up what is left of the last round, then
+	 * write whole rounds straight to the buffer, keeping any part of
+	 * the last one that isn't needed yet for next time.
+	 */
+	amount = gen->spare_length < count ? gen->spare_length : count;
+	if (amount > 0) {
+		memcpy(buf, gen->spare + sizeof(gen->spare) - gen->spare_length, amount);
+		buf += amount;
+		count -= amount;
+		gen->spare_length -= amount;
+	}
+
+	if (count >= sizeof(gen->spare)) {
+		size_t rounds = count / sizeof(gen->spare);
+		pv__generate_rounds(gen, buf, rounds);
+		buf += rounds * sizeof(gen->spare);
+		count -= rounds * sizeof(gen->spare);
+	}
+
+	if (count > 0) {
+		pv__generate_rounds(gen, gen->spare, 1);
+		memcpy(buf, gen->spare, count);
+		gen->spare_length = sizeof(gen->spare) - count;
+	}
+}
+
+
+/*
+ * Free a generator and everything it holds.
+ */
+void pv_generate_free(struct pvgenerate_s *gen)
+{
+	if (NULL == gen)
+		return;
+	if (NULL != gen->period)
+		free(gen->period);
+	free(gen);
+}
+
+
+/*
+ * Set up the generator for --generate, in place of opening the first input
+ * file.  The rest of the main loop still expects an input file descriptor,
+ * so one open on /dev/null is returned, which is never read from.  Returns
+ * -1 on error.
+ */
+int pv_generate_open(pvstate_t state)
+{
+	int fd;
+
+	if (NULL == state->generator) {
+		state->generator = pv_generate_new(state, state->generate, "--generate");
+		if (NULL == state->generator)
+			return -1;
+	}
+
+	fd = open("/dev/null", O_RDONLY);	/* flawfinder: ignore */
+
+	/*
+	 * flawfinder: the path is fixed, and the file is never read.
+	 */
+
+	if (fd < 0) {
+		pv_error(state, "%s: %s: %s", _("failed to read file"), "/dev/null", strerror(errno));
+		state->exit_status |= 2;
+		return -1;
+	}
+
+	state->current_file = _("(generated)");
+	state->current_file_num = 0;
+	state->input_remaining = -1;
+
+	pv_engine_start(state, fd);
+
+	return fd;
+}
+
+/* EOF */
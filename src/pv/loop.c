@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/select.h>
 
 
 /*
@@ -44,6 +45,271 @@ static void pv_timeval_add_usec(struct timeval *val, long usec)
 }
 
 
+/*
+ * Timing shared by the transfer loops: when the transfer started, when the
+ * display, rate limit, and remote control checks are next due, and how
+ * much the rate limit allows to be sent.
+ */
+struct pvlooptimer_s {
+	struct timeval start_time;	 /* when the transfer started */
+	struct timeval cur_time;	 /* time as of the last check */
+	struct timeval next_update;	 /* when the display is next due */
+	struct timeval next_ratecheck;	 /* when the rate allowance next grows */
+	struct timeval next_remotecheck; /* when to next check for -R messages */
+	long rate_granularity;		 /* microseconds between rate checks */
+	long double target;		 /* amount the rate limit allows */
+};
+
+
+/*
+ * Start the loop timer "timer" from now, with the first display update due
+ * after one interval, or after the --delay-start time if that is longer.
+ */
+static void pv_loop_timer_init(pvstate_t state, struct pvlooptimer_s *timer)
+{
+	gettimeofday(&(timer->start_time), NULL);
+	gettimeofday(&(timer->cur_time), NULL);
+
+	timer->next_update.tv_sec = timer->start_time.tv_sec;
+	timer->next_update.tv_usec = timer->start_time.tv_usec;
+	if ((state->delay_start > 0)
+	    && (state->delay_start > state->interval)) {
+		pv_timeval_add_usec(&(timer->next_update), (long) (1000000.0 * state->delay_start));
+	} else {
+		pv_timeval_add_usec(&(timer->next_update), (long) (1000000.0 * state->interval));
+	}
+
+	timer->next_ratecheck.tv_sec = timer->start_time.tv_sec;
+	timer->next_ratecheck.tv_usec = timer->start_time.tv_usec;
+	timer->next_remotecheck.tv_sec = timer->start_time.tv_sec;
+	timer->next_remotecheck.tv_usec = timer->start_time.tv_usec;
+
+	/*
+	 * With a --max-latency target, let rate limited data out in smaller
+	 * chunks more often, so that it isn't held waiting for the next one.
+	 */
+	timer->rate_granularity = RATE_GRANULARITY;
+	if ((state->max_latency > 0) && (250000.0 * state->max_latency < RATE_GRANULARITY)) {
+		timer->rate_granularity = (long) (250000.0 * state->max_latency);
+		if (timer->rate_granularity < LATENCY_GRANULARITY_MIN)
+			timer->rate_granularity = LATENCY_GRANULARITY_MIN;
+	}
+
+	timer->target = 0;
+}
+
+
+/*
+ * Do the checks due at the start of each time around a transfer loop:
+ * look for remote messages from -R every short while, and with a rate
+ * limit, add to the amount the rate limit allows once each granularity
+ * period, up to the burst window.
+ */
+static void pv_loop_timer_tick(pvstate_t state, struct pvlooptimer_s *timer)
+{
+	struct timeval *cur_time;
+
+	cur_time = &(timer->cur_time);
+
+	if ((cur_time->tv_sec > timer->next_remotecheck.tv_sec)
+	    || (cur_time->tv_sec == timer->next_remotecheck.tv_sec
+		&& cur_time->tv_usec >= timer->next_remotecheck.tv_usec)) {
+		pv_remote_check(state);
+		pv_timeval_add_usec(&(timer->next_remotecheck), REMOTE_INTERVAL);
+	}
+
+	if (state->rate_limit <= 0)
+		return;
+
+	gettimeofday(cur_time, NULL);
+	if ((cur_time->tv_sec > timer->next_ratecheck.tv_sec)
+	    || (cur_time->tv_sec == timer->next_ratecheck.tv_sec
+		&& cur_time->tv_usec >= timer->next_ratecheck.tv_usec)) {
+		long double burst_max;
+
+		timer->target +=
+		    ((long double) (state->rate_limit)) * (long double) (timer->rate_granularity) / 1000000.0;
+		burst_max = ((long double) (state->rate_limit * RATE_BURST_WINDOW));
+		if (timer->target > burst_max)
+			timer->target = burst_max;
+		pv_timeval_add_usec(&(timer->next_ratecheck), timer->rate_granularity);
+	}
+}
+
+
+/*
+ * Update the display if it is due as of the last check of the time, or
+ * straight away if this is the final update and the display has been
+ * shown or wasn't being delayed, passing on "since_last" and
+ * "total_written" and then resetting "since_last" to zero.
+ */
+static void pv_loop_timer_display(pvstate_t state, struct pvlooptimer_s *timer, bool final_update,
+				  long long *since_last, long long total_written)
+{
+	struct timeval *cur_time, *next_update;
+	struct timeval init_time;
+	long double elapsed;
+
+	cur_time = &(timer->cur_time);
+	next_update = &(timer->next_update);
+
+	if (final_update && ((state->display_visible) || (0 == state->delay_start)))
+		next_update->tv_sec = cur_time->tv_sec - 1;
+
+	if ((cur_time->tv_sec < next_update->tv_sec)
+	    || (cur_time->tv_sec == next_update->tv_sec && cur_time->tv_usec < next_update->tv_usec)) {
+		return;
+	}
+
+	pv_timeval_add_usec(next_update, (long) (1000000.0 * state->interval));
+
+	if (next_update->tv_sec < cur_time->tv_sec) {
+		next_update->tv_sec = cur_time->tv_sec;
+		next_update->tv_usec = cur_time->tv_usec;
+	} else if (next_update->tv_sec == cur_time->tv_sec && next_update->tv_usec < cur_time->tv_usec) {
+		next_update->tv_usec = cur_time->tv_usec;
+	}
+
+	init_time.tv_sec = timer->start_time.tv_sec + state->pv_sig_toffset.tv_sec;
+	init_time.tv_usec = timer->start_time.tv_usec + state->pv_sig_toffset.tv_usec;
+	if (init_time.tv_usec >= 1000000) {
+		init_time.tv_sec++;
+		init_time.tv_usec -= 1000000;
+	}
+	if (init_time.tv_usec < 0) {
+		init_time.tv_sec--;
+		init_time.tv_usec += 1000000;
+	}
+
+	elapsed = cur_time->tv_sec - init_time.tv_sec;
+	elapsed += (cur_time->tv_usec - init_time.tv_usec) / 1000000.0;
+
+	if (final_update)
+		*since_last = -1;
+
+	if (state->pv_sig_newsize) {
+		state->pv_sig_newsize = 0;
+		pv_screensize(&(state->width), &(state->height));
+	}
+
+	pv_display(state, elapsed, *since_last, total_written);
+
+	*since_last = 0;
+}
+
+
+/*
+ * Leave the terminal tidy once a transfer loop has finished: restore the
+ * cursor with -c, or otherwise move past the display and any extra lines
+ * drawn below it.
+ */
+static void pv_loop_display_end(pvstate_t state)
+{
+	if (state->cursor) {
+		pv_crs_fini(state);
+	} else {
+		if ((!state->numeric) && (!state->no_op)
+		    && (state->display_visible))
+			pv_write_retry(STDERR_FILENO, "\n", 1);
+		for (; state->display_sublines > 0; state->display_sublines--)
+			pv_write_retry(STDERR_FILENO, "\n", 1);
+	}
+}
+
+
+/*
+ * Run all of the --multi transfers at once, waiting for any of them to be
+ * able to move data along, showing their total progress on the main
+ * display line with a line for each stream below it.  Any rate limit is
+ * shared equally between the streams still running.
+ *
+ * Returns nonzero on error.
+ */
+static int pv_multi_loop(pvstate_t state)
+{
+	struct pvlooptimer_s timer;
+	long long total_written, since_last, written;
+	bool final_update;
+
+	pv_crs_init(state);
+
+	if (!pv_multi_open(state)) {
+		pv_multi_fini(state);
+		if (state->cursor)
+			pv_crs_fini(state);
+		return state->exit_status;
+	}
+
+	total_written = 0;
+	since_last = 0;
+	state->initial_offset = 0;
+
+	pv_loop_timer_init(state, &timer);
+
+	final_update = false;
+
+	while (!final_update) {
+		fd_set readfds, writefds;
+		struct timeval tv;
+		int max_fd;
+
+		pv_loop_timer_tick(state, &timer);
+
+		if (pv_sig_aborted(state))
+			break;
+
+		/*
+		 * Wait for any stream to be ready, unless the rate limit
+		 * leaves nothing to share out, in which case just wait for
+		 * the next allowance.
+		 */
+		FD_ZERO(&readfds);
+		FD_ZERO(&writefds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 90000;
+		max_fd = -1;
+		if ((state->rate_limit > 0) && (timer.target < (long double) pv_multi_active(state))) {
+			tv.tv_usec = timer.rate_granularity;
+		} else {
+			max_fd = pv_multi_fdset(state, &readfds, &writefds, -1);
+		}
+		if ((select(max_fd + 1, &readfds, &writefds, NULL, &tv) < 0) && (EINTR != errno)) {
+			pv_error(state, "%s: %s", _("select call failed"), strerror(errno));
+			state->exit_status |= 16;
+			break;
+		}
+
+		written = pv_multi_transfer(state, state->rate_limit > 0 ? true : false,
+					    timer.target > 0 ? (unsigned long long) (timer.target) : 0);
+		if (written < 0) {
+			final_update = true;
+			written = 0;
+		}
+
+		since_last += written;
+		total_written += written;
+		if (state->rate_limit > 0)
+			timer.target -= written;
+
+		gettimeofday(&(timer.cur_time), NULL);
+
+		if (state->no_op)
+			continue;
+
+		pv_loop_timer_display(state, &timer, final_update, &since_last, total_written);
+	}
+
+	pv_loop_display_end(state);
+
+	if (pv_sig_aborted(state))
+		state->exit_status |= 32;
+
+	pv_multi_fini(state);
+
+	return state->exit_status;
+}
+
+
 /*
  * Pipe data from a list of files to standard output, giving information
  * about the transfer on standard error according to the given options.
@@ -52,13 +318,12 @@ static void pv_timeval_add_usec(struct timeval *val, long usec)
  */
 int pv_main_loop(pvstate_t state)
 {
+	struct pvlooptimer_s timer;
 	long written, lineswritten;
 	long long total_written, since_last, cansend;
-	long double target;
-	int eof_in, eof_out, final_update;
-	struct timeval start_time, next_update, next_ratecheck, cur_time;
-	struct timeval init_time, next_remotecheck;
-	long double elapsed;
+	int eof_in, eof_out;
+	bool final_update;
+	struct timeval next_checkpoint;
 	struct stat sb;
 	int fd, n;
 
@@ -77,6 +342,9 @@ int pv_main_loop(pvstate_t state)
 	 * The remaining variables are all unchanged by linemode.
 	 */
 
+	if (state->multi)
+		return pv_multi_loop(state);
+
 	fd = -1;
 
 	pv_crs_init(state);
@@ -87,41 +355,95 @@ int pv_main_loop(pvstate_t state)
 	since_last = 0;
 	state->initial_offset = 0;
 
-	gettimeofday(&start_time, NULL);
-	gettimeofday(&cur_time, NULL);
-
-	next_update.tv_sec = start_time.tv_sec;
-	next_update.tv_usec = start_time.tv_usec;
-	if ((state->delay_start > 0)
-	    && (state->delay_start > state->interval)) {
-		pv_timeval_add_usec(&next_update, (long) (1000000.0 * state->delay_start));
-	} else {
-		pv_timeval_add_usec(&next_update, (long) (1000000.0 * state->interval));
-	}
+	pv_loop_timer_init(state, &timer);
 
-	next_ratecheck.tv_sec = start_time.tv_sec;
-	next_ratecheck.tv_usec = start_time.tv_usec;
-	next_remotecheck.tv_sec = start_time.tv_sec;
-	next_remotecheck.tv_usec = start_time.tv_usec;
+	next_checkpoint.tv_sec = timer.start_time.tv_sec + CHECKPOINT_INTERVAL;
+	next_checkpoint.tv_usec = timer.start_time.tv_usec;
 
-	target = 0;
-	final_update = 0;
+	final_update = false;
 	n = 0;
 
-	fd = pv_next_file(state, n, -1);
+	/*
+	 * When resuming, start from the input file the checkpoint was taken
+	 * in, counting what was done before as already transferred so that
+	 * the rate and ETA only cover what is transferred this time.
+	 */
+	if (state->resume) {
+		if (!pv_checkpoint_load(state)) {
+			if (state->cursor)
+				pv_crs_fini(state);
+			return state->exit_status;
+		}
+		n = state->resume_file;
+		total_written = state->resume_done;
+		state->initial_offset = state->resume_done;
+	}
+
+	/*
+	 * Start any --exec command before opening the input, so that the I/O
+	 * engine is chosen for the pipe to the command, not standard output.
+	 */
+	if (!pv_exec_start(state)) {
+		if (state->cursor)
+			pv_crs_fini(state);
+		return state->exit_status;
+	}
+
+	fd = (NULL != state->generate) ? pv_generate_open(state) : pv_next_file(state, n, -1);
 	if (fd < 0) {
 		if (state->cursor)
 			pv_crs_fini(state);
 		return state->exit_status;
 	}
+
+	if (!pv_checkpoint_resume_output(state)) {
+		close(fd);
+		if (state->cursor)
+			pv_crs_fini(state);
+		return state->exit_status;
+	}
+
+	/*
+	 * Move past the start of the output, unless resuming, in which case
+	 * the checkpoint already took that into account.
+	 */
+	if ((!state->resume) && (state->seek_output > 0)
+	    && (lseek(state->output_fd, (off_t) (state->seek_output), SEEK_CUR) < 0)) {
+		pv_error(state, "%s: %s: %s", "(stdout)", _("failed to seek output"), strerror(errno));
+		state->exit_status |= 2;
+		close(fd);
+		if (state->cursor)
+			pv_crs_fini(state);
+		return state->exit_status;
+	}
+
+	if (!pv_verify_start(state)) {
+		close(fd);
+		if (state->cursor)
+			pv_crs_fini(state);
+		return state->exit_status;
+	}
+
+	pv_preallocate_output(state);
 #ifdef O_DIRECT
 	/*
 	 * Set or clear O_DIRECT on the output.
 	 */
-	fcntl(STDOUT_FILENO, F_SETFL, (state->direct_io ? O_DIRECT : 0) | fcntl(STDOUT_FILENO, F_GETFL));
+	fcntl(state->output_fd, F_SETFL,
+	      (state->direct_io ? O_DIRECT : 0) | (fcntl(state->output_fd, F_GETFL) & ~O_DIRECT));
 	state->direct_io_changed = false;
 #endif				/* O_DIRECT */
 
+	if (!state->discard)
+		pv_set_pipe_size(state, state->output_fd);
+
+	/*
+	 * With --discard, the buffer is only ever read into and thrown
+	 * away, so make it as big as a single read() is allowed to be.
+	 */
+	if ((state->discard) && (0 == state->target_buffer_size))
+		state->target_buffer_size = MAX_READ_AT_ONCE;
+
 	/*
 	 * Set target buffer size if the initial file's block size can be
 	 * read and we weren't given a target buffer size.
@@ -137,37 +459,43 @@ int pv_main_loop(pvstate_t state)
 	if (0 == state->target_buffer_size)
 		state->target_buffer_size = BUFFER_SIZE;
 
+	/*
+	 * Leave room for a whole input block to be read in while a partial
+	 * output block is still waiting in the buffer.
+	 */
+	if (state->target_buffer_size < (unsigned long long) (state->input_block_size) + state->output_block_size)
+		state->target_buffer_size = (unsigned long long) (state->input_block_size) + state->output_block_size;
+
+	if (!pv_fanout_open(state)) {
+		close(fd);
+		if (state->cursor)
+			pv_crs_fini(state);
+		return state->exit_status;
+	}
+
+	if ((!pv_merge_open(state, fd)) || (!pv_digest_start(state)) || (!pv_validate_start(state))
+	    || (!pv_perfile_start(state, total_written))) {
+		pv_merge_fini(state);
+		pv_fanout_fini(state);
+		close(fd);
+		if (state->cursor)
+			pv_crs_fini(state);
+		return state->exit_status;
+	}
+
+	pv_perfile_update(state, n, total_written);
+
 	while ((!(eof_in && eof_out)) || (!final_update)) {
 
 		cansend = 0;
 
-		/*
-		 * Check for remote messages from -R every short while
-		 */
-		if ((cur_time.tv_sec > next_remotecheck.tv_sec)
-		    || (cur_time.tv_sec == next_remotecheck.tv_sec && cur_time.tv_usec >= next_remotecheck.tv_usec)) {
-			pv_remote_check(state);
-			pv_timeval_add_usec(&next_remotecheck, REMOTE_INTERVAL);
-		}
+		pv_loop_timer_tick(state, &timer);
 
-		if (state->pv_sig_abort)
+		if (pv_sig_aborted(state))
 			break;
 
-		if (state->rate_limit > 0) {
-			gettimeofday(&cur_time, NULL);
-			if ((cur_time.tv_sec > next_ratecheck.tv_sec)
-			    || (cur_time.tv_sec == next_ratecheck.tv_sec && cur_time.tv_usec >= next_ratecheck.tv_usec)) {
-
-				target +=
-				    ((long double) (state->rate_limit)) / (long double) (1000000 / RATE_GRANULARITY);
-				long double burstMax = ((long double) (state->rate_limit * RATE_BURST_WINDOW));
-				if (target > burstMax) {
-					target = burstMax;
-				}
-				pv_timeval_add_usec(&next_ratecheck, RATE_GRANULARITY);
-			}
-			cansend = target;
-		}
+		if (state->rate_limit > 0)
+			cansend = timer.target;
 
 		/*
 		 * If we have to stop at "size" bytes, make sure we don't
@@ -190,9 +518,15 @@ int pv_main_loop(pvstate_t state)
 			written = 0;
 		} else {
 			written = pv_transfer(state, fd, &eof_in, &eof_out, cansend, &lineswritten);
+			pv_engine_update(state, written);
 		}
 
 		if (written < 0) {
+			pv_perfile_finish(state, total_written);
+			pv_parallel_fini(state);
+			pv_error_map_save(state, fd, false);
+			pv_checkpoint_save(state, fd, n, total_written);
+			pv_preallocate_trim(state);
 			if (state->cursor)
 				pv_crs_fini(state);
 			return state->exit_status;
@@ -202,35 +536,67 @@ int pv_main_loop(pvstate_t state)
 			since_last += lineswritten;
 			total_written += lineswritten;
 			if (state->rate_limit > 0)
-				target -= lineswritten;
+				timer.target -= lineswritten;
 		} else {
 			since_last += written;
 			total_written += written;
 			if (state->rate_limit > 0)
-				target -= written;
+				timer.target -= written;
 		}
 
-		if (eof_in && eof_out && n < (state->input_file_count - 1)) {
+		pv_perfile_update(state, n, total_written);
+
+		/*
+		 * Once an input file has been read through, try to recover
+		 * anything skipped because of read errors.
+		 */
+		if (eof_in && eof_out && (state->skipped_tried < state->skipped_count))
+			pv_recover_skipped(state, fd);
+
+		if (eof_in && eof_out && (!state->merge) && n < (state->input_file_count - 1)) {
+			pv_digest_file_end(state, n);
 			n++;
 			fd = pv_next_file(state, n, fd);
 			if (fd < 0) {
+				pv_perfile_finish(state, total_written);
+				pv_preallocate_trim(state);
 				if (state->cursor)
 					pv_crs_fini(state);
 				return state->exit_status;
 			}
+			pv_perfile_update(state, n, total_written);
 			eof_in = 0;
 			eof_out = 0;
 		}
 
-		gettimeofday(&cur_time, NULL);
+		gettimeofday(&(timer.cur_time), NULL);
 
-		if (eof_in && eof_out) {
-			final_update = 1;
-			if ((state->display_visible)
-			    || (0 == state->delay_start))
-				next_update.tv_sec = cur_time.tv_sec - 1;
+		if ((NULL != state->checkpoint)
+		    && ((timer.cur_time.tv_sec > next_checkpoint.tv_sec)
+			|| (timer.cur_time.tv_sec == next_checkpoint.tv_sec
+			    && timer.cur_time.tv_usec >= next_checkpoint.tv_usec))) {
+			pv_checkpoint_save(state, fd, n, total_written);
+			next_checkpoint.tv_sec = timer.cur_time.tv_sec + CHECKPOINT_INTERVAL;
+			next_checkpoint.tv_usec = timer.cur_time.tv_usec;
 		}
 
+		/*
+		 * Once everything has been written to standard output, give
+		 * any --tee outputs which are behind a chance to catch up.
+		 */
+		if (eof_in && eof_out && pv_fanout_pending(state))
+			pv_fanout_wait(state);
+
+		/*
+		 * Likewise, let an --exec command see the end of its input,
+		 * and wait for it to finish writing its output.
+		 */
+		if (eof_in && eof_out && (!pv_fanout_pending(state)) && pv_exec_pending(state))
+			pv_exec_wait(state);
+
+		if (eof_in && eof_out && (!pv_fanout_pending(state)) && (!pv_exec_pending(state)))
+			final_update = true;
+
 		if (state->no_op)
 			continue;
 
@@ -258,72 +624,49 @@ int pv_main_loop(pvstate_t state)
 			 * previously (while waiting for data), the timers
 			 * will be wrongly offset.
 			 *
-			 * While we reset the offset counter we must disable
-			 * SIGTSTOP so things don't mess up.
+			 * Catch up with any signals first, so that time
+			 * spent stopped before now isn't added on later.
 			 */
-			pv_sig_nopause();
-			gettimeofday(&start_time, NULL);
+			pv_sig_check(state);
+			gettimeofday(&(timer.start_time), NULL);
 			state->pv_sig_toffset.tv_sec = 0;
 			state->pv_sig_toffset.tv_usec = 0;
-			pv_sig_allowpause();
-
-			next_update.tv_sec = start_time.tv_sec;
-			next_update.tv_usec = start_time.tv_usec;
-			pv_timeval_add_usec(&next_update, (long) (1000000.0 * state->interval));
-		}
-
-		if ((cur_time.tv_sec < next_update.tv_sec)
-		    || (cur_time.tv_sec == next_update.tv_sec && cur_time.tv_usec < next_update.tv_usec)) {
-			continue;
-		}
-
-		pv_timeval_add_usec(&next_update, (long) (1000000.0 * state->interval));
 
-		if (next_update.tv_sec < cur_time.tv_sec) {
-			next_update.tv_sec = cur_time.tv_sec;
-			next_update.tv_usec = cur_time.tv_usec;
-		} else if (next_update.tv_sec == cur_time.tv_sec && next_update.tv_usec < cur_time.tv_usec) {
-			next_update.tv_usec = cur_time.tv_usec;
+			timer.next_update.tv_sec = timer.start_time.tv_sec;
+			timer.next_update.tv_usec = timer.start_time.tv_usec;
+			pv_timeval_add_usec(&(timer.next_update), (long) (1000000.0 * state->interval));
 		}
 
-		init_time.tv_sec = start_time.tv_sec + state->pv_sig_toffset.tv_sec;
-		init_time.tv_usec = start_time.tv_usec + state->pv_sig_toffset.tv_usec;
-		if (init_time.tv_usec >= 1000000) {
-			init_time.tv_sec++;
-			init_time.tv_usec -= 1000000;
-		}
-		if (init_time.tv_usec < 0) {
-			init_time.tv_sec--;
-			init_time.tv_usec += 1000000;
-		}
-
-		elapsed = cur_time.tv_sec - init_time.tv_sec;
-		elapsed += (cur_time.tv_usec - init_time.tv_usec) / 1000000.0;
-
-		if (final_update)
-			since_last = -1;
-
-		if (state->pv_sig_newsize) {
-			state->pv_sig_newsize = 0;
-			pv_screensize(&(state->width), &(state->height));
-		}
+		pv_loop_timer_display(state, &timer, final_update, &since_last, total_written);
+	}
 
-		pv_display(state, elapsed, since_last, total_written);
+	pv_perfile_finish(state, total_written);
 
-		since_last = 0;
+	/*
+	 * With --verify, read the output back to check it, showing the
+	 * progress of that too.
+	 */
+	if (state->verify && (!pv_sig_aborted(state))) {
+		pv_fanout_fini(state);
+		pv_merge_fini(state);
+		pv_verify_run(state);
 	}
 
-	if (state->cursor) {
-		pv_crs_fini(state);
-	} else {
-		if ((!state->numeric) && (!state->no_op)
-		    && (state->display_visible))
-			pv_write_retry(STDERR_FILENO, "\n", 1);
-	}
+	pv_loop_display_end(state);
 
-	if (state->pv_sig_abort)
+	if (pv_sig_aborted(state))
 		state->exit_status |= 32;
 
+	pv_parallel_fini(state);
+	pv_error_map_save(state, fd, pv_sig_aborted(state) ? false : true);
+	pv_checkpoint_save(state, fd, n, total_written);
+	pv_preallocate_trim(state);
+	pv_fanout_fini(state);
+	pv_exec_fini(state);
+	pv_merge_fini(state);
+	pv_digest_finish(state, pv_sig_aborted(state) ? false : true);
+	pv_validate_finish(state, pv_sig_aborted(state) ? false : true);
+
 	if (fd >= 0)
 		close(fd);
 
@@ -399,7 +742,7 @@ int pv_watchfd_loop(pvstate_t state)
 			pv_timeval_add_usec(&next_remotecheck, REMOTE_INTERVAL);
 		}
 
-		if (state->pv_sig_abort)
+		if (pv_sig_aborted(state))
 			break;
 
 		position_now = pv_watchfd_position(&info);
@@ -470,7 +813,7 @@ int pv_watchfd_loop(pvstate_t state)
 	if (!state->numeric)
 		pv_write_retry(STDERR_FILENO, "\n", 1);
 
-	if (state->pv_sig_abort)
+	if (pv_sig_aborted(state))
 		state->exit_status |= 32;
 
 	return state->exit_status;
@@ -548,7 +891,7 @@ int pv_watchpid_loop(pvstate_t state)
 	while (1) {
 		int rc, fd, displayed_lines;
 
-		if (state->pv_sig_abort)
+		if (pv_sig_aborted(state))
 			break;
 
 		gettimeofday(&cur_time, NULL);
@@ -0,0 +1,309 @@
+/*
+ * Functions for reading all of the input files at the same time with
+ * --merge, interleaving whole lines from each of them onto the output as
+ * they arrive.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+/*
+ * Open input file number "filenum" for --merge, returning its file
+ * descriptor, or -1 on error.  As with pv_next_file(), it is an error for
+ * it to be the file stdout is pointing to.
+ */
+static int pv__merge_open_input(pvstate_t state, int filenum)
+{
+	struct stat isb;
+	struct stat osb;
+	const char *name;
+	int fd;
+
+	name = state->input_files[filenum];
+
+	if (0 == strcmp(name, "-"))
+		return STDIN_FILENO;
+
+	fd = open(name, O_RDONLY);	/* flawfinder: ignore */
+
+	/*
+	 * flawfinder: the file is only read from, and is named by the user
+	 * on the command line in the same way as in pv_next_file().
+	 */
+
+	if (fd < 0) {
+		pv_error(state, "%s: %s: %s", _("failed to read file"), name, strerror(errno));
+		state->exit_status |= 2;
+		return -1;
+	}
+
+	if ((0 == fstat(fd, &isb)) && (0 == fstat(state->output_fd, &osb))
+	    && (isb.st_dev == osb.st_dev) && (isb.st_ino == osb.st_ino)
+	    && (S_ISREG(isb.st_mode) || S_ISBLK(isb.st_mode))) {
+		pv_error(state, "%s: %s", _("input file is output file"), name);
+		close(fd);
+		state->exit_status |= 4;
+		return -1;
+	}
+
+	pv_set_pipe_size(state, fd);
+
+	return fd;
+}
+
+
+/*
+ * Set up every input file for reading at once with --merge, "fd" being
+ * the first one, already opened by pv_next_file().  Each is given a buffer
+ * the size of the transfer buffer to collect partial lines in, plus one
+ * byte for ending an unfinished last line at EOF.  Returns false on error.
+ */
+bool pv_merge_open(pvstate_t state, int fd)
+{
+	unsigned int idx;
+
+	if ((!state->merge) || (state->input_file_count < 1))
+		return true;
+
+	state->merge_inputs = calloc((size_t) (state->input_file_count), sizeof(struct pvmergeinput_s));
+	if (NULL == state->merge_inputs) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return false;
+	}
+
+	state->merge_input_count = 0;
+	state->merge_next = 0;
+
+	for (idx = 0; idx < (unsigned int) (state->input_file_count); idx++) {
+		struct pvmergeinput_s *input = &(state->merge_inputs[idx]);
+
+		input->counter.name = state->input_files[idx];
+		if (0 == strcmp(input->counter.name, "-"))
+			input->counter.name = "(stdin)";
+
+		input->fd = (0 == idx) ? fd : pv__merge_open_input(state, (int) idx);
+		if (input->fd < 0)
+			return false;
+
+		state->merge_input_count++;
+
+		input->buffer_size = state->target_buffer_size;
+		input->buffer = malloc(input->buffer_size + 1);
+		if (NULL == input->buffer) {
+			pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->exit_status |= 64;
+			return false;
+		}
+
+		debug("%s: %s: %d", "opened --merge input", input->counter.name, input->fd);
+	}
+
+	state->current_file = _("(merged)");
+
+	return true;
+}
+
+
+/*
+ * Add each --merge input which has room in its buffer and is not yet at
+ * EOF to "readfds", returning the new highest file descriptor given the
+ * current one "max_fd".
+ */
+int pv_merge_fdset(pvstate_t state, fd_set *readfds, int max_fd)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < state->merge_input_count; idx++) {
+		struct pvmergeinput_s *input = &(state->merge_inputs[idx]);
+		if (input->eof || (input->buffer_fill >= input->buffer_size))
+			continue;
+		FD_SET(input->fd, readfds);
+		if (input->fd > max_fd)
+			max_fd = input->fd;
+	}
+
+	return max_fd;
+}
+
+
+/*
+ * Read from the --merge input "input", which select() has said is ready.
+ *
+ * At EOF, an unfinished last line is given a line separator, so that it is
+ * passed on as a line of its own rather than being joined on to the start
+ * of a line from another input.
+ */
+static void pv__merge_read_input(pvstate_t state, struct pvmergeinput_s *input)
+{
+	unsigned char separator;
+	ssize_t nread;
+
+	separator = state->null ? '\0' : '\n';
+
+	nread = read(input->fd, input->buffer + input->buffer_fill, input->buffer_size - input->buffer_fill);
+
+	if (nread > 0) {
+		input->buffer_fill += (size_t) nread;
+		input->counter.position += (unsigned long long) nread;
+		return;
+	}
+
+	if ((nread < 0) && ((EINTR == errno) || (EAGAIN == errno)))
+		return;
+
+	if (nread < 0) {
+		pv_error(state, "%s: %s: %s", input->counter.name, _("read failed"), strerror(errno));
+		state->exit_status |= 16;
+	}
+
+	debug("%s: %s", input->counter.name, "--merge input finished");
+	input->eof = true;
+
+	if ((input->buffer_fill > 0) && (separator != input->buffer[input->buffer_fill - 1])) {
+		input->buffer[input->buffer_fill] = separator;
+		input->buffer_fill++;
+	}
+}
+
+
+/*
+ * Return how many bytes at the start of the buffer of "input" can be
+ * passed on into "room" bytes of space: everything up to and including its
+ * last line separator that fits, or if it has no whole line in it but is
+ * full or at EOF, as much of it as fits.
+ */
+static size_t pv__merge_movable(pvstate_t state, struct pvmergeinput_s *input, size_t room)
+{
+	unsigned char separator;
+	size_t limit, idx;
+
+	separator = state->null ? '\0' : '\n';
+
+	limit = input->buffer_fill;
+	if (limit > room)
+		limit = room;
+
+	for (idx = limit; idx > 0; idx--) {
+		if (separator == input->buffer[idx - 1])
+			return idx;
+	}
+
+	/*
+	 * No whole line fits.  Pass on a partial one only if it can never
+	 * be finished, or if it is too long for the transfer buffer.
+	 */
+	if ((input->buffer_fill <= room) && (input->eof || (input->buffer_fill >= input->buffer_size)))
+		return input->buffer_fill;
+	if ((input->buffer_fill > room) && (state->read_position == state->write_position))
+		return limit;
+
+	return 0;
+}
+
+
+/*
+ * Read from any --merge inputs marked as ready in "readfds" (which may be
+ * NULL, to skip reading), and then move whole lines from each input in
+ * turn into "dest", which has "room" bytes of space.  Returns the number
+ * of bytes moved, setting "finished" to true once every input has reached
+ * EOF and been passed on in full.
+ */
+size_t pv_merge_read(pvstate_t state, fd_set *readfds, unsigned char *dest, size_t room, bool *finished)
+{
+	unsigned int idx, count;
+	size_t moved;
+	bool progress;
+
+	count = state->merge_input_count;
+	if (0 == count) {
+		*finished = true;
+		return 0;
+	}
+
+	if (NULL != readfds) {
+		for (idx = 0; idx < count; idx++) {
+			struct pvmergeinput_s *input = &(state->merge_inputs[idx]);
+			if ((!input->eof) && FD_ISSET(input->fd, readfds))
+				pv__merge_read_input(state, input);
+		}
+	}
+
+	/*
+	 * Take lines from each input in turn, starting with a different one
+	 * each time so that none of them is favoured.
+	 */
+	moved = 0;
+	progress = true;
+	while (progress && (room > 0)) {
+		progress = false;
+		for (idx = 0; idx < count && room > 0; idx++) {
+			struct pvmergeinput_s *input = &(state->merge_inputs[(state->merge_next + idx) % count]);
+			size_t amount;
+
+			amount = pv__merge_movable(state, input, room);
+			if (0 == amount)
+				continue;
+
+			memcpy(dest + moved, input->buffer, amount);
+			input->buffer_fill -= amount;
+			if (input->buffer_fill > 0)
+				memmove(input->buffer, input->buffer + amount, input->buffer_fill);
+
+			moved += amount;
+			room -= amount;
+			progress = true;
+		}
+	}
+	state->merge_next = (state->merge_next + 1) % count;
+
+	*finished = true;
+	for (idx = 0; idx < count; idx++) {
+		if ((!state->merge_inputs[idx].eof) || (state->merge_inputs[idx].buffer_fill > 0))
+			*finished = false;
+	}
+
+	return moved;
+}
+
+
+/*
+ * Close all of the --merge inputs and free their buffers, apart from the
+ * first input's file descriptor, which is left for the caller to close.
+ */
+void pv_merge_fini(pvstate_t state)
+{
+	unsigned int idx;
+
+	if (NULL == state->merge_inputs)
+		return;
+
+	for (idx = 0; idx < state->merge_input_count; idx++) {
+		struct pvmergeinput_s *input = &(state->merge_inputs[idx]);
+		if ((idx > 0) && (input->fd > STDIN_FILENO))
+			(void) close(input->fd);
+		if (NULL != input->buffer)
+			free(input->buffer);
+	}
+
+	free(state->merge_inputs);
+	state->merge_inputs = NULL;
+	state->merge_input_count = 0;
+}
+
+/* EOF */
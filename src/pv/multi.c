@@ -0,0 +1,486 @@
+/*
+ * Functions for running many independent transfers at once with --multi,
+ * each from its own input to its own output with its own state, driven
+ * together by pv_multi_loop() under one display and one rate limit.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+
+/*
+ * Add a stream from "input" to "output", shown as "name" (or the input's
+ * name if NULL), to the list.  Returns false on error.
+ */
+static bool pv__multi_add(pvstate_t state, const char *input, const char *output, const char *name)
+{
+	struct pvstream_s *streams, *stream;
+
+	streams = realloc(state->streams, (state->stream_count + 1) * sizeof(*streams));
+	if (NULL == streams) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return false;
+	}
+	state->streams = streams;
+
+	stream = &(streams[state->stream_count]);
+	memset(stream, 0, sizeof(*stream));
+	stream->input = input;
+	stream->output = output;
+	stream->output_fd = -1;
+	stream->counter.name = (NULL != name) ? name : (0 == strcmp(input, "-") ? _("(stdin)") : input);
+
+	state->stream_count++;
+
+	return true;
+}
+
+
+/*
+ * Return the next field of "*line", which ends at a tab, or if "tabs" is
+ * false, at a space, terminating it and moving "*line" past it.  Returns
+ * NULL if there are no more fields.
+ */
+static char *pv__multi_field(char **line, bool tabs)
+{
+	char *start, *end;
+
+	start = *line;
+	while ((' ' == *start) || ('\t' == *start))
+		start++;
+	if ('\0' == *start)
+		return NULL;
+
+	end = start;
+	while (('\0' != *end) && ('\t' != *end) && (tabs || (' ' != *end)))
+		end++;
+
+	*line = end;
+	if ('\0' != *end) {
+		*end = '\0';
+		*line = end + 1;
+	}
+
+	return start;
+}
+
+
+/*
+ * Read the streams listed in the --multi-file "filename", one per line as
+ * "INPUT OUTPUT [NAME]", with the fields separated by tabs, or by spaces if
+ * there are no tabs on the line, in which case the name is everything
+ * after the output.  Blank lines and lines starting with "#" are ignored.
+ * Returns false on error.
+ */
+static bool pv__multi_read_spec(pvstate_t state, const char *filename)
+{
+	char buf[4096];			 /* flawfinder: ignore */
+	unsigned int line_number;
+	FILE *fptr;
+	bool ok;
+
+	/*
+	 * flawfinder: buf is only written by fgets(), which is bounded and
+	 * always terminates.
+	 */
+
+	fptr = fopen(filename, "r");	/* flawfinder: ignore */
+	/*
+	 * flawfinder: the file is only read from, and is named by the user.
+	 */
+	if (NULL == fptr) {
+		pv_error(state, "%s: %s: %s", _("failed to read file"), filename, strerror(errno));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	ok = true;
+	line_number = 0;
+
+	while (ok && (NULL != fgets(buf, sizeof(buf), fptr))) {
+		char *line, *rest, *input, *output, *name;
+		size_t length;
+		bool tabs;
+
+		line_number++;
+
+		length = strlen(buf);
+		while ((length > 0) && (('\n' == buf[length - 1]) || ('\r' == buf[length - 1])))
+			buf[--length] = '\0';
+
+		rest = buf;
+		while ((' ' == *rest) || ('\t' == *rest))
+			rest++;
+		if (('\0' == *rest) || ('#' == *rest))
+			continue;
+
+		/*
+		 * Keep a copy of the line for the names to point into.
+		 */
+		line = strdup(rest);	/* flawfinder: ignore */
+		/*
+		 * flawfinder: rest is always terminated, since buf is.
+		 */
+		if (NULL == line) {
+			pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->exit_status |= 64;
+			ok = false;
+			break;
+		}
+
+		tabs = (NULL != strchr(line, '\t')) ? true : false;
+		rest = line;
+		input = pv__multi_field(&rest, tabs);
+		output = pv__multi_field(&rest, tabs);
+		name = pv__multi_field(&rest, true);
+
+		if ((NULL == input) || (NULL == output)) {
+			pv_error(state, "%s:%u: %s", filename, line_number, _("expected an input and an output"));
+			state->exit_status |= 2;
+			free(line);
+			ok = false;
+			break;
+		}
+
+		if (!pv__multi_add(state, input, output, name)) {
+			free(line);
+			ok = false;
+			break;
+		}
+		state->streams[state->stream_count - 1].spec_line = line;
+	}
+
+	if (ok && ferror(fptr)) {
+		pv_error(state, "%s: %s: %s", _("failed to read file"), filename, strerror(errno));
+		state->exit_status |= 2;
+		ok = false;
+	}
+
+	(void) fclose(fptr);
+
+	return ok;
+}
+
+
+/*
+ * Stats callback for each stream in numeric mode (-n), writing the name
+ * of the stream given as "data", how much it has copied, and how far
+ * through it is as a percentage (-1 if unknown), with "finished" added to
+ * the last one.
+ */
+static void pv__multi_numeric( __attribute__((unused)) pvstate_t pv, const struct pvstats_s *stats, void *data)
+{
+	struct pvstream_s *stream = data;
+	char line[1024];		 /* flawfinder: ignore */
+
+	/*
+	 * flawfinder: only written with pv_snprintf(), which is bounded and
+	 * always terminates.
+	 */
+
+	(void) pv_snprintf(line, sizeof(line), "%.900s: %llu %.0f%s\n", stream->counter.name, stats->transferred,
+			   stats->percentage, stats->finished ? " finished" : "");
+	pv_write_retry(STDERR_FILENO, line, strlen(line));
+}
+
+
+/*
+ * Open the input and output of "stream", and give it a state of its own,
+ * set up like the main one, to be run with pv_step().  Returns false on
+ * error.
+ */
+static bool pv__multi_open_stream(pvstate_t state, struct pvstream_s *stream)
+{
+	pvstate_t pv;
+
+	pv = pv_state_alloc(state->program_name);
+	if (NULL == pv) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return false;
+	}
+	stream->pv = pv;
+
+	pv->linemode = state->linemode;
+	pv->null = state->null;
+	pv->no_splice = state->no_splice;
+	pv->direct_io = state->direct_io;
+	pv->sync_after_write = state->sync_after_write;
+	pv->skip_errors = state->skip_errors;
+	pv->error_skip_block = state->error_skip_block;
+	pv->pipe_size = state->pipe_size;
+	pv->target_buffer_size = state->target_buffer_size;
+	pv->interval = state->interval;
+
+	if ((state->numeric) && (!state->no_op))
+		pv_state_stats_callback_set(pv, pv__multi_numeric, stream);
+
+	if (0 == strcmp(stream->output, "-")) {
+		stream->output_fd = state->output_fd;
+	} else {
+		stream->output_fd = open(stream->output, O_WRONLY | O_CREAT | O_TRUNC, 0666);	/* flawfinder: ignore */
+		/*
+		 * flawfinder: the file is named by the user, to be written
+		 * as themselves, as if redirected by the shell.
+		 */
+		if (stream->output_fd < 0) {
+			pv_error(state, "%s: %s: %s", _("failed to open output file"), stream->output, strerror(errno));
+			state->exit_status |= 2;
+			pv->exit_status |= 2;
+			return false;
+		}
+	}
+	pv->output_fd = stream->output_fd;
+
+	pv_state_inputfiles(pv, 1, &(stream->input));
+	if (!pv_step_start(pv)) {
+		state->exit_status |= pv->exit_status;
+		return false;
+	}
+	stream->size = pv->size;
+
+	debug("%s: %s -> %s: %llu", "opened stream", stream->input, stream->output, stream->size);
+
+	return true;
+}
+
+
+/*
+ * Set up the streams for --multi: every two input file arguments are an
+ * input and an output, followed by any streams listed in the --multi-file.
+ * All of their inputs and outputs are opened, and if the total amount of
+ * data is known and no size was given, it is used as the size.
+ *
+ * A stream whose input or output can't be opened is reported and marked
+ * as finished, and the others carry on, just as a normal transfer carries
+ * on past an input file it can't read.  Returns false on error.
+ */
+bool pv_multi_open(pvstate_t state)
+{
+	unsigned long long total_size;
+	bool sizes_known;
+	unsigned int idx;
+	int arg;
+
+	if ((state->input_file_count % 2) != 0) {
+		pv_error(state, "%s: %s", "--multi", _("each input needs an output"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	for (arg = 0; arg + 1 < state->input_file_count; arg += 2) {
+		if (!pv__multi_add(state, state->input_files[arg], state->input_files[arg + 1], NULL))
+			return false;
+	}
+
+	if ((NULL != state->multi_file) && (!pv__multi_read_spec(state, state->multi_file)))
+		return false;
+
+	if (0 == state->stream_count) {
+		pv_error(state, "%s: %s", "--multi", _("no streams given"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	total_size = 0;
+	sizes_known = true;
+
+	for (idx = 0; idx < state->stream_count; idx++) {
+		struct pvstream_s *stream = &(state->streams[idx]);
+
+		if (!pv__multi_open_stream(state, stream)) {
+			state->exit_status |= 2;
+			stream->done = true;
+			if ((stream->output_fd >= 0) && (stream->output_fd != state->output_fd))
+				(void) close(stream->output_fd);
+			stream->output_fd = -1;
+			continue;
+		}
+		if (0 == state->streams[idx].size)
+			sizes_known = false;
+		total_size += state->streams[idx].size;
+	}
+
+	if ((0 == state->size) && sizes_known)
+		state->size = total_size;
+
+	state->current_file = _("(multiple)");
+
+	return true;
+}
+
+
+/*
+ * Add the file descriptors of the streams which are ready for more to
+ * "readfds" and "writefds", returning the highest one, or "max_fd" if none
+ * are higher.
+ */
+int pv_multi_fdset(pvstate_t state, fd_set *readfds, fd_set *writefds, int max_fd)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < state->stream_count; idx++) {
+		if (!state->streams[idx].done)
+			max_fd = pv_step_fdset(state->streams[idx].pv, readfds, writefds, max_fd);
+	}
+
+	return max_fd;
+}
+
+
+/*
+ * Return the number of streams which have not finished yet.
+ */
+unsigned int pv_multi_active(pvstate_t state)
+{
+	unsigned int idx, active;
+
+	active = 0;
+	for (idx = 0; idx < state->stream_count; idx++) {
+		if (!state->streams[idx].done)
+			active++;
+	}
+
+	return active;
+}
+
+
+/*
+ * Mark "stream" as finished, closing its input and output, and passing on
+ * its exit status.
+ */
+static void pv__multi_finish(pvstate_t state, struct pvstream_s *stream)
+{
+	stream->done = true;
+	state->exit_status |= pv_step_finish(stream->pv);
+
+	if ((stream->output_fd >= 0) && (stream->output_fd != state->output_fd)) {
+		if (0 != close(stream->output_fd)) {
+			pv_error(state, "%s: %s: %s", stream->output, _("failed to close output file"),
+				 strerror(errno));
+			state->exit_status |= 16;
+		}
+	}
+	stream->output_fd = -1;
+
+	debug("%s: %s: %llu", "stream finished", stream->counter.name, stream->counter.position);
+}
+
+
+/*
+ * Let each of the unfinished streams transfer whatever it can without
+ * waiting.  If "limited" is true, only "allowed" bytes (or lines) may be
+ * written in total, shared out equally between the streams which still
+ * have something to do, any share that isn't used being left over for
+ * the next time.  Streams take turns to go first.  Returns the number of
+ * bytes written (lines, in line mode), or -1 if every stream has finished.
+ */
+long long pv_multi_transfer(pvstate_t state, bool limited, unsigned long long allowed)
+{
+	unsigned long long share;
+	unsigned int active, turn;
+	long long total;
+
+	active = pv_multi_active(state);
+	if (0 == active)
+		return -1;
+
+	share = limited ? allowed / active : 0;
+	if (limited && (0 == share))
+		return 0;
+
+	total = 0;
+
+	for (turn = 0; turn < state->stream_count; turn++) {
+		struct pvstream_s *stream;
+		long long moved;
+		pvstate_t pv;
+
+		stream = &(state->streams[(state->stream_next + turn) % state->stream_count]);
+		if (stream->done)
+			continue;
+		pv = stream->pv;
+
+		/*
+		 * Let any error message move off the display properly.
+		 */
+		pv->display_visible = state->display_visible;
+		pv->display_sublines = state->display_sublines;
+
+		moved = pv_step(pv, share);
+
+		state->display_sublines = pv->display_sublines;
+
+		if (moved < 0) {
+			pv__multi_finish(state, stream);
+			continue;
+		}
+
+		stream->counter.position += moved;
+		total += moved;
+	}
+
+	state->stream_next = (state->stream_next + 1) % state->stream_count;
+
+	return total;
+}
+
+
+/*
+ * Return the status text for the display line of "stream" in "buffer":
+ * how far through it is, or whether it has finished.
+ */
+void pv_multi_status(struct pvstream_s *stream, char *buffer, size_t size)
+{
+	buffer[0] = '\0';
+	if (stream->done && (0 != stream->pv->exit_status)) {
+		(void) pv_snprintf(buffer, size, "%s", _("failed"));
+	} else if (stream->done) {
+		(void) pv_snprintf(buffer, size, "%s", _("finished"));
+	} else if (stream->size > 0) {
+		(void) pv_snprintf(buffer, size, "%3.0Lf%%",
+				   100.0 * (long double) (stream->counter.position) / (long double) (stream->size));
+	}
+}
+
+
+/*
+ * Close everything still open for --multi, and free the streams.
+ */
+void pv_multi_fini(pvstate_t state)
+{
+	unsigned int idx;
+
+	if (NULL == state->streams)
+		return;
+
+	for (idx = 0; idx < state->stream_count; idx++) {
+		struct pvstream_s *stream = &(state->streams[idx]);
+		if ((!stream->done) && (NULL != stream->pv))
+			pv__multi_finish(state, stream);
+		if (NULL != stream->pv)
+			pv_state_free(stream->pv);
+		if (NULL != stream->spec_line)
+			free(stream->spec_line);
+	}
+
+	free(state->streams);
+	state->streams = NULL;
+	state->stream_count = 0;
+}
+
+/* EOF */
@@ -0,0 +1,600 @@
+/*
+ * Functions for the parallel positional I/O engine, which copies a
+ * seekable input to a seekable output with several threads at once, each
+ * using pread() and pwrite() on its own chunk of the file.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef HAVE_PARALLEL_ENGINE
+#include <pthread.h>
+#endif				/* HAVE_PARALLEL_ENGINE */
+
+#ifdef HAVE_PARALLEL_ENGINE
+
+struct pvparallel_s;
+
+/*
+ * One worker thread, and the input offset of the chunk it is working on
+ * (-1 if it is waiting for work).
+ */
+struct pvparallelworker_s {
+	struct pvparallel_s *engine;	 /* engine this worker belongs to */
+	pthread_t thread;		 /* the thread itself */
+	bool started;			 /* set if the thread was created */
+	unsigned char *buffer;		 /* buffer of chunk_size bytes */
+	off_t chunk;			 /* input offset being worked on */
+};
+
+/*
+ * State of the parallel engine.  The input file "fd" is copied from
+ * "input_start" up to "end", to the output starting at "output_start";
+ * "next" is the input offset of the next chunk to hand out.
+ *
+ * If "limited" is set, only "budget" more bytes may be handed out, so
+ * that -L and -S still apply.  Bytes finished by the workers are added to
+ * "completed" until pv_parallel_transfer() passes them on to the main
+ * loop; "outstanding" counts everything handed out but not yet passed on.
+ *
+ * Everything from "next" on is protected by "mutex".
+ */
+struct pvparallel_s {
+	int fd;				 /* input file descriptor */
+	int output_fd;			 /* output file descriptor */
+	bool running;			 /* set while the workers exist */
+	bool sync_after_write;		 /* fdatasync() after each pwrite() */
+	size_t chunk_size;		 /* bytes each worker does at once */
+	off_t input_start;		 /* input offset we started at */
+	off_t output_start;		 /* output offset we started at */
+	unsigned int count;		 /* number of workers */
+	struct pvparallelworker_s *workers;	/* array of workers */
+	pthread_mutex_t mutex;		 /* lock for everything below */
+	pthread_cond_t work_cond;	 /* signalled when there is more work */
+	pthread_cond_t done_cond;	 /* signalled when a chunk is done */
+	off_t next;			 /* input offset of next chunk */
+	off_t end;			 /* input offset to stop at */
+	bool limited;			 /* set if "budget" applies */
+	unsigned long long budget;	 /* bytes which may be handed out */
+	unsigned long long completed;	 /* bytes done, not yet passed on */
+	unsigned long long outstanding;	 /* bytes handed out, not passed on */
+	bool stopping;			 /* set to tell the workers to stop */
+	int error;			 /* errno of first failure, or 0 */
+	bool error_in_write;		 /* set if that was a write failure */
+	off_t error_offset;		 /* input offset of first failure */
+};
+
+
+/*
+ * Copy "length" bytes from input offset "offset" to the corresponding
+ * place in the output, using the worker's buffer.  Returns the number of
+ * bytes copied, which is less than "length" if the input ended early, or
+ * -1 on error, with "*in_write" set if it was the write that failed.
+ */
+static ssize_t pv__parallel_copy(struct pvparallel_s *engine, unsigned char *buffer, off_t offset, size_t length,
+				 bool *in_write)
+{
+	size_t got, put;
+	ssize_t rc;
+
+	*in_write = false;
+
+	got = 0;
+	while (got < length) {
+		rc = pread(engine->fd, buffer + got, length - got, offset + (off_t) got);
+		if ((rc < 0) && (EINTR == errno))
+			continue;
+		if (rc < 0)
+			return -1;
+		if (0 == rc)
+			break;
+		got += rc;
+	}
+
+	put = 0;
+	while (put < got) {
+		rc = pwrite(engine->output_fd, buffer + put, got - put,
+			    engine->output_start + (offset - engine->input_start) + (off_t) put);
+		if ((rc < 0) && (EINTR == errno))
+			continue;
+		if (rc <= 0) {
+			*in_write = true;
+			if (0 == rc)
+				errno = ENOSPC;
+			return -1;
+		}
+		put += rc;
+	}
+
+#ifdef HAVE_FDATASYNC
+	if ((engine->sync_after_write) && (got > 0) && (fdatasync(engine->output_fd) < 0) && (EIO == errno)) {
+		*in_write = true;
+		return -1;
+	}
+#endif				/* HAVE_FDATASYNC */
+
+	return (ssize_t) got;
+}
+
+
+/*
+ * Worker thread: repeatedly take the next chunk, copy it, and report back,
+ * until there is nothing left, something fails, or we are told to stop.
+ */
+static void *pv__parallel_worker(void *arg)
+{
+	struct pvparallelworker_s *worker;
+	struct pvparallel_s *engine;
+
+	worker = (struct pvparallelworker_s *) arg;
+	engine = worker->engine;
+
+	pthread_mutex_lock(&(engine->mutex));
+
+	while (true) {
+		off_t offset;
+		size_t length;
+		ssize_t copied;
+		bool in_write;
+
+		while ((!engine->stopping) && (0 == engine->error) && (engine->next < engine->end)
+		       && (engine->limited) && (0 == engine->budget))
+			pthread_cond_wait(&(engine->work_cond), &(engine->mutex));
+
+		if ((engine->stopping) || (0 != engine->error) || (engine->next >= engine->end))
+			break;
+
+		length = engine->chunk_size;
+		if ((off_t) length > engine->end - engine->next)
+			length = (size_t) (engine->end - engine->next);
+		if ((engine->limited) && ((unsigned long long) length > engine->budget))
+			length = (size_t) (engine->budget);
+		if (engine->limited)
+			engine->budget -= length;
+
+		offset = engine->next;
+		engine->next += length;
+		engine->outstanding += length;
+		worker->chunk = offset;
+
+		pthread_mutex_unlock(&(engine->mutex));
+
+		copied = pv__parallel_copy(engine, worker->buffer, offset, length, &in_write);
+
+		pthread_mutex_lock(&(engine->mutex));
+
+		worker->chunk = -1;
+
+		if (copied < 0) {
+			if ((0 == engine->error) || (offset < engine->error_offset)) {
+				engine->error = errno;
+				engine->error_in_write = in_write;
+				engine->error_offset = offset;
+			}
+			engine->outstanding -= length;
+		} else {
+			engine->completed += copied;
+			/*
+			 * If the input ended early, nothing past here will
+			 * be copied.
+			 */
+			if ((size_t) copied < length) {
+				engine->outstanding -= length - copied;
+				if (engine->end > offset + copied)
+					engine->end = offset + copied;
+			}
+		}
+
+		pthread_cond_broadcast(&(engine->done_cond));
+	}
+
+	pthread_mutex_unlock(&(engine->mutex));
+
+	return NULL;
+}
+
+
+/*
+ * Return the input offset before which everything has been copied.  The
+ * mutex must be held.
+ */
+static off_t pv__parallel_done(struct pvparallel_s *engine)
+{
+	off_t done;
+	unsigned int idx;
+
+	done = engine->next;
+	for (idx = 0; idx < engine->count; idx++) {
+		if ((engine->workers[idx].chunk >= 0) && (engine->workers[idx].chunk < done))
+			done = engine->workers[idx].chunk;
+	}
+	if ((0 != engine->error) && (engine->error_offset < done))
+		done = engine->error_offset;
+	if (done > engine->end)
+		done = engine->end;
+
+	return done;
+}
+
+
+/*
+ * Stop the parallel engine, if it is running, waiting for the workers to
+ * finish what they are doing, and leave the input and output file offsets
+ * just after the last byte copied, so that anything else carrying on from
+ * here picks up in the right place.
+ *
+ * Returns the number of bytes finished but not yet passed on.
+ */
+static unsigned long long pv__parallel_halt(pvstate_t state)
+{
+	struct pvparallel_s *engine;
+	unsigned long long leftover;
+	unsigned int idx;
+	off_t done;
+
+	engine = state->parallel;
+	if ((NULL == engine) || (!engine->running))
+		return 0;
+
+	pthread_mutex_lock(&(engine->mutex));
+	engine->stopping = true;
+	pthread_cond_broadcast(&(engine->work_cond));
+	pthread_mutex_unlock(&(engine->mutex));
+
+	for (idx = 0; idx < engine->count; idx++) {
+		if (engine->workers[idx].started)
+			pthread_join(engine->workers[idx].thread, NULL);
+	}
+
+	done = pv__parallel_done(engine);
+	leftover = engine->completed;
+
+	debug("%s %d: %s (%lld)", "fd", engine->fd, "stopping parallel engine", (long long) done);
+
+	(void) lseek(engine->fd, done, SEEK_SET);
+	(void) lseek(state->output_fd, engine->output_start + (done - engine->input_start), SEEK_SET);
+
+	for (idx = 0; idx < engine->count; idx++) {
+		if (NULL != engine->workers[idx].buffer)
+			free(engine->workers[idx].buffer);
+	}
+	free(engine->workers);
+	engine->workers = NULL;
+	engine->count = 0;
+
+	pthread_cond_destroy(&(engine->done_cond));
+	pthread_cond_destroy(&(engine->work_cond));
+	pthread_mutex_destroy(&(engine->mutex));
+
+	engine->running = false;
+
+	return leftover;
+}
+
+
+/*
+ * Start the parallel engine on input file "fd", copying up to "end", with
+ * state->parallel_threads workers.  Returns 0, or the error number saying
+ * why it couldn't be started.
+ */
+static int pv__parallel_start(pvstate_t state, int fd, off_t end)
+{
+	struct pvparallel_s *engine;
+	unsigned int idx;
+	int error;
+
+	if (NULL == state->parallel) {
+		state->parallel = calloc(1, sizeof(*(state->parallel)));
+		if (NULL == state->parallel)
+			return ENOMEM;
+	}
+	engine = state->parallel;
+
+	memset(engine, 0, sizeof(*engine));
+	engine->fd = fd;
+	engine->output_fd = state->output_fd;
+	engine->sync_after_write = state->sync_after_write;
+	engine->chunk_size = state->target_buffer_size > 0 ? state->target_buffer_size : BUFFER_SIZE;
+	engine->input_start = lseek(fd, 0, SEEK_CUR);
+	engine->output_start = lseek(state->output_fd, 0, SEEK_CUR);
+	if ((engine->input_start < 0) || (engine->output_start < 0))
+		return errno;
+	engine->next = engine->input_start;
+	engine->end = end;
+
+	engine->workers = calloc(state->parallel_threads, sizeof(*(engine->workers)));
+	if (NULL == engine->workers)
+		return ENOMEM;
+	engine->count = state->parallel_threads;
+
+	pthread_mutex_init(&(engine->mutex), NULL);
+	pthread_cond_init(&(engine->work_cond), NULL);
+	pthread_cond_init(&(engine->done_cond), NULL);
+	engine->running = true;
+
+	error = 0;
+	for (idx = 0; idx < engine->count; idx++) {
+		engine->workers[idx].engine = engine;
+		engine->workers[idx].chunk = -1;
+		engine->workers[idx].buffer = malloc(engine->chunk_size);
+		if (NULL == engine->workers[idx].buffer) {
+			error = ENOMEM;
+			break;
+		}
+	}
+
+	/*
+	 * Hold the lock until all the workers exist, so that none of them
+	 * starts before the budget has been set.
+	 */
+	pthread_mutex_lock(&(engine->mutex));
+	engine->limited = true;
+	engine->budget = 0;
+	if (idx == engine->count) {
+		for (idx = 0; idx < engine->count; idx++) {
+			error = pthread_create(&(engine->workers[idx].thread), NULL, pv__parallel_worker,
+					       &(engine->workers[idx]));
+			if (0 != error)
+				break;
+			engine->workers[idx].started = true;
+		}
+	}
+	pthread_mutex_unlock(&(engine->mutex));
+
+	if ((idx < engine->count) || (!engine->workers[0].started)) {
+		debug("%s %d: %s", "fd", fd, "failed to start parallel engine workers");
+		(void) pv__parallel_halt(state);
+		return (0 != error) ? error : EAGAIN;
+	}
+
+	debug("%s %d: %s: %u x %lu, %lld - %lld -> %lld", "fd", fd, "started parallel engine", engine->count,
+	      (unsigned long) (engine->chunk_size), (long long) (engine->input_start), (long long) end,
+	      (long long) (engine->output_start));
+
+	return 0;
+}
+
+
+/*
+ * Return the size of the regular file or block device "fd", or -1 if it
+ * is neither.
+ */
+static off_t pv__parallel_size(int fd)
+{
+	struct stat sb;
+	off_t here, size;
+
+	if (0 != fstat(fd, &sb))
+		return -1;
+	if (S_ISREG(sb.st_mode))
+		return sb.st_size;
+	if (!S_ISBLK(sb.st_mode))
+		return -1;
+
+	here = lseek(fd, 0, SEEK_CUR);
+	size = lseek(fd, 0, SEEK_END);
+	if ((here < 0) || (lseek(fd, here, SEEK_SET) != here))
+		return -1;
+
+	return size;
+}
+
+#endif				/* HAVE_PARALLEL_ENGINE */
+
+
+/*
+ * Return true if the parallel engine could be used to copy input file
+ * "fd" to standard output: --parallel must have been given, both must be
+ * regular files or block devices, the output must not be appended to,
+ * and none of line mode, -E, or -K can be in use.
+ */
+bool pv_parallel_usable(pvstate_t state, int fd)
+{
+#ifdef HAVE_PARALLEL_ENGINE
+	struct stat sb;
+	int flags;
+
+	if ((state->parallel_threads < 2) || (state->linemode) || (state->skip_errors > 0) || (state->direct_io))
+		return false;
+	if (pv__parallel_size(fd) < 0)
+		return false;
+	if ((0 != fstat(state->output_fd, &sb)) || ((!S_ISREG(sb.st_mode)) && (!S_ISBLK(sb.st_mode))))
+		return false;
+	flags = fcntl(state->output_fd, F_GETFL);
+	if ((flags < 0) || (0 != (flags & O_APPEND)))
+		return false;
+	if (lseek(state->output_fd, 0, SEEK_CUR) < 0)
+		return false;
+
+	return true;
+#else				/* !HAVE_PARALLEL_ENGINE */
+	return false;
+#endif				/* HAVE_PARALLEL_ENGINE */
+}
+
+
+/*
+ * Move data from "fd" to standard output with the parallel engine, if it
+ * is the engine in use, starting it if necessary.  The workers are handed
+ * no more than "allowed" bytes beyond what they have already been given,
+ * if there is a rate limit or "allowed" is nonzero, as in pv_transfer();
+ * then we wait briefly for some of them to finish.
+ *
+ * Returns 1 if the parallel engine was used, with state->written set to
+ * the number of bytes copied since the last call (or -1 on a write
+ * error), or 0 if it can't be used and something else should be.
+ */
+int pv_parallel_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned long long allowed)
+{
+#ifdef HAVE_PARALLEL_ENGINE
+	struct pvparallel_s *engine;
+	unsigned long long written;
+	struct timeval now;
+	struct timespec until;
+	bool finished;
+	int error;
+	bool error_in_write;
+
+	engine = state->parallel;
+
+	if ((!pv_engine_allowed(state, PV_ENGINE_PARALLEL))
+	    || (state->read_position > state->write_position)) {
+		if ((NULL != engine) && (engine->running)) {
+			state->written = (long) pv__parallel_halt(state);
+			return (state->written > 0) ? 1 : 0;
+		}
+		return 0;
+	}
+
+	if ((NULL != engine) && (engine->running) && (engine->fd != fd))
+		(void) pv__parallel_halt(state);
+
+	if ((NULL == engine) || (!engine->running)) {
+		off_t end, start;
+
+		/*
+		 * A state whose engines were never chosen, such as a
+		 * --calibrate trial, allows every engine, so check that this
+		 * one was asked for and can be used before starting it.
+		 */
+		if (!pv_parallel_usable(state, fd))
+			return 0;
+
+		end = pv__parallel_size(fd);
+		start = lseek(fd, 0, SEEK_CUR);
+		if ((end < 0) || (start < 0))
+			return 0;
+		if ((state->input_remaining >= 0) && (end - start > state->input_remaining))
+			end = start + (off_t) (state->input_remaining);
+		error = pv__parallel_start(state, fd, end);
+		if (0 != error) {
+			pv_error(state, "%s: %s", _("failed to start parallel engine"), strerror(error));
+			state->parallel_threads = 0;
+			return 0;
+		}
+		engine = state->parallel;
+	}
+
+	pthread_mutex_lock(&(engine->mutex));
+
+	/*
+	 * Let the workers have as much more as the caller allows.
+	 */
+	if ((state->rate_limit > 0) || (allowed > 0)) {
+		engine->limited = true;
+		engine->budget = (allowed > engine->outstanding) ? allowed - engine->outstanding : 0;
+	} else {
+		engine->limited = false;
+	}
+	pthread_cond_broadcast(&(engine->work_cond));
+
+	/*
+	 * Wait for something to finish - or if nothing has been handed out
+	 * because of the rate limit, just wait a little, as the other
+	 * engines do.
+	 */
+	if ((0 == engine->completed) && (0 == engine->error)
+	    && ((engine->next < engine->end) || (engine->outstanding > 0))) {
+		gettimeofday(&now, NULL);
+		now.tv_usec += (0 == engine->outstanding) ? 10000 : TRANSFER_READ_TIMEOUT;
+		until.tv_sec = now.tv_sec + now.tv_usec / 1000000;
+		until.tv_nsec = (now.tv_usec % 1000000) * 1000;
+		(void) pthread_cond_timedwait(&(engine->done_cond), &(engine->mutex), &until);
+	}
+
+	written = engine->completed;
+	engine->completed = 0;
+	engine->outstanding -= written;
+	error = engine->error;
+	error_in_write = engine->error_in_write;
+	finished = ((engine->next >= engine->end) && (0 == engine->outstanding)) ? true : false;
+
+	pthread_mutex_unlock(&(engine->mutex));
+
+	state->written = (long) written;
+
+	if (0 != error) {
+		(void) pv__parallel_halt(state);
+		pv_error(state, "%s: %s: %s", state->current_file,
+			 error_in_write ? _("write failed") : _("read failed"), strerror(error));
+		state->exit_status |= 16;
+		*eof_in = 1;
+		*eof_out = 1;
+		if (error_in_write)
+			state->written = -1;
+		return 1;
+	}
+
+	if (finished) {
+		(void) pv__parallel_halt(state);
+		*eof_in = 1;
+		*eof_out = 1;
+	}
+
+	return 1;
+#else				/* !HAVE_PARALLEL_ENGINE */
+	return 0;
+#endif				/* HAVE_PARALLEL_ENGINE */
+}
+
+
+/*
+ * Return the input offset before which the parallel engine has copied
+ * everything, and the corresponding output offset, or false if it isn't
+ * running on "fd".
+ */
+bool pv_parallel_offsets(pvstate_t state, int fd, off_t *input_offset, off_t *output_offset)
+{
+#ifdef HAVE_PARALLEL_ENGINE
+	struct pvparallel_s *engine;
+	off_t done;
+
+	engine = state->parallel;
+	if ((NULL == engine) || (!engine->running) || ((fd >= 0) && (engine->fd != fd)))
+		return false;
+
+	pthread_mutex_lock(&(engine->mutex));
+	done = pv__parallel_done(engine);
+	pthread_mutex_unlock(&(engine->mutex));
+
+	if (NULL != input_offset)
+		*input_offset = done;
+	if (NULL != output_offset)
+		*output_offset = engine->output_start + (done - engine->input_start);
+
+	return true;
+#else				/* !HAVE_PARALLEL_ENGINE */
+	return false;
+#endif				/* HAVE_PARALLEL_ENGINE */
+}
+
+
+/*
+ * Stop the parallel engine if it is running, leaving the file offsets
+ * where it got to, and free it.
+ */
+void pv_parallel_fini(pvstate_t state)
+{
+#ifdef HAVE_PARALLEL_ENGINE
+	if (NULL == state->parallel)
+		return;
+	(void) pv__parallel_halt(state);
+	free(state->parallel);
+	state->parallel = NULL;
+#endif				/* HAVE_PARALLEL_ENGINE */
+}
+
+/* EOF */
@@ -0,0 +1,434 @@
+/*
+ * Functions for timing each input file's share of the transfer, for the
+ * current file's line on the display with --per-file and the manifest
+ * written at the end with --manifest.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+
+/*
+ * The record for each input file, and the file being read at the moment.
+ * Times are in seconds, not counting any time spent stopped (^Z).
+ */
+struct pvperfile_s {
+	struct pvfilestat_s *files;	 /* one record per input file */
+	int count;			 /* number of entries in "files" */
+	int current;			 /* file being read, or -1 */
+	bool finished;			 /* set once the manifest is done */
+	long long base;			 /* total transferred when it started */
+	long long last_total;		 /* total at the last update */
+	long double start;		 /* when it started */
+	long double last_arrival;	 /* when data last arrived from it */
+	long double sample_start;	 /* start of the current rate sample */
+	long long sample_total;		 /* total at the start of that sample */
+	struct pvcounter_s counter;	 /* its line on the display */
+	bool counter_restart;		 /* set when the line shows a new file */
+};
+
+
+/*
+ * Return the current time in seconds, less the time spent stopped.
+ */
+static long double pv__perfile_now(pvstate_t state)
+{
+	struct timeval cur_time;
+	long double now;
+
+	gettimeofday(&cur_time, NULL);
+	now = (long double) (cur_time.tv_sec - state->pv_sig_toffset.tv_sec);
+	now += (cur_time.tv_usec - state->pv_sig_toffset.tv_usec) / 1000000.0;
+
+	return now;
+}
+
+
+/*
+ * Set up the per-file records if --per-file or --manifest was given, with
+ * "total" being the amount already transferred.  Returns false on error.
+ */
+bool pv_perfile_start(pvstate_t state, long long total)
+{
+	struct pvperfile_s *perfile;
+	int count;
+
+	if ((!state->per_file) && (NULL == state->manifest))
+		return true;
+	if (NULL != state->perfile)
+		return true;
+
+	count = state->input_file_count > 0 ? state->input_file_count : 1;
+
+	perfile = calloc(1, sizeof(*perfile));
+	if (NULL != perfile)
+		perfile->files = calloc((size_t) count, sizeof(*(perfile->files)));
+	if ((NULL == perfile) || (NULL == perfile->files)) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		if (NULL != perfile)
+			free(perfile);
+		return false;
+	}
+
+	perfile->count = count;
+	perfile->current = -1;
+	perfile->last_total = total;
+	state->perfile = perfile;
+
+	return true;
+}
+
+
+/*
+ * Close the record of the file being read, as of "now".
+ */
+static void pv__perfile_end(struct pvperfile_s *perfile, long double now)
+{
+	struct pvfilestat_s *file;
+	long double idle;
+
+	if ((perfile->current < 0) || (perfile->current >= perfile->count))
+		return;
+
+	file = &(perfile->files[perfile->current]);
+
+	idle = now - perfile->last_arrival;
+	if (idle >= PERFILE_STALL_MIN)
+		file->stalled += (double) idle;
+
+	file->transferred = (unsigned long long) (perfile->last_total - perfile->base);
+	file->elapsed = (double) (now - perfile->start);
+
+	/*
+	 * A file read in less than one rate sample never got a peak rate
+	 * of its own, so use its mean rate.
+	 */
+	if ((file->elapsed > 0.000001) && (file->peak_rate < (double) (file->transferred) / file->elapsed))
+		file->peak_rate = (double) (file->transferred) / file->elapsed;
+
+	perfile->current = -1;
+}
+
+
+/*
+ * Bring the record of input file "filenum" up to date, given the "total"
+ * transferred so far, in bytes or lines.  If this is a new file, the one
+ * before it is finished off first.
+ *
+ * The rate is sampled over each display interval for the peak rate, and
+ * any gap of PERFILE_STALL_MIN seconds or more with nothing arriving is
+ * counted as time stalled.
+ */
+void pv_perfile_update(pvstate_t state, int filenum, long long total)
+{
+	struct pvperfile_s *perfile = state->perfile;
+	struct pvfilestat_s *file;
+	long double now, window;
+
+	if ((NULL == perfile) || (perfile->finished) || (filenum < 0) || (filenum >= perfile->count))
+		return;
+
+	now = pv__perfile_now(state);
+
+	if (filenum != perfile->current) {
+		pv__perfile_end(perfile, now);
+
+		file = &(perfile->files[filenum]);
+		memset(file, 0, sizeof(*file));
+		file->started = true;
+		file->size = state->linemode ? 0 : state->current_file_size;
+
+		perfile->current = filenum;
+		perfile->base = total;
+		perfile->last_total = total;
+		perfile->start = now;
+		perfile->last_arrival = now;
+		perfile->sample_start = now;
+		perfile->sample_total = total;
+
+		memset(&(perfile->counter), 0, sizeof(perfile->counter));
+		perfile->counter.name = state->current_file;
+		perfile->counter_restart = true;
+		return;
+	}
+
+	file = &(perfile->files[filenum]);
+
+	if (total != perfile->last_total) {
+		if (now - perfile->last_arrival >= PERFILE_STALL_MIN)
+			file->stalled += (double) (now - perfile->last_arrival);
+		perfile->last_arrival = now;
+		perfile->last_total = total;
+	}
+
+	window = state->interval > 0 ? state->interval : 1;
+	if (now - perfile->sample_start >= window) {
+		double rate;
+		rate = (double) ((long double) (total - perfile->sample_total) / (now - perfile->sample_start));
+		if (rate > file->peak_rate)
+			file->peak_rate = rate;
+		perfile->sample_start = now;
+		perfile->sample_total = total;
+	}
+
+	file->transferred = (unsigned long long) (total - perfile->base);
+	file->elapsed = (double) (now - perfile->start);
+}
+
+
+/*
+ * Return the counter for the display line of the file being read, with
+ * --per-file, or NULL if there isn't one to show, such as when there is
+ * only one input file.  "elapsed_sec" is the elapsed time the display is
+ * using, so that the line's rate only covers the current file.
+ */
+struct pvcounter_s *pv_perfile_counter(pvstate_t state, long double elapsed_sec)
+{
+	struct pvperfile_s *perfile = state->perfile;
+
+	if ((NULL == perfile) || (!state->per_file) || (perfile->current < 0) || (perfile->count < 2))
+		return NULL;
+
+	perfile->counter.position = (unsigned long long) (perfile->last_total - perfile->base);
+
+	if (perfile->counter_restart) {
+		perfile->counter.prev_position = 0;
+		perfile->counter.prev_elapsed = elapsed_sec - (pv__perfile_now(state) - perfile->start);
+		perfile->counter.rate = 0;
+		perfile->counter_restart = false;
+	}
+
+	return &(perfile->counter);
+}
+
+
+/*
+ * Write the status of the file being read into "buffer", which is
+ * "bufsize" bytes long: its number out of the number of input files, and a
+ * bar and percentage if its size is known.
+ */
+void pv_perfile_status(pvstate_t state, char *buffer, size_t bufsize)
+{
+	struct pvperfile_s *perfile = state->perfile;
+	struct pvfilestat_s *file;
+	char bar[PERFILE_BAR_WIDTH + 1];	/* flawfinder: ignore */
+	unsigned int filled, idx;
+	long percentage;
+
+	/*
+	 * flawfinder: "bar" is filled in up to its size and terminated.
+	 */
+
+	if (bufsize < 1)
+		return;
+	buffer[0] = '\0';
+
+	if ((NULL == perfile) || (perfile->current < 0))
+		return;
+
+	file = &(perfile->files[perfile->current]);
+
+	if (0 == file->size) {
+		(void) pv_snprintf(buffer, bufsize, "(%d/%d)", perfile->current + 1, perfile->count);
+		return;
+	}
+
+	percentage = (long) (100.0 * (double) (perfile->last_total - perfile->base) / (double) (file->size));
+	if (percentage < 0)
+		percentage = 0;
+	if (percentage > 100)
+		percentage = 100;
+
+	filled = (unsigned int) ((PERFILE_BAR_WIDTH * percentage) / 100);
+	for (idx = 0; idx < PERFILE_BAR_WIDTH; idx++)
+		bar[idx] = (idx < filled) ? '=' : ' ';
+	if ((filled > 0) && (filled < PERFILE_BAR_WIDTH))
+		bar[filled - 1] = '>';
+	bar[PERFILE_BAR_WIDTH] = '\0';
+
+	(void) pv_snprintf(buffer, bufsize, "(%d/%d) [%s] %3ld%%", perfile->current + 1, perfile->count, bar,
+			   percentage);
+}
+
+
+/*
+ * Write "name" to "fptr" as a TSV field, with backslash, tab, newline, and
+ * carriage return escaped.
+ */
+static void pv__perfile_tsv_name(FILE *fptr, const char *name)
+{
+	for (; '\0' != *name; name++) {
+		switch (*name) {
+		case '\\':
+			fputs("\\\\", fptr);
+			break;
+		case '\t':
+			fputs("\\t", fptr);
+			break;
+		case '\n':
+			fputs("\\n", fptr);
+			break;
+		case '\r':
+			fputs("\\r", fptr);
+			break;
+		default:
+			fputc(*name, fptr);
+			break;
+		}
+	}
+}
+
+
+/*
+ * Write "name" to "fptr" as a JSON string, quoted and escaped.
+ */
+static void pv__perfile_json_name(FILE *fptr, const char *name)
+{
+	fputc('"', fptr);
+	for (; '\0' != *name; name++) {
+		unsigned char ch = (unsigned char) (*name);
+		if (('"' == ch) || ('\\' == ch)) {
+			fputc('\\', fptr);
+			fputc((int) ch, fptr);
+		} else if (ch < 0x20) {
+			fprintf(fptr, "\\u%04x", (unsigned int) ch);
+		} else {
+			fputc((int) ch, fptr);
+		}
+	}
+	fputc('"', fptr);
+}
+
+
+/*
+ * Write the --manifest file, with a line or JSON object for each input
+ * file that was started: its name, how much was transferred from it and
+ * how much was expected, the time spent on it, its mean and peak rates,
+ * and the time it spent stalled.  Files never reached are left out.
+ */
+static void pv__perfile_manifest(pvstate_t state)
+{
+	struct pvperfile_s *perfile = state->perfile;
+	const char *unit;
+	FILE *fptr;
+	int idx;
+	bool first;
+
+	fptr = fopen(state->manifest, "w");	/* flawfinder: ignore */
+	if (NULL == fptr) {
+		pv_error(state, "%s: %s", state->manifest, strerror(errno));
+		state->exit_status |= 2;
+		return;
+	}
+
+	unit = state->linemode ? "lines" : "bytes";
+
+	if (state->manifest_json) {
+		fprintf(fptr, "[\n");
+	} else {
+		fprintf(fptr, "file\t%s\tsize\tseconds\tmean_rate\tpeak_rate\tstalled\n", unit);
+	}
+
+	first = true;
+	for (idx = 0; idx < perfile->count; idx++) {
+		struct pvfilestat_s *file = &(perfile->files[idx]);
+		const char *name;
+		double mean_rate;
+
+		if (!file->started)
+			continue;
+
+		name = "-";
+		if (idx < state->input_file_count)
+			name = state->input_files[idx];
+
+		mean_rate = (file->elapsed > 0.000001) ? (double) (file->transferred) / file->elapsed : 0;
+
+		if (state->manifest_json) {
+			fprintf(fptr, "%s  {\"file\": ", first ? "" : ",\n");
+			pv__perfile_json_name(fptr, name);
+			fprintf(fptr, ", \"%s\": %llu, \"size\": ", unit, file->transferred);
+			if (file->size > 0) {
+				fprintf(fptr, "%llu", file->size);
+			} else {
+				fprintf(fptr, "null");
+			}
+			fprintf(fptr, ", \"seconds\": %.3f, \"mean_rate\": %.3f", file->elapsed, mean_rate);
+			fprintf(fptr, ", \"peak_rate\": %.3f, \"stalled\": %.3f}", file->peak_rate, file->stalled);
+		} else {
+			pv__perfile_tsv_name(fptr, name);
+			fprintf(fptr, "\t%llu\t", file->transferred);
+			if (file->size > 0) {
+				fprintf(fptr, "%llu", file->size);
+			} else {
+				fprintf(fptr, "-");
+			}
+			fprintf(fptr, "\t%.3f\t%.3f\t%.3f\t%.3f\n", file->elapsed, mean_rate, file->peak_rate,
+				file->stalled);
+		}
+
+		first = false;
+	}
+
+	if (state->manifest_json)
+		fprintf(fptr, "%s]\n", first ? "" : "\n");
+
+	if ((0 != ferror(fptr)) || (0 != fclose(fptr))) {
+		pv_error(state, "%s: %s", state->manifest, strerror(errno));
+		state->exit_status |= 2;
+	}
+}
+
+
+/*
+ * Finish off the record of the last file read, given the "total"
+ * transferred, and write the --manifest file if one was asked for.
+ */
+void pv_perfile_finish(pvstate_t state, long long total)
+{
+	struct pvperfile_s *perfile = state->perfile;
+
+	if ((NULL == perfile) || (perfile->finished))
+		return;
+
+	if (perfile->current >= 0) {
+		pv_perfile_update(state, perfile->current, total);
+		pv__perfile_end(perfile, pv__perfile_now(state));
+	}
+
+	perfile->finished = true;
+
+	debug("%s", "per-file records finished");
+
+	if (NULL != state->manifest)
+		pv__perfile_manifest(state);
+}
+
+
+/*
+ * Free the per-file records.
+ */
+void pv_perfile_fini(pvstate_t state)
+{
+	if (NULL == state->perfile)
+		return;
+
+	if (NULL != state->perfile->files)
+		free(state->perfile->files);
+	free(state->perfile);
+	state->perfile = NULL;
+}
+
+/* EOF */
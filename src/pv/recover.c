@@ -0,0 +1,725 @@
+/*
+ * Functions for recovering data from regions of the input which were
+ * skipped because of read errors.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+/*
+ * Add a region to the end of the given array of skipped regions, merging
+ * it with the last one if they are contiguous in both the input and the
+ * output.  Returns false if memory could not be allocated.
+ */
+static bool pv__skipped_append(struct pvskipregion_s **regions, unsigned int *count, unsigned int *allocated,
+			       off_t input_offset, off_t output_offset, off_t length)
+{
+	struct pvskipregion_s *last;
+
+	if (*count > 0) {
+		last = &((*regions)[*count - 1]);
+		if ((last->input_offset + last->length == input_offset)
+		    && (((last->output_offset < 0) && (output_offset < 0))
+			|| ((last->output_offset >= 0) && (last->output_offset + last->length == output_offset)))) {
+			last->length += length;
+			return true;
+		}
+	}
+
+	if (*count >= *allocated) {
+		struct pvskipregion_s *newptr;
+		unsigned int newsize;
+
+		newsize = (*allocated > 0) ? *allocated * 2 : 16;
+		newptr = realloc(*regions, newsize * sizeof(**regions));
+		if (NULL == newptr)
+			return false;
+		*regions = newptr;
+		*allocated = newsize;
+	}
+
+	last = &((*regions)[*count]);
+	last->input_offset = input_offset;
+	last->output_offset = output_offset;
+	last->length = length;
+	(*count)++;
+
+	return true;
+}
+
+
+/*
+ * Return the current offset of the output, if it is a regular file or
+ * block device that we could go back and write to with pwrite() - which
+ * on some systems ignores the offset when appending - or -1 otherwise.
+ */
+static off_t pv__output_offset(pvstate_t state)
+{
+	struct stat sb;
+	int flags;
+
+	flags = fcntl(state->output_fd, F_GETFL);
+	if ((flags < 0) || (0 != (flags & O_APPEND)))
+		return -1;
+	if (0 != fstat(state->output_fd, &sb))
+		return -1;
+	if (!(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)))
+		return -1;
+
+	return lseek(state->output_fd, 0, SEEK_CUR);
+}
+
+
+/*
+ * Return the size of the input file "fd", if it is a regular file or block
+ * device, or -1 otherwise.
+ */
+static off_t pv__input_size(int fd)
+{
+	struct stat sb;
+	off_t position, size;
+
+	if (0 != fstat(fd, &sb))
+		return -1;
+	if (S_ISREG(sb.st_mode))
+		return sb.st_size;
+	if (!S_ISBLK(sb.st_mode))
+		return -1;
+
+	position = lseek(fd, 0, SEEK_CUR);
+	size = lseek(fd, 0, SEEK_END);
+	if (position >= 0)
+		(void) lseek(fd, position, SEEK_SET);
+
+	return size;
+}
+
+
+/*
+ * Remember that "length" bytes of the current input starting at
+ * "input_offset" were skipped because of read errors, and zero-filled in
+ * the transfer buffer.  "buffered" is the number of bytes which were
+ * already waiting in the buffer ahead of the zeroes, so that we can work
+ * out where the zeroes will end up in the output, if it can be patched
+ * later.
+ */
+void pv_skipped_add(pvstate_t state, off_t input_offset, off_t length, unsigned long buffered)
+{
+	off_t output_offset;
+
+	if (length <= 0)
+		return;
+
+	output_offset = pv__output_offset(state);
+	if (output_offset >= 0)
+		output_offset += buffered;
+
+	if (!pv__skipped_append
+	    (&(state->skipped), &(state->skipped_count), &(state->skipped_alloc), input_offset, output_offset,
+	     length)) {
+		pv_error(state, "%s: %s", _("skipped region list allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+	}
+}
+
+
+/*
+ * Forget all skipped regions, such as when moving on to a new input file.
+ */
+void pv_skipped_reset(pvstate_t state)
+{
+	state->skipped_count = 0;
+	state->skipped_tried = 0;
+}
+
+
+/*
+ * Read as much of the "length" bytes at "input_offset" in "fd" as we can
+ * in one go into "buffer", returning the number of bytes read before an
+ * error or the end of the file.
+ */
+static off_t pv__recover_read(int fd, unsigned char *buffer, off_t input_offset, off_t length)
+{
+	off_t total;
+
+	total = 0;
+	while (total < length) {
+		ssize_t nread;
+
+		nread = pread(fd, buffer + total, length - total, input_offset + total);
+		if ((nread < 0) && ((EINTR == errno) || (EAGAIN == errno)))
+			continue;
+		if (nread <= 0)
+			break;
+		total += nread;
+	}
+
+	return total;
+}
+
+
+/*
+ * Try to recover the skipped region of "length" bytes at "input_offset",
+ * whose zeroes are at "output_offset" in the output, by reading it all in
+ * one go, and if that fails, splitting what wasn't read in two on a
+ * RECOVER_MIN_BLOCK boundary and trying each half, down to single blocks.
+ * Whatever is read is written over the zeroes in the output.
+ *
+ * Regions which still can't be read are added to the "remaining" array.
+ *
+ * Returns the number of bytes recovered, or -1 on a write error or if we
+ * were interrupted.
+ */
+static off_t pv__recover_region(pvstate_t state, int fd, unsigned char *buffer, size_t bufsize,
+				off_t input_offset, off_t output_offset, off_t length,
+				struct pvskipregion_s **remaining, unsigned int *count, unsigned int *allocated)
+{
+	off_t recovered, split, first, second;
+
+	if (pv_sig_aborted(state))
+		return -1;
+
+	recovered = 0;
+
+	if (length <= (off_t) bufsize) {
+		off_t nread;
+
+		nread = pv__recover_read(fd, buffer, input_offset, length);
+		if (nread > 0) {
+			off_t nwritten;
+
+			nwritten = 0;
+			while (nwritten < nread) {
+				ssize_t n;
+
+				n = pwrite(state->output_fd, buffer + nwritten, nread - nwritten,
+					   output_offset + nwritten);
+				if ((n < 0) && ((EINTR == errno) || (EAGAIN == errno)))
+					continue;
+				if (n <= 0) {
+					pv_error(state, "%s: %s", _("write failed"), strerror(errno));
+					state->exit_status |= 16;
+					return -1;
+				}
+				nwritten += n;
+			}
+
+			debug("%s: %lld+%lld: %lld %s", "recovered", (long long) input_offset, (long long) length,
+			      (long long) nread, "bytes");
+
+			recovered = nread;
+			input_offset += nread;
+			output_offset += nread;
+			length -= nread;
+			if (0 == length)
+				return recovered;
+		}
+	}
+
+	/*
+	 * Split on a block boundary, giving up if this is already no more
+	 * than one block.
+	 */
+	split = input_offset + (length / 2);
+	split -= split % RECOVER_MIN_BLOCK;
+	if (split <= input_offset)
+		split = input_offset + RECOVER_MIN_BLOCK - (input_offset % RECOVER_MIN_BLOCK);
+
+	if ((length <= RECOVER_MIN_BLOCK) || (split >= input_offset + length)) {
+		if (!pv__skipped_append(remaining, count, allocated, input_offset, output_offset, length)) {
+			pv_error(state, "%s: %s", _("skipped region list allocation failed"), strerror(errno));
+			state->exit_status |= 64;
+			return -1;
+		}
+		return recovered;
+	}
+
+	first = pv__recover_region(state, fd, buffer, bufsize, input_offset, output_offset, split - input_offset,
+				   remaining, count, allocated);
+	if (first < 0)
+		return -1;
+
+	second = pv__recover_region(state, fd, buffer, bufsize, split, output_offset + (split - input_offset),
+				    input_offset + length - split, remaining, count, allocated);
+	if (second < 0)
+		return -1;
+
+	return recovered + first + second;
+}
+
+
+/*
+ * Once the input file "fd" has been read all the way through, go back
+ * over the regions that were skipped because of read errors, and recover
+ * as much of them as can be read, writing it over the zeroes in the
+ * output with pwrite().  This is only possible if the input and output
+ * are both seekable; regions which couldn't be patched are left alone.
+ *
+ * Afterwards, the list of skipped regions holds only what could still not
+ * be read, or couldn't be patched.
+ */
+void pv_recover_skipped(pvstate_t state, int fd)
+{
+	struct pvskipregion_s *remaining;
+	unsigned int remaining_count, remaining_alloc, idx;
+	unsigned char *buffer;
+	size_t bufsize;
+	off_t skipped_total, recovered_total;
+
+	if ((NULL == state) || (0 == state->error_skip_block) || (state->skipped_tried >= state->skipped_count))
+		return;
+
+	bufsize = state->error_skip_block;
+	if (bufsize < RECOVER_MIN_BLOCK)
+		bufsize = RECOVER_MIN_BLOCK;
+	if (bufsize > RECOVER_MAX_BUFFER)
+		bufsize = RECOVER_MAX_BUFFER;
+
+	buffer = malloc(bufsize);
+	if (NULL == buffer) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return;
+	}
+
+	remaining = NULL;
+	remaining_count = 0;
+	remaining_alloc = 0;
+	skipped_total = 0;
+	recovered_total = 0;
+
+	for (idx = 0; idx < state->skipped_count; idx++) {
+		struct pvskipregion_s *region = &(state->skipped[idx]);
+		unsigned int recorded;
+		off_t recovered;
+
+		if ((idx < state->skipped_tried) || (region->output_offset < 0)) {
+			if (!pv__skipped_append
+			    (&remaining, &remaining_count, &remaining_alloc, region->input_offset,
+			     region->output_offset, region->length)) {
+				pv_error(state, "%s: %s", _("skipped region list allocation failed"), strerror(errno));
+				state->exit_status |= 64;
+			}
+			continue;
+		}
+
+		skipped_total += region->length;
+
+		recorded = remaining_count;
+		recovered = pv__recover_region(state, fd, buffer, bufsize, region->input_offset,
+					       region->output_offset, region->length, &remaining, &remaining_count,
+					       &remaining_alloc);
+		if (recovered < 0) {
+			/*
+			 * Keep whatever wasn't tried, including all of this
+			 * region in place of any parts of it already recorded,
+			 * so that the list has no overlaps.
+			 */
+			remaining_count = recorded;
+			for (; idx < state->skipped_count; idx++) {
+				region = &(state->skipped[idx]);
+				(void) pv__skipped_append(&remaining, &remaining_count, &remaining_alloc,
+							  region->input_offset, region->output_offset, region->length);
+			}
+			break;
+		}
+
+		recovered_total += recovered;
+	}
+
+	free(buffer);
+
+	if ((skipped_total > 0) && (state->skip_errors < 2) && (!state->no_op)) {
+		pv_error(state, "%s: %s: %lld/%lld %s", state->current_file,
+			 _("recovered from skipped regions"), (long long) recovered_total, (long long) skipped_total,
+			 _("B"));
+	}
+
+	if (NULL != state->skipped)
+		free(state->skipped);
+	state->skipped = remaining;
+	state->skipped_count = remaining_count;
+	state->skipped_alloc = remaining_alloc;
+	state->skipped_tried = remaining_count;
+}
+
+
+/*
+ * Write the list of skipped regions of the input file "fd" to the
+ * --error-map file, replacing it, so that a later run can try them again.
+ *
+ * If "finished" is false, the transfer stopped early, so everything from
+ * the first byte not yet written onwards is added as one more region.
+ *
+ * The size the output had reached is recorded too, so that a retry can
+ * check that the output it is given still holds the first pass.
+ */
+void pv_error_map_save(pvstate_t state, int fd, bool finished)
+{
+	char tmpname[PV_SIZEOF_ERROR_MAP_NAME];	 /* flawfinder: ignore */
+	off_t input_size, output_size, tail_start, tail_output;
+	unsigned int idx;
+	FILE *fptr;
+
+	/*
+	 * flawfinder: tmpname is only written with pv_snprintf(), which is
+	 * bounded and always terminates.
+	 */
+
+	if ((NULL == state) || (NULL == state->error_map))
+		return;
+
+	input_size = (fd >= 0) ? pv__input_size(fd) : -1;
+
+	/*
+	 * When retrying, the output position is still at the start, so keep
+	 * the size from the map being retried.
+	 */
+	output_size = pv__output_offset(state);
+	if (state->error_map_output > output_size)
+		output_size = state->error_map_output;
+
+	tail_start = -1;
+	tail_output = -1;
+	if ((!finished) && (fd >= 0) && (input_size >= 0)) {
+		tail_start = pv_transfer_input_offset(state, fd);
+		tail_output = pv__output_offset(state);
+	}
+
+	(void) pv_snprintf(tmpname, sizeof(tmpname), "%s.tmp", state->error_map);
+
+	fptr = fopen(tmpname, "w");	/* flawfinder: ignore */
+	if (NULL == fptr) {
+		pv_error(state, "%s: %s", tmpname, strerror(errno));
+		state->exit_status |= 2;
+		return;
+	}
+
+	fprintf(fptr, "%s\n", PV_ERROR_MAP_HEADER);
+	fprintf(fptr, "# input: %s\n", NULL == state->current_file ? "-" : state->current_file);
+	fprintf(fptr, "# size: %lld\n", (long long) input_size);
+	fprintf(fptr, "# output: %lld\n", (long long) output_size);
+	fprintf(fptr, "# input_offset length output_offset\n");
+
+	for (idx = 0; idx < state->skipped_count; idx++) {
+		struct pvskipregion_s *region = &(state->skipped[idx]);
+		off_t length;
+
+		length = region->length;
+		if (tail_start >= 0) {
+			if (region->input_offset >= tail_start)
+				continue;
+			if (region->input_offset + length > tail_start)
+				length = tail_start - region->input_offset;
+		}
+
+		fprintf(fptr, "%lld %lld %lld\n", (long long) (region->input_offset), (long long) length,
+			(long long) (region->output_offset));
+	}
+
+	if ((tail_start >= 0) && (input_size > tail_start)) {
+		fprintf(fptr, "%lld %lld %lld\n", (long long) tail_start, (long long) (input_size - tail_start),
+			(long long) tail_output);
+	}
+
+	if ((0 != ferror(fptr)) || (0 != fclose(fptr))) {
+		pv_error(state, "%s: %s", tmpname, strerror(errno));
+		state->exit_status |= 2;
+		(void) unlink(tmpname);
+		return;
+	}
+
+	if (0 != rename(tmpname, state->error_map)) {
+		pv_error(state, "%s: %s", state->error_map, strerror(errno));
+		state->exit_status |= 2;
+		(void) unlink(tmpname);
+	}
+}
+
+
+/*
+ * Load the regions listed in the --error-map file into the list of skipped
+ * regions for the input file "fd", checking that the map was made from an
+ * input of the same size, and that the output is at least as big as it
+ * was when the map was made, so that it still holds the first pass rather
+ * than having been truncated.  Returns false on error.
+ */
+static bool pv__error_map_load(pvstate_t state, int fd)
+{
+	char line[256];			 /* flawfinder: ignore */
+	off_t input_size, output_needed;
+	struct stat sb;
+	unsigned int idx;
+	FILE *fptr;
+	bool header_seen;
+
+	/*
+	 * flawfinder: fgets() is bounded by sizeof(line) and always
+	 * terminates.
+	 */
+
+	fptr = fopen(state->error_map, "r");	/* flawfinder: ignore */
+	if (NULL == fptr) {
+		pv_error(state, "%s: %s", state->error_map, strerror(errno));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	input_size = pv__input_size(fd);
+	header_seen = false;
+	pv_skipped_reset(state);
+
+	while (NULL != fgets(line, sizeof(line), fptr)) {
+		long long input_offset, length, output_offset, size;
+
+		if (!header_seen) {
+			if (0 != strncmp(line, PV_ERROR_MAP_HEADER, strlen(PV_ERROR_MAP_HEADER)))
+				break;
+			header_seen = true;
+			continue;
+		}
+
+		if (1 == sscanf(line, "# size: %lld", &size)) {
+			if ((size >= 0) && (input_size >= 0) && (size != (long long) input_size)) {
+				pv_error(state, "%s: %s", state->error_map,
+					 _("error map is for an input of a different size"));
+				state->exit_status |= 2;
+				fclose(fptr);
+				return false;
+			}
+			continue;
+		}
+
+		if (1 == sscanf(line, "# output: %lld", &size)) {
+			state->error_map_output = (off_t) size;
+			continue;
+		}
+
+		if ('#' == line[0])
+			continue;
+
+		if (3 != sscanf(line, "%lld %lld %lld", &input_offset, &length, &output_offset))
+			continue;
+
+		if ((input_offset < 0) || (length <= 0))
+			continue;
+
+		if (!pv__skipped_append
+		    (&(state->skipped), &(state->skipped_count), &(state->skipped_alloc), (off_t) input_offset,
+		     (off_t) output_offset, (off_t) length)) {
+			pv_error(state, "%s: %s", _("skipped region list allocation failed"), strerror(errno));
+			state->exit_status |= 64;
+			fclose(fptr);
+			return false;
+		}
+	}
+
+	fclose(fptr);
+
+	if (!header_seen) {
+		pv_error(state, "%s: %s", state->error_map, _("not an error map"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	/*
+	 * The output must reach as far as the first pass wrote it.  That may
+	 * be short of the end of the last region, which can run on past a
+	 * "--stop-at-size" limit or into the unread tail of an interrupted
+	 * transfer, so only if the map doesn't say how far the output got do
+	 * we go by the regions instead.
+	 */
+	output_needed = state->error_map_output;
+	for (idx = 0; (state->error_map_output < 0) && (idx < state->skipped_count); idx++) {
+		struct pvskipregion_s *region = &(state->skipped[idx]);
+		off_t region_end;
+
+		if (region->output_offset < 0)
+			continue;
+		region_end = region->output_offset + region->length;
+		if (region_end > output_needed)
+			output_needed = region_end;
+	}
+
+	if ((0 == fstat(state->output_fd, &sb)) && (S_ISREG(sb.st_mode)) && (sb.st_size < output_needed)) {
+		pv_error(state, "%s: %s", "(stdout)", _("output is shorter than the error map"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Try again to read the regions listed in the --error-map file from the
+ * first input file, a block at a time, and write whatever can be read to
+ * the output at the offsets recorded in the map, which must therefore be a
+ * regular file or block device opened without truncating or appending
+ * (such as with "1<>FILE" in the shell).  The map is then rewritten to
+ * list only what still couldn't be read.
+ *
+ * Regions are read in blocks of -Z bytes, or RECOVER_RETRY_BLOCK if not
+ * given, and any block which can't be read is bisected down to
+ * RECOVER_MIN_BLOCK.  Reads use O_DIRECT if -K was given, in which case the
+ * regions are widened to RECOVER_MIN_BLOCK boundaries.
+ *
+ * Returns nonzero on error, including if anything is still unreadable.
+ */
+int pv_error_map_retry(pvstate_t state)
+{
+	struct pvskipregion_s *remaining;
+	unsigned int remaining_count, remaining_alloc, idx;
+	unsigned char *buffer;
+	size_t bufsize;
+	off_t wanted_total, recovered_total, input_size;
+	int fd;
+
+	if (NULL == state)
+		return 1;
+
+	fd = pv_next_file(state, 0, -1);
+	if (fd < 0)
+		return state->exit_status;
+
+	if (!pv__error_map_load(state, fd)) {
+		if (fd != STDIN_FILENO)
+			close(fd);
+		return state->exit_status;
+	}
+
+	if ((state->skipped_count > 0) && (pv__output_offset(state) < 0)) {
+		pv_error(state, "%s",
+			 _("retrying an error map needs an output file which is not truncated or appended to"));
+		state->exit_status |= 2;
+		if (fd != STDIN_FILENO)
+			close(fd);
+		return state->exit_status;
+	}
+
+	bufsize = state->error_skip_block > 0 ? state->error_skip_block : RECOVER_RETRY_BLOCK;
+	bufsize -= bufsize % RECOVER_MIN_BLOCK;
+	if (bufsize < RECOVER_MIN_BLOCK)
+		bufsize = RECOVER_MIN_BLOCK;
+	if (bufsize > RECOVER_MAX_BUFFER)
+		bufsize = RECOVER_MAX_BUFFER;
+
+	buffer = NULL;
+#ifdef HAVE_POSIX_MEMALIGN
+	if (0 != posix_memalign((void **) &buffer, 4096, bufsize))
+		buffer = NULL;
+#else				/* !HAVE_POSIX_MEMALIGN */
+	buffer = malloc(bufsize);
+#endif				/* HAVE_POSIX_MEMALIGN */
+	if (NULL == buffer) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		if (fd != STDIN_FILENO)
+			close(fd);
+		return state->exit_status;
+	}
+
+	remaining = NULL;
+	remaining_count = 0;
+	remaining_alloc = 0;
+	wanted_total = 0;
+	recovered_total = 0;
+	input_size = pv__input_size(fd);
+
+	for (idx = 0; idx < state->skipped_count; idx++) {
+		struct pvskipregion_s region = state->skipped[idx];
+		unsigned int recorded;
+		off_t recovered, widen;
+
+		if (pv_sig_aborted(state) || (region.output_offset < 0)) {
+			(void) pv__skipped_append(&remaining, &remaining_count, &remaining_alloc, region.input_offset,
+						  region.output_offset, region.length);
+			continue;
+		}
+
+		/*
+		 * Direct I/O needs aligned offsets and lengths - reading a
+		 * little more either side is harmless, since the output
+		 * holds a straight copy of the input.
+		 */
+		if (state->direct_io) {
+			widen = region.input_offset % RECOVER_MIN_BLOCK;
+			if (widen > region.output_offset)
+				widen = 0;
+			region.input_offset -= widen;
+			region.output_offset -= widen;
+			region.length += widen;
+			if (0 != region.length % RECOVER_MIN_BLOCK)
+				region.length += RECOVER_MIN_BLOCK - (region.length % RECOVER_MIN_BLOCK);
+		}
+
+		/*
+		 * Don't go looking past the end of the input.
+		 */
+		if ((input_size >= 0) && (region.input_offset + region.length > input_size))
+			region.length = input_size - region.input_offset;
+		if (region.length <= 0)
+			continue;
+
+		wanted_total += region.length;
+
+		recorded = remaining_count;
+		recovered = pv__recover_region(state, fd, buffer, bufsize, region.input_offset, region.output_offset,
+					       region.length, &remaining, &remaining_count, &remaining_alloc);
+		if (recovered < 0) {
+			/*
+			 * Keep the whole region, in place of any parts of it
+			 * that were recorded before giving up.
+			 */
+			remaining_count = recorded;
+			(void) pv__skipped_append(&remaining, &remaining_count, &remaining_alloc, region.input_offset,
+						  region.output_offset, region.length);
+			continue;
+		}
+
+		recovered_total += recovered;
+	}
+
+	free(buffer);
+
+	if ((wanted_total > 0) && (state->skip_errors < 2) && (!state->no_op)) {
+		pv_error(state, "%s: %s: %lld/%lld %s", state->current_file,
+			 _("recovered from error map"), (long long) recovered_total, (long long) wanted_total, _("B"));
+	}
+
+	if (NULL != state->skipped)
+		free(state->skipped);
+	state->skipped = remaining;
+	state->skipped_count = remaining_count;
+	state->skipped_alloc = remaining_alloc;
+	state->skipped_tried = remaining_count;
+
+	pv_error_map_save(state, fd, true);
+
+	if (remaining_count > 0)
+		state->exit_status |= 16;
+
+	if (pv_sig_aborted(state))
+		state->exit_status |= 32;
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	return state->exit_status;
+}
+
+/* EOF */
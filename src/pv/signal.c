@@ -11,17 +11,57 @@
 #include "pv-internal.h"
 
 #include <signal.h>
+#include <string.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
 
 #ifdef HAVE_IPC
 void pv_crs_needreinit(pvstate_t);
 #endif
 
-static pvstate_t pv_sig_state = NULL;
+/*
+ * Signals are delivered to the whole process rather than to any one
+ * transfer, so all the handlers do is record them here, and each state
+ * catches up with them in pv_sig_check().  That way any number of states
+ * can be in use at once, in any number of threads.
+ *
+ * The time spent stopped is only changed by pv_sig_cont(), which bumps
+ * the continue count afterwards, so that pv_sig_check() can tell if it
+ * read the time while it was being changed.
+ */
+static volatile sig_atomic_t pv__sig_abort_count = 0;	/* SIGINT, SIGHUP, SIGTERM */
+static volatile sig_atomic_t pv__sig_winch_count = 0;	/* SIGWINCH */
+static volatile sig_atomic_t pv__sig_cont_count = 0;	/* SIGCONT */
+static volatile sig_atomic_t pv__sig_old_stderr = -1;	/* see pv_sig_ttou() */
+static volatile long pv__sig_stopped_sec = 0;	/* total time spent stopped */
+static volatile long pv__sig_stopped_usec = 0;
+static struct timeval pv__sig_tstp_time;	/* see pv_sig_tstp() */
+
+/*
+ * The number of states which have called pv_sig_init() without calling
+ * pv_sig_fini() yet, and the signal actions from before the first of
+ * them installed the handlers.
+ */
+static unsigned int pv__sig_users = 0;
+static struct {
+	struct sigaction sigpipe;
+	struct sigaction sigttou;
+	struct sigaction sigtstp;
+	struct sigaction sigcont;
+	struct sigaction sigwinch;
+	struct sigaction sigint;
+	struct sigaction sighup;
+	struct sigaction sigterm;
+} pv__sig_old;
+#ifdef HAVE_THREADS
+static pthread_mutex_t pv__sig_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif				/* HAVE_THREADS */
 
 
 /*
@@ -40,8 +80,8 @@ static void pv_sig_ttou( __attribute__((unused))
 	if (fd < 0)
 		return;
 
-	if (-1 == pv_sig_state->pv_sig_old_stderr)
-		pv_sig_state->pv_sig_old_stderr = dup(STDERR_FILENO);
+	if (-1 == pv__sig_old_stderr)
+		pv__sig_old_stderr = dup(STDERR_FILENO);
 
 	dup2(fd, STDERR_FILENO);
 	close(fd);
@@ -55,219 +95,283 @@ static void pv_sig_ttou( __attribute__((unused))
 static void pv_sig_tstp( __attribute__((unused))
 			int s)
 {
-	gettimeofday(&(pv_sig_state->pv_sig_tstp_time), NULL);
+	gettimeofday(&pv__sig_tstp_time, NULL);
 	raise(SIGSTOP);
 }
 
 
 /*
  * Handle SIGCONT (continue if stopped) by adding the elapsed time since the
- * last SIGTSTP to the elapsed time offset, and by trying to write to the
- * terminal again (by replacing the /dev/null stderr with the old stderr).
+ * last SIGTSTP to the total time spent stopped, and by trying to write to
+ * the terminal again (by replacing the /dev/null stderr with the old
+ * stderr).
  */
 static void pv_sig_cont( __attribute__((unused))
 			int s)
 {
 	struct timeval tv;
 	struct termios t;
+	long sec, usec;
+
+	if (0 != pv__sig_tstp_time.tv_sec) {
+		gettimeofday(&tv, NULL);
+
+		sec = pv__sig_stopped_sec + (tv.tv_sec - pv__sig_tstp_time.tv_sec);
+		usec = pv__sig_stopped_usec + (tv.tv_usec - pv__sig_tstp_time.tv_usec);
+		if (usec >= 1000000) {
+			sec++;
+			usec -= 1000000;
+		}
+		if (usec < 0) {
+			sec--;
+			usec += 1000000;
+		}
+		pv__sig_stopped_sec = sec;
+		pv__sig_stopped_usec = usec;
+
+		pv__sig_tstp_time.tv_sec = 0;
+		pv__sig_tstp_time.tv_usec = 0;
+
+		if (pv__sig_old_stderr != -1) {
+			dup2(pv__sig_old_stderr, STDERR_FILENO);
+			close(pv__sig_old_stderr);
+			pv__sig_old_stderr = -1;
+		}
+	}
 
-	pv_sig_state->pv_sig_newsize = 1;
+	tcgetattr(STDERR_FILENO, &t);
+	t.c_lflag |= TOSTOP;
+	tcsetattr(STDERR_FILENO, TCSANOW, &t);
 
-	if (0 == pv_sig_state->pv_sig_tstp_time.tv_sec) {
-		tcgetattr(STDERR_FILENO, &t);
-		t.c_lflag |= TOSTOP;
-		tcsetattr(STDERR_FILENO, TCSANOW, &t);
-#ifdef HAVE_IPC
-		pv_crs_needreinit(pv_sig_state);
-#endif
-		return;
-	}
+	pv__sig_cont_count++;
+}
+
+
+/*
+ * Handle SIGWINCH (window size changed) by counting it.
+ */
+static void pv_sig_winch( __attribute__((unused))
+			 int s)
+{
+	pv__sig_winch_count++;
+}
 
-	gettimeofday(&tv, NULL);
 
-	pv_sig_state->pv_sig_toffset.tv_sec += (tv.tv_sec - pv_sig_state->pv_sig_tstp_time.tv_sec);
-	pv_sig_state->pv_sig_toffset.tv_usec += (tv.tv_usec - pv_sig_state->pv_sig_tstp_time.tv_usec);
-	if (pv_sig_state->pv_sig_toffset.tv_usec >= 1000000) {
-		pv_sig_state->pv_sig_toffset.tv_sec++;
-		pv_sig_state->pv_sig_toffset.tv_usec -= 1000000;
+/*
+ * Handle termination signals by counting them.
+ */
+static void pv_sig_term( __attribute__((unused))
+			int s)
+{
+	pv__sig_abort_count++;
+}
+
+
+/*
+ * Treat all of the signals received so far as already seen by "state", and
+ * zero its count of the time spent stopped.
+ */
+void pv_sig_sync(pvstate_t state)
+{
+	sig_atomic_t count;
+
+	do {
+		count = pv__sig_cont_count;
+		state->pv_sig_seen_stopped.tv_sec = pv__sig_stopped_sec;
+		state->pv_sig_seen_stopped.tv_usec = pv__sig_stopped_usec;
+	} while (count != pv__sig_cont_count);
+
+	state->pv_sig_seen_cont = count;
+	state->pv_sig_seen_abort = pv__sig_abort_count;
+	state->pv_sig_seen_winch = pv__sig_winch_count;
+	state->pv_sig_toffset.tv_sec = 0;
+	state->pv_sig_toffset.tv_usec = 0;
+}
+
+
+/*
+ * Catch "state" up with any signals received since it last looked: set its
+ * abort flag after a termination signal, its new size flag after the
+ * window size changes or the process is continued, and add any time spent
+ * stopped to its elapsed time offset.
+ */
+void pv_sig_check(pvstate_t state)
+{
+	sig_atomic_t count;
+	long sec, usec;
+
+	if (state->pv_sig_seen_abort != pv__sig_abort_count) {
+		state->pv_sig_seen_abort = pv__sig_abort_count;
+		state->pv_sig_abort = true;
 	}
-	if (pv_sig_state->pv_sig_toffset.tv_usec < 0) {
-		pv_sig_state->pv_sig_toffset.tv_sec--;
-		pv_sig_state->pv_sig_toffset.tv_usec += 1000000;
+
+	if (state->pv_sig_seen_winch != pv__sig_winch_count) {
+		state->pv_sig_seen_winch = pv__sig_winch_count;
+		state->pv_sig_newsize = true;
 	}
 
-	pv_sig_state->pv_sig_tstp_time.tv_sec = 0;
-	pv_sig_state->pv_sig_tstp_time.tv_usec = 0;
+	if (state->pv_sig_seen_cont == pv__sig_cont_count)
+		return;
 
-	if (pv_sig_state->pv_sig_old_stderr != -1) {
-		dup2(pv_sig_state->pv_sig_old_stderr, STDERR_FILENO);
-		close(pv_sig_state->pv_sig_old_stderr);
-		pv_sig_state->pv_sig_old_stderr = -1;
+	do {
+		count = pv__sig_cont_count;
+		sec = pv__sig_stopped_sec;
+		usec = pv__sig_stopped_usec;
+	} while (count != pv__sig_cont_count);
+
+	state->pv_sig_toffset.tv_sec += sec - state->pv_sig_seen_stopped.tv_sec;
+	state->pv_sig_toffset.tv_usec += usec - state->pv_sig_seen_stopped.tv_usec;
+	if (state->pv_sig_toffset.tv_usec >= 1000000) {
+		state->pv_sig_toffset.tv_sec++;
+		state->pv_sig_toffset.tv_usec -= 1000000;
+	}
+	if (state->pv_sig_toffset.tv_usec < 0) {
+		state->pv_sig_toffset.tv_sec--;
+		state->pv_sig_toffset.tv_usec += 1000000;
 	}
 
-	tcgetattr(STDERR_FILENO, &t);
-	t.c_lflag |= TOSTOP;
-	tcsetattr(STDERR_FILENO, TCSANOW, &t);
+	state->pv_sig_seen_stopped.tv_sec = sec;
+	state->pv_sig_seen_stopped.tv_usec = usec;
+	state->pv_sig_seen_cont = count;
+	state->pv_sig_newsize = true;
 
 #ifdef HAVE_IPC
-	pv_crs_needreinit(pv_sig_state);
+	pv_crs_needreinit(state);
 #endif
 }
 
 
 /*
- * Handle SIGWINCH (window size changed) by setting a flag.
+ * Return true if the transfer on "state" has to stop because of a
+ * termination signal, catching up with any signals received first.
  */
-static void pv_sig_winch( __attribute__((unused))
-			 int s)
+bool pv_sig_aborted(pvstate_t state)
 {
-	pv_sig_state->pv_sig_newsize = 1;
+	pv_sig_check(state);
+	return state->pv_sig_abort;
 }
 
 
 /*
- * Handle termination signals by setting the abort flag.
+ * Install "handler" for signal "signum", saving the previous action in
+ * "old".
  */
-static void pv_sig_term( __attribute__((unused))
-			int s)
+static void pv__sig_install(int signum, void (*handler)(int), struct sigaction *old)
 {
-	pv_sig_state->pv_sig_abort = 1;
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler;
+	sigemptyset(&(sa.sa_mask));
+	sa.sa_flags = 0;
+	sigaction(signum, &sa, old);
 }
 
 
 /*
  * Initialise signal handling.
+ *
+ * The handlers are installed by the first state to get here, and the
+ * previous actions are put back by the last one to call pv_sig_fini(), so
+ * that one transfer finishing doesn't take the handlers away from another
+ * which is still running.
  */
 void pv_sig_init(pvstate_t state)
 {
-	struct sigaction sa;
+	pv_sig_sync(state);
 
-	pv_sig_state = state;
+	if (state->pv_sig_installed)
+		return;
+	state->pv_sig_installed = true;
 
-	pv_sig_state->pv_sig_old_stderr = -1;
-	pv_sig_state->pv_sig_tstp_time.tv_sec = 0;
-	pv_sig_state->pv_sig_tstp_time.tv_usec = 0;
-	pv_sig_state->pv_sig_toffset.tv_sec = 0;
-	pv_sig_state->pv_sig_toffset.tv_usec = 0;
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&pv__sig_lock);
+#endif				/* HAVE_THREADS */
+
+	pv__sig_users++;
+	if (pv__sig_users > 1) {
+#ifdef HAVE_THREADS
+		pthread_mutex_unlock(&pv__sig_lock);
+#endif				/* HAVE_THREADS */
+		return;
+	}
 
 	/*
 	 * Ignore SIGPIPE, so we don't die if stdout is a pipe and the other
 	 * end closes unexpectedly.
 	 */
-	sa.sa_handler = SIG_IGN;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGPIPE, &sa, &(pv_sig_state->pv_sig_old_sigpipe));
+	pv__sig_install(SIGPIPE, SIG_IGN, &(pv__sig_old.sigpipe));
 
 	/*
 	 * Handle SIGTTOU by continuing with output switched off, so that we
 	 * can be stopped and backgrounded without messing up the terminal.
 	 */
-	sa.sa_handler = pv_sig_ttou;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGTTOU, &sa, &(pv_sig_state->pv_sig_old_sigttou));
+	pv__sig_install(SIGTTOU, pv_sig_ttou, &(pv__sig_old.sigttou));
 
 	/*
 	 * Handle SIGTSTP by storing the time the signal happened for later
 	 * use by pv_sig_cont(), and then stopping the process.
 	 */
-	sa.sa_handler = pv_sig_tstp;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGTSTP, &sa, &(pv_sig_state->pv_sig_old_sigtstp));
+	pv__sig_install(SIGTSTP, pv_sig_tstp, &(pv__sig_old.sigtstp));
 
 	/*
 	 * Handle SIGCONT by adding the elapsed time since the last SIGTSTP
 	 * to the elapsed time offset, and by trying to write to the
 	 * terminal again.
 	 */
-	sa.sa_handler = pv_sig_cont;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGCONT, &sa, &(pv_sig_state->pv_sig_old_sigcont));
+	pv__sig_install(SIGCONT, pv_sig_cont, &(pv__sig_old.sigcont));
 
 	/*
 	 * Handle SIGWINCH by setting a flag to let the main loop know it
 	 * has to reread the terminal size.
 	 */
-	sa.sa_handler = pv_sig_winch;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGWINCH, &sa, &(pv_sig_state->pv_sig_old_sigwinch));
+	pv__sig_install(SIGWINCH, pv_sig_winch, &(pv__sig_old.sigwinch));
 
 	/*
 	 * Handle SIGINT, SIGHUP, SIGTERM by setting a flag to let the
 	 * main loop know it should quit now.
 	 */
-	sa.sa_handler = pv_sig_term;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGINT, &sa, &(pv_sig_state->pv_sig_old_sigint));
-
-	sa.sa_handler = pv_sig_term;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGHUP, &sa, &(pv_sig_state->pv_sig_old_sighup));
-
-	sa.sa_handler = pv_sig_term;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGTERM, &sa, &(pv_sig_state->pv_sig_old_sigterm));
-}
-
+	pv__sig_install(SIGINT, pv_sig_term, &(pv__sig_old.sigint));
+	pv__sig_install(SIGHUP, pv_sig_term, &(pv__sig_old.sighup));
+	pv__sig_install(SIGTERM, pv_sig_term, &(pv__sig_old.sigterm));
 
-/*
- * Shut down signal handling.
- */
-void pv_sig_fini( __attribute__((unused)) pvstate_t state)
-{
-	sigaction(SIGPIPE, &(pv_sig_state->pv_sig_old_sigpipe), NULL);
-	sigaction(SIGTTOU, &(pv_sig_state->pv_sig_old_sigttou), NULL);
-	sigaction(SIGTSTP, &(pv_sig_state->pv_sig_old_sigtstp), NULL);
-	sigaction(SIGCONT, &(pv_sig_state->pv_sig_old_sigcont), NULL);
-	sigaction(SIGWINCH, &(pv_sig_state->pv_sig_old_sigwinch), NULL);
-	sigaction(SIGINT, &(pv_sig_state->pv_sig_old_sigint), NULL);
-	sigaction(SIGHUP, &(pv_sig_state->pv_sig_old_sighup), NULL);
-	sigaction(SIGTERM, &(pv_sig_state->pv_sig_old_sigterm), NULL);
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&pv__sig_lock);
+#endif				/* HAVE_THREADS */
 }
 
 
 /*
- * Stop reacting to SIGTSTP and SIGCONT.
+ * Shut down signal handling, putting back the previous actions if no
+ * other state is still using the handlers.
  */
-void pv_sig_nopause(void)
+void pv_sig_fini(pvstate_t state)
 {
-	struct sigaction sa;
-
-	sa.sa_handler = SIG_IGN;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGTSTP, &sa, NULL);
-
-	sa.sa_handler = SIG_DFL;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGCONT, &sa, NULL);
-}
-
-
-/*
- * Start catching SIGTSTP and SIGCONT again.
- */
-void pv_sig_allowpause(void)
-{
-	struct sigaction sa;
-
-	sa.sa_handler = pv_sig_tstp;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGTSTP, &sa, NULL);
+	if (!state->pv_sig_installed)
+		return;
+	state->pv_sig_installed = false;
+
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&pv__sig_lock);
+#endif				/* HAVE_THREADS */
+
+	if (pv__sig_users > 0)
+		pv__sig_users--;
+
+	if (0 == pv__sig_users) {
+		sigaction(SIGPIPE, &(pv__sig_old.sigpipe), NULL);
+		sigaction(SIGTTOU, &(pv__sig_old.sigttou), NULL);
+		sigaction(SIGTSTP, &(pv__sig_old.sigtstp), NULL);
+		sigaction(SIGCONT, &(pv__sig_old.sigcont), NULL);
+		sigaction(SIGWINCH, &(pv__sig_old.sigwinch), NULL);
+		sigaction(SIGINT, &(pv__sig_old.sigint), NULL);
+		sigaction(SIGHUP, &(pv__sig_old.sighup), NULL);
+		sigaction(SIGTERM, &(pv__sig_old.sigterm), NULL);
+	}
 
-	sa.sa_handler = pv_sig_cont;
-	sigemptyset(&(sa.sa_mask));
-	sa.sa_flags = 0;
-	sigaction(SIGCONT, &sa, NULL);
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&pv__sig_lock);
+#endif				/* HAVE_THREADS */
 }
 
 
@@ -277,29 +381,30 @@ void pv_sig_allowpause(void)
  * get backgrounded, then foregrounded again, we start writing to the
  * terminal again.
  */
-void pv_sig_checkbg(void)
+void pv_sig_checkbg(pvstate_t state)
 {
-	static time_t next_check = 0;
 	struct termios t;
+	int fd;
 
-	if (time(NULL) < next_check)
+	if (time(NULL) < state->pv_sig_next_checkbg)
 		return;
 
-	next_check = time(NULL) + 1;
+	state->pv_sig_next_checkbg = time(NULL) + 1;
 
-	if (-1 == pv_sig_state->pv_sig_old_stderr)
+	fd = pv__sig_old_stderr;
+	if (-1 == fd)
 		return;
+	pv__sig_old_stderr = -1;
 
-	dup2(pv_sig_state->pv_sig_old_stderr, STDERR_FILENO);
-	close(pv_sig_state->pv_sig_old_stderr);
-	pv_sig_state->pv_sig_old_stderr = -1;
+	dup2(fd, STDERR_FILENO);
+	close(fd);
 
 	tcgetattr(STDERR_FILENO, &t);
 	t.c_lflag |= TOSTOP;
 	tcsetattr(STDERR_FILENO, TCSANOW, &t);
 
 #ifdef HAVE_IPC
-	pv_crs_needreinit(pv_sig_state);
+	pv_crs_needreinit(state);
 #endif
 }
 
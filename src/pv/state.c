@@ -54,12 +54,26 @@ pvstate_t pv_state_alloc(const char *program_name)
 	state->crs_pvcount = 1;
 #endif				/* HAVE_IPC */
 	state->crs_lock_fd = -1;
+	state->output_fd = STDOUT_FILENO;
+	state->input_fd = -1;
+
+	pv_sig_sync(state);
 
 	state->reparse_display = 1;
 	state->current_file = _("none");
 #ifdef HAVE_SPLICE
 	state->splice_failed_fd = -1;
+	state->discard_null_fd = -1;
+	state->discard_pipe[0] = -1;
+	state->discard_pipe[1] = -1;
 #endif				/* HAVE_SPLICE */
+#ifdef HAVE_MMAP_ENGINE
+	state->mmap_failed_fd = -1;
+#endif				/* HAVE_MMAP_ENGINE */
+	state->engine_fd = -1;
+	state->engine_trial = -1;
+	state->input_remaining = -1;
+	state->error_map_output = -1;
 	state->display_visible = false;
 
 	/*
@@ -88,10 +102,21 @@ void pv_state_free(pvstate_t state)
 	if (0 == state)
 		return;
 
+	(void) pv_step_finish(state);
+
 	if (NULL != state->display_buffer)
 		free(state->display_buffer);
 	state->display_buffer = NULL;
 
+	pv_transfer_fini(state);
+	pv_digest_finish(state, false);
+	pv_generate_free(state->generator);
+	state->generator = NULL;
+	pv_validate_finish(state, false);
+	pv_exec_fini(state);
+	pv_multi_fini(state);
+	pv_perfile_fini(state);
+
 	if (NULL != state->transfer_buffer)
 		free(state->transfer_buffer);
 	state->transfer_buffer = NULL;
@@ -100,6 +125,10 @@ void pv_state_free(pvstate_t state)
 		free(state->history);
 	state->history = NULL;
 
+	if (NULL != state->skipped)
+		free(state->skipped);
+	state->skipped = NULL;
+
 	free(state);
 
 	return;
@@ -136,6 +165,7 @@ void pv_state_set_format(pvstate_t state, bool progress,
 		(void) pv_snprintf(buf, sizeof(buf), "%%%uA", lastwritten);
 		PV_ADDFORMAT(lastwritten > 0, buf);
 	}
+	PV_ADDFORMAT(state->max_latency > 0, "%L");
 
 	state->name = name;
 	state->reparse_display = 1;
@@ -192,6 +222,141 @@ void pv_state_skip_errors_set(pvstate_t state, unsigned int val)
 	state->skip_errors = val;
 };
 
+void pv_state_error_skip_block_set(pvstate_t state, unsigned long long val)
+{
+	state->error_skip_block = val;
+};
+
+void pv_state_error_map_set(pvstate_t state, const char *val)
+{
+	state->error_map = val;
+};
+
+void pv_state_skip_input_set(pvstate_t state, unsigned long long val)
+{
+	state->skip_input = val;
+};
+
+void pv_state_seek_output_set(pvstate_t state, unsigned long long val)
+{
+	state->seek_output = val;
+};
+
+void pv_state_input_length_set(pvstate_t state, unsigned long long val)
+{
+	state->input_length = val;
+};
+
+void pv_state_input_block_size_set(pvstate_t state, unsigned long long val)
+{
+	state->input_block_size = (unsigned long) (val > BLOCK_SIZE_MAX ? BLOCK_SIZE_MAX : val);
+};
+
+void pv_state_output_block_size_set(pvstate_t state, unsigned long long val)
+{
+	state->output_block_size = (unsigned long) (val > BLOCK_SIZE_MAX ? BLOCK_SIZE_MAX : val);
+};
+
+void pv_state_output_block_pad_set(pvstate_t state, bool val)
+{
+	state->output_block_pad = val;
+};
+
+void pv_state_preallocate_set(pvstate_t state, bool val)
+{
+	state->preallocate = val;
+};
+
+void pv_state_parallel_set(pvstate_t state, unsigned int val)
+{
+	state->parallel_threads = val > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : val;
+};
+
+void pv_state_tee_drop_set(pvstate_t state, bool val)
+{
+	state->tee_drop = val;
+};
+
+void pv_state_split_set(pvstate_t state, bool val)
+{
+	state->split = val;
+};
+
+void pv_state_merge_set(pvstate_t state, bool val)
+{
+	state->merge = val;
+};
+
+void pv_state_hash_set(pvstate_t state, const char *val)
+{
+	state->digest_names = val;
+};
+
+void pv_state_hash_per_file_set(pvstate_t state, bool val)
+{
+	state->digest_per_file = val;
+};
+
+void pv_state_verify_set(pvstate_t state, bool val)
+{
+	state->verify = val;
+};
+
+void pv_state_generate_set(pvstate_t state, const char *val)
+{
+	state->generate = val;
+};
+
+void pv_state_validate_set(pvstate_t state, const char *val)
+{
+	state->validate = val;
+};
+
+void pv_state_discard_set(pvstate_t state, bool val)
+{
+	state->discard = val;
+};
+
+void pv_state_exec_set(pvstate_t state, const char *val)
+{
+	state->exec_command = val;
+};
+
+void pv_state_multi_set(pvstate_t state, bool val)
+{
+	state->multi = val;
+};
+
+void pv_state_multi_file_set(pvstate_t state, const char *val)
+{
+	state->multi_file = val;
+};
+
+void pv_state_per_file_set(pvstate_t state, bool val)
+{
+	state->per_file = val;
+};
+
+void pv_state_manifest_set(pvstate_t state, const char *val)
+{
+	state->manifest = val;
+};
+
+void pv_state_manifest_json_set(pvstate_t state, bool val)
+{
+	state->manifest_json = val;
+};
+
+void pv_state_checkpoint_set(pvstate_t state, const char *val)
+{
+	state->checkpoint = val;
+};
+
+void pv_state_resume_set(pvstate_t state, bool val)
+{
+	state->resume = val;
+};
+
 void pv_state_stop_at_size_set(pvstate_t state, bool val)
 {
 	state->stop_at_size = val;
@@ -223,6 +388,16 @@ void pv_state_no_splice_set(pvstate_t state, bool val)
 	state->no_splice = val;
 };
 
+void pv_state_pipe_size_set(pvstate_t state, unsigned int val)
+{
+	state->pipe_size = val;
+};
+
+void pv_state_max_latency_set(pvstate_t state, double val)
+{
+	state->max_latency = val;
+};
+
 void pv_state_size_set(pvstate_t state, unsigned long long val)
 {
 	state->size = val;
@@ -287,4 +462,43 @@ void pv_state_inputfiles(pvstate_t state, int input_file_count, const char **inp
 	state->input_files = input_files;
 }
 
+
+/*
+ * Set the array of extra output files to copy everything to.
+ */
+void pv_state_outputfiles(pvstate_t state, unsigned int output_file_count, const char **output_files)
+{
+	state->output_file_count = output_file_count;
+	state->output_files = output_files;
+}
+
+
+/*
+ * Set the file descriptor to read from instead of the input files.
+ */
+void pv_state_input_fd_set(pvstate_t state, int fd)
+{
+	state->input_fd = fd;
+}
+
+
+/*
+ * Set the file descriptor to write to instead of standard output.
+ */
+void pv_state_output_fd_set(pvstate_t state, int fd)
+{
+	state->output_fd = fd;
+}
+
+
+/*
+ * Set the function to give a snapshot of the transfer to at each update,
+ * and the pointer to pass to it.
+ */
+void pv_state_stats_callback_set(pvstate_t state, pv_stats_callback_t callback, void *data)
+{
+	state->stats_callback = callback;
+	state->stats_callback_data = data;
+}
+
 /* EOF */
@@ -0,0 +1,354 @@
+/*
+ * Functions for programs embedding PV to run a transfer a step at a time
+ * with pv_step(), instead of handing control over to pv_main_loop(), and
+ * to receive snapshots of its progress instead of a terminal display.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+
+/*
+ * The progress of a transfer being made with pv_step().  Times are in
+ * seconds since the start.
+ */
+struct pvstep_s {
+	int fd;				 /* input file descriptor, or -1 */
+	int file_num;			 /* number of the input file being read */
+	int eof_in;			 /* set once the input has ended */
+	int eof_out;			 /* set once everything is written */
+	bool finished;			 /* set once there is nothing left */
+	long long total_written;	 /* bytes (lines) moved so far */
+	long double target;		 /* bytes (lines) the rate limit allows */
+	long double last_ratecheck;	 /* when "target" was last added to */
+	long double next_update;	 /* when to next update the snapshot */
+	struct timeval start_time;	 /* when the transfer started */
+};
+
+
+/*
+ * Return the number of seconds since "step" started.
+ */
+static long double pv__step_elapsed(struct pvstep_s *step)
+{
+	struct timeval cur_time;
+	long double elapsed;
+
+	gettimeofday(&cur_time, NULL);
+	elapsed = cur_time.tv_sec - step->start_time.tv_sec;
+	elapsed += (cur_time.tv_usec - step->start_time.tv_usec) / 1000000.0;
+
+	return elapsed;
+}
+
+
+/*
+ * Update the snapshot of the transfer, given the seconds elapsed and the
+ * amount transferred so far, and pass it to the stats callback if there
+ * is one.  If "final" is true, the transfer has ended and the rate is the
+ * average over the whole of it.
+ */
+void pv_stats_update(pvstate_t state, long double elapsed, long long transferred, bool final)
+{
+	struct pvstats_s *stats = &(state->stats);
+	long double since_last;
+
+	if (transferred < 0)
+		transferred = 0;
+
+	/*
+	 * Leave the current rate alone until enough time has passed to
+	 * measure it.
+	 */
+	since_last = elapsed - stats->elapsed;
+	if ((!final) && (since_last < 0.01) && (stats->elapsed > 0))
+		return;
+
+	if (final) {
+		stats->rate = (elapsed > 0.000001) ? (long double) transferred / elapsed : 0;
+	} else if (since_last > 0) {
+		stats->rate = (long double) (transferred - (long long) (stats->transferred)) / since_last;
+	}
+
+	stats->transferred = (unsigned long long) transferred;
+	stats->size = state->size;
+	stats->elapsed = elapsed;
+	stats->average_rate = (elapsed > 0.000001) ? (long double) transferred / elapsed : 0;
+	stats->percentage = -1;
+	stats->eta = -1;
+	stats->file_num = state->current_file_num;
+	stats->finished = final;
+
+	if (state->size > 0) {
+		stats->percentage = 100.0 * (double) transferred / (double) (state->size);
+		if (stats->transferred >= state->size) {
+			stats->eta = 0;
+		} else if (stats->average_rate > 0) {
+			stats->eta =
+			    (long) ((long double) (state->size - stats->transferred) / stats->average_rate);
+		}
+	}
+
+	if (NULL != state->stats_callback)
+		state->stats_callback(state, stats, state->stats_callback_data);
+}
+
+
+/*
+ * Fill in "stats" with the snapshot of the transfer as of the last update.
+ */
+void pv_stats(pvstate_t state, struct pvstats_s *stats)
+{
+	memcpy(stats, &(state->stats), sizeof(*stats));
+}
+
+
+/*
+ * Open the input ready for pv_step() - the caller's file descriptor if one
+ * was given, or otherwise the first input file - and work out the size of
+ * the transfer if none was given.  Returns false on error.
+ */
+bool pv_step_start(pvstate_t state)
+{
+	struct pvstep_s *step;
+	struct stat sb;
+
+	if (NULL != state->step)
+		return true;
+
+	step = calloc(1, sizeof(*step));
+	if (NULL == step) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return false;
+	}
+	state->step = step;
+
+	/*
+	 * The caller does any waiting, not pv_transfer().
+	 */
+	state->no_wait = true;
+
+	if (state->input_fd >= 0) {
+		step->fd = state->input_fd;
+		state->current_file = _("(input)");
+		state->current_file_num = 0;
+		state->input_remaining = -1;
+		pv_skipped_reset(state);
+		pv_engine_start(state, step->fd);
+	} else {
+		step->fd = pv_next_file(state, 0, -1);
+	}
+
+	if (step->fd < 0) {
+		step->finished = true;
+		return false;
+	}
+
+	pv_set_pipe_size(state, state->output_fd);
+
+	if ((0 == state->target_buffer_size) && (0 == fstat(step->fd, &sb))) {
+		state->target_buffer_size = sb.st_blksize * 32;
+		if (state->target_buffer_size > BUFFER_SIZE_MAX)
+			state->target_buffer_size = BUFFER_SIZE_MAX;
+	}
+	if (0 == state->target_buffer_size)
+		state->target_buffer_size = BUFFER_SIZE;
+
+	/*
+	 * Work out the size, if we can, so that there is a percentage and
+	 * an ETA in the snapshots.
+	 */
+	if ((0 == state->size) && (!state->linemode)) {
+		if (state->input_fd < 0) {
+			state->size = pv_calc_total_size(state);
+		} else if ((0 == fstat(step->fd, &sb)) && S_ISREG(sb.st_mode)) {
+			off_t position = lseek(step->fd, 0, SEEK_CUR);
+			if ((position >= 0) && (sb.st_size > position))
+				state->size = (unsigned long long) (sb.st_size - position);
+		}
+	}
+
+	memset(&(state->stats), 0, sizeof(state->stats));
+	state->stats.size = state->size;
+	state->stats.percentage = -1;
+	state->stats.eta = -1;
+
+	gettimeofday(&(step->start_time), NULL);
+	step->next_update = state->interval > 0 ? state->interval : 1;
+
+	debug("%s: %d: %llu", "step transfer started", step->fd, state->size);
+
+	return true;
+}
+
+
+/*
+ * Move what can be moved from the input to the output without waiting, up
+ * to "budget" bytes (lines, in line mode), or with no limit other than the
+ * rate limit if "budget" is 0.  Once an input file ends, the next one is
+ * opened.  The snapshot is updated every state->interval seconds, and at
+ * the end.
+ *
+ * Returns the number of bytes (lines) moved, which may be 0, or -1 once
+ * the transfer has ended, whether because there is nothing left or
+ * because of an error, after which pv_step_finish() gives the exit status.
+ */
+long long pv_step(pvstate_t state, unsigned long long budget)
+{
+	struct pvstep_s *step;
+	unsigned long long allowed;
+	long written, lineswritten;
+	long double elapsed;
+	long long moved;
+
+	if ((NULL == state->step) && (!pv_step_start(state)))
+		return -1;
+
+	step = state->step;
+	if (step->finished)
+		return -1;
+
+	elapsed = pv__step_elapsed(step);
+	allowed = budget;
+
+	/*
+	 * Top up the rate limit allowance for the time that has passed
+	 * since the last step, however long that was, up to the burst
+	 * window.
+	 */
+	if (state->rate_limit > 0) {
+		step->target += (long double) (state->rate_limit) * (elapsed - step->last_ratecheck);
+		step->last_ratecheck = elapsed;
+		if (step->target > (long double) (state->rate_limit * RATE_BURST_WINDOW))
+			step->target = (long double) (state->rate_limit * RATE_BURST_WINDOW);
+		if (step->target < 1)
+			return 0;
+		if ((0 == allowed) || ((long double) allowed > step->target))
+			allowed = (unsigned long long) (step->target);
+	}
+
+	if ((state->stop_at_size) && (state->size > 0)) {
+		unsigned long long remaining;
+
+		remaining = 0;
+		if (state->size > (unsigned long long) (step->total_written))
+			remaining = state->size - (unsigned long long) (step->total_written);
+		if (0 == remaining) {
+			step->finished = true;
+			pv_stats_update(state, elapsed, step->total_written, true);
+			return -1;
+		}
+		if ((0 == allowed) || (allowed > remaining))
+			allowed = remaining;
+	}
+
+	lineswritten = 0;
+	written = pv_transfer(state, step->fd, &(step->eof_in), &(step->eof_out), allowed, &lineswritten);
+	pv_engine_update(state, written);
+
+	if (written < 0) {
+		step->finished = true;
+		pv_stats_update(state, elapsed, step->total_written, true);
+		return -1;
+	}
+
+	moved = state->linemode ? lineswritten : written;
+	step->total_written += moved;
+	if (state->rate_limit > 0)
+		step->target -= moved;
+
+	if (step->eof_in && step->eof_out) {
+		if ((state->input_fd < 0) && (step->file_num < state->input_file_count - 1)) {
+			step->file_num++;
+			step->fd = pv_next_file(state, step->file_num, step->fd);
+			if (step->fd < 0)
+				step->finished = true;
+			step->eof_in = 0;
+			step->eof_out = 0;
+		} else {
+			step->finished = true;
+		}
+	}
+
+	if ((step->finished) || (elapsed >= step->next_update)) {
+		pv_stats_update(state, elapsed, step->total_written, step->finished);
+		step->next_update = elapsed + (state->interval > 0 ? state->interval : 1);
+	}
+
+	if ((step->finished) && (0 == moved))
+		return -1;
+
+	return moved;
+}
+
+
+/*
+ * Add the file descriptors that the transfer being made with pv_step() is
+ * waiting on to "readfds" and "writefds", returning the highest one, or
+ * "max_fd" if none are higher.
+ */
+int pv_step_fdset(pvstate_t state, fd_set *readfds, fd_set *writefds, int max_fd)
+{
+	struct pvstep_s *step = state->step;
+
+	if ((NULL == step) || (step->finished) || (step->fd < 0))
+		return max_fd;
+
+	if ((!step->eof_in) && ((0 == state->buffer_size) || (state->read_position < state->buffer_size))) {
+		FD_SET(step->fd, readfds);
+		if (step->fd > max_fd)
+			max_fd = step->fd;
+	}
+
+	if (state->read_position > state->write_position) {
+		FD_SET(state->output_fd, writefds);
+		if (state->output_fd > max_fd)
+			max_fd = state->output_fd;
+	}
+
+	return max_fd;
+}
+
+
+/*
+ * Finish a transfer made with pv_step(), closing the input unless it was
+ * the caller's, and giving a final snapshot if it hadn't already ended.
+ * Returns the exit status.
+ */
+int pv_step_finish(pvstate_t state)
+{
+	struct pvstep_s *step = state->step;
+
+	if (NULL == step)
+		return state->exit_status;
+
+	if (!step->finished) {
+		step->finished = true;
+		pv_stats_update(state, pv__step_elapsed(step), step->total_written, true);
+	}
+
+	if ((step->fd >= 0) && (step->fd != state->input_fd))
+		(void) close(step->fd);
+
+	free(step);
+	state->step = NULL;
+
+	return state->exit_status;
+}
+
+/* EOF */
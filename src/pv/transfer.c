@@ -22,6 +22,17 @@
 #include <signal.h>
 #include <sys/time.h>
 
+#if defined(HAVE_LINE_TEE) || (defined(HAVE_MMAP_ENGINE) && defined(HAVE_THREADS))
+#include <pthread.h>
+#endif
+#ifdef HAVE_MMAP_ENGINE
+#include <setjmp.h>
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_VMSPLICE
+#include <sys/uio.h>
+#endif
+
 
 /*
  * Read up to "count" bytes from file descriptor "fd" into the buffer "buf",
@@ -29,12 +40,16 @@
  *
  * Unlike read(), if we have read less than "count" bytes, we check to see
  * if there's any more to read, and keep trying, to make sure we fill the
- * buffer as full as we can.
+ * buffer as full as we can.  If a later read fails, what was read before
+ * it is returned, and the error is left for the next call to run into.
  *
  * We stop retrying if the time elapsed since this function was entered
- * reaches TRANSFER_READ_TIMEOUT microseconds.
+ * reaches "timeout" microseconds.
+ *
+ * This is not used with --input-block-size, where each read() has to be
+ * exactly one block, as devices such as tape drives expect.
  */
-static ssize_t pv__transfer_read_repeated(int fd, void *buf, size_t count)
+static ssize_t pv__transfer_read_repeated(int fd, void *buf, size_t count, long timeout)
 {
 	struct timeval start_time;
 	ssize_t total_read;
@@ -50,7 +65,7 @@ static ssize_t pv__transfer_read_repeated(int fd, void *buf, size_t count)
 
 		nread = read(fd, buf, count > MAX_READ_AT_ONCE ? MAX_READ_AT_ONCE : count);
 		if (nread < 0)
-			return nread;
+			return total_read > 0 ? total_read : nread;
 
 		total_read += nread;
 		buf += nread;
@@ -61,7 +76,7 @@ static ssize_t pv__transfer_read_repeated(int fd, void *buf, size_t count)
 
 		gettimeofday(&now, NULL);
 		elapsed_usec = 1000000 * (now.tv_sec - start_time.tv_sec) + (now.tv_usec - start_time.tv_usec);
-		if (elapsed_usec > TRANSFER_READ_TIMEOUT) {
+		if (elapsed_usec > timeout) {
 			debug("%s %d: %s (%ld %s)", "fd", fd,
 			      "stopping read - timer expired", elapsed_usec, "usec elapsed");
 			return total_read;
@@ -99,10 +114,13 @@ static ssize_t pv__transfer_read_repeated(int fd, void *buf, size_t count)
  * If "sync_after_write" is true, we call fdatasync() after each write() (or
  * fsync() if _POSIX_SYNCHRONIZED_IO is not > 0).
  *
+ * If "block_size" is nonzero, each write() is given exactly that many
+ * bytes, or whatever is left of "count" if that is less.
+ *
  * We stop retrying if the time elapsed since this function was entered
  * reaches TRANSFER_WRITE_TIMEOUT microseconds.
  */
-static ssize_t pv__transfer_write_repeated(int fd, void *buf, size_t count, bool sync_after_write)
+static ssize_t pv__transfer_write_repeated(int fd, void *buf, size_t count, size_t block_size, bool sync_after_write)
 {
 	struct timeval start_time;
 	ssize_t total_written;
@@ -118,6 +136,15 @@ static ssize_t pv__transfer_write_repeated(int fd, void *buf, size_t count, bool
 		size_t asked_to_write;
 
 		asked_to_write = count > MAX_WRITE_AT_ONCE ? MAX_WRITE_AT_ONCE : count;
+		if (block_size > 0) {
+			/*
+			 * After a short write, only ask for the rest of the
+			 * block, so later writes stay on block boundaries.
+			 */
+			asked_to_write = block_size - ((size_t) total_written % block_size);
+			if (asked_to_write > count)
+				asked_to_write = count;
+		}
 
 		nwritten = write(fd, buf, asked_to_write);
 
@@ -160,46 +187,1382 @@ static ssize_t pv__transfer_write_repeated(int fd, void *buf, size_t count, bool
 		buf += nwritten;
 		count -= nwritten;
 
-		if (0 == nwritten)
-			return total_written;
+		if (0 == nwritten)
+			return total_written;
+
+		gettimeofday(&now, NULL);
+		elapsed_usec = 1000000 * (now.tv_sec - start_time.tv_sec) + (now.tv_usec - start_time.tv_usec);
+		if (elapsed_usec > TRANSFER_WRITE_TIMEOUT) {
+			debug("%s %d: %s (%ld %s)", "fd", fd,
+			      "stopping write - timer expired", elapsed_usec, "usec elapsed");
+			return total_written;
+		}
+
+		/*
+		 * Running the select() here seems to make PV eat a lot of
+		 * CPU in some cases, so instead we just go round the loop
+		 * again and rely on our alarm() to interrupt us if we run
+		 * out of time - also on our gettimeofday() check.
+		 */
+		if (count > 0) {
+#if 0					    /* disabled after 1.6.0 - see comment above */
+			fd_set writefds;
+			struct timeval tv;
+#endif
+
+			debug("%s %d: %s (%ld %s, %ld %s)", "fd", fd,
+			      "trying another write after partial buffer flush",
+			      nwritten, "written", count, "remaining");
+
+#if 0					    /* disabled after 1.6.0 - see comment above */
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+			FD_ZERO(&writefds);
+			FD_SET(fd, &writefds);
+			if (select(fd + 1, NULL, &writefds, NULL, &tv) < 1)
+				break;
+#endif
+		}
+	}
+
+	return total_written;
+}
+
+
+/*
+ * Return "count", reduced if necessary so as not to take more from the
+ * current input file than --input-length allows.
+ */
+static size_t pv__input_limit(pvstate_t state, size_t count)
+{
+	if ((state->input_remaining >= 0)
+	    && ((unsigned long long) count > (unsigned long long) (state->input_remaining)))
+		count = (size_t) (state->input_remaining);
+	return count;
+}
+
+
+/*
+ * Count "count" bytes as having been taken from the current input file,
+ * towards --input-length.
+ */
+static void pv__input_taken(pvstate_t state, size_t count)
+{
+	if (state->input_remaining < 0)
+		return;
+	state->input_remaining -= (long long) count;
+	if (state->input_remaining < 0)
+		state->input_remaining = 0;
+}
+
+
+/*
+ * Return the number of "separator" characters in the "count" bytes at
+ * "buf" - this is how lines are counted in line mode.
+ */
+static unsigned long pv__count_separators(const unsigned char *buf, size_t count, char separator)
+{
+	const unsigned char *ptr;
+	const unsigned char *end;
+	unsigned long found;
+
+	found = 0;
+	ptr = buf;
+	end = buf + count;
+
+	while ((ptr < end) && (NULL != (ptr = memchr(ptr, separator, end - ptr)))) {
+		found++;
+		ptr++;
+	}
+
+	return found;
+}
+
+
+/*
+ * If we're monitoring the output, update our copy of the last few bytes
+ * we've written, given the "count" bytes at "buf" that were just written.
+ */
+static void pv__update_lastoutput(pvstate_t state, const unsigned char *buf, size_t count)
+{
+	long new_portion_length, old_portion_length;
+
+	if (((state->components_used & PV_DISPLAY_OUTPUTBUF) == 0) || (0 == count))
+		return;
+
+	new_portion_length = count;
+	if (new_portion_length > state->lastoutput_length)
+		new_portion_length = state->lastoutput_length;
+
+	old_portion_length = state->lastoutput_length - new_portion_length;
+
+	/*
+	 * Make room for the new portion.
+	 */
+	if (old_portion_length > 0) {
+		memmove(state->lastoutput_buffer, state->lastoutput_buffer + new_portion_length, old_portion_length);
+	}
+
+	/*
+	 * Copy the new data in.
+	 */
+	memcpy(state->lastoutput_buffer + old_portion_length, buf + count - new_portion_length, new_portion_length);
+}
+
+
+/*
+ * Arrival times and hold time histogram for --max-latency.
+ *
+ * Each read into the transfer buffer adds a mark recording when it
+ * arrived; byte offsets are counted from the start of the transfer rather
+ * than being buffer positions, since the buffer contents get moved around.
+ * If all LATENCY_MARKS are in use, the newest mark is extended instead,
+ * which can only overstate how long those bytes were held.
+ *
+ * The histogram has four buckets per power of two microseconds, and counts
+ * bytes rather than writes, so that a percentile of it is a percentile of
+ * the delay seen by each byte.
+ */
+struct pvlatency_s {
+	struct {
+		unsigned long long end;	 /* offset just past these bytes */
+		struct timeval arrived;	 /* when they were read */
+	} marks[LATENCY_MARKS];
+	int first;			 /* index of the oldest mark */
+	int count;			 /* number of marks in use */
+	unsigned long long bytes_in;	 /* bytes read into the buffer */
+	unsigned long long bytes_out;	 /* bytes written from the buffer */
+	unsigned long long histogram[LATENCY_BUCKETS];	/* bytes by hold time */
+	unsigned long long total;	 /* bytes counted in the histogram */
+};
+
+
+/*
+ * Return the number of microseconds from "start" to "end", or 0 if "end"
+ * is earlier.
+ */
+static unsigned long pv__latency_usec(struct timeval *start, struct timeval *end)
+{
+	long usec;
+
+	usec = 1000000 * (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec);
+
+	return usec > 0 ? (unsigned long) usec : 0;
+}
+
+
+/*
+ * Return the histogram bucket for a hold time of "usec" microseconds.
+ */
+static int pv__latency_bucket(unsigned long usec)
+{
+	int bit;
+
+	if (usec < 4)
+		return (int) usec;
+
+	for (bit = 2; (bit < (LATENCY_BUCKETS / 4) - 1) && ((usec >> (bit + 1)) > 0); bit++);
+
+	return (bit * 4) + (int) ((usec >> (bit - 2)) & 3);
+}
+
+
+/*
+ * Return the longest hold time, in microseconds, that falls into the given
+ * histogram bucket.
+ */
+static unsigned long pv__latency_bucket_limit(int bucket)
+{
+	if (bucket < 8)
+		return (unsigned long) bucket;
+	return ((unsigned long) (4 + (bucket & 3) + 1) << ((bucket / 4) - 2)) - 1;
+}
+
+
+/*
+ * Return how long, in microseconds, the oldest data in the transfer buffer
+ * has been held for, or 0 if the buffer is empty.
+ */
+static unsigned long pv__latency_held(pvstate_t state, struct timeval *now)
+{
+	struct pvlatency_s *latency = state->latency;
+
+	if ((NULL == latency) || (0 == latency->count) || (state->read_position <= state->write_position))
+		return 0;
+
+	return pv__latency_usec(&(latency->marks[latency->first].arrived), now);
+}
+
+
+/*
+ * Return the number of microseconds that reading may carry on for before
+ * the oldest data in the buffer has to be written out to meet the
+ * --max-latency target, leaving half of the target for writing.  Without
+ * a target this is TRANSFER_READ_TIMEOUT, as before.
+ */
+static long pv__latency_read_budget(pvstate_t state)
+{
+	struct timeval now;
+	long budget;
+
+	if ((state->max_latency <= 0) || (NULL == state->latency))
+		return TRANSFER_READ_TIMEOUT;
+
+	gettimeofday(&now, NULL);
+
+	budget = (long) (500000.0 * state->max_latency) - (long) pv__latency_held(state, &now);
+
+	if (budget > TRANSFER_READ_TIMEOUT)
+		budget = TRANSFER_READ_TIMEOUT;
+	if (budget < 0)
+		budget = 0;
+
+	return budget;
+}
+
+
+/*
+ * Return the most that may be read into the buffer now without holding
+ * data for longer than the --max-latency target, given the rate limit -
+ * with no target or no byte rate limit, this is the whole buffer.
+ */
+static unsigned long pv__latency_read_limit(pvstate_t state)
+{
+	unsigned long long most, buffered;
+
+	if ((state->max_latency <= 0) || (0 == state->rate_limit) || (state->linemode))
+		return state->buffer_size;
+
+	most = (unsigned long long) (state->max_latency * (double) (state->rate_limit));
+	if (most < 1)
+		most = 1;
+
+	buffered = state->read_position - state->write_position;
+	if (buffered >= most)
+		return 0;
+
+	return (unsigned long) (most - buffered);
+}
+
+
+/*
+ * Return true if the oldest data in the buffer has been held for half of
+ * the --max-latency target, so that it should be written out now rather
+ * than being held back for any reason.
+ */
+static bool pv__latency_due(pvstate_t state)
+{
+	struct timeval now;
+
+	if ((state->max_latency <= 0) || (NULL == state->latency))
+		return false;
+
+	gettimeofday(&now, NULL);
+
+	return (pv__latency_held(state, &now) >= (unsigned long) (500000.0 * state->max_latency)) ? true : false;
+}
+
+
+/*
+ * Record that "count" bytes have just been read into the transfer buffer.
+ */
+static void pv__latency_arrived(pvstate_t state, size_t count)
+{
+	struct pvlatency_s *latency = state->latency;
+	int idx;
+
+	if ((NULL == latency) || (0 == count))
+		return;
+
+	/*
+	 * If the buffer was empty before this read, forget any marks left
+	 * over from data which was dropped rather than written.
+	 */
+	if (state->read_position - count <= state->write_position) {
+		latency->first = 0;
+		latency->count = 0;
+		latency->bytes_out = latency->bytes_in;
+	}
+
+	latency->bytes_in += count;
+
+	if (latency->count >= LATENCY_MARKS) {
+		idx = (latency->first + latency->count - 1) % LATENCY_MARKS;
+		latency->marks[idx].end = latency->bytes_in;
+		return;
+	}
+
+	idx = (latency->first + latency->count) % LATENCY_MARKS;
+	latency->marks[idx].end = latency->bytes_in;
+	gettimeofday(&(latency->marks[idx].arrived), NULL);
+	latency->count++;
+}
+
+
+/*
+ * Record that "count" bytes have just been written out of the transfer
+ * buffer, adding how long they were held for to the histogram.
+ */
+static void pv__latency_departed(pvstate_t state, size_t count)
+{
+	struct pvlatency_s *latency = state->latency;
+	struct timeval now;
+
+	if ((NULL == latency) || (0 == count))
+		return;
+
+	gettimeofday(&now, NULL);
+
+	while ((count > 0) && (latency->count > 0)) {
+		unsigned long long taken;
+		int idx;
+
+		idx = latency->first;
+		taken = latency->marks[idx].end - latency->bytes_out;
+		if (taken > count)
+			taken = count;
+
+		latency->histogram[pv__latency_bucket(pv__latency_usec(&(latency->marks[idx].arrived), &now))] += taken;
+		latency->total += taken;
+		latency->bytes_out += taken;
+		count -= taken;
+
+		if (latency->bytes_out >= latency->marks[idx].end) {
+			latency->first = (latency->first + 1) % LATENCY_MARKS;
+			latency->count--;
+		}
+	}
+}
+
+
+/*
+ * Return the time in seconds which the given fraction of the bytes that
+ * have passed through the transfer buffer were held for no longer than,
+ * or -1 if there is nothing to go on.
+ */
+long double pv_transfer_hold_time(pvstate_t state, long double fraction)
+{
+	struct pvlatency_s *latency;
+	unsigned long long seen;
+	int bucket;
+
+	if ((NULL == state) || (NULL == state->latency) || (0 == state->latency->total))
+		return -1;
+
+	latency = state->latency;
+	seen = 0;
+
+	for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++) {
+		seen += latency->histogram[bucket];
+		if ((long double) seen >= fraction * (long double) (latency->total))
+			break;
+	}
+
+	return (long double) pv__latency_bucket_limit(bucket) / 1000000.0;
+}
+
+
+#ifdef HAVE_LINE_TEE
+/*
+ * State of the line counting side channel used in line mode between two
+ * pipes.  The input pipe's contents are duplicated into side_pipe with
+ * tee(), and the helper thread reads them back out of side_pipe[0] and
+ * counts the line separators, adding them to "lines" under "mutex".
+ *
+ * "untaken" is the number of bytes which have been duplicated into the
+ * side pipe but which have not yet been spliced to the output, so that
+ * they are neither duplicated nor counted twice.
+ */
+struct pvlinetee_s {
+	int fd;				 /* input fd the side channel is for */
+	int side_pipe[2];		 /* private pipe fed by tee() */
+	bool null;			 /* lines are null-terminated */
+	bool running;			 /* set while the helper thread exists */
+	pthread_t thread;		 /* helper thread counting lines */
+	pthread_mutex_t mutex;		 /* lock protecting "lines" */
+	unsigned long long lines;	 /* lines counted by the helper */
+	unsigned long long lines_reported;	/* lines passed to the caller */
+	size_t untaken;			 /* bytes teed but not yet spliced */
+};
+
+
+/*
+ * Helper thread for the line counting side channel: read everything from
+ * the side pipe, counting line separators, until the write end is closed.
+ */
+static void *pv__linetee_thread(void *arg)
+{
+	struct pvlinetee_s *linetee;
+	unsigned char buf[65536];
+	char separator;
+
+	linetee = (struct pvlinetee_s *) arg;
+	separator = linetee->null ? '\0' : '\n';
+
+	while (1) {
+		unsigned long lines;
+		ssize_t nread;
+
+		nread = read(linetee->side_pipe[0], buf, sizeof(buf));
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread <= 0)
+			break;
+
+		lines = pv__count_separators(buf, nread, separator);
+
+		if (lines > 0) {
+			pthread_mutex_lock(&(linetee->mutex));
+			linetee->lines += lines;
+			pthread_mutex_unlock(&(linetee->mutex));
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Stop the line counting side channel: close the write end of the side
+ * pipe so that the helper thread sees EOF once it has counted everything
+ * we have passed it, then wait for the thread to finish.
+ *
+ * The line count is left in place so that pv__linetee_collect() can pass
+ * on the final lines.
+ */
+static void pv__linetee_stop(pvstate_t state)
+{
+	struct pvlinetee_s *linetee;
+
+	linetee = state->linetee;
+	if ((NULL == linetee) || (!linetee->running))
+		return;
+
+	debug("%s %d: %s", "fd", linetee->fd, "stopping line counting side channel");
+
+	close(linetee->side_pipe[1]);
+	pthread_join(linetee->thread, NULL);
+	close(linetee->side_pipe[0]);
+
+	linetee->running = false;
+	linetee->fd = -1;
+}
+
+
+/*
+ * Return true if the line counting side channel is running for input file
+ * descriptor "fd".
+ */
+static bool pv__linetee_running(pvstate_t state, int fd)
+{
+	if (NULL == state->linetee)
+		return false;
+	return (state->linetee->running && (state->linetee->fd == fd)) ? true : false;
+}
+
+
+/*
+ * Start the line counting side channel for input file descriptor "fd",
+ * if both it and standard output are pipes.
+ *
+ * Returns true if the side channel is running for "fd".
+ */
+static bool pv__linetee_start(pvstate_t state, int fd)
+{
+	struct pvlinetee_s *linetee;
+	struct stat sb;
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	if (pv__linetee_running(state, fd))
+		return true;
+
+	pv__linetee_stop(state);
+
+	if ((0 != fstat(fd, &sb)) || (!S_ISFIFO(sb.st_mode)))
+		return false;
+	if ((0 != fstat(state->output_fd, &sb)) || (!S_ISFIFO(sb.st_mode)))
+		return false;
+
+	if (NULL == state->linetee) {
+		state->linetee = calloc(1, sizeof(*(state->linetee)));
+		if (NULL == state->linetee)
+			return false;
+		pthread_mutex_init(&(state->linetee->mutex), NULL);
+	}
+
+	linetee = state->linetee;
+
+	if (0 != pipe(linetee->side_pipe)) {
+		debug("%s: %s", "side pipe", strerror(errno));
+		return false;
+	}
+#ifdef F_SETPIPE_SZ
+	/*
+	 * Make the side pipe at least as big as the input pipe, so that
+	 * tee() can duplicate everything the input has waiting.
+	 */
+	rc = fcntl(fd, F_GETPIPE_SZ);
+	if (rc > 0)
+		(void) fcntl(linetee->side_pipe[1], F_SETPIPE_SZ, rc);
+#endif
+
+	linetee->fd = fd;
+	linetee->null = state->null;
+	linetee->untaken = 0;
+
+	/*
+	 * Block all signals while creating the thread, so that it inherits
+	 * a mask leaving signal handling to the main thread.
+	 */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(linetee->thread), NULL, pv__linetee_thread, linetee);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		debug("%s: %s", "pthread_create", strerror(rc));
+		close(linetee->side_pipe[0]);
+		close(linetee->side_pipe[1]);
+		linetee->fd = -1;
+		return false;
+	}
+
+	linetee->running = true;
+
+	debug("%s %d: %s", "fd", fd, "started line counting side channel");
+
+	return true;
+}
+
+
+/*
+ * Return the number of lines counted by the side channel helper since the
+ * last call.
+ */
+static long pv__linetee_collect(pvstate_t state)
+{
+	struct pvlinetee_s *linetee;
+	unsigned long long lines;
+
+	linetee = state->linetee;
+	if (NULL == linetee)
+		return 0;
+
+	pthread_mutex_lock(&(linetee->mutex));
+	lines = linetee->lines - linetee->lines_reported;
+	linetee->lines_reported = linetee->lines;
+	pthread_mutex_unlock(&(linetee->mutex));
+
+	return (long) lines;
+}
+
+
+/*
+ * Move up to "count" bytes from "fd" to standard output with splice(),
+ * having first duplicated them into the side pipe with tee() so that the
+ * helper thread can count the lines in them.  Returns the number of bytes
+ * written to standard output, 0 at the end of the input, or -1 on error,
+ * like splice().
+ *
+ * Anything teed but not spliced last time is spliced first, without
+ * duplicating it again.
+ */
+static ssize_t pv__linetee_splice(pvstate_t state, int fd, size_t count)
+{
+	struct pvlinetee_s *linetee;
+	ssize_t nteed, nspliced;
+
+	linetee = state->linetee;
+
+	if (0 == linetee->untaken) {
+		nteed = tee(fd, linetee->side_pipe[1], count, SPLICE_F_NONBLOCK);
+		if ((nteed < 0) && (EAGAIN == errno)) {
+			struct timeval tv;
+			fd_set writefds;
+
+			/*
+			 * The side pipe is full, so wait a little for the
+			 * helper thread to make room in it before trying
+			 * again, rather than spinning.
+			 */
+			FD_ZERO(&writefds);
+			FD_SET(linetee->side_pipe[1], &writefds);
+			tv.tv_sec = 0;
+			tv.tv_usec = 10000;
+			if (select(linetee->side_pipe[1] + 1, NULL, &writefds, NULL, &tv) > 0)
+				nteed = tee(fd, linetee->side_pipe[1], count, SPLICE_F_NONBLOCK);
+			else
+				errno = EAGAIN;
+		}
+		if (nteed <= 0)
+			return nteed;
+		linetee->untaken = nteed;
+	}
+
+	nspliced = splice(fd, NULL, state->output_fd, NULL, linetee->untaken, SPLICE_F_MORE);
+	if (nspliced > 0)
+		linetee->untaken -= nspliced;
+
+	/*
+	 * We already know there is data, so a zero return means the output
+	 * went away; report it as a broken pipe rather than an input EOF.
+	 */
+	if (0 == nspliced) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	return nspliced;
+}
+#endif				/* HAVE_LINE_TEE */
+
+#ifdef HAVE_MMAP_ENGINE
+/*
+ * State of the memory mapped input engine.  A window of up to
+ * MMAP_WINDOW_SIZE bytes of the input file "fd", starting at the page
+ * aligned file offset "offset", is mapped at "base"; "position" is the
+ * file offset of the next byte to be written to standard output.
+ *
+ * While the engine is running, SIGBUS is caught so that a file truncated
+ * under us can be detected.
+ */
+struct pvmmap_s {
+	int fd;				 /* input fd being mapped */
+	dev_t dev;			 /* device of the input file */
+	ino_t ino;			 /* inode of the input file */
+	bool running;			 /* set while the engine is in use */
+	bool vmsplice;			 /* write to the output with vmsplice() */
+	unsigned char *base;		 /* start of mapped window, or NULL */
+	size_t length;			 /* length of the mapped window */
+	off_t offset;			 /* file offset of the mapped window */
+	off_t position;			 /* file offset of next byte to send */
+};
+
+/*
+ * SIGBUS is delivered to the thread which caused it, so with more than one
+ * transfer running in threads, each thread needs its own jump buffer and
+ * flag.
+ */
+#if defined(HAVE_THREADS) && defined(__GNUC__)
+#define PV__MMAP_THREAD_LOCAL __thread
+#else				/* !(HAVE_THREADS && __GNUC__) */
+#define PV__MMAP_THREAD_LOCAL
+#endif				/* HAVE_THREADS && __GNUC__ */
+
+/*
+ * Where to jump to if SIGBUS is raised while accessing the mapping, and a
+ * flag to say whether we are accessing the mapping at the moment.
+ */
+static PV__MMAP_THREAD_LOCAL sigjmp_buf pv__mmap_sigbus_jump;
+static PV__MMAP_THREAD_LOCAL volatile sig_atomic_t pv__mmap_sigbus_armed = 0;
+
+/*
+ * The signal action is process-wide, so it is installed when the first
+ * engine starts and the previous action is restored when the last one
+ * stops.
+ */
+static unsigned int pv__mmap_sigbus_users = 0;
+static struct sigaction pv__mmap_old_sigbus;
+#ifdef HAVE_THREADS
+static pthread_mutex_t pv__mmap_sigbus_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif				/* HAVE_THREADS */
+
+
+/*
+ * Handle SIGBUS while the memory mapped input engine is running.  If the
+ * mapping was being accessed, jump back out to pv__transfer_mmap();
+ * otherwise this is nothing to do with us, so restore the default action
+ * and let it happen again.
+ */
+static void pv__mmap_sigbus(int signum)
+{
+	if (pv__mmap_sigbus_armed) {
+		pv__mmap_sigbus_armed = 0;
+		siglongjmp(pv__mmap_sigbus_jump, 1);
+	}
+	signal(signum, SIG_DFL);
+	raise(signum);
+}
+
+
+/*
+ * Install the SIGBUS handler, if no other engine has already done so.
+ * Returns false on error.
+ */
+static bool pv__mmap_sigbus_catch(void)
+{
+	bool ok = true;
+
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&pv__mmap_sigbus_lock);
+#endif				/* HAVE_THREADS */
+	if (0 == pv__mmap_sigbus_users) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = pv__mmap_sigbus;
+		sigemptyset(&(sa.sa_mask));
+		sa.sa_flags = 0;
+		if (0 != sigaction(SIGBUS, &sa, &pv__mmap_old_sigbus))
+			ok = false;
+	}
+	if (ok)
+		pv__mmap_sigbus_users++;
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&pv__mmap_sigbus_lock);
+#endif				/* HAVE_THREADS */
+
+	return ok;
+}
+
+
+/*
+ * Restore the previous SIGBUS action, if no other engine is still running.
+ */
+static void pv__mmap_sigbus_release(void)
+{
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&pv__mmap_sigbus_lock);
+#endif				/* HAVE_THREADS */
+	if (pv__mmap_sigbus_users > 0) {
+		pv__mmap_sigbus_users--;
+		if (0 == pv__mmap_sigbus_users)
+			sigaction(SIGBUS, &pv__mmap_old_sigbus, NULL);
+	}
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&pv__mmap_sigbus_lock);
+#endif				/* HAVE_THREADS */
+}
+
+
+/*
+ * Unmap the current window of the memory mapped input engine, if any.
+ */
+static void pv__mmap_unmap(struct pvmmap_s *engine)
+{
+	if (NULL == engine->base)
+		return;
+	munmap(engine->base, engine->length);
+	engine->base = NULL;
+	engine->length = 0;
+}
+
+
+/*
+ * Stop the memory mapped input engine, if it is running.  If "reposition"
+ * is true, the input fd is still the one the engine was started on, so
+ * move its file offset to just after the last byte written, so that read()
+ * can carry on from where the engine left off.
+ */
+static void pv__mmap_stop(pvstate_t state, bool reposition)
+{
+	struct pvmmap_s *engine;
+
+	engine = state->mmap_engine;
+	if ((NULL == engine) || (!engine->running))
+		return;
+
+	debug("%s %d: %s (%ld)", "fd", engine->fd, "stopping memory mapped input", (long) (engine->position));
+
+	pv__mmap_unmap(engine);
+
+	if (reposition)
+		lseek(engine->fd, engine->position, SEEK_SET);
+
+	pv__mmap_sigbus_release();
+
+	engine->running = false;
+	engine->fd = -1;
+}
+
+
+/*
+ * Start the memory mapped input engine on "fd", a regular file whose
+ * details are in "sb", starting from its current file offset.  Returns
+ * true on success.
+ */
+static bool pv__mmap_start(pvstate_t state, int fd, struct stat *sb)
+{
+	struct pvmmap_s *engine;
+	off_t position;
+
+	position = lseek(fd, 0, SEEK_CUR);
+	if (position < 0)
+		return false;
+
+	if (NULL == state->mmap_engine) {
+		state->mmap_engine = calloc(1, sizeof(*(state->mmap_engine)));
+		if (NULL == state->mmap_engine)
+			return false;
+	}
+	engine = state->mmap_engine;
+
+	engine->fd = fd;
+	engine->dev = sb->st_dev;
+	engine->ino = sb->st_ino;
+	engine->base = NULL;
+	engine->length = 0;
+	engine->offset = 0;
+	engine->position = position;
+
+	engine->vmsplice = false;
+#ifdef HAVE_VMSPLICE
+	if (!state->no_splice) {
+		struct stat outsb;
+		if ((0 == fstat(state->output_fd, &outsb)) && (S_ISFIFO(outsb.st_mode)))
+			engine->vmsplice = true;
+	}
+#endif				/* HAVE_VMSPLICE */
+
+	if (!pv__mmap_sigbus_catch())
+		return false;
+
+	engine->running = true;
+
+	debug("%s %d: %s (%ld)%s", "fd", fd, "started memory mapped input", (long) position,
+	      engine->vmsplice ? " with vmsplice()" : "");
+
+	return true;
+}
+
+
+/*
+ * Make sure the memory mapped input engine has a window mapped which
+ * contains its current position, given that the input file is "size"
+ * bytes long.  Returns false if the mapping failed.
+ */
+static bool pv__mmap_window(struct pvmmap_s *engine, off_t size)
+{
+	long page_size;
+	int flags;
+	void *base;
+
+	if ((NULL != engine->base)
+	    && (engine->position >= engine->offset)
+	    && (engine->position < engine->offset + (off_t) (engine->length)))
+		return true;
+
+	pv__mmap_unmap(engine);
+
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+	page_size = sysconf(_SC_PAGESIZE);
+#else				/* ! defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
+	page_size = 8192;
+#endif				/* defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
+	if (page_size < 1)
+		page_size = 8192;
+
+	engine->offset = engine->position - (engine->position % page_size);
+	engine->length = MMAP_WINDOW_SIZE;
+	if ((off_t) (engine->length) > size - engine->offset)
+		engine->length = size - engine->offset;
+
+	flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+
+	base = mmap(NULL, engine->length, PROT_READ, flags, engine->fd, engine->offset);
+	if (MAP_FAILED == base) {
+		debug("%s %d: %s: %s", "fd", engine->fd, "mmap failed", strerror(errno));
+		engine->length = 0;
+		return false;
+	}
+
+	engine->base = base;
+
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+	madvise(base, engine->length, MADV_SEQUENTIAL);
+#endif
+
+	return true;
+}
+
+
+/*
+ * Transfer some data from the regular file "fd" to standard output by
+ * writing it straight out of a memory mapping of the file, without copying
+ * it through the transfer buffer.  This is only done when splice() is not
+ * going to be used on this fd, such as in line mode, with -C, or when the
+ * output is not a pipe; and not when the transfer buffer itself is needed.
+ *
+ * Returns 0 if the engine was not used, in which case the caller should
+ * carry on with read() and the transfer buffer as normal, or 1 if it was,
+ * in which case state->written holds the number of bytes written (or -1 on
+ * error, with state->exit_status updated).
+ *
+ * If the file is truncated under us, touching the missing pages raises
+ * SIGBUS.  This is caught, and the engine is abandoned for this fd so that
+ * read() takes over from the same file offset.
+ */
+static int pv__transfer_mmap(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned long long allowed,
+			     long *lineswritten)
+{
+	struct pvmmap_s *engine;
+	struct stat sb;
+	struct timeval tv;
+	fd_set writefds;
+	unsigned char *chunk;
+	volatile size_t count;
+	volatile ssize_t nwritten;
+	bool usable;
+	int n;
+
+	usable = true;
+	if ((*eof_in) || (*eof_out)
+	    || (fd == state->mmap_failed_fd)
+	    || (state->direct_io)
+	    || (state->skip_errors > 0)
+	    || (state->read_position > state->write_position)
+	    || (0 != (state->components_used & PV_DISPLAY_BUFPERCENT))
+	    || (!pv_engine_allowed(state, PV_ENGINE_MMAP)))
+		usable = false;
+#ifdef HAVE_SPLICE
+	/*
+	 * Without the engine selector, leave anything splice() can do to
+	 * splice().
+	 */
+	if ((0 == state->engine_candidates)
+	    && (!state->linemode) && (!state->no_splice) && (fd != state->splice_failed_fd))
+		usable = false;
+#endif				/* HAVE_SPLICE */
+	if (usable && ((0 != fstat(fd, &sb)) || (!S_ISREG(sb.st_mode))))
+		usable = false;
+
+	engine = state->mmap_engine;
+
+	/*
+	 * If the engine is running but can't be used now, or is running on
+	 * a different file, stop it, only moving the file offset to where
+	 * it got to if it really is the same file.
+	 */
+	if ((NULL != engine) && (engine->running)) {
+		struct stat esb;
+		bool same_file;
+
+		same_file = ((fd == engine->fd) && (0 == fstat(fd, &esb))
+			     && (esb.st_dev == engine->dev) && (esb.st_ino == engine->ino)) ? true : false;
+		if ((!usable) || (!same_file))
+			pv__mmap_stop(state, same_file);
+	}
+
+	if (!usable)
+		return 0;
+
+	if ((NULL == engine) || (!engine->running)) {
+		if (!pv__mmap_start(state, fd, &sb)) {
+			debug("%s %d: %s", "fd", fd, "memory mapped input not available");
+			state->mmap_failed_fd = fd;
+			return 0;
+		}
+		engine = state->mmap_engine;
+	}
+
+	state->written = 0;
+
+	if (engine->position >= sb.st_size) {
+		pv__mmap_stop(state, true);
+		*eof_in = 1;
+		*eof_out = 1;
+		return 1;
+	}
+
+	/*
+	 * Work out how much we're allowed to write, as in pv_transfer(),
+	 * and wait a bit if it's nothing at the moment.
+	 */
+	count = state->buffer_size;
+	if ((state->rate_limit > 0) || (allowed > 0)) {
+		if ((unsigned long long) count > allowed)
+			count = allowed;
+	}
+	if (0 == count) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+		select(0, NULL, NULL, NULL, &tv);
+		return 1;
+	}
+
+	if (!pv__mmap_window(engine, sb.st_size)) {
+		pv__mmap_stop(state, true);
+		state->mmap_failed_fd = fd;
+		return 0;
+	}
+
+	if ((off_t) count > engine->offset + (off_t) (engine->length) - engine->position)
+		count = engine->offset + engine->length - engine->position;
+	if ((off_t) count > sb.st_size - engine->position)
+		count = sb.st_size - engine->position;
+	count = pv__input_limit(state, count);
+
+	chunk = engine->base + (engine->position - engine->offset);
+
+	tv.tv_sec = 0;
+	tv.tv_usec = state->no_wait ? 0 : 90000;
+	FD_ZERO(&writefds);
+	FD_SET(state->output_fd, &writefds);
+
+	n = select(state->output_fd + 1, NULL, &writefds, NULL, &tv);
+	if ((n < 0) && (EINTR != errno)) {
+		pv_error(state, "%s: %s: %d: %s", state->current_file, _("select call failed"), n, strerror(errno));
+		state->exit_status |= 16;
+		state->written = -1;
+		return 1;
+	}
+	if (n < 1)
+		return 1;
+
+	nwritten = 0;
+
+	/*
+	 * From here on, only refer to the engine through the state, since
+	 * local variables may not survive the siglongjmp() from the SIGBUS
+	 * handler.
+	 */
+	if (0 != sigsetjmp(pv__mmap_sigbus_jump, 1)) {
+		/*
+		 * The input was truncated while we were looking at it -
+		 * account for whatever made it out, and let read() carry
+		 * on from there.
+		 */
+		debug("%s %d: %s", "fd", fd, "SIGBUS on memory mapped input - falling back to read()");
+		if (nwritten > 0) {
+			state->mmap_engine->position += nwritten;
+			state->written = nwritten;
+			pv__input_taken(state, nwritten);
+		}
+		pv__mmap_stop(state, true);
+		state->mmap_failed_fd = fd;
+		return (nwritten > 0) ? 1 : 0;
+	}
+
+	pv__mmap_sigbus_armed = 1;
+
+	/*
+	 * In line mode, only write up to and including the last newline,
+	 * so that we're writing output line-by-line.
+	 */
+	if ((state->linemode) && !(state->null)) {
+		size_t end;
+		for (end = count; end > 0; end--) {
+			if ('\n' == chunk[end - 1])
+				break;
+		}
+		if (end > 0)
+			count = end;
+	}
+
+	signal(SIGALRM, SIG_IGN);
+	alarm(1);
+
+#ifdef HAVE_VMSPLICE
+	if (state->mmap_engine->vmsplice) {
+		struct iovec iov;
+		iov.iov_base = chunk;
+		iov.iov_len = count;
+		nwritten = vmsplice(state->output_fd, &iov, 1, 0);
+	} else
+#endif				/* HAVE_VMSPLICE */
+		nwritten = pv__transfer_write_repeated(state->output_fd, chunk, count, 0, state->sync_after_write);
+
+	alarm(0);
+
+	if (nwritten > 0) {
+		if ((state->linemode) && (lineswritten != NULL))
+			*lineswritten += pv__count_separators(chunk, nwritten, state->null ? '\0' : '\n');
+		pv__update_lastoutput(state, chunk, nwritten);
+		pv_digest_data(state, chunk, nwritten);
+	}
+
+	pv__mmap_sigbus_armed = 0;
+
+	if (nwritten >= 0) {
+		state->mmap_engine->position += nwritten;
+		state->written = nwritten;
+		pv__input_taken(state, nwritten);
+		return 1;
+	}
+
+	/*
+	 * Transient errors - wait a bit and try again next time.
+	 */
+	if ((EINTR == errno) || (EAGAIN == errno)) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+		select(0, NULL, NULL, NULL, &tv);
+		return 1;
+	}
+
+	/*
+	 * The mapping could not be read - probably truncated - so fall
+	 * back to read().
+	 */
+	if (EFAULT == errno) {
+		debug("%s %d: %s", "fd", fd, "EFAULT on memory mapped input - falling back to read()");
+		pv__mmap_stop(state, true);
+		state->mmap_failed_fd = fd;
+		return 0;
+	}
+
+	pv__mmap_stop(state, true);
+
+	/*
+	 * SIGPIPE means we've finished. Don't output an error because it's
+	 * not really our error to report.
+	 */
+	if (EPIPE == errno) {
+		*eof_in = 1;
+		*eof_out = 1;
+		return 1;
+	}
+
+	pv_error(state, "%s: %s", _("write failed"), strerror(errno));
+	state->exit_status |= 16;
+	*eof_out = 1;
+	state->written = -1;
+
+	return 1;
+}
+#endif				/* HAVE_MMAP_ENGINE */
+
+
+/*
+ * With --generate, write the next part of the generated data to standard
+ * output, bypassing the usual reading into the transfer buffer.  Returns
+ * the number of bytes written, or -1 on error.
+ *
+ * The repeating types fill the transfer buffer once with whole periods of
+ * the data and then write from it over and over, with vmsplice() if the
+ * output is a pipe, since the pages never change.  Random data is written
+ * normally, as the buffer is refilled once it has all been written.
+ */
+static long pv__transfer_generate(pvstate_t state, int *eof_in, int *eof_out, unsigned long long allowed)
+{
+	struct pvgenerate_s *gen;
+	struct timeval tv;
+	fd_set writefds;
+	size_t count;
+	ssize_t nwritten;
+	int n;
+
+	gen = state->generator;
+	state->written = 0;
+
+	if ((*eof_out) || (NULL == gen))
+		return 0;
+
+	/*
+	 * Set up where to write from, and set it up again if the transfer
+	 * buffer has been reallocated, carrying on from the same point in
+	 * the period.
+	 */
+	if ((gen->period_length > 0) && (gen->source != state->transfer_buffer) && (gen->source != gen->period)) {
+		size_t phase;
+		phase = (gen->source_fill > 0) ? gen->source_offset % gen->period_length : 0;
+		gen->phase = 0;
+		if (gen->period_length <= state->buffer_size) {
+			gen->source = state->transfer_buffer;
+			gen->source_fill = state->buffer_size - (state->buffer_size % gen->period_length);
+			pv_generate_data(gen, gen->source, gen->source_fill);
+		} else {
+			gen->source = gen->period;
+			gen->source_fill = gen->period_length;
+		}
+		gen->source_offset = phase;
+#ifdef HAVE_VMSPLICE
+		{
+			struct stat sb;
+			gen->vmsplice = ((!state->no_splice) && (0 == fstat(state->output_fd, &sb))
+					 && S_ISFIFO(sb.st_mode)) ? true : false;
+		}
+#endif				/* HAVE_VMSPLICE */
+	} else if (0 == gen->period_length) {
+		gen->source = state->transfer_buffer;
+	}
+
+	if (gen->source_offset >= gen->source_fill) {
+		if (0 == gen->period_length) {
+			gen->source_fill = state->buffer_size;
+			pv_generate_data(gen, gen->source, gen->source_fill);
+		}
+		gen->source_offset = 0;
+	}
+
+	count = gen->source_fill - gen->source_offset;
+	if ((state->rate_limit > 0) || (allowed > 0)) {
+		if ((unsigned long long) count > allowed)
+			count = allowed;
+	}
+	if (0 == count) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+		select(0, NULL, NULL, NULL, &tv);
+		return 0;
+	}
+
+	tv.tv_sec = 0;
+	tv.tv_usec = 90000;
+	FD_ZERO(&writefds);
+	FD_SET(state->output_fd, &writefds);
+
+	n = select(state->output_fd + 1, NULL, &writefds, NULL, &tv);
+	if ((n < 0) && (EINTR != errno)) {
+		pv_error(state, "%s: %s: %d: %s", state->current_file, _("select call failed"), n, strerror(errno));
+		state->exit_status |= 16;
+		return -1;
+	}
+	if (n < 1)
+		return 0;
+
+	signal(SIGALRM, SIG_IGN);
+	alarm(1);
+
+#ifdef HAVE_VMSPLICE
+	if (gen->vmsplice) {
+		struct iovec iov;
+		iov.iov_base = gen->source + gen->source_offset;
+		iov.iov_len = count;
+		nwritten = vmsplice(state->output_fd, &iov, 1, 0);
+	} else
+#endif				/* HAVE_VMSPLICE */
+		nwritten = pv__transfer_write_repeated(state->output_fd, gen->source + gen->source_offset, count, 0,
+						       state->sync_after_write);
+
+	alarm(0);
+
+	if (nwritten > 0) {
+		pv__update_lastoutput(state, gen->source + gen->source_offset, nwritten);
+		pv_digest_data(state, gen->source + gen->source_offset, nwritten);
+		gen->source_offset += nwritten;
+		state->written = nwritten;
+		return nwritten;
+	}
+
+	if (0 == nwritten) {
+		*eof_in = 1;
+		*eof_out = 1;
+		return 0;
+	}
+
+	/*
+	 * Transient errors - wait a bit and try again next time.
+	 */
+	if ((EINTR == errno) || (EAGAIN == errno)) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+		select(0, NULL, NULL, NULL, &tv);
+		return 0;
+	}
+
+	/*
+	 * SIGPIPE means we've finished, as in pv__transfer_write().
+	 */
+	if (EPIPE == errno) {
+		*eof_in = 1;
+		*eof_out = 1;
+		return 0;
+	}
+
+	pv_error(state, "%s: %s", _("write failed"), strerror(errno));
+	state->exit_status |= 16;
+	*eof_out = 1;
+	state->written = -1;
+
+	return -1;
+}
+
+
+/*
+ * Switch to the I/O engine the selector wants, if nothing would be lost or
+ * reordered by doing so: the transfer buffer must be empty, and the line
+ * counting side channel must not be holding on to anything.
+ *
+ * A running mmap() engine is stopped by pv__transfer_mmap() itself once it
+ * is no longer allowed.
+ */
+static void pv__engine_switch(pvstate_t state)
+{
+	if (state->read_position > state->write_position)
+		return;
+
+#ifdef HAVE_LINE_TEE
+	if ((NULL != state->linetee) && (state->linetee->running)) {
+		if (state->linetee->untaken > 0)
+			return;
+		pv__linetee_stop(state);
+	}
+#endif				/* HAVE_LINE_TEE */
+
+	if (pv_digest_pending(state))
+		return;
+
+	pv_engine_begin(state, state->engine_wanted);
+}
+
 
-		gettimeofday(&now, NULL);
-		elapsed_usec = 1000000 * (now.tv_sec - start_time.tv_sec) + (now.tv_usec - start_time.tv_usec);
-		if (elapsed_usec > TRANSFER_WRITE_TIMEOUT) {
-			debug("%s %d: %s (%ld %s)", "fd", fd,
-			      "stopping write - timer expired", elapsed_usec, "usec elapsed");
-			return total_written;
-		}
+#ifdef HAVE_SPLICE
+/*
+ * With --discard, move up to "count" bytes from "fd" to /dev/null with
+ * splice(), so that they never pass through user space: straight there if
+ * "fd" is a pipe, otherwise through a private pipe which is drained before
+ * returning.  Returns the number of bytes taken from "fd", or -1 on error,
+ * as splice() does.  If /dev/null or the private pipe can't be opened,
+ * fails with EINVAL so that the caller falls back to read().
+ */
+static ssize_t pv__transfer_discard_splice(pvstate_t state, int fd, size_t count)
+{
+	struct stat sb;
+	ssize_t nread, drained;
 
+	if (state->discard_null_fd < 0) {
+		state->discard_null_fd = open("/dev/null", O_WRONLY);	/* flawfinder: ignore */
 		/*
-		 * Running the select() here seems to make PV eat a lot of
-		 * CPU in some cases, so instead we just go round the loop
-		 * again and rely on our alarm() to interrupt us if we run
-		 * out of time - also on our gettimeofday() check.
+		 * flawfinder: the path is fixed.
 		 */
-		if (count > 0) {
-#if 0					    /* disabled after 1.6.0 - see comment above */
-			fd_set writefds;
-			struct timeval tv;
-#endif
+		if (state->discard_null_fd < 0) {
+			debug("%s: %s", "/dev/null", strerror(errno));
+			errno = EINVAL;
+			return -1;
+		}
+	}
 
-			debug("%s %d: %s (%ld %s, %ld %s)", "fd", fd,
-			      "trying another write after partial buffer flush",
-			      nwritten, "written", count, "remaining");
+	if ((0 == fstat(fd, &sb)) && S_ISFIFO(sb.st_mode))
+		return splice(fd, NULL, state->discard_null_fd, NULL, count, SPLICE_F_MORE);
 
-#if 0					    /* disabled after 1.6.0 - see comment above */
-			tv.tv_sec = 0;
-			tv.tv_usec = 0;
-			FD_ZERO(&writefds);
-			FD_SET(fd, &writefds);
-			if (select(fd + 1, NULL, &writefds, NULL, &tv) < 1)
-				break;
-#endif
+	if (state->discard_pipe[0] < 0) {
+		if (0 != pipe(state->discard_pipe)) {
+			debug("%s: %s", "private pipe", strerror(errno));
+			state->discard_pipe[0] = -1;
+			state->discard_pipe[1] = -1;
+			errno = EINVAL;
+			return -1;
 		}
+#ifdef F_SETPIPE_SZ
+		(void) fcntl(state->discard_pipe[1], F_SETPIPE_SZ, (int) (state->buffer_size));
+#endif				/* F_SETPIPE_SZ */
 	}
 
-	return total_written;
+	nread = splice(fd, NULL, state->discard_pipe[1], NULL, count, SPLICE_F_MORE);
+	if (nread <= 0)
+		return nread;
+
+	for (drained = 0; drained < nread;) {
+		ssize_t moved;
+		moved = splice(state->discard_pipe[0], NULL, state->discard_null_fd, NULL, (size_t) (nread - drained),
+			       SPLICE_F_MORE);
+		if ((moved < 0) && (EINTR == errno))
+			continue;
+		if (moved <= 0) {
+			debug("%s: %s", "failed to drain private pipe", strerror(errno));
+			break;
+		}
+		drained += moved;
+	}
+
+	return nread;
 }
+#endif				/* HAVE_SPLICE */
 
 
 /*
@@ -246,18 +1609,98 @@ static int pv__transfer_read(pvstate_t state, int fd, int *eof_in, int *eof_out,
 		do_not_skip_errors = true;
 
 	bytes_can_read = state->buffer_size - state->read_position;
+	if (bytes_can_read > pv__latency_read_limit(state))
+		bytes_can_read = pv__latency_read_limit(state);
+	/*
+	 * With --input-block-size, pv_transfer() only looks for input once
+	 * there is room for a whole block, so read exactly that.
+	 */
+	if (state->input_block_size > 0)
+		bytes_can_read = state->input_block_size;
+	bytes_can_read = pv__input_limit(state, bytes_can_read);
+	nread = 0;
 
 #ifdef HAVE_SPLICE
 	state->splice_used = 0;
+#ifdef HAVE_LINE_TEE
+	/*
+	 * In line mode, splice() can still be used between two pipes, with
+	 * the lines being counted from a tee() side channel.
+	 */
+	if ((state->linemode) && (!state->no_splice) && (NULL == state->digest)
+	    && (fd != state->splice_failed_fd)
+	    && (0 == state->to_write)
+	    && (pv_engine_allowed(state, PV_ENGINE_SPLICE))
+	    && (pv__linetee_running(state, fd) || ((0 == state->rate_limit) && (0 == allowed)))) {
+		if (!pv__linetee_start(state, fd)) {
+			debug("%s %d: %s", "fd", fd, "line counting side channel not available");
+			state->splice_failed_fd = fd;
+		} else if ((state->rate_limit > 0) && (0 == allowed)) {
+			/*
+			 * A rate limit was set while the side channel was
+			 * running, and nothing is allowed through yet.
+			 */
+			struct timeval tv;
+			tv.tv_sec = 0;
+			tv.tv_usec = 10000;
+			select(0, NULL, NULL, NULL, &tv);
+			return 0;
+		} else {
+			if (state->rate_limit || allowed != 0)
+				bytes_to_splice = pv__input_limit(state, allowed);
+			else
+				bytes_to_splice = bytes_can_read;
+
+			nread = pv__linetee_splice(state, fd, bytes_to_splice);
+
+			state->splice_used = 1;
+			if (nread > 0) {
+				state->written = nread;
+			} else if ((-1 == nread) && (EAGAIN == errno)) {
+				/* side pipe full or nothing read yet */
+			} else if ((-1 == nread) && (EPIPE == errno)) {
+				/*
+				 * The output has gone away - treat this
+				 * like a write failing with EPIPE.
+				 */
+				pv__linetee_stop(state);
+				*eof_in = 1;
+				*eof_out = 1;
+				return 0;
+			} else if (0 == nread) {
+				/* end of input - wait for the count to finish */
+				pv__linetee_stop(state);
+			} else {
+				/*
+				 * Any other error is a read error, so stop
+				 * the side channel and let read() report it.
+				 */
+				pv__linetee_stop(state);
+				state->splice_failed_fd = fd;
+				state->splice_used = 0;
+			}
+		}
+	}
+#endif				/* HAVE_LINE_TEE */
 	if ((!state->linemode) && (!state->no_splice)
 	    && (fd != state->splice_failed_fd)
-	    && (0 == state->to_write)) {
+	    && (0 == state->to_write)
+	    && (pv_engine_allowed(state, PV_ENGINE_SPLICE))) {
 		if (state->rate_limit || allowed != 0)
-			bytes_to_splice = allowed;
+			bytes_to_splice = pv__input_limit(state, allowed);
 		else
 			bytes_to_splice = bytes_can_read;
 
-		nread = splice(fd, NULL, STDOUT_FILENO, NULL, bytes_to_splice, SPLICE_F_MORE);
+		/*
+		 * With --hash, duplicate the data for the hash thread
+		 * with tee() on the way through.
+		 */
+		if (NULL != state->digest)
+			nread = pv_digest_splice(state, fd, bytes_to_splice);
+		else if (state->discard)
+			nread = pv__transfer_discard_splice(state, fd, bytes_to_splice);
+		else
+			nread = splice(fd, NULL, state->output_fd, NULL, bytes_to_splice, SPLICE_F_MORE);
 
 		state->splice_used = 1;
 		if ((nread < 0) && (EINVAL == errno)) {
@@ -280,7 +1723,7 @@ static int pv__transfer_read(pvstate_t state, int fd, int *eof_in, int *eof_out,
 				 * error, we cannot skip it, so set
 				 * "do_not_skip_errors".
 				 */
-				if ((fdatasync(STDOUT_FILENO) < 0)
+				if ((fdatasync(state->output_fd) < 0)
 				    && (EIO == errno)) {
 					nread = -1;
 					do_not_skip_errors = true;
@@ -294,11 +1737,19 @@ static int pv__transfer_read(pvstate_t state, int fd, int *eof_in, int *eof_out,
 			state->splice_used = 0;
 		}
 	}
-	if (0 == state->splice_used) {
-		nread = pv__transfer_read_repeated(fd, state->transfer_buffer + state->read_position, bytes_can_read);
+	if ((0 == state->splice_used) && (state->input_block_size > 0)) {
+		nread = read(fd, state->transfer_buffer + state->read_position, bytes_can_read);
+	} else if (0 == state->splice_used) {
+		nread = pv__transfer_read_repeated(fd, state->transfer_buffer + state->read_position, bytes_can_read,
+						   pv__latency_read_budget(state));
 	}
 #else
-	nread = pv__transfer_read_repeated(fd, state->transfer_buffer + state->read_position, bytes_can_read);
+	if (state->input_block_size > 0) {
+		nread = read(fd, state->transfer_buffer + state->read_position, bytes_can_read);
+	} else {
+		nread = pv__transfer_read_repeated(fd, state->transfer_buffer + state->read_position,
+						   bytes_can_read, pv__latency_read_budget(state));
+	}
 #endif				/* HAVE_SPLICE */
 
 
@@ -320,15 +1771,19 @@ static int pv__transfer_read(pvstate_t state, int fd, int *eof_in, int *eof_out,
 		 * we've got in the buffer.
 		 */
 		state->read_errors_in_a_row = 0;
+		pv__input_taken(state, nread);
 #ifdef HAVE_SPLICE
 		/*
 		 * If we used splice(), there isn't any more data in the
 		 * buffer than there was before.
 		 */
-		if (0 == state->splice_used)
+		if (0 == state->splice_used) {
 			state->read_position += nread;
+			pv__latency_arrived(state, nread);
+		}
 #else
 		state->read_position += nread;
+		pv__latency_arrived(state, nread);
 #endif				/* HAVE_SPLICE */
 		return 1;
 	}
@@ -398,7 +1853,9 @@ static int pv__transfer_read(pvstate_t state, int fd, int *eof_in, int *eof_out,
 		return 1;
 	}
 
-	if (state->read_errors_in_a_row < 10) {
+	if (state->error_skip_block > 0) {
+		amount_to_skip = state->error_skip_block;
+	} else if (state->read_errors_in_a_row < 10) {
 		amount_to_skip = state->read_errors_in_a_row < 5 ? 1 : 2;
 	} else if (state->read_errors_in_a_row < 20) {
 		amount_to_skip = 1 << (state->read_errors_in_a_row - 10);
@@ -461,6 +1918,8 @@ static int pv__transfer_read(pvstate_t state, int fd, int *eof_in, int *eof_out,
 	 */
 	if (amount_skipped > 0) {
 		memset(state->transfer_buffer + state->read_position, 0, amount_skipped);
+		pv_skipped_add(state, orig_offset, amount_skipped, state->read_position - state->write_position);
+		pv__input_taken(state, amount_skipped);
 		state->read_position += amount_skipped;
 		if (state->skip_errors < 2) {
 			pv_error(state, "%s: %s: %ld - %ld (%ld %s)",
@@ -481,6 +1940,103 @@ static int pv__transfer_read(pvstate_t state, int fd, int *eof_in, int *eof_out,
 }
 
 
+/*
+ * With --merge, read from whichever inputs are marked as ready in
+ * "readfds" (if it isn't NULL), and move whole lines from them into the
+ * buffer, updating state->read_position.  Once every input has been read
+ * to the end and passed on, sets *eof_in to 1, and *eof_out too if all
+ * data in the buffer has been written.
+ */
+static void pv__transfer_merge(pvstate_t state, fd_set *readfds, int *eof_in, int *eof_out)
+{
+	unsigned long room;
+	bool finished;
+	size_t moved;
+
+	room = state->buffer_size - state->read_position;
+	if (room > pv__latency_read_limit(state))
+		room = pv__latency_read_limit(state);
+
+	finished = false;
+	moved = pv_merge_read(state, readfds, state->transfer_buffer + state->read_position, room, &finished);
+	if (moved > 0) {
+		state->read_position += moved;
+		pv__latency_arrived(state, moved);
+	}
+
+	if (finished) {
+		*eof_in = 1;
+		if (state->write_position >= state->read_position)
+			*eof_out = 1;
+	}
+}
+
+
+/*
+ * With --output-block-size, cut state->to_write down to a whole number of
+ * blocks, or if there's less than one block waiting but more is allowed,
+ * round it up to one.  Once the last input file is at EOF, the last
+ * partial block is written as it is, or with --output-block-pad, after
+ * padding it out with zeros; at the end of any other input file, *eof_out
+ * is set, leaving the partial block for the next file to fill.
+ *
+ * While waiting for the rest of a partial block, if there's no room left
+ * after it in the buffer, it is moved back to the start of the buffer so
+ * that reading can continue.
+ *
+ * If an earlier write was short, leaving a block part-written, only the
+ * rest of that block is written next, so that the block boundaries in the
+ * output stay where they were.
+ */
+static void pv__transfer_reblock(pvstate_t state, int eof_in, int *eof_out)
+{
+	unsigned long block, pending, available, need_room;
+	bool last_input;
+
+	block = state->output_block_size;
+	pending = block - (state->output_block_done % block);
+	available = state->read_position - state->write_position;
+	last_input = ((state->merge) || (state->current_file_num >= state->input_file_count - 1)) ? true : false;
+
+	if ((eof_in) && (!last_input) && (available < pending)) {
+		state->to_write = 0;
+		*eof_out = 1;
+		return;
+	}
+
+	need_room = state->input_block_size > 0 ? state->input_block_size : 1;
+	if ((state->write_position > 0) && (available < pending)
+	    && ((eof_in && state->output_block_pad) || (state->buffer_size - state->read_position < need_room))) {
+		memmove(state->transfer_buffer, state->transfer_buffer + state->write_position, available);
+		state->write_position = 0;
+		state->read_position = available;
+	}
+
+	if (state->to_write <= 0)
+		return;
+
+	if ((eof_in) && (available < pending)) {
+		if ((state->output_block_pad) && (available > 0)) {
+			memset(state->transfer_buffer + state->read_position, 0, pending - available);
+			state->read_position += pending - available;
+			pv__latency_arrived(state, pending - available);
+			debug("%s: %lu", "padded last output block by", pending - available);
+			available = pending;
+		}
+		state->to_write = (long) available;
+		return;
+	}
+
+	if ((unsigned long) (state->to_write) < pending) {
+		state->to_write = available >= pending ? (long) pending : 0;
+	} else if (pending < block) {
+		state->to_write = (long) pending;
+	} else {
+		state->to_write -= (long) ((unsigned long) (state->to_write) % block);
+	}
+}
+
+
 /*
  * Write state->to_write bytes of data from the transfer buffer to stdout.
  * Returns zero if there was a transient error and we need to return 0 from
@@ -498,14 +2054,37 @@ static int pv__transfer_write(pvstate_t state, int *eof_in, int *eof_out, long *
 {
 	ssize_t nwritten;
 
-	signal(SIGALRM, SIG_IGN);
-	alarm(1);
+	if (state->split) {
+		/*
+		 * With --split, hand the data to an idle output instead;
+		 * if they're all busy, try again next time.
+		 */
+		nwritten = pv_fanout_split(state, state->transfer_buffer + state->write_position,
+					   (size_t) (state->to_write));
+		if (0 == nwritten)
+			return 1;
+	} else if (state->discard) {
+		/*
+		 * With --discard, there's nothing to do.
+		 */
+		nwritten = state->to_write;
+	} else if (NULL != state->validator) {
+		/*
+		 * With --validate, check the data instead of writing it.
+		 */
+		nwritten = (ssize_t) pv_validate_data(state, state->transfer_buffer + state->write_position,
+						      (size_t) (state->to_write));
+	} else {
+		signal(SIGALRM, SIG_IGN);
+		alarm(1);
 
-	nwritten = pv__transfer_write_repeated(STDOUT_FILENO,
-					       state->transfer_buffer +
-					       state->write_position, state->to_write, state->sync_after_write);
+		nwritten = pv__transfer_write_repeated(state->output_fd,
+						       state->transfer_buffer +
+						       state->write_position, state->to_write,
+						       state->output_block_size, state->sync_after_write);
 
-	alarm(0);
+		alarm(0);
+	}
 
 	if (0 == nwritten) {
 		/*
@@ -518,66 +2097,21 @@ static int pv__transfer_write(pvstate_t state, int *eof_in, int *eof_out, long *
 		 * Write returned >0 - data successfully written.
 		 */
 		if ((state->linemode) && (lineswritten != NULL)) {
-			/*
-			 * Guillaume Marcais: use strchr to count \n
-			 */
-			unsigned char save;
-			char *ptr;
-			long lines = 0;
-
-			save = state->transfer_buffer[state->write_position + nwritten];
-			state->transfer_buffer[state->write_position + nwritten] = 0;
-			ptr = (char *) (state->transfer_buffer + state->write_position - 1);
-
-			if (state->null) {
-				for (ptr++;
-				     ptr -
-				     (char *) state->transfer_buffer -
-				     state->write_position < (size_t) nwritten; ptr++) {
-					if (*ptr == '\0')
-						++lines;
-				}
-			} else {
-				while ((ptr = strchr((char *) (ptr + 1), '\n')))
-					++lines;
-			}
-
-			*lineswritten += lines;
-			state->transfer_buffer[state->write_position + nwritten] = save;
+			*lineswritten +=
+			    pv__count_separators(state->transfer_buffer + state->write_position, nwritten,
+						 state->null ? '\0' : '\n');
 		}
 
+		pv__update_lastoutput(state, state->transfer_buffer + state->write_position, nwritten);
+		pv__latency_departed(state, nwritten);
+		pv_fanout_append(state, state->transfer_buffer + state->write_position, nwritten);
+		pv_digest_data(state, state->transfer_buffer + state->write_position, nwritten);
+
 		state->write_position += nwritten;
 		state->written += nwritten;
-
-		/*
-		 * If we're monitoring the output, update our copy of the
-		 * last few bytes we've written.
-		 */
-		if (((state->components_used & PV_DISPLAY_OUTPUTBUF) != 0)
-		    && (nwritten > 0)) {
-			long new_portion_length, old_portion_length;
-
-			new_portion_length = nwritten;
-			if (new_portion_length > state->lastoutput_length)
-				new_portion_length = state->lastoutput_length;
-
-			old_portion_length = state->lastoutput_length - new_portion_length;
-
-			/*
-			 * Make room for the new portion.
-			 */
-			if (old_portion_length > 0) {
-				memmove(state->lastoutput_buffer,
-					state->lastoutput_buffer + new_portion_length, old_portion_length);
-			}
-
-			/*
-			 * Copy the new data in.
-			 */
-			memcpy(state->lastoutput_buffer +
-			       old_portion_length,
-			       state->transfer_buffer + state->write_position - new_portion_length, new_portion_length);
-		}
+		if (state->output_block_size > 0)
+			state->output_block_done =
+			    (state->output_block_done + (unsigned long) nwritten) % state->output_block_size;
 
 		/*
 		 * If we've written all the data in the buffer, reset the
@@ -642,7 +2176,7 @@ static int pv__transfer_write(pvstate_t state, int *eof_in, int *eof_out, long *
  *
  * Returns NULL on complete allocation failure.
  */
-static unsigned char *pv__allocate_aligned_buffer(int fd, size_t target_size)
+static unsigned char *pv__allocate_aligned_buffer(int fd, int output_fd, size_t target_size)
 {
 	unsigned char *newptr;
 
@@ -651,7 +2185,7 @@ static unsigned char *pv__allocate_aligned_buffer(int fd, size_t target_size)
 	size_t required_alignment;
 
 	input_alignment = fd >= 0 ? fpathconf(fd, _PC_REC_XFER_ALIGN) : -1;
-	output_alignment = fpathconf(STDOUT_FILENO, _PC_REC_XFER_ALIGN);
+	output_alignment = fpathconf(output_fd, _PC_REC_XFER_ALIGN);
 #if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
 	min_alignment = sysconf(_SC_PAGESIZE);
 #else				/* ! defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
@@ -706,6 +2240,16 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 	if (NULL == state)
 		return 0;
 
+	/*
+	 * If the --exec command's output can no longer be relayed, finish as
+	 * if our standard output had gone away.
+	 */
+	if (pv_exec_failed(state)) {
+		*eof_in = 1;
+		*eof_out = 1;
+		return 0;
+	}
+
 #ifdef O_DIRECT
 	/*
 	 * Set or clear O_DIRECT on the input and output file descriptors,
@@ -713,11 +2257,11 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 	 */
 	if (state->direct_io_changed) {
 		if (!(*eof_in)) {
-			fcntl(fd, F_SETFL, (state->direct_io ? O_DIRECT : 0) | fcntl(fd, F_GETFL));
+			fcntl(fd, F_SETFL, (state->direct_io ? O_DIRECT : 0) | (fcntl(fd, F_GETFL) & ~O_DIRECT));
 		}
 		if (!(*eof_out)) {
-			fcntl(STDOUT_FILENO, F_SETFL,
-			      (state->direct_io ? O_DIRECT : 0) | fcntl(STDOUT_FILENO, F_GETFL));
+			fcntl(state->output_fd, F_SETFL,
+			      (state->direct_io ? O_DIRECT : 0) | (fcntl(state->output_fd, F_GETFL) & ~O_DIRECT));
 		}
 		state->direct_io_changed = false;
 	}
@@ -738,7 +2282,7 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 	 * (important if using O_DIRECT).
 	 */
 	if (NULL == state->transfer_buffer) {
-		state->transfer_buffer = pv__allocate_aligned_buffer(fd, state->target_buffer_size + 32);
+		state->transfer_buffer = pv__allocate_aligned_buffer(fd, state->output_fd, state->target_buffer_size + 32);
 		if (NULL == state->transfer_buffer) {
 			pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
 			state->exit_status |= 64;
@@ -747,6 +2291,18 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 		state->buffer_size = state->target_buffer_size;
 	}
 
+	/*
+	 * Set up the arrival tracking for --max-latency.
+	 */
+	if ((state->max_latency > 0) && (NULL == state->latency)) {
+		state->latency = calloc(1, sizeof(*(state->latency)));
+		if (NULL == state->latency) {
+			pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+			state->exit_status |= 64;
+			return -1;
+		}
+	}
+
 	/*
 	 * Reallocate the buffer if the buffer size has changed
 	 * mid-transfer.  We have to do this by allocating a new buffer,
@@ -756,7 +2312,7 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 	 */
 	if (state->buffer_size < state->target_buffer_size) {
 		unsigned char *newptr;
-		newptr = pv__allocate_aligned_buffer(fd, state->target_buffer_size + 32);
+		newptr = pv__allocate_aligned_buffer(fd, state->output_fd, state->target_buffer_size + 32);
 		if (NULL == newptr) {
 			/*
 			 * Reset target if realloc failed so we don't keep
@@ -784,22 +2340,110 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 	if ((*eof_in) && (*eof_out))
 		return 0;
 
+	/*
+	 * Once --input-length bytes have been taken from this input, treat
+	 * it as having ended.
+	 */
+	if ((0 == state->input_remaining) && (!(*eof_in))) {
+#ifdef HAVE_LINE_TEE
+		pv__linetee_stop(state);
+#endif				/* HAVE_LINE_TEE */
+		*eof_in = 1;
+		if (state->write_position >= state->read_position) {
+			*eof_out = 1;
+#ifdef HAVE_LINE_TEE
+			if ((state->linemode) && (lineswritten != NULL))
+				*lineswritten += pv__linetee_collect(state);
+#endif				/* HAVE_LINE_TEE */
+			return 0;
+		}
+	}
+
+	/*
+	 * With --generate, there's nothing to read.
+	 */
+	if (NULL != state->generator)
+		return pv__transfer_generate(state, eof_in, eof_out, allowed);
+
+	/*
+	 * Switch to the I/O engine the selector wants, if it's safe to.
+	 */
+	if (state->engine != state->engine_wanted)
+		pv__engine_switch(state);
+
+	/*
+	 * Leave it all to the parallel engine's workers if it's in use.
+	 */
+	if (pv_parallel_transfer(state, fd, eof_in, eof_out, allowed)) {
+		if (state->written > 0)
+			pv__input_taken(state, state->written);
+		return state->written;
+	}
+
+#ifdef HAVE_MMAP_ENGINE
+	/*
+	 * Write straight from a memory mapping of the input if we can.
+	 */
+	if (pv__transfer_mmap(state, fd, eof_in, eof_out, allowed, lineswritten))
+		return state->written;
+#endif				/* HAVE_MMAP_ENGINE */
+
 	tv.tv_sec = 0;
-	tv.tv_usec = 90000;
+	tv.tv_usec = state->no_wait ? 0 : 90000;
+
+	/*
+	 * Don't wait for longer than half the --max-latency target, so that
+	 * held data is looked at again in time.
+	 */
+	if ((state->max_latency > 0) && (500000.0 * state->max_latency < tv.tv_usec)) {
+		tv.tv_usec = (long) (500000.0 * state->max_latency);
+		if (tv.tv_usec < LATENCY_GRANULARITY_MIN)
+			tv.tv_usec = LATENCY_GRANULARITY_MIN;
+	}
 
 	FD_ZERO(&readfds);
 	FD_ZERO(&writefds);
 
 	max_fd = 0;
 
+	/*
+	 * With --input-block-size, make room for a whole block at the end of
+	 * the buffer by moving what is still waiting back to the start.
+	 */
+	if ((state->input_block_size > 0) && (state->write_position > 0)
+	    && (state->buffer_size - state->read_position < state->input_block_size)) {
+		memmove(state->transfer_buffer, state->transfer_buffer + state->write_position,
+			state->read_position - state->write_position);
+		state->read_position -= state->write_position;
+		state->write_position = 0;
+	}
+
 	/*
 	 * If the input file is not at EOF and there's room in the buffer,
-	 * look for incoming data from it.
+	 * look for incoming data from it - unless we're waiting for the
+	 * buffer to empty so that we can switch I/O engines, or the buffer
+	 * holds as much as can be sent on within the --max-latency target.
+	 * With --input-block-size, there has to be room for a whole block,
+	 * and the --max-latency target has to allow one, unless the buffer
+	 * is empty, since a block can't be split.
 	 */
-	if ((!(*eof_in)) && (state->read_position < state->buffer_size)) {
-		FD_SET(fd, &readfds);
-		if (fd > max_fd)
-			max_fd = fd;
+	if ((!(*eof_in)) && (state->read_position < state->buffer_size) && (pv__latency_read_limit(state) > 0)
+	    && ((state->engine == state->engine_wanted) || (state->read_position == state->write_position))
+	    && (state->buffer_size - state->read_position >= state->input_block_size)
+	    && ((pv__latency_read_limit(state) >= state->input_block_size)
+		|| (state->read_position == state->write_position))) {
+		if (state->merge) {
+			/*
+			 * With --merge, pass on any whole lines left over
+			 * from last time, and look at all of the inputs.
+			 */
+			pv__transfer_merge(state, NULL, eof_in, eof_out);
+			max_fd = pv_merge_fdset(state, &readfds, max_fd);
+		} else {
+			FD_SET(fd, &readfds);
+			if (fd > max_fd)
+				max_fd = fd;
+		}
 	}
 
 	/*
@@ -815,16 +2459,43 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 		}
 	}
 
+	/*
+	 * Don't write more than the --tee outputs have room for.
+	 */
+	if ((state->sink_count > 0) && (state->to_write > 0))
+		state->to_write = (long) pv_fanout_room(state, (size_t) (state->to_write));
+
+	/*
+	 * Only write whole blocks if --output-block-size was given.
+	 */
+	if (state->output_block_size > 0)
+		pv__transfer_reblock(state, *eof_in, eof_out);
+
 	/*
 	 * If we don't think we've finished writing and there's anything
 	 * we're allowed to write, look for the stdout becoming writable.
 	 */
-	if ((!(*eof_out)) && (state->to_write > 0)) {
-		FD_SET(STDOUT_FILENO, &writefds);
-		if (STDOUT_FILENO > max_fd)
-			max_fd = STDOUT_FILENO;
+	if ((!(*eof_out)) && (state->to_write > 0)
+	    && ((state->split) || (NULL != state->validator) || (state->discard))) {
+		/*
+		 * With --split, there's an idle output to hand data to, and
+		 * with --validate or --discard, nothing is written, so don't
+		 * wait.
+		 */
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+	} else if ((!(*eof_out)) && (state->to_write > 0)) {
+		FD_SET(state->output_fd, &writefds);
+		if (state->output_fd > max_fd)
+			max_fd = state->output_fd;
 	}
 
+	/*
+	 * Look for any --tee outputs with data waiting becoming writable.
+	 */
+	if (state->sink_count > 0)
+		max_fd = pv_fanout_fdset(state, &writefds, max_fd);
+
 	n = select(max_fd + 1, &readfds, &writefds, NULL, &tv);
 
 	if (n < 0) {
@@ -846,47 +2517,89 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 
 	state->written = 0;
 
+	if (state->sink_count > 0)
+		pv_fanout_flush(state, &writefds);
+
 	/*
 	 * If there is data to read, try to read some in. Return early if
 	 * there was a transient read error.
 	 *
 	 * NB this can update state->written because of splice().
 	 */
-	if (FD_ISSET(fd, &readfds)) {
+	if (state->merge) {
+		if (!(*eof_in))
+			pv__transfer_merge(state, &readfds, eof_in, eof_out);
+	} else if (FD_ISSET(fd, &readfds)) {
 		if (pv__transfer_read(state, fd, eof_in, eof_out, allowed) == 0)
 			return 0;
 	}
 
+#ifdef HAVE_LINE_TEE
+	/*
+	 * Pass on any lines counted by the side channel helper thread.
+	 */
+	if ((state->linemode) && (lineswritten != NULL))
+		*lineswritten += pv__linetee_collect(state);
+#endif				/* HAVE_LINE_TEE */
+
 	/*
 	 * In line mode, only write up to and including the last newline,
-	 * so that we're writing output line-by-line.
+	 * so that we're writing output line-by-line - unless we're waiting
+	 * for the buffer to empty so that we can switch I/O engines, or the
+	 * data has been held for as long as --max-latency allows.
+	 *
+	 * With --split, always do this, so that each output is only given
+	 * whole lines (or with --null, whole null-terminated records).
 	 */
-	if ((state->to_write > 0) && (state->linemode) && !(state->null)) {
-		/*
-		 * Guillaume Marcais: use strrchr to find last \n
-		 */
+	if ((state->to_write > 0) && (((state->linemode) && !(state->null)) || (state->split))
+	    && (0 == state->output_block_size)
+	    && (state->engine == state->engine_wanted) && (!pv__latency_due(state))) {
 		unsigned char save;
 		char *start;
 		char *end;
 
-		save = state->transfer_buffer[state->write_position + state->to_write];
-		state->transfer_buffer[state->write_position + state->to_write] = 0;
-
 		start = (char *) (state->transfer_buffer + state->write_position);
-		end = strrchr(start, '\n');
-		state->transfer_buffer[state->write_position + state->to_write] = save;
+		end = NULL;
+
+		if (state->null) {
+			long idx;
+			for (idx = state->to_write - 1; idx >= 0; idx--) {
+				if ('\0' == start[idx]) {
+					end = start + idx;
+					break;
+				}
+			}
+		} else {
+			/*
+			 * Guillaume Marcais: use strrchr to find last \n
+			 */
+			save = state->transfer_buffer[state->write_position + state->to_write];
+			state->transfer_buffer[state->write_position + state->to_write] = 0;
+			end = strrchr(start, '\n');
+			state->transfer_buffer[state->write_position + state->to_write] = save;
+		}
 
 		if (end != NULL) {
 			state->to_write = (end - start) + 1;
+		} else if ((state->split) && (!(*eof_in)) && (state->read_position < state->buffer_size)
+			   && (state->to_write == (long) (state->read_position - state->write_position))) {
+			/*
+			 * Wait for the rest of a partial line rather than
+			 * splitting it, unless the buffer is already full.
+			 */
+			state->to_write = 0;
 		}
 	}
 
 	/*
-	 * If there is data to write, and stdout is ready to receive it, and
-	 * we didn't use splice() this time, write some data.  Return early
-	 * if there was a transient write error.
+	 * If there is data to write, and stdout is ready to receive it (or
+	 * with --split, there's somewhere to hand it to, or with --validate
+	 * or --discard, it isn't needed), and we didn't use splice() this
+	 * time, write some data.  Return early if there was a transient
+	 * write error.
 	 */
-	if (FD_ISSET(STDOUT_FILENO, &writefds)
+	if ((FD_ISSET(state->output_fd, &writefds)
+	     || ((state->split || (NULL != state->validator) || state->discard) && (!(*eof_out))))
 #ifdef HAVE_SPLICE
 	    && (0 == state->splice_used)
 #endif				/* HAVE_SPLICE */
@@ -917,4 +2630,100 @@ long pv_transfer(pvstate_t state, int fd, int *eof_in, int *eof_out, unsigned lo
 	return state->written;
 }
 
+
+/*
+ * Return the offset in the input file "fd" of the first byte which has not
+ * yet been written to the output, or -1 if it can't be determined.
+ */
+off_t pv_transfer_input_offset(pvstate_t state, int fd)
+{
+	off_t position;
+
+	/*
+	 * Nor does the parallel engine, while it is running.
+	 */
+	if (pv_parallel_offsets(state, fd, &position, NULL))
+		return position;
+
+#ifdef HAVE_MMAP_ENGINE
+	/*
+	 * The memory mapping engine doesn't move the file offset.
+	 */
+	if ((NULL != state->mmap_engine) && (state->mmap_engine->running) && (state->mmap_engine->fd == fd))
+		return state->mmap_engine->position;
+#endif				/* HAVE_MMAP_ENGINE */
+
+	position = lseek(fd, 0, SEEK_CUR);
+	if (position < 0)
+		return -1;
+
+	return position - (off_t) (state->read_position - state->write_position);
+}
+
+
+/*
+ * Return the offset in the output after the last byte which has been
+ * written, with nothing missing before it, or -1 if it can't be
+ * determined.
+ */
+off_t pv_transfer_output_offset(pvstate_t state)
+{
+	off_t position;
+
+	if (pv_parallel_offsets(state, -1, NULL, &position))
+		return position;
+
+	return lseek(state->output_fd, 0, SEEK_CUR);
+}
+
+
+/*
+ * Release any resources held by the transfer functions, such as the line
+ * counting side channel and its helper thread, any memory mapping of the
+ * input, the --max-latency arrival tracking, the parallel engine, and the
+ * --tee outputs.
+ */
+void pv_transfer_fini(pvstate_t state)
+{
+	if (NULL == state)
+		return;
+
+	pv_parallel_fini(state);
+	pv_fanout_fini(state);
+
+#ifdef HAVE_LINE_TEE
+	if (NULL != state->linetee) {
+		pv__linetee_stop(state);
+		pthread_mutex_destroy(&(state->linetee->mutex));
+		free(state->linetee);
+		state->linetee = NULL;
+	}
+#endif				/* HAVE_LINE_TEE */
+
+#ifdef HAVE_MMAP_ENGINE
+	if (NULL != state->mmap_engine) {
+		pv__mmap_stop(state, false);
+		free(state->mmap_engine);
+		state->mmap_engine = NULL;
+	}
+#endif				/* HAVE_MMAP_ENGINE */
+
+	if (NULL != state->latency) {
+		free(state->latency);
+		state->latency = NULL;
+	}
+
+#ifdef HAVE_SPLICE
+	if (state->discard_null_fd >= 0)
+		(void) close(state->discard_null_fd);
+	state->discard_null_fd = -1;
+	if (state->discard_pipe[0] >= 0) {
+		(void) close(state->discard_pipe[0]);
+		(void) close(state->discard_pipe[1]);
+	}
+	state->discard_pipe[0] = -1;
+	state->discard_pipe[1] = -1;
+#endif				/* HAVE_SPLICE */
+}
+
 /* EOF */
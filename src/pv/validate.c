@@ -0,0 +1,167 @@
+/*
+ * Functions for checking the data passing through against what --generate
+ * would have produced with --validate, instead of writing it anywhere.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+/*
+ * Set up the expected data for --validate.  Returns false on error.
+ */
+bool pv_validate_start(pvstate_t state)
+{
+	if ((NULL == state->validate) || (NULL != state->validator))
+		return true;
+
+	state->validator = pv_generate_new(state, state->validate, "--validate");
+	if (NULL == state->validator)
+		return false;
+
+	state->validate_expected = malloc(VALIDATE_CHUNK_SIZE);
+	if (NULL == state->validate_expected) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		return false;
+	}
+
+	state->validate_offset = 0;
+	state->validate_mismatches = 0;
+	state->validate_first_bad = -1;
+
+	return true;
+}
+
+
+/*
+ * Return the number of bytes which differ between "a" and "b", which are
+ * both "count" bytes long, comparing a word at a time.
+ */
+static unsigned long long pv__validate_count(const unsigned char *a, const unsigned char *b, size_t count)
+{
+	unsigned long long mismatches;
+	size_t idx;
+
+	mismatches = 0;
+
+	for (idx = 0; idx + 8 <= count; idx += 8) {
+		unsigned long long wa, wb, diff;
+
+		memcpy(&wa, a + idx, 8);
+		memcpy(&wb, b + idx, 8);
+		diff = wa ^ wb;
+		if (0 == diff)
+			continue;
+
+		/*
+		 * Set the top bit of every byte that is not zero, and count
+		 * those bits.
+		 */
+		diff = (((diff & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | diff) & 0x8080808080808080ULL;
+#ifdef __GNUC__
+		mismatches += (unsigned long long) __builtin_popcountll(diff);
+#else				/* !__GNUC__ */
+		for (; diff != 0; diff &= diff - 1)
+			mismatches++;
+#endif				/* __GNUC__ */
+	}
+
+	for (; idx < count; idx++) {
+		if (a[idx] != b[idx])
+			mismatches++;
+	}
+
+	return mismatches;
+}
+
+
+/*
+ * With --validate, check the "count" bytes at "buf", which come next in
+ * the data, against the expected data.  Returns the number of bytes dealt
+ * with, which is always "count".
+ */
+size_t pv_validate_data(pvstate_t state, const unsigned char *buf, size_t count)
+{
+	size_t done;
+
+	if ((NULL == state->validator) || (NULL == state->validate_expected))
+		return count;
+
+	for (done = 0; done < count;) {
+		size_t amount, idx;
+
+		amount = count - done;
+		if (amount > VALIDATE_CHUNK_SIZE)
+			amount = VALIDATE_CHUNK_SIZE;
+
+		pv_generate_data(state->validator, state->validate_expected, amount);
+
+		/*
+		 * The library's memcmp() is the fastest way to find out
+		 * that everything matches, which is what usually happens.
+		 */
+		if (0 != memcmp(buf + done, state->validate_expected, amount)) {
+			if (state->validate_first_bad < 0) {
+				for (idx = 0; idx < amount; idx++) {
+					if (buf[done + idx] != state->validate_expected[idx])
+						break;
+				}
+				state->validate_first_bad = (long long) (state->validate_offset + idx);
+				debug("%s: %lld", "first mismatch", state->validate_first_bad);
+			}
+			state->validate_mismatches +=
+			    pv__validate_count(buf + done, state->validate_expected, amount);
+		}
+
+		done += amount;
+		state->validate_offset += amount;
+	}
+
+	return count;
+}
+
+
+/*
+ * Report the result of --validate, if "report" is true, and free the
+ * expected data.  If a size was given, it is also an error for the data
+ * to have ended before reaching it.
+ */
+void pv_validate_finish(pvstate_t state, bool report)
+{
+	if (NULL == state->validator)
+		return;
+
+	if (report && (state->validate_mismatches > 0)) {
+		pv_error(state, "%s: %llu %s %lld", "--validate", state->validate_mismatches,
+			 _("bytes differed from the expected data, the first at offset"), state->validate_first_bad);
+		state->exit_status |= 16;
+	} else if (report) {
+		debug("%s: %llu %s", state->validate, state->validate_offset, "bytes matched");
+	}
+
+	if (report && (state->size > 0) && (!state->linemode) && (state->validate_offset < state->size)) {
+		pv_error(state, "%s: %s: %llu/%llu", "--validate", _("data ended early"), state->validate_offset,
+			 state->size);
+		state->exit_status |= 16;
+	}
+
+	pv_generate_free(state->validator);
+	state->validator = NULL;
+
+	if (NULL != state->validate_expected)
+		free(state->validate_expected);
+	state->validate_expected = NULL;
+}
+
+/* EOF */
@@ -0,0 +1,318 @@
+/*
+ * Functions for reading the output back once it has been written with
+ * --verify, checking it against the hash of each block that was taken as
+ * it was written.
+ *
+ * Copyright 2023 Andrew Wood
+ *
+ * Distributed under the Artistic License v2.0; see `doc/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+/*
+ * Check that the output can be read back afterwards with --verify, and
+ * note where the transfer starts writing to it.  Returns false on error.
+ */
+bool pv_verify_start(pvstate_t state)
+{
+	struct stat sb;
+	int flags;
+
+	if (!state->verify)
+		return true;
+
+	if ((0 != fstat(state->output_fd, &sb)) || (!(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)))) {
+		pv_error(state, "%s: %s", "(stdout)", _("--verify needs the output to be a file or block device"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	flags = fcntl(state->output_fd, F_GETFL);
+	if ((flags >= 0) && (0 != (flags & O_APPEND))) {
+		pv_error(state, "%s: %s", "(stdout)", _("cannot verify output opened for appending"));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	state->verify_offset = lseek(state->output_fd, 0, SEEK_CUR);
+	if (state->verify_offset < 0) {
+		pv_error(state, "%s: %s: %s", "(stdout)", _("failed to find output position"), strerror(errno));
+		state->exit_status |= 2;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Open the output "output_fd" again for reading, with O_DIRECT if "direct"
+ * is true so that what is read comes from the device rather than the page
+ * cache.  Returns the new file descriptor, or -1 on error.
+ */
+static int pv__verify_open(int output_fd, bool direct)
+{
+	char path[64];			 /* flawfinder: ignore */
+	int flags, fd;
+
+	/*
+	 * flawfinder: path is only written with pv_snprintf(), which is
+	 * bounded and always terminates, and names our own output.
+	 */
+
+	(void) pv_snprintf(path, sizeof(path), "/proc/self/fd/%d", output_fd);
+
+	flags = O_RDONLY;
+#ifdef O_DIRECT
+	if (direct)
+		flags |= O_DIRECT;
+#else				/* !O_DIRECT */
+	if (direct)
+		return -1;
+#endif				/* O_DIRECT */
+
+	fd = open(path, flags);		/* flawfinder: ignore */
+	if (fd >= 0)
+		return fd;
+
+	/*
+	 * Without /proc, fall back to the output itself if it was
+	 * opened for reading as well, such as with "1<>FILE".
+	 */
+	if (direct)
+		return -1;
+	flags = fcntl(output_fd, F_GETFL);
+	if ((flags >= 0) && (O_RDWR == (flags & O_ACCMODE)))
+		return dup(output_fd);
+
+	return -1;
+}
+
+
+/*
+ * Return the number of seconds elapsed since "start", leaving out any time
+ * spent stopped, as the main loop does.
+ */
+static long double pv__verify_elapsed(pvstate_t state, struct timeval *start)
+{
+	struct timeval now;
+	long double elapsed;
+
+	gettimeofday(&now, NULL);
+
+	elapsed = now.tv_sec - start->tv_sec - state->pv_sig_toffset.tv_sec;
+	elapsed += (now.tv_usec - start->tv_usec - state->pv_sig_toffset.tv_usec) / 1000000.0;
+
+	return elapsed;
+}
+
+
+/*
+ * With --verify, once the transfer is complete, read everything written
+ * to the output back in large aligned reads, with O_DIRECT where the
+ * output allows it, passing it to the hash thread to compare with what
+ * was written, and showing the progress of this on a new display line.
+ *
+ * Reading is pipelined with the hashing: the hash thread works on one
+ * chunk while the next is being read.  Any mismatch is reported with the
+ * offset of the first block that differed and the number that did.
+ */
+void pv_verify_run(pvstate_t state)
+{
+	unsigned char *buffer;
+	long long total, first_bad;
+	unsigned long long done, bad_blocks;
+	long long since_last;
+	long double next_update, elapsed;
+	struct timeval start_time;
+	off_t offset;
+	size_t skip;
+	bool direct;
+	int fd;
+
+	if ((!state->verify) || (NULL == state->digest))
+		return;
+
+	total = pv_digest_verify_begin(state);
+	if (total <= 0)
+		return;
+
+	/*
+	 * Make sure the output device has everything before reading it
+	 * back; only treat EIO as a failure, as in pv_checkpoint_save().
+	 */
+#ifdef HAVE_FDATASYNC
+	if ((fdatasync(state->output_fd) < 0) && (EIO == errno)) {
+#else				/* !HAVE_FDATASYNC */
+	if ((fsync(state->output_fd) < 0) && (EIO == errno)) {
+#endif				/* HAVE_FDATASYNC */
+		pv_error(state, "%s: %s", _("failed to sync output"), strerror(errno));
+		state->exit_status |= 16;
+		return;
+	}
+
+	direct = true;
+	fd = pv__verify_open(state->output_fd, true);
+	if (fd < 0) {
+		direct = false;
+		fd = pv__verify_open(state->output_fd, false);
+	}
+	if (fd < 0) {
+		pv_error(state, "%s: %s: %s", "(stdout)", _("failed to open output to verify it"), strerror(errno));
+		state->exit_status |= 2;
+		return;
+	}
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+	/*
+	 * Without O_DIRECT, at least try to make the reads go to the device.
+	 */
+	if (!direct)
+		(void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+	buffer = NULL;
+#ifdef HAVE_POSIX_MEMALIGN
+	if (0 != posix_memalign((void **) &buffer, VERIFY_ALIGN, VERIFY_READ_SIZE))
+		buffer = NULL;
+#else				/* !HAVE_POSIX_MEMALIGN */
+	buffer = malloc(VERIFY_READ_SIZE);
+#endif				/* HAVE_POSIX_MEMALIGN */
+	if (NULL == buffer) {
+		pv_error(state, "%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->exit_status |= 64;
+		close(fd);
+		return;
+	}
+
+	debug("%s: %lld %s %lld%s", "verifying", total, "bytes from offset", (long long) (state->verify_offset),
+	      direct ? " with O_DIRECT" : "");
+
+	/*
+	 * Start a new display line for the verification pass.
+	 */
+	if ((!state->numeric) && (!state->cursor) && (state->display_visible)) {
+		pv_write_retry(STDERR_FILENO, "\n", 1);
+		for (; state->display_sublines > 0; state->display_sublines--)
+			pv_write_retry(STDERR_FILENO, "\n", 1);
+	}
+	state->linemode = false;
+	pv_display_restart(state, (unsigned long long) total);
+
+	pv_sig_check(state);
+	gettimeofday(&start_time, NULL);
+	state->pv_sig_toffset.tv_sec = 0;
+	state->pv_sig_toffset.tv_usec = 0;
+
+	/*
+	 * Direct I/O needs aligned offsets, so start reading at the aligned
+	 * offset below where the transfer started, and skip up to it.
+	 */
+	offset = state->verify_offset - (state->verify_offset % VERIFY_ALIGN);
+	skip = (size_t) (state->verify_offset - offset);
+	done = 0;
+	since_last = 0;
+	next_update = state->interval;
+
+	while ((done < (unsigned long long) total) && (!pv_sig_aborted(state))) {
+		unsigned char *data;
+		ssize_t nread;
+		size_t count;
+
+		nread = pread(fd, buffer, VERIFY_READ_SIZE, offset);
+
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+
+		if ((nread < 0) && (EINVAL == errno) && direct) {
+			debug("%s", "O_DIRECT read failed - reading back without it");
+			close(fd);
+			direct = false;
+			fd = pv__verify_open(state->output_fd, false);
+			if (fd < 0) {
+				pv_error(state, "%s: %s: %s", "(stdout)", _("failed to open output to verify it"),
+					 strerror(errno));
+				state->exit_status |= 2;
+				break;
+			}
+			continue;
+		}
+
+		if (nread < 0) {
+			pv_error(state, "%s: %s: %s", "(stdout)", _("read failed while verifying"), strerror(errno));
+			state->exit_status |= 16;
+			break;
+		}
+
+		/*
+		 * The output is shorter than what was written to it; the
+		 * blocks never read are counted as bad below.
+		 */
+		if (0 == nread)
+			break;
+
+		offset += nread;
+		data = buffer;
+		count = (size_t) nread;
+
+		if (skip > 0) {
+			size_t amount = skip < count ? skip : count;
+			data += amount;
+			count -= amount;
+			skip -= amount;
+		}
+
+		if (count > (unsigned long long) total - done)
+			count = (size_t) ((unsigned long long) total - done);
+
+		pv_digest_data(state, data, count);
+		done += count;
+		since_last += count;
+
+		if (state->no_op)
+			continue;
+
+		elapsed = pv__verify_elapsed(state, &start_time);
+		if (elapsed < next_update)
+			continue;
+		next_update = elapsed + state->interval;
+
+		pv_display(state, elapsed, since_last, (long long) done);
+		since_last = 0;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	free(buffer);
+
+	if (!state->no_op)
+		pv_display(state, pv__verify_elapsed(state, &start_time), -1, (long long) done);
+
+	if (pv_sig_aborted(state))
+		return;
+
+	bad_blocks = pv_digest_verify_end(state, &first_bad);
+
+	if (bad_blocks > 0) {
+		pv_error(state, "%s: %llu %s %lld", "(stdout)", bad_blocks,
+			 _("bad blocks found on verification, the first at offset"),
+			 (long long) (state->verify_offset) + first_bad * VERIFY_BLOCK_SIZE);
+		state->exit_status |= 16;
+		/* pv_error() has already moved off the display line. */
+		state->display_visible = false;
+	}
+}
+
+/* EOF */
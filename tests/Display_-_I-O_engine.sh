@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Check that "%E" shows which I/O engine is in use, that the engines are
+# tried and one is settled on, and that data passes through intact while
+# switching between them.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+dd if=/dev/urandom of="${workFile3}" bs=1024 count=8192 2>/dev/null
+
+# Transfer 8MiB at 4MiB/s from a file to a pipe, so that there is time for
+# every candidate engine to be tried.
+#
+"${testSubject}" -f -F 'engine:%E' -i 0.1 -L 4M "${workFile3}" 2>"${workFile1}" | cat > "${workFile2}"
+
+if ! cmp -s "${workFile2}" "${workFile3}"; then
+	echo "output did not match input"
+	exit 1
+fi
+
+# Every update should name a known engine, with "?" while trying them.
+#
+badValues=$(tr '\r' '\n' < "${workFile1}" | sed 's/ *$//' | grep -v '^$' | grep -Ev '^engine:(read/write|splice|mmap)\??$' || true)
+if test -n "${badValues}"; then
+	echo "unexpected values displayed: ${badValues}"
+	exit 1
+fi
+
+# By the end, the trials should be over.
+#
+lastValue=$(tr '\r' '\n' < "${workFile1}" | sed 's/ *$//' | grep -v '^$' | sed -n '$p')
+case "${lastValue}" in
+engine:*\?)	echo "still trying engines at the end (${lastValue})"; exit 1 ;;
+engine:*)	;;
+*)		echo "no engine displayed"; exit 1 ;;
+esac
+
+exit 0
+
+# EOF
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# Check that "--verify" passes an output which was written correctly, that
+# it reports blocks changed after they were written, and that it refuses an
+# output which cannot be read back.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v dd >/dev/null 2>&1 || exit 2
+command -v mkfifo >/dev/null 2>&1 || exit 2
+
+# Skip the test if verification is not supported on this platform.
+printf '%s' "abc" | "${testSubject}" -q --verify > "${workFile2}" 2>/dev/null || exit 2
+
+# Enough data to span several verification blocks.
+awk 'BEGIN{for(i=0;i<200000;i++)printf "%031d\n",i}' > "${workFile1}"
+
+"${testSubject}" -q --verify "${workFile1}" > "${workFile2}" || { echo "verification of a good output failed"; exit 1; }
+cmp "${workFile1}" "${workFile2}" || { echo "output differs from input"; exit 1; }
+
+# The output not starting at offset 0.
+(printf '%s' "abc"; "${testSubject}" -q --verify "${workFile1}") > "${workFile2}" \
+|| { echo "verification of a good output at an offset failed"; exit 1; }
+
+# Change two blocks of the output after they have been written, before
+# the input is finished, which must be detected.
+rm -f "${workFile3}"
+mkfifo "${workFile3}" || exit 2
+"${testSubject}" -q --verify "${workFile3}" > "${workFile2}" 2>/dev/null &
+testPid=$!
+{
+	cat "${workFile1}"
+	while test "$(wc -c < "${workFile2}")" -lt 6400000; do sleep 1; done
+	printf '%s' "XX" | dd of="${workFile2}" bs=1 seek=2500000 conv=notrunc 2>/dev/null
+	printf '%s' "XX" | dd of="${workFile2}" bs=1 seek=6000000 conv=notrunc 2>/dev/null
+} > "${workFile3}"
+testStatus=0
+wait "${testPid}" || testStatus=$?
+rm -f "${workFile3}"
+if ! test "${testStatus}" -eq 16; then
+	echo "changed output not detected - exit status ${testStatus}"
+	exit 1
+fi
+
+# A pipe cannot be read back.
+{
+	testStatus=0
+	"${testSubject}" -q --verify "${workFile1}" 2>/dev/null || testStatus=$?
+	echo "${testStatus}" > "${workFile3}"
+} | cat > /dev/null
+if ! test "$(cat "${workFile3}")" -eq 2; then
+	echo "output to a pipe was not refused"
+	exit 1
+fi
+
+exit 0
+
+# EOF
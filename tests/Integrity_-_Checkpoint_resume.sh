@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# Check that an interrupted run with "--checkpoint" can be carried on with
+# "--resume", and that the result matches the input.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+
+# 1MiB of varying data, so a misplaced block would be noticed.
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -f "${workFile2}" "${workFile3}"
+
+"${testSubject}" -q -L 200K --checkpoint "${workFile3}" "${workFile1}" > "${workFile2}" &
+pvPid=$!
+sleep 1
+kill -INT "${pvPid}"
+wait "${pvPid}" || true
+
+outputSize=$(wc -c < "${workFile2}" | tr -dc '0-9')
+if ! test "${outputSize}" -lt 1048576; then
+	echo "first run was not interrupted"
+	exit 1
+fi
+
+# A checkpoint which doesn't match the input must be refused.
+if "${testSubject}" -q --checkpoint "${workFile3}" --resume "${workFile3}" 1<>"${workFile2}" 2>/dev/null; then
+	echo "resumed from a checkpoint for a different input"
+	exit 1
+fi
+
+"${testSubject}" -q --checkpoint "${workFile3}" --resume "${workFile1}" 1<>"${workFile2}"
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "output differs from input after resuming"
+	exit 1
+fi
+
+rm -f "${workFile3}"
+
+exit 0
+
+# EOF
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Check that an interrupted run with "--error-map" records the part of the
+# input it didn't get to, that "--error-map-retry" refuses an output which
+# no longer holds the first pass, and that otherwise it fills in the rest
+# of the output, without any messages when "-q" is given.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+
+# 1MiB of varying data, so a misplaced block would be noticed.
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -f "${workFile2}" "${workFile3}"
+
+"${testSubject}" -q -L 200K --error-map "${workFile3}" "${workFile1}" > "${workFile2}" &
+pvPid=$!
+sleep 1
+kill -INT "${pvPid}"
+wait "${pvPid}" || true
+
+tailLines=$(grep -vc '^#' "${workFile3}" || true)
+if ! test "${tailLines}" = "1"; then
+	echo "expected the unread tail in the error map, got ${tailLines} lines"
+	cat "${workFile3}"
+	exit 1
+fi
+
+# A truncated output has lost the first pass, so it must be refused.
+testStatus=0
+"${testSubject}" -q --error-map "${workFile3}" --error-map-retry "${workFile1}" > "${workFile2}.new" 2>/dev/null || testStatus=$?
+rm -f "${workFile2}.new"
+if test "${testStatus}" -eq 0; then
+	echo "retry into a truncated output was not refused"
+	exit 1
+fi
+
+errorOutput=$("${testSubject}" -q --error-map "${workFile3}" --error-map-retry "${workFile1}" 2>&1 1<>"${workFile2}")
+
+if test -n "${errorOutput}"; then
+	echo "unexpected messages with \"-q\": ${errorOutput}"
+	exit 1
+fi
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "output differs from input after the retry"
+	exit 1
+fi
+
+remainingLines=$(grep -vc '^#' "${workFile3}" || true)
+if ! test "${remainingLines}" = "0"; then
+	echo "error map still lists ${remainingLines} regions"
+	exit 1
+fi
+
+# Without "--error-map-retry", an existing map is just replaced by a normal
+# transfer, so running the same command twice copies everything twice.
+"${testSubject}" -q --error-map "${workFile3}" "${workFile1}" > "${workFile2}"
+"${testSubject}" -q --error-map "${workFile3}" "${workFile1}" > "${workFile2}"
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "output differs from input after a repeated run"
+	exit 1
+fi
+
+# Nor can a complete first pass be retried into an emptied output.
+testStatus=0
+"${testSubject}" -q --error-map "${workFile3}" --error-map-retry "${workFile1}" > "${workFile2}" 2>/dev/null || testStatus=$?
+if test "${testStatus}" -eq 0; then
+	echo "retry into an emptied output was not refused"
+	exit 1
+fi
+
+rm -f "${workFile3}"
+
+exit 0
+
+# EOF
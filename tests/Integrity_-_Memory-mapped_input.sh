@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Check that data passes through intact, and lines are counted correctly,
+# when a regular file is written out from a memory mapping of it - to a
+# file, to a pipe, and with splice() turned off.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+seq 1 200000 > "${workFile3}"
+
+# Line mode, regular file to regular file.
+#
+"${testSubject}" -bnl -i 0.1 -f "${workFile3}" 2>"${workFile1}" > "${workFile2}"
+
+lastNumber=$(sed -n '$p' < "${workFile1}")
+if ! test "${lastNumber}" = "200000"; then
+	echo "line counter was incorrect to a file (${lastNumber} instead of 200000)"
+	exit 1
+fi
+if ! cmp -s "${workFile2}" "${workFile3}"; then
+	echo "output to a file did not match input"
+	exit 1
+fi
+
+# Line mode, regular file to a pipe.
+#
+"${testSubject}" -bnl -i 0.1 -f "${workFile3}" 2>"${workFile1}" | cat > "${workFile2}"
+
+lastNumber=$(sed -n '$p' < "${workFile1}")
+if ! test "${lastNumber}" = "200000"; then
+	echo "line counter was incorrect to a pipe (${lastNumber} instead of 200000)"
+	exit 1
+fi
+if ! cmp -s "${workFile2}" "${workFile3}"; then
+	echo "output to a pipe did not match input"
+	exit 1
+fi
+
+# Byte mode with splice() turned off, from standard input part way through
+# the file, to a pipe.
+#
+{ dd bs=1000 count=1 of=/dev/null 2>/dev/null; "${testSubject}" -C -q; } < "${workFile3}" | cat > "${workFile2}"
+
+if ! tail -c +1001 "${workFile3}" | cmp -s - "${workFile2}"; then
+	echo "output from part way through did not match input"
+	exit 1
+fi
+
+exit 0
+
+# EOF
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Check that with "-E -Z", unreadable input is skipped a whole block at a
+# time and zero-filled in the output.  The start of a process's own
+# memory is never mapped, so reading it fails.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+test -r /proc/self/mem || exit 2
+
+"${testSubject}" -E -Z 4096 -s 65536 -S -q /proc/self/mem 2>"${workFile1}" > "${workFile2}" || true
+
+outputSize=$(wc -c < "${workFile2}" | tr -dc '0-9')
+if ! test "${outputSize}" = "65536"; then
+	echo "output was ${outputSize} bytes instead of 65536"
+	exit 1
+fi
+
+nonZeroBytes=$(tr -d '\000' < "${workFile2}" | wc -c | tr -dc '0-9')
+if ! test "${nonZeroBytes}" = "0"; then
+	echo "skipped regions were not zero-filled"
+	exit 1
+fi
+
+# One skip per 4KiB block, not one per few bytes.
+skipCount=$(grep -c "skipped past read error" "${workFile1}" || true)
+if ! test "${skipCount}" -ge 16 || ! test "${skipCount}" -le 17; then
+	echo "expected 16 block skips, got ${skipCount}"
+	exit 1
+fi
+
+exit 0
+
+# EOF
@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Check that blocks skipped with "-E -Z" are patched back into the output
+# once the input can be read again.  Reading a directory always fails, so
+# the first pass is made from a directory, which is then replaced by the
+# real input before "--error-map-retry" - as if a failing disk had
+# recovered - and the zero-filled output must end up matching the input.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+
+# 64KiB of varying data, so a misplaced block would be noticed.
+awk 'BEGIN{for(i=0;i<1024;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -rf "${workFile2}" "${workFile2}.map" "${workFile3}"
+mkdir "${workFile3}" || exit 2
+
+"${testSubject}" -q -E -Z 4096 -s 65536 -S --error-map "${workFile2}.map" "${workFile3}" > "${workFile2}" 2>/dev/null || true
+
+outputSize=$(wc -c < "${workFile2}" | tr -dc '0-9')
+nonZeroBytes=$(tr -d '\000' < "${workFile2}" | wc -c | tr -dc '0-9')
+if ! test "${outputSize}" = "65536" || ! test "${nonZeroBytes}" = "0"; then
+	echo "first pass wrote ${outputSize} bytes, ${nonZeroBytes} of them non-zero, instead of 65536 null bytes"
+	rm -rf "${workFile3}" "${workFile2}.map"
+	exit 1
+fi
+
+rmdir "${workFile3}"
+cp "${workFile1}" "${workFile3}"
+
+testStatus=0
+"${testSubject}" -q --error-map "${workFile2}.map" --error-map-retry "${workFile3}" 1<>"${workFile2}" || testStatus=$?
+if ! test "${testStatus}" -eq 0; then
+	echo "retry exited with status ${testStatus}"
+	rm -f "${workFile2}.map"
+	exit 1
+fi
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "skipped blocks were not written back into the output"
+	rm -f "${workFile2}.map"
+	exit 1
+fi
+
+remainingLines=$(grep -vc '^#' "${workFile2}.map" || true)
+rm -f "${workFile2}.map"
+if ! test "${remainingLines}" = "0"; then
+	echo "error map still lists ${remainingLines} regions"
+	exit 1
+fi
+
+exit 0
+
+# EOF
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Check that line mode counts lines correctly, and passes all data through,
+# when both input and output are pipes, where the lines are counted from a
+# side channel while the data is spliced.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+seq 1 100000 > "${workFile3}"
+
+# Pass through 100000 lines, pipe to pipe.
+#
+cat "${workFile3}" \
+| "${testSubject}" -bnl -i 0.1 -f 2>"${workFile1}" \
+| cat > "${workFile2}"
+
+lastNumber=$(sed -n '$p' < "${workFile1}")
+
+# The last number output should be the number of input lines.
+if ! test "${lastNumber}" = "100000"; then
+	echo "line counter was incorrect (${lastNumber} instead of 100000)"
+	exit 1
+fi
+
+# The output should match the input.
+if ! cmp -s "${workFile2}" "${workFile3}"; then
+	echo "output did not match input"
+	exit 1
+fi
+
+exit 0
+
+# EOF
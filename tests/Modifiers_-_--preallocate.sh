@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Check that "--preallocate" doesn't change the output, and that the
+# unused part of the preallocated space is trimmed off if the transfer is
+# interrupted.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -f "${workFile2}"
+
+"${testSubject}" -q --preallocate "${workFile1}" > "${workFile2}" 2>"${workFile3}"
+
+# Skip if the filesystem can't preallocate.
+if grep -q "preallocation failed" "${workFile3}"; then
+	exit 2
+fi
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "output differs from input"
+	exit 1
+fi
+
+rm -f "${workFile2}"
+"${testSubject}" -q -L 200K --preallocate "${workFile1}" > "${workFile2}" &
+pvPid=$!
+sleep 1
+kill -INT "${pvPid}"
+wait "${pvPid}" || true
+
+outputSize=$(wc -c < "${workFile2}" | tr -dc '0-9')
+if ! test "${outputSize}" -lt 1048576; then
+	echo "output was not trimmed after being interrupted (${outputSize} bytes)"
+	exit 1
+fi
+
+if ! head -c "${outputSize}" "${workFile1}" | cmp - "${workFile2}" >/dev/null 2>&1; then
+	echo "interrupted output is not the start of the input"
+	exit 1
+fi
+
+exit 0
+
+# EOF
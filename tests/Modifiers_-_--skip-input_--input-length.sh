@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# Check that "--skip-input" and "--input-length" pass on only the chosen
+# part of the input, whether it is a file or a pipe, that "--seek-output"
+# writes it at the chosen offset in the output, and that all three reject
+# arguments which aren't numbers.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+
+# 1MiB of numbered lines, so a misplaced byte would be noticed.
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+
+# Lines 1000 to 1099 of the input.
+sed -n '1001,1100p' < "${workFile1}" > "${workFile3}"
+
+"${testSubject}" -q --skip-input 64000 --input-length 6400 "${workFile1}" > "${workFile2}"
+if ! cmp "${workFile3}" "${workFile2}" >/dev/null 2>&1; then
+	echo "wrong part of the input file was passed on"
+	exit 1
+fi
+
+"${testSubject}" -q --skip-input 64000 --input-length 6400 < "${workFile1}" | cat > "${workFile2}"
+if ! cmp "${workFile3}" "${workFile2}" >/dev/null 2>&1; then
+	echo "wrong part of the input file was passed on from a pipe"
+	exit 1
+fi
+
+cat "${workFile1}" | "${testSubject}" -q --skip-input 64000 --input-length 6400 > "${workFile2}"
+if ! cmp "${workFile3}" "${workFile2}" >/dev/null 2>&1; then
+	echo "wrong part of a piped input was passed on"
+	exit 1
+fi
+
+# Patch lines 1000 to 1099 into the same place in a file of zeroes.
+dd if=/dev/zero of="${workFile2}" bs=64 count=16384 2>/dev/null
+"${testSubject}" -q --skip-input 64000 --seek-output 64000 --input-length 6400 "${workFile1}" 1<>"${workFile2}"
+outputSize=$(wc -c < "${workFile2}" | tr -dc '0-9')
+if ! test "${outputSize}" = "1048576"; then
+	echo "output was resized to ${outputSize} bytes"
+	exit 1
+fi
+if ! dd if="${workFile2}" bs=64 skip=1000 count=100 2>/dev/null | cmp "${workFile3}" - >/dev/null 2>&1; then
+	echo "window was not written at the output offset"
+	exit 1
+fi
+
+# Arguments which aren't numbers.
+for optionName in skip-input seek-output input-length; do
+	testStatus=0
+	"${testSubject}" -q "--${optionName}" foo "${workFile1}" > /dev/null 2>&1 || testStatus=$?
+	if test "${testStatus}" -eq 0; then
+		echo "non-numeric --${optionName} not rejected"
+		exit 1
+	fi
+done
+
+exit 0
+
+# EOF
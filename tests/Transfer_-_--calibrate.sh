@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Check that "--calibrate" passes every byte through intact, whether the
+# input and output can be rewound or not, without touching the output
+# before where it was asked to start, and reports the options to use
+# without any errors from the individual tries.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+# An odd size, so that the last write of each direct I/O try fails.
+dd if=/dev/urandom of="${workFile3}" bs=1000 count=1049 2>/dev/null
+
+# Regular file to regular file, rewinding between tries.
+#
+"${testSubject}" --calibrate "${workFile3}" 2>"${workFile1}" > "${workFile2}"
+
+if ! cmp -s "${workFile2}" "${workFile3}"; then
+	echo "output to a file did not match input"
+	exit 1
+fi
+if ! grep -q "^.*: ${testSubject##*/}" "${workFile1}"; then
+	echo "no recommended options were shown"
+	cat "${workFile1}"
+	exit 1
+fi
+if grep -v "calibration results" "${workFile1}" | grep -q "^${testSubject##*/}: "; then
+	echo "errors were reported during calibration"
+	cat "${workFile1}"
+	exit 1
+fi
+
+# Each try starts again from the "--seek-output" offset, not the start of
+# the output.
+#
+printf '%s' "HEADER" > "${workFile2}"
+"${testSubject}" --calibrate --seek-output 6 "${workFile3}" 2>"${workFile1}" 1<>"${workFile2}"
+
+if ! test "$(head -c 6 "${workFile2}")" = "HEADER"; then
+	echo "calibration overwrote the output before the seek offset"
+	exit 1
+fi
+if ! tail -c +7 "${workFile2}" | cmp -s - "${workFile3}"; then
+	echo "output after the seek offset did not match input"
+	exit 1
+fi
+
+# Pipe to pipe, carrying on from one try to the next.
+#
+cat "${workFile3}" | "${testSubject}" --calibrate 2>"${workFile1}" | cat > "${workFile2}"
+
+if ! cmp -s "${workFile2}" "${workFile3}"; then
+	echo "output through pipes did not match input"
+	exit 1
+fi
+
+exit 0
+
+# EOF
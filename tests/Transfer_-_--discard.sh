@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Check that "--discard" reads all of the input, from a file or a pipe,
+# without writing anything, and that lines are still counted and the data
+# still hashed.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v awk >/dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<100000;i++)printf "%031d\n",i}' > "${workFile1}"
+
+# Standard output is left alone, even if it is the input.
+printf '%s\n' "unchanged" > "${workFile2}"
+"${testSubject}" -q --discard "${workFile1}" >> "${workFile2}" || { echo "discarding a file failed"; exit 1; }
+if ! test "$(cat "${workFile2}")" = "unchanged"; then
+	echo "output was written"
+	exit 1
+fi
+"${testSubject}" -q --discard "${workFile1}" >> "${workFile1}" || { echo "input as output was refused"; exit 1; }
+
+# All of the data is read, with and without splice().
+for splice in "" "--no-splice"; do
+	testBytes=$("${testSubject}" -n -b --discard ${splice} "${workFile1}" 2>&1 | tail -n 1)
+	if ! test "${testBytes}" = "3200000"; then
+		echo "file ${splice}: wrong byte count: ${testBytes}"
+		exit 1
+	fi
+	testBytes=$(cat "${workFile1}" | "${testSubject}" -n -b --discard ${splice} 2>&1 | tail -n 1)
+	if ! test "${testBytes}" = "3200000"; then
+		echo "pipe ${splice}: wrong byte count: ${testBytes}"
+		exit 1
+	fi
+done
+
+# Lines are counted.
+testLines=$(cat "${workFile1}" | "${testSubject}" -n -b -l --discard 2>&1 | tail -n 1)
+if ! test "${testLines}" = "100000"; then
+	echo "wrong line count: ${testLines}"
+	exit 1
+fi
+
+# Hashing still works, if it is supported.
+if "${testSubject}" -q --hash sha256 "${workFile1}" > /dev/null 2> "${workFile2}"; then
+	cat "${workFile1}" | "${testSubject}" -q --discard --hash sha256 2> "${workFile3}" \
+	|| { echo "discarding with --hash failed"; exit 1; }
+	if ! test "$(sed 's/^.*= //' "${workFile2}")" = "$(sed 's/^.*= //' "${workFile3}")"; then
+		echo "hash differs"
+		cat "${workFile2}" "${workFile3}"
+		exit 1
+	fi
+fi
+
+exit 0
+
+# EOF
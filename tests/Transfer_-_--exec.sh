@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# Check that "--exec" passes the data through the command and on to
+# standard output, from a file or a pipe, that the command's output is
+# counted on its own display line, that a failing command is reported, and
+# that the transfer stops when the reader of the command's output goes away.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v awk >/dev/null 2>&1 || exit 2
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v grep >/dev/null 2>&1 || exit 2
+command -v head >/dev/null 2>&1 || exit 2
+command -v tr >/dev/null 2>&1 || exit 2
+
+# Skip the test if --exec is not supported on this platform.
+printf '%s' "abc" | "${testSubject}" -q --exec "cat" > /dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<100000;i++)printf "%031d\n",i}' > "${workFile1}"
+
+"${testSubject}" -q --exec "cat" "${workFile1}" > "${workFile2}" || { echo "file through cat failed"; exit 1; }
+cmp "${workFile1}" "${workFile2}" || { echo "file through cat: output differs from input"; exit 1; }
+
+cat "${workFile1}" | "${testSubject}" -q --exec "cat" > "${workFile2}" || { echo "pipe through cat failed"; exit 1; }
+cmp "${workFile1}" "${workFile2}" || { echo "pipe through cat: output differs from input"; exit 1; }
+
+# The command really is in between.
+"${testSubject}" -q --exec "tr 0 x" "${workFile1}" | tr x 0 > "${workFile2}" || { echo "tr failed"; exit 1; }
+cmp "${workFile1}" "${workFile2}" || { echo "tr: output differs from input"; exit 1; }
+
+# Half of the data comes out, which the display line for the command's
+# output shows.
+"${testSubject}" -f -b --exec "awk 'NR%2==0'" "${workFile1}" 2> "${workFile3}" > "${workFile2}" \
+|| { echo "awk failed"; exit 1; }
+if ! test "$(wc -l < "${workFile2}")" -eq 50000; then
+	echo "wrong output from awk"
+	exit 1
+fi
+if ! tr '\r' '\n' < "${workFile3}" | grep -Eq "awk .*: .*1[.]5[0-9]*MiB.*ratio 0[.]500"; then
+	echo "command output not shown"
+	cat "${workFile3}"
+	exit 1
+fi
+
+# A failing command.
+testStatus=0
+"${testSubject}" -q --exec "cat > /dev/null; exit 3" "${workFile1}" 2>/dev/null || testStatus=$?
+if ! test "${testStatus}" -eq 16; then
+	echo "failing command not reported - exit status ${testStatus}"
+	exit 1
+fi
+
+# The reader of the command's output going away, with far more data left
+# than the pipes can hold, ends the transfer without an error.
+for i in 1 2 3 4 5 6 7 8; do cat "${workFile1}"; done > "${workFile3}"
+rm -f "${workFile2}" "${workFile2}.pid"
+{
+	"${testSubject}" -q --exec "cat" "${workFile3}" 2>/dev/null &
+	echo "$!" > "${workFile2}.pid"
+	testStatus=0
+	wait "$!" || testStatus=$?
+	echo "${testStatus}" > "${workFile2}"
+} | head -c 10 > /dev/null &
+waited=0
+while ! test -s "${workFile2}"; do
+	sleep 1
+	waited=$((waited+1))
+	if test "${waited}" -ge 10; then
+		echo "transfer did not stop when the output's reader went away"
+		kill "$(cat "${workFile2}.pid")" 2>/dev/null
+		rm -f "${workFile2}.pid"
+		exit 1
+	fi
+done
+rm -f "${workFile2}.pid"
+if ! test "$(cat "${workFile2}")" = "0"; then
+	echo "exit status $(cat "${workFile2}") when the output's reader went away"
+	exit 1
+fi
+
+exit 0
+
+# EOF
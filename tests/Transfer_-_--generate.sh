@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# Check that "--generate" writes the expected amount of each type of data,
+# that the repeating types repeat, and that the same seed gives the same
+# random data whatever the buffer size.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v tr >/dev/null 2>&1 || exit 2
+command -v wc >/dev/null 2>&1 || exit 2
+
+for generateType in zero pattern pattern:abc random random:7 text text:7; do
+	"${testSubject}" -q --generate "${generateType}" -s 1000000 | cat > "${workFile1}"
+	byteCount=$(wc -c < "${workFile1}" | tr -dc '0-9')
+	if ! test "${byteCount}" = "1000000"; then
+		echo "${generateType}: wrong amount of data: ${byteCount}"
+		exit 1
+	fi
+done
+
+# Zeros, through a pipe and to a file.
+"${testSubject}" -q --generate zero -s 300000 | tr -d '\000' > "${workFile1}"
+if test -s "${workFile1}"; then
+	echo "zero: not all zero bytes"
+	exit 1
+fi
+"${testSubject}" -q --generate zero -s 300000 > "${workFile2}"
+tr -d '\000' < "${workFile2}" > "${workFile1}"
+if test -s "${workFile1}"; then
+	echo "zero: not all zero bytes in a file"
+	exit 1
+fi
+
+# A pattern, with a small buffer so that it is written many times.
+"${testSubject}" -q -B 1000 --generate pattern:abc -s 300000 | tr -d 'abc' > "${workFile1}"
+if test -s "${workFile1}"; then
+	echo "pattern: unexpected bytes"
+	exit 1
+fi
+"${testSubject}" -q -B 1000 --generate pattern:abc -s 7 | cat > "${workFile1}"
+printf '%s' "abcabca" > "${workFile2}"
+cmp "${workFile1}" "${workFile2}" || { echo "pattern: wrong data"; exit 1; }
+
+# The same random data whatever the buffer size, and different seeds
+# giving different data.
+"${testSubject}" -q -B 4099 --generate random:7 -s 500000 > "${workFile1}"
+"${testSubject}" -q --generate random:7 -s 500000 | cat > "${workFile2}"
+cmp "${workFile1}" "${workFile2}" || { echo "random: data depends on buffer size"; exit 1; }
+"${testSubject}" -q --generate random:8 -s 500000 > "${workFile2}"
+if cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "random: seed makes no difference"
+	exit 1
+fi
+
+# Input files can't be read as well.
+if "${testSubject}" -q --generate zero "${workFile1}" > /dev/null 2>&1; then
+	echo "input file accepted with --generate"
+	exit 1
+fi
+
+exit 0
+
+# EOF
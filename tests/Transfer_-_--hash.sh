@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+# Check that "--hash" gives the standard CRC32C, XXH3, and SHA-256 values,
+# that the data passes through unchanged when the input and output are
+# both pipes, and that "--hash-per-file" hashes each input file as well.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v grep >/dev/null 2>&1 || exit 2
+
+# Skip the test if hashing is not supported on this platform.
+printf '%s' "123456789" | "${testSubject}" -q --hash crc32c > /dev/null 2> "${workFile3}" || exit 2
+
+if ! grep -Fxq "CRC32C (stdout) = e3069283" "${workFile3}"; then
+	echo "wrong CRC32C"
+	cat "${workFile3}"
+	exit 1
+fi
+
+printf '%s' "abc" | "${testSubject}" -q --hash xxh3,sha256 > /dev/null 2> "${workFile3}"
+
+if ! grep -Fxq "XXH3 (stdout) = 78af5f94892f3950" "${workFile3}"; then
+	echo "wrong XXH3"
+	cat "${workFile3}"
+	exit 1
+fi
+
+if ! grep -Fxq "SHA256 (stdout) = ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" "${workFile3}"; then
+	echo "wrong SHA-256"
+	cat "${workFile3}"
+	exit 1
+fi
+
+# Enough data for the hashes to work through many blocks.
+awk 'BEGIN{for(i=0;i<65536;i++)printf "%031d\n",i}' > "${workFile1}"
+
+cat "${workFile1}" | "${testSubject}" -q --hash sha256,xxh3,crc32c 2> "${workFile3}" | cat > "${workFile2}"
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "data changed when hashing between pipes"
+	exit 1
+fi
+
+if command -v sha256sum >/dev/null 2>&1; then
+	expected=$(sha256sum < "${workFile1}" | cut -d ' ' -f 1)
+	if ! grep -Fxq "SHA256 (stdout) = ${expected}" "${workFile3}"; then
+		echo "wrong SHA-256 of data passed between pipes"
+		cat "${workFile3}"
+		exit 1
+	fi
+fi
+
+printf '%s' "abc" > "${workFile2}"
+
+"${testSubject}" -q --hash sha256 --hash-per-file "${workFile2}" "${workFile1}" "${workFile2}" > /dev/null 2> "${workFile3}"
+
+if ! test "$(grep -Fxc "SHA256 (${workFile2}) = ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" "${workFile3}")" -eq 2; then
+	echo "wrong or missing per-file hashes"
+	cat "${workFile3}"
+	exit 1
+fi
+
+if ! test "$(wc -l < "${workFile3}" | tr -dc '0-9')" -eq 4; then
+	echo "wrong number of hash lines"
+	cat "${workFile3}"
+	exit 1
+fi
+
+exit 0
+
+# EOF
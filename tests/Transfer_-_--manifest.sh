@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Check that "--per-file" shows a display line for the input file being
+# read, and that "--manifest" lists each input file with how much came from
+# it, as TSV or as JSON.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v grep >/dev/null 2>&1 || exit 2
+command -v tr >/dev/null 2>&1 || exit 2
+command -v wc >/dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -f "${workFile3}"
+
+displayed=$("${testSubject}" -f --per-file --manifest "${workFile3}" "${workFile1}" "${workFile1}" 2>&1 > "${workFile2}")
+
+if ! cat "${workFile1}" "${workFile1}" | cmp - "${workFile2}" >/dev/null 2>&1; then
+	echo "output differs from input"
+	exit 1
+fi
+
+if ! printf '%s\n' "${displayed}" | tr '\r' '\n' | grep -q -e "<- ${workFile1}: .* (2/2) \[=*\] 100%"; then
+	echo "no display line for the second input file"
+	exit 1
+fi
+
+# A header, then a line for each file, with its bytes and size.
+lineCount=$(wc -l < "${workFile3}" | tr -dc '0-9')
+if ! test "${lineCount}" -eq 3; then
+	echo "TSV manifest has ${lineCount} lines, not 3"
+	exit 1
+fi
+
+if ! grep -q "^file	bytes	size	seconds	mean_rate	peak_rate	stalled$" "${workFile3}"; then
+	echo "TSV manifest header missing"
+	exit 1
+fi
+
+matchCount=$(grep -c "^${workFile1}	1048576	1048576	" "${workFile3}")
+if ! test "${matchCount}" -eq 2; then
+	echo "TSV manifest does not list both input files"
+	exit 1
+fi
+
+# The same as JSON, in line mode.
+"${testSubject}" -q -l --manifest "${workFile3}" --manifest-format json "${workFile1}" "${workFile1}" > "${workFile2}" 2>/dev/null
+
+matchCount=$(grep -c "\"file\": \"${workFile1}\", \"lines\": 16384, \"size\": null, " "${workFile3}")
+if ! test "${matchCount}" -eq 2; then
+	echo "JSON manifest does not list both input files"
+	exit 1
+fi
+
+# An unknown manifest format.
+testStatus=0
+"${testSubject}" -q --manifest "${workFile3}" --manifest-format xml "${workFile1}" > /dev/null 2>&1 || testStatus=$?
+if test "${testStatus}" -eq 0; then
+	echo "unknown manifest format not rejected"
+	exit 1
+fi
+
+rm -f "${workFile3}"
+
+exit 0
+
+# EOF
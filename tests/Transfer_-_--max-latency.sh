@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Check that with "--max-latency", rate limited data is passed on within
+# the target, that "%L" shows the 99th percentile hold time, and that the
+# data is intact.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+dd if=/dev/urandom of="${workFile3}" bs=1024 count=1024 2>/dev/null
+
+# Without a target, the whole buffer is filled before being let out at
+# 2MiB/s, so data is held for ~200ms; with a 50ms target, the p99 hold
+# time should be well under 100ms.
+#
+"${testSubject}" -C -L 2M --max-latency 0.05 -f -i 0.1 -F '%L' < "${workFile3}" 2>"${workFile1}" > "${workFile2}"
+
+if ! cmp -s "${workFile2}" "${workFile3}"; then
+	echo "output did not match input"
+	exit 1
+fi
+
+holdTime=$(tr '\r' '\n' < "${workFile1}" | sed 's/ *$//' | grep '^p99 ' | sed -n '$p')
+holdMilliseconds=$(echo "${holdTime}" | awk '/us$/ { print 0; exit } /ms$/ { sub(/ms$/, "", $2); print int($2); exit } { print 999999 }')
+
+if ! test "${holdMilliseconds}" -lt 100; then
+	echo "p99 hold time was too high: ${holdTime}"
+	exit 1
+fi
+
+exit 0
+
+# EOF
@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Check that "--merge" reads a file and a pipe at the same time, passing
+# on every whole line from both without mixing them up, keeping each
+# input's lines in order, showing a display line for each input, and
+# keeping unfinished last lines apart.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v grep >/dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<16384;i++)printf "a%062d\n",i}' > "${workFile1}"
+awk 'BEGIN{for(i=0;i<16384;i++)printf "b%030d\n",i}' > "${workFile3}"
+
+displayed=$(cat "${workFile3}" | "${testSubject}" -f -B 16K --merge "${workFile1}" - 2>&1 > "${workFile2}")
+
+if ! grep '^a' "${workFile2}" | cmp - "${workFile1}" >/dev/null 2>&1; then
+	echo "lines from the file lost, reordered, or changed"
+	exit 1
+fi
+
+if ! grep '^b' "${workFile2}" | cmp - "${workFile3}" >/dev/null 2>&1; then
+	echo "lines from the pipe lost, reordered, or changed"
+	exit 1
+fi
+
+if ! test "$(wc -l < "${workFile2}" | tr -dc '0-9')" -eq 32768; then
+	echo "lines mixed up or repeated"
+	exit 1
+fi
+
+if ! echo "${displayed}" | tr '\r' '\n' | grep -Fq "<- (stdin)"; then
+	echo "no display line for each input"
+	exit 1
+fi
+
+# Inputs without a final newline each end up on a line of their own.
+printf 'noeol' > "${workFile1}"
+printf 'noeol' > "${workFile3}"
+"${testSubject}" -q --merge "${workFile1}" "${workFile3}" > "${workFile2}"
+if ! test "$(grep -c '^noeol$' "${workFile2}")" -eq 2; then
+	echo "unfinished last lines joined together"
+	exit 1
+fi
+
+exit 0
+
+# EOF
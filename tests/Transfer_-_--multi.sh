@@ -0,0 +1,103 @@
+#!/bin/sh
+#
+# Check that "--multi" copies each input to the output after it, including
+# standard input and output, and those listed in a "--multi-file", showing
+# a display line for each one, or with "-n" a numeric line for each, and
+# carrying on past an input it can't read.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v grep >/dev/null 2>&1 || exit 2
+command -v tr >/dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -f "${workFile2}" "${workFile3}"
+
+# One pair from a file to a file, and one from standard input to standard
+# output.
+displayed=$("${testSubject}" -f --multi "${workFile1}" "${workFile2}" - - 2>&1 < "${workFile1}" > "${workFile3}")
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "file output differs from input"
+	exit 1
+fi
+
+if ! cmp "${workFile1}" "${workFile3}" >/dev/null 2>&1; then
+	echo "standard output differs from standard input"
+	exit 1
+fi
+
+if ! printf '%s\n' "${displayed}" | tr '\r' '\n' | grep -q -e "-> ${workFile1}: .* finished"; then
+	echo "no display line for the file copy"
+	exit 1
+fi
+
+if ! printf '%s\n' "${displayed}" | tr '\r' '\n' | grep -q -e "-> (stdin): "; then
+	echo "no display line for the standard input copy"
+	exit 1
+fi
+
+# A pair listed in a file, with its own name for the display.
+rm -f "${workFile2}"
+printf '# comment\n\n%s\t%s\t%s\n' "${workFile1}" "${workFile2}" "named copy" > "${workFile3}"
+displayed=$("${testSubject}" -f --multi-file "${workFile3}" 2>&1)
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "--multi-file output differs from input"
+	exit 1
+fi
+
+if ! printf '%s\n' "${displayed}" | tr '\r' '\n' | grep -q -e "-> named copy: "; then
+	echo "no display line for the named copy"
+	exit 1
+fi
+
+# With "-n", each pair ends with one line giving how much it copied, its
+# percentage, and that it finished.
+rm -f "${workFile2}"
+displayed=$("${testSubject}" -n --multi "${workFile1}" "${workFile2}" - - 2>&1 < "${workFile1}" > /dev/null)
+
+for streamName in "${workFile1}" "(stdin)"; do
+	finishedLines=$(printf '%s\n' "${displayed}" | grep -c -F -x -e "${streamName}: 1048576 100 finished" || true)
+	if ! test "${finishedLines}" = "1"; then
+		echo "expected one numeric finished line for ${streamName}, got ${finishedLines}"
+		printf '%s\n' "${displayed}"
+		exit 1
+	fi
+done
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "file output differs from input with \"-n\""
+	exit 1
+fi
+
+# An input without an output.
+testStatus=0
+"${testSubject}" -q --multi "${workFile1}" 2>/dev/null || testStatus=$?
+if ! test "${testStatus}" -eq 2; then
+	echo "unpaired input not rejected - exit status ${testStatus}"
+	exit 1
+fi
+
+# An input that can't be read is reported, but the other pairs are still
+# copied.
+rm -f "${workFile2}" "${workFile3}"
+testStatus=0
+"${testSubject}" -q --multi "${workFile3}" "${workFile3}.out" "${workFile1}" "${workFile2}" 2>/dev/null || testStatus=$?
+rm -f "${workFile3}.out"
+if ! test "${testStatus}" -eq 2; then
+	echo "unreadable input not reported - exit status ${testStatus}"
+	exit 1
+fi
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "other pair not copied after an unreadable input"
+	exit 1
+fi
+
+rm -f "${workFile3}"
+
+exit 0
+
+# EOF
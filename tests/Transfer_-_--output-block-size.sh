@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Check that "--output-block-size" passes on everything, across more than
+# one input file, and that "--output-block-pad" pads the output out to a
+# whole number of blocks with zeros.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v head >/dev/null 2>&1 || exit 2
+
+# 1MiB of data, followed by 1000 bytes, neither a multiple of the block size.
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+head -c 1000 "${workFile1}" > "${workFile2}"
+
+# Blocks carry on across input files without losing anything.
+"${testSubject}" -q -B 16K --input-block-size 3000 --output-block-size 10240 "${workFile1}" "${workFile2}" > "${workFile3}"
+if ! cat "${workFile1}" "${workFile2}" | cmp - "${workFile3}" >/dev/null 2>&1; then
+	echo "data changed when reblocking"
+	exit 1
+fi
+
+# With padding, the output is a whole number of blocks: 1049576 bytes of
+# data rounds up to 103 blocks of 10240 bytes.
+"${testSubject}" -q --output-block-size 10240 --output-block-pad "${workFile1}" "${workFile2}" > "${workFile3}"
+outputSize=$(wc -c < "${workFile3}" | tr -dc '0-9')
+if ! test "${outputSize}" -eq 1054720; then
+	echo "padded output is ${outputSize} bytes, not 1054720"
+	exit 1
+fi
+if ! cat "${workFile1}" "${workFile2}" | cmp -n 1049576 - "${workFile3}" >/dev/null 2>&1; then
+	echo "data changed when padding"
+	exit 1
+fi
+if ! test "$(tail -c 5144 "${workFile3}" | tr -d '\000' | wc -c | tr -dc '0-9')" -eq 0; then
+	echo "last block not padded with zeros"
+	exit 1
+fi
+
+exit 0
+
+# EOF
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Check that "--parallel" copies a file intact, stops where "-S" says to,
+# and shows itself as the I/O engine in use.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -f "${workFile2}"
+
+"${testSubject}" -f -B 64K --parallel 4 -F '%E' "${workFile1}" > "${workFile2}" 2>"${workFile3}"
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "output differs from input"
+	exit 1
+fi
+
+# Skip the engine check if threads aren't available.
+if grep -q "parallel" "${workFile3}"; then
+	:
+elif grep -q "read/write\|splice\|mmap" "${workFile3}"; then
+	exit 2
+else
+	echo "no I/O engine shown"
+	exit 1
+fi
+
+rm -f "${workFile2}"
+"${testSubject}" -q -B 16K --parallel 4 -L 2M -s 300000 -S "${workFile1}" > "${workFile2}"
+
+outputSize=$(wc -c < "${workFile2}" | tr -dc '0-9')
+if ! test "${outputSize}" -eq 300000; then
+	echo "expected 300000 bytes with -S, got ${outputSize}"
+	exit 1
+fi
+
+if ! head -c 300000 "${workFile1}" | cmp - "${workFile2}" >/dev/null 2>&1; then
+	echo "output with -S is not the start of the input"
+	exit 1
+fi
+
+exit 0
+
+# EOF
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Check that "--split" spreads whole lines between the "--tee" outputs,
+# including a command, without losing or repeating any, and writes
+# nothing to standard output.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+command -v sort >/dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -f "${workFile2}" "${workFile3}"
+
+outputSize=$("${testSubject}" -q -B 16K --split --tee "${workFile2}" --tee "|cat > '${workFile3}'" "${workFile1}" | wc -c | tr -dc '0-9')
+
+if ! test "${outputSize}" -eq 0; then
+	echo "${outputSize} bytes written to standard output"
+	exit 1
+fi
+
+if ! cat "${workFile2}" "${workFile3}" | sort | cmp - "${workFile1}" >/dev/null 2>&1; then
+	echo "lines lost, repeated, or changed"
+	exit 1
+fi
+
+if ! test -s "${workFile2}" || ! test -s "${workFile3}"; then
+	echo "data not split between the outputs"
+	exit 1
+fi
+
+exit 0
+
+# EOF
@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Check that "--tee" writes the same data to each extra output as to
+# standard output, and shows a display line for each one.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v cmp >/dev/null 2>&1 || exit 2
+
+awk 'BEGIN{for(i=0;i<16384;i++)printf "%063d\n",i}' > "${workFile1}"
+rm -f "${workFile2}" "${workFile3}"
+
+displayed=$("${testSubject}" -f -B 16K --tee "${workFile3}" "${workFile1}" 2>&1 > "${workFile2}")
+
+if ! cmp "${workFile1}" "${workFile2}" >/dev/null 2>&1; then
+	echo "standard output differs from input"
+	exit 1
+fi
+
+if ! cmp "${workFile1}" "${workFile3}" >/dev/null 2>&1; then
+	echo "--tee output differs from input"
+	exit 1
+fi
+
+if ! printf '%s\n' "${displayed}" | grep -q -e "-> ${workFile3}: "; then
+	echo "no display line for the --tee output"
+	exit 1
+fi
+
+exit 0
+
+# EOF
@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# Check that "--validate" accepts what "--generate" writes, that it counts
+# the bytes that were changed and reports the first one, and that it writes
+# nothing to standard output.
+
+# Dummy assignments for "shellcheck".
+testSubject="${testSubject:-false}"; workFile1="${workFile1:-.tmp1}"; workFile2="${workFile2:-.tmp2}"; workFile3="${workFile3:-.tmp3}"
+
+command -v dd >/dev/null 2>&1 || exit 2
+command -v grep >/dev/null 2>&1 || exit 2
+
+for generateType in zero pattern pattern:abc random:7 text:7; do
+	"${testSubject}" -q --generate "${generateType}" -s 1000000 \
+	| "${testSubject}" -q --validate "${generateType}" -s 1000000 > "${workFile1}" \
+	|| { echo "${generateType}: validation failed"; exit 1; }
+	if test -s "${workFile1}"; then
+		echo "${generateType}: output was written"
+		exit 1
+	fi
+done
+
+# Change 3 bytes, and then 1 more later on.
+"${testSubject}" -q --generate random:7 -s 1000000 > "${workFile1}"
+printf '%s' "XYZ" | dd of="${workFile1}" bs=1 seek=300001 conv=notrunc 2>/dev/null
+printf '%s' "Q" | dd of="${workFile1}" bs=1 seek=900000 conv=notrunc 2>/dev/null
+
+testStatus=0
+"${testSubject}" -q --validate random:7 "${workFile1}" 2> "${workFile2}" || testStatus=$?
+if ! test "${testStatus}" -eq 16; then
+	echo "changed data not detected - exit status ${testStatus}"
+	cat "${workFile2}"
+	exit 1
+fi
+# The chance of a random byte already matching is small but not zero.
+if ! grep -Eq ": [34] bytes differed .* offset 30000[1-4]\$" "${workFile2}"; then
+	echo "wrong report of changed data"
+	cat "${workFile2}"
+	exit 1
+fi
+
+# A different seed.
+if "${testSubject}" -q --generate random:7 -s 100000 | "${testSubject}" -q --validate random:8 2>/dev/null; then
+	echo "wrong seed not detected"
+	exit 1
+fi
+
+# Data ending early, with a size given.
+if "${testSubject}" -q --generate zero -s 100000 | "${testSubject}" -q --validate zero -s 200000 2>/dev/null; then
+	echo "short data not detected"
+	exit 1
+fi
+
+exit 0
+
+# EOF